@@ -0,0 +1,563 @@
+// Timing and correctness of hitboxes_overlap for every pair of hitbox types, under identity, translated,
+// rotated and scaled transforms, and of hitbox_tilemap_collision (what entity_tilemap_collision runs) on
+// generated maps. Every result is checked against a plain separating-axis reference written here.
+// Standalone; doesn't open a window or touch the GPU. Needs the SDL2 headers; everything that would pull in
+// the rest of the engine is dropped by the linker.
+//
+//   g++ -O2 -std=c++14 -D__forceinline=inline -ffunction-sections -fdata-sections \
+//       $(sdl2-config --cflags) -I../src -I../lib/sdl-gpu/include -I../lib/angelscript-sdk/include \
+//       collision.cpp ../src/hitbox.cpp ../src/gjk.cpp ../src/vectors.cpp ../src/transform.cpp ../src/level.cpp ../src/tilegrid.cpp \
+//       -Wl,--gc-sections -o collision
+//   ./collision [cases per combination] [repetitions]
+
+#include "hitbox.h"
+#include "level.h"
+#include "mempool.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Reference results within this distance of touching are ambiguous and skipped
+#define REF_EPSILON 1e-3f
+#define PI_F 3.1415926535f
+
+static std::mt19937 rng(12345);
+
+static float uniform(float lo, float hi) {
+	return std::uniform_real_distribution<float>(lo, hi)(rng);
+}
+
+static Vector2 uniform_point(float extent) {
+	return { uniform(-extent, extent), uniform(-extent, extent) };
+}
+
+// =========================================================================================
+// ==== Hitbox generation ====
+// =========================================================================================
+
+static const Hitbox::Type TYPES[] = {
+	Hitbox::BOX, Hitbox::CIRCLE, Hitbox::LINE, Hitbox::ONEWAY, Hitbox::POLYGON, Hitbox::COMPOSITE
+};
+static const char* const TYPE_NAMES[] = { "box", "circle", "line", "oneway", "polygon", "composite" };
+constexpr int N_TYPES = sizeof(TYPES) / sizeof(TYPES[0]);
+
+enum TransformKind { Identity, Translated, Rotated, Scaled, N_KINDS };
+static const char* const KIND_NAMES[] = { "identity", "translated", "rotated", "scaled" };
+
+static Hitbox make_hitbox(Hitbox::Type type, Point2 center, float size, MemoryPool& pool) {
+	Hitbox hitbox;
+	hitbox.type = type;
+
+	switch (type) {
+	case Hitbox::BOX:
+	{
+		float hw = uniform(0.25f, 1.f) * size, hh = uniform(0.25f, 1.f) * size;
+		hitbox.box = { center.x - hw, center.x + hw, center.y - hh, center.y + hh };
+		break;
+	}
+	case Hitbox::CIRCLE:
+		hitbox.circle = { center, uniform(0.25f, 1.f) * size };
+		break;
+	case Hitbox::LINE:
+	case Hitbox::ONEWAY:
+	{
+		Vector2 half = Vector2::fromPolar(uniform(0.f, 2.f * PI_F), uniform(0.5f, 1.25f) * size);
+		hitbox.line = { center - half, center + half };
+		break;
+	}
+	case Hitbox::POLYGON:
+	{
+		// Points on an ellipse in angle order are always convex
+		int n = 3 + (int) (rng() % 6);
+		float angles[8];
+		for (int i = 0; i < n; ++i) angles[i] = uniform(0.f, 2.f * PI_F);
+		std::sort(angles, angles + n);
+
+		float rx = uniform(0.25f, 1.f) * size, ry = uniform(0.25f, 1.f) * size;
+		Point2* vertices = pool.alloc<Point2>(n);
+		for (int i = 0; i < n; ++i) {
+			vertices[i] = { center.x + rx * cosf(angles[i]), center.y + ry * sinf(angles[i]) };
+		}
+		new(&hitbox.polygon.vertices) Array<const Point2>(vertices, n);
+		hitbox.polygon.aabb = poly_to_aabb(hitbox.polygon.vertices);
+		break;
+	}
+	case Hitbox::COMPOSITE:
+	{
+		static const Hitbox::Type CHILD_TYPES[] = { Hitbox::BOX, Hitbox::CIRCLE, Hitbox::LINE, Hitbox::POLYGON };
+		int n = 2 + (int) (rng() % 10);
+		Hitbox* subs = pool.alloc<Hitbox>(n);
+		for (int i = 0; i < n; ++i) {
+			subs[i] = make_hitbox(CHILD_TYPES[rng() % 4], center + uniform_point(size), size * 0.4f, pool);
+		}
+		hitbox = make_composite(subs, n, pool);
+		break;
+	}
+	default:
+		break;
+	}
+	return hitbox;
+}
+
+static Transform make_transform(TransformKind kind) {
+	switch (kind) {
+	case Translated:
+		return Transform::translation(uniform_point(8.f));
+	case Rotated:
+		return Transform::rot_trans(uniform(0.f, 2.f * PI_F), uniform_point(8.f));
+	case Scaled:
+		return Transform::scal_trans({ uniform(0.5f, 2.f), uniform(0.5f, 2.f) }, uniform_point(8.f));
+	default:
+		return Transform::identity;
+	}
+}
+
+// =========================================================================================
+// ==== Reference ====
+// =========================================================================================
+
+// Convex point set (1 point, a segment or a polygon) grown by a radius
+struct RefConvex {
+	Point2 pts[16];
+	int n;
+	float radius;
+	bool oneway;
+};
+
+// Same world shapes transform_hitbox produces, flattened
+static void ref_shapes(const Hitbox& hitbox, const Transform& tx, std::vector<RefConvex>& out) {
+	RefConvex c;
+	c.n = 0;
+	c.radius = 0.f;
+	c.oneway = false;
+
+	switch (hitbox.type) {
+	case Hitbox::BOX:
+		aabb_to_poly(hitbox.box, c.pts);
+		for (int i = 0; i < 4; ++i) c.pts[i] = tx * c.pts[i];
+		c.n = 4;
+		break;
+	case Hitbox::CIRCLE:
+		if (tx.is_uniform_scale()) {
+			Circle circ = tx * hitbox.circle;
+			c.pts[0] = circ.center;
+			c.n = 1;
+			c.radius = circ.radius;
+		}
+		else {
+			// Stretched circles are approximated by the same 12-gon
+			for (int i = 0; i < 12; ++i) {
+				c.pts[i] = tx * (hitbox.circle.center + Vector2::fromPolar(i * (2.f * PI_F / 12), hitbox.circle.radius));
+			}
+			c.n = 12;
+		}
+		break;
+	case Hitbox::LINE:
+	case Hitbox::ONEWAY:
+		c.pts[0] = tx * hitbox.line.p1;
+		c.pts[1] = tx * hitbox.line.p2;
+		c.n = 2;
+		c.oneway = hitbox.type == Hitbox::ONEWAY;
+		break;
+	case Hitbox::POLYGON:
+		for (const Point2& p : hitbox.polygon.vertices) c.pts[c.n++] = tx * p;
+		break;
+	case Hitbox::COMPOSITE:
+		for (const Hitbox& sub : hitbox.composite.hitboxes) ref_shapes(sub, tx, out);
+		return;
+	default:
+		return;
+	}
+	out.push_back(c);
+}
+
+static inline int n_edges(const RefConvex& c) {
+	return c.n < 2 ? 0 : c.n == 2 ? 1 : c.n;
+}
+
+static float point_segment_distance(Point2 p, Point2 a, Point2 b) {
+	Vector2 ab = b - a;
+	float len2 = ab.dot(ab);
+	float t = len2 > 0.f ? SDL_max(0.f, SDL_min(1.f, (p - a).dot(ab) / len2)) : 0.f;
+	return (p - (a + ab * t)).magnitude();
+}
+
+// Smallest distance from a vertex of a to b's outline (or vertices)
+static float vertex_distance(const RefConvex& a, Vector2 aOff, const RefConvex& b, Vector2 bOff) {
+	float best = INFINITY;
+	for (int i = 0; i < a.n; ++i) {
+		Point2 p = a.pts[i] + aOff;
+		if (b.n == 1) {
+			best = SDL_min(best, (p - (b.pts[0] + bOff)).magnitude());
+		}
+		for (int j = 0; j < n_edges(b); ++j) {
+			best = SDL_min(best, point_segment_distance(p, b.pts[j] + bOff, b.pts[(j + 1) % b.n] + bOff));
+		}
+	}
+	return best;
+}
+
+static void add_axes(const RefConvex& c, std::vector<Vector2>& axes) {
+	for (int i = 0; i < n_edges(c); ++i) {
+		Vector2 e = c.pts[(i + 1) % c.n] - c.pts[i];
+		if (e.x == 0.f && e.y == 0.f) continue;
+		e = e.normalized();
+		axes.push_back(e);                // needed for collinear segments
+		axes.push_back({ -e.y, e.x });
+	}
+}
+
+// Signed distance between the shapes: negative (by the penetration depth) when they overlap
+static float ref_separation(const RefConvex& a, Vector2 aOff, const RefConvex& b, Vector2 bOff) {
+	thread_local std::vector<Vector2> axes;
+	axes.clear();
+	add_axes(a, axes);
+	add_axes(b, axes);
+	if (axes.empty()) {
+		axes.push_back({ 1.f, 0.f });
+		axes.push_back({ 0.f, 1.f });
+	}
+
+	bool disjoint = false;
+	float penetration = INFINITY;
+	for (Vector2 axis : axes) {
+		float alo = INFINITY, ahi = -INFINITY, blo = INFINITY, bhi = -INFINITY;
+		for (int i = 0; i < a.n; ++i) {
+			float d = (a.pts[i] + aOff).dot(axis);
+			alo = SDL_min(alo, d);
+			ahi = SDL_max(ahi, d);
+		}
+		for (int i = 0; i < b.n; ++i) {
+			float d = (b.pts[i] + bOff).dot(axis);
+			blo = SDL_min(blo, d);
+			bhi = SDL_max(bhi, d);
+		}
+		float gap = SDL_max(blo - ahi, alo - bhi);
+		if (gap > 0.f) disjoint = true;
+		penetration = SDL_min(penetration, -gap);
+	}
+
+	if (disjoint) {
+		float dist = SDL_min(vertex_distance(a, aOff, b, bOff), vertex_distance(b, bOff, a, aOff));
+		return dist - a.radius - b.radius;
+	}
+	return -penetration - a.radius - b.radius;
+}
+
+// 1 = overlap, -1 = apart, 0 = too close to touching to call
+static int ref_overlap(const RefConvex& a, Vector2 aOff, const RefConvex& b, Vector2 bOff) {
+	float s = ref_separation(a, aOff, b, bOff);
+	return s < -REF_EPSILON ? 1 : s > REF_EPSILON ? -1 : 0;
+}
+
+// One-ways only collide with things moving into their solid side that weren't already overlapping them
+static int ref_leaf_test(const RefConvex& a, Vector2 aDis, const RefConvex& b, Vector2 bDis) {
+	if (a.oneway && b.oneway) return -1;
+
+	int now = ref_overlap(a, { 0.f, 0.f }, b, { 0.f, 0.f });
+	if (!a.oneway && !b.oneway) return now;
+	if (now == -1) return -1;
+
+	const RefConvex& line = a.oneway ? a : b;
+	Vector2 netDis = a.oneway ? bDis - aDis : aDis - bDis;
+	if ((line.pts[1] - line.pts[0]).cross(netDis) < 0.f) return -1;
+
+	int before = ref_overlap(a, -aDis, b, -bDis);
+	if (now == 0 || before == 0) return 0;
+	return before == 1 ? -1 : 1;
+}
+
+static int ref_test(const std::vector<RefConvex>& a, Vector2 aDis, const std::vector<RefConvex>& b, Vector2 bDis) {
+	int result = -1;
+	for (const RefConvex& sa : a) {
+		for (const RefConvex& sb : b) {
+			int r = ref_leaf_test(sa, aDis, sb, bDis);
+			if (r == 1) return 1;
+			if (r == 0) result = 0;
+		}
+	}
+	return result;
+}
+
+// =========================================================================================
+// ==== hitboxes_overlap ====
+// =========================================================================================
+
+struct Case {
+	Hitbox a, b;
+	Transform aTx, bTx;
+	Vector2 aDis, bDis;
+};
+
+static int bench_hitboxes(size_t n_cases, int reps, MemoryPool& pool) {
+	int failures = 0;
+	std::vector<Case> cases(n_cases);
+	std::vector<RefConvex> refA, refB;
+
+	printf("hitboxes_overlap, ns per test (%% overlapping)\n");
+	printf("%-20s", "");
+	for (int k = 0; k < N_KINDS; ++k) printf("%18s", KIND_NAMES[k]);
+	printf("\n");
+
+	for (int ta = 0; ta < N_TYPES; ++ta) {
+		for (int tb = 0; tb < N_TYPES; ++tb) {
+			char label[32];
+			snprintf(label, sizeof(label), "%s-%s", TYPE_NAMES[ta], TYPE_NAMES[tb]);
+			printf("%-20s", label);
+
+			for (int k = 0; k < N_KINDS; ++k) {
+				pool.clear();
+				for (Case& c : cases) {
+					c.a = make_hitbox(TYPES[ta], uniform_point(6.f), uniform(3.f, 10.f), pool);
+					c.b = make_hitbox(TYPES[tb], uniform_point(6.f), uniform(3.f, 10.f), pool);
+					c.aTx = make_transform((TransformKind) k);
+					c.bTx = make_transform((TransformKind) k);
+					c.aDis = uniform_point(3.f);
+					c.bDis = uniform_point(3.f);
+				}
+
+				size_t overlapping = 0, mismatches = 0;
+				for (const Case& c : cases) {
+					bool hit = hitboxes_overlap(c.a, c.aTx, c.aDis, c.b, c.bTx, c.bDis);
+					overlapping += hit;
+
+					refA.clear();
+					refB.clear();
+					ref_shapes(c.a, c.aTx, refA);
+					ref_shapes(c.b, c.bTx, refB);
+					int expected = ref_test(refA, c.aDis, refB, c.bDis);
+					if (expected != 0 && hit != (expected == 1)) ++mismatches;
+				}
+
+				size_t sink = 0;
+				auto start = std::chrono::steady_clock::now();
+				for (int r = 0; r < reps; ++r) {
+					for (const Case& c : cases) {
+						sink += hitboxes_overlap(c.a, c.aTx, c.aDis, c.b, c.bTx, c.bDis);
+					}
+				}
+				std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+				double ns = elapsed.count() / ((double) n_cases * reps);
+
+				printf("%10.1f (%3d%%)", ns + (sink == SIZE_MAX), (int) (100 * overlapping / n_cases));
+				if (mismatches > 0) {
+					printf("\nMISMATCH: %s-%s %s: %zu of %zu disagree with the reference\n",
+						TYPE_NAMES[ta], TYPE_NAMES[tb], KIND_NAMES[k], mismatches, n_cases);
+					++failures;
+				}
+			}
+			printf("\n");
+		}
+	}
+	return failures;
+}
+
+// =========================================================================================
+// ==== Tilemaps ====
+// =========================================================================================
+
+#define TILE_SIZE 16
+#define MAP_SIZE 128
+
+// Solid part of a slope tile, worked out independently of slope_polygon
+static RefConvex ref_slope(const Tile::Solidity& solidity, Point2 offset) {
+	const auto& slope = solidity.slope;
+	RefConvex c;
+	c.n = 0;
+	c.radius = 0.f;
+	c.oneway = false;
+
+	// Walk the cell's outline, keeping the solid side and adding the points where the line crosses it
+	const Point2 rect[4] = { { 0.f, 0.f }, { TILE_SIZE, 0.f }, { TILE_SIZE, TILE_SIZE }, { 0.f, TILE_SIZE } };
+	for (int i = 0; i < 4; ++i) {
+		Point2 p = rect[i], q = rect[(i + 1) % 4];
+		float dp = slope.position + slope.slope * p.x - p.y;
+		float dq = slope.position + slope.slope * q.x - q.y;
+		if (!slope.above) {
+			dp = -dp;
+			dq = -dq;
+		}
+		if (dp >= 0.f) c.pts[c.n++] = p + offset;
+		if ((dp >= 0.f) != (dq >= 0.f)) c.pts[c.n++] = p + (q - p) * (dp / (dp - dq)) + offset;
+	}
+	return c;
+}
+
+static void ref_tile_shapes(const Tile& tile, Point2 offset, std::vector<RefConvex>& out) {
+	Hitbox box;
+	box.type = Hitbox::BOX;
+	box.box = { 0.f, TILE_SIZE, 0.f, TILE_SIZE };
+
+	switch (tile.solidity.type) {
+	case Tile::Solidity::Full:
+		ref_shapes(box, Transform::translation(offset), out);
+		break;
+	case Tile::Solidity::Partial:
+	{
+		const auto& partial = tile.solidity.partial;
+		if (partial.vertical) (partial.topleft ? box.box.right : box.box.left) = partial.position;
+		else (partial.topleft ? box.box.bottom : box.box.top) = partial.position;
+		ref_shapes(box, Transform::translation(offset), out);
+		break;
+	}
+	case Tile::Solidity::Slope:
+	{
+		RefConvex c = ref_slope(tile.solidity, offset);
+		if (c.n >= 3) out.push_back(c);
+		break;
+	}
+	case Tile::Solidity::Complex:
+		ref_shapes(tile.solidity.complex, Transform::translation(offset), out);
+		break;
+	default:
+		break;
+	}
+}
+
+// Tiles hold a Hitbox in a union, so they're set up in raw zeroed memory like the loaders do
+static Tile& add_tile(Tile* tiles, size_t& n_tiles, Tile::Solidity::Type type) {
+	Tile& tile = tiles[n_tiles++];
+	memset(&tile, 0, sizeof(Tile));
+	tile.solidity.type = type;
+	return tile;
+}
+
+static int bench_tilemap(size_t n_queries, int reps, MemoryPool& pool) {
+	pool.clear();
+
+	// Every kind of solidity, including complex tiles with lines, one-ways and composites
+	Tile* tiles = static_cast<Tile*>(malloc(16 * sizeof(Tile)));
+	size_t n_tiles = 0;
+	add_tile(tiles, n_tiles, Tile::Solidity::Full);
+	for (int i = 0; i < 4; ++i) {
+		add_tile(tiles, n_tiles, Tile::Solidity::Partial).solidity.partial = { i % 2 ? 6.f : 10.f, i < 2, i % 2 == 0 };
+	}
+	add_tile(tiles, n_tiles, Tile::Solidity::Slope).solidity.slope = { (float) TILE_SIZE, -1.f, false };
+	add_tile(tiles, n_tiles, Tile::Solidity::Slope).solidity.slope = { 0.f, 0.5f, true };
+
+	Hitbox& box = add_tile(tiles, n_tiles, Tile::Solidity::Complex).solidity.complex;
+	box.type = Hitbox::BOX;
+	box.box = { 2.f, 14.f, 4.f, 12.f };
+	Hitbox& line = add_tile(tiles, n_tiles, Tile::Solidity::Complex).solidity.complex;
+	line.type = Hitbox::LINE;
+	line.line = { { 0.f, 0.f }, { TILE_SIZE, TILE_SIZE } };
+	Hitbox& oneway = add_tile(tiles, n_tiles, Tile::Solidity::Complex).solidity.complex;
+	oneway.type = Hitbox::ONEWAY;
+	oneway.line = { { 0.f, 4.f }, { TILE_SIZE, 4.f } };
+	add_tile(tiles, n_tiles, Tile::Solidity::Complex).solidity.complex = make_hitbox(Hitbox::COMPOSITE, { 8.f, 8.f }, 4.f, pool);
+	add_tile(tiles, n_tiles, Tile::Solidity::None);
+
+	Tileset tileset;
+	tileset.name = "bench";
+	tileset.tilesheet = nullptr;
+	tileset.tile_width = TILE_SIZE;
+	tileset.tile_height = TILE_SIZE;
+	tileset.tile_data = Array<const Tile>(tiles, n_tiles);
+
+	Tilemap map;
+	map.tileset = &tileset;
+	map.tiles = TileGrid::allocate(MAP_SIZE, MAP_SIZE);
+	map.z_order = 0;
+	map.offset = { -40.f, 24.f };
+	map.scale = { 1.f, 1.f };
+	map.parallax = { 1.f, 1.f };
+	map.solid = true;
+	// Bands of open air between bands of mixed tiles, so some chunks have nothing solid
+	for (int y = 0; y < MAP_SIZE; ++y) {
+		for (int x = 0; x < MAP_SIZE; ++x) {
+			bool open = (y / 40) % 2 == 1 || rng() % 2;
+			map.tiles.set(x, y, open ? TILE_BLANK : (uint16_t) (1 + rng() % n_tiles));
+		}
+	}
+	map.tiles.update(tileset);
+
+	// Reference shapes of every tile, and their bounds for a quick reject
+	std::vector<std::vector<RefConvex>> tile_shapes(MAP_SIZE * MAP_SIZE);
+	std::vector<AABB> tile_bounds(MAP_SIZE * MAP_SIZE);
+	for (int y = 0; y < MAP_SIZE; ++y) {
+		for (int x = 0; x < MAP_SIZE; ++x) {
+			Point2 offset = { map.offset.x + x * TILE_SIZE, map.offset.y + y * TILE_SIZE };
+			uint16_t t = map.tiles(x, y);
+			if (t != TILE_BLANK) ref_tile_shapes(tiles[t - 1], offset, tile_shapes[y * MAP_SIZE + x]);
+			tile_bounds[y * MAP_SIZE + x] = { offset.x - 1.f, offset.x + TILE_SIZE + 1.f, offset.y - 1.f, offset.y + TILE_SIZE + 1.f };
+		}
+	}
+
+	// Entity-sized solidity hitboxes all over the map (and a bit past its edges)
+	static const Hitbox::Type QUERY_TYPES[] = { Hitbox::BOX, Hitbox::CIRCLE, Hitbox::POLYGON, Hitbox::COMPOSITE };
+	const float extent = MAP_SIZE * TILE_SIZE;
+	std::vector<Case> queries(n_queries);
+	for (Case& q : queries) {
+		q.a = make_hitbox(QUERY_TYPES[rng() % 4], { 0.f, 0.f }, uniform(4.f, 24.f), pool);
+		Point2 pos = map.offset + Vector2{ uniform(-32.f, extent + 32.f), uniform(-32.f, extent + 32.f) };
+		q.aTx = Transform::translation(pos) * make_transform((TransformKind) (rng() % N_KINDS));
+		q.aDis = uniform_point(3.f);
+	}
+
+	size_t overlapping = 0, mismatches = 0;
+	std::vector<RefConvex> ref;
+	for (const Case& q : queries) {
+		bool hit = hitbox_tilemap_collision(q.a, q.aTx, q.aDis, map);
+		overlapping += hit;
+
+		ref.clear();
+		ref_shapes(q.a, q.aTx, ref);
+		AABB bounds = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+		for (const RefConvex& c : ref) {
+			for (int i = 0; i < c.n; ++i) {
+				bounds |= AABB{ c.pts[i].x - c.radius, c.pts[i].x + c.radius, c.pts[i].y - c.radius, c.pts[i].y + c.radius };
+			}
+		}
+
+		int expected = -1;
+		for (size_t i = 0; i < tile_shapes.size() && expected != 1; ++i) {
+			const AABB& tb = tile_bounds[i];
+			if (tile_shapes[i].empty() || tb.left > bounds.right || bounds.left > tb.right ||
+				tb.top > bounds.bottom || bounds.top > tb.bottom) continue;
+			int r = ref_test(ref, q.aDis, tile_shapes[i], { 0.f, 0.f });
+			if (r == 1 || (r == 0 && expected == -1)) expected = r;
+		}
+		if (expected != 0 && hit != (expected == 1)) ++mismatches;
+	}
+
+	size_t sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < reps; ++r) {
+		for (const Case& q : queries) {
+			sink += hitbox_tilemap_collision(q.a, q.aTx, q.aDis, map);
+		}
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+	printf("\nhitbox_tilemap_collision, %dx%d map of %d px tiles\n", MAP_SIZE, MAP_SIZE, TILE_SIZE);
+	printf("%10.1f ns per query (%d%% overlapping)\n",
+		elapsed.count() / ((double) n_queries * reps) + (sink == SIZE_MAX), (int) (100 * overlapping / n_queries));
+
+	map.tiles.free();
+	::free(tiles);
+	if (mismatches > 0) {
+		printf("MISMATCH: tilemap: %zu of %zu disagree with the reference\n", mismatches, n_queries);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	size_t n = argc > 1 ? (size_t) strtoul(argv[1], nullptr, 10) : 1000;
+	int reps = argc > 2 ? atoi(argv[2]) : 20;
+
+	MemoryPool pool(64 << 20);
+	int failures = bench_hitboxes(n, reps, pool);
+	failures += bench_tilemap(n * 4, reps, pool);
+	pool.free();
+
+	if (failures > 0) printf("\n%d combinations disagree with the reference\n", failures);
+	return failures;
+}
@@ -0,0 +1,97 @@
+// Throughput of the batched narrow phase kernels against the plain per-pair tests they replace.
+// Standalone; doesn't need SDL or a GPU.
+//
+//   g++ -O2 -msse2 -std=c++14 -I../src collision_kernels.cpp ../src/collisionkernels.cpp -o collision_kernels
+//   ./collision_kernels [pairs] [repetitions]
+
+#include "collisionkernels.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <algorithm>
+#include <vector>
+
+// Same tests as box_box_test and circle_circle_test in hitbox.cpp
+static size_t scalar_boxes(const BoxPairs& p, uint32_t* hits) {
+	size_t count = 0;
+	for (size_t i = 0; i < p.size(); ++i) {
+		if (p.a_left[i] < p.b_right[i] && p.a_right[i] > p.b_left[i] &&
+			p.a_top[i] < p.b_bottom[i] && p.a_bottom[i] > p.b_top[i]) {
+			hits[count++] = (uint32_t) i;
+		}
+	}
+	return count;
+}
+
+static size_t scalar_circles(const CirclePairs& p, uint32_t* hits) {
+	size_t count = 0;
+	for (size_t i = 0; i < p.size(); ++i) {
+		float dx = p.a_x[i] - p.b_x[i];
+		float dy = p.a_y[i] - p.b_y[i];
+		float r = p.a_radius[i] + p.b_radius[i];
+		if (dx * dx + dy * dy < r * r) {
+			hits[count++] = (uint32_t) i;
+		}
+	}
+	return count;
+}
+
+// Runs the kernel `reps` times and returns pairs tested per second
+template <class Pairs, class F>
+static double measure(F&& kernel, const Pairs& pairs, uint32_t* hits, int reps, size_t& n_hits) {
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < reps; ++r) {
+		n_hits = kernel(pairs, hits);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return (double) pairs.size() * reps / elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+	size_t n = argc > 1 ? (size_t) strtoul(argv[1], nullptr, 10) : 4096;
+	int reps = argc > 2 ? atoi(argv[2]) : 2000;
+
+	// Broadphase candidates are all close to each other, so a good fraction of them overlap
+	std::mt19937 rng(12345);
+	std::uniform_real_distribution<float> pos(0.f, 64.f);
+	std::uniform_real_distribution<float> size(4.f, 32.f);
+
+	BoxPairs boxes;
+	CirclePairs circles;
+	boxes.reserve(n);
+	circles.reserve(n);
+	for (size_t i = 0; i < n; ++i) {
+		float ax = pos(rng), ay = pos(rng), aw = size(rng), ah = size(rng);
+		float bx = pos(rng), by = pos(rng), bw = size(rng), bh = size(rng);
+		boxes.push(ax, ax + aw, ay, ay + ah, bx, bx + bw, by, by + bh);
+		circles.push(ax, ay, aw * 0.5f, bx, by, bw * 0.5f);
+	}
+
+	std::vector<uint32_t> simd_hits(n), scalar_hits(n);
+	size_t n_simd, n_scalar;
+	int failures = 0;
+
+	double box_simd = measure(overlap_boxes, boxes, simd_hits.data(), reps, n_simd);
+	double box_scalar = measure(scalar_boxes, boxes, scalar_hits.data(), reps, n_scalar);
+	if (n_simd != n_scalar || !std::equal(simd_hits.begin(), simd_hits.begin() + n_simd, scalar_hits.begin())) {
+		printf("MISMATCH: box kernels disagree\n");
+		++failures;
+	}
+	printf("boxes:   %zu pairs, %zu overlapping\n", n, n_simd);
+	printf("  simd    %10.1f M pairs/s\n", box_simd / 1e6);
+	printf("  scalar  %10.1f M pairs/s  (%.2fx)\n", box_scalar / 1e6, box_simd / box_scalar);
+
+	double circ_simd = measure(overlap_circles, circles, simd_hits.data(), reps, n_simd);
+	double circ_scalar = measure(scalar_circles, circles, scalar_hits.data(), reps, n_scalar);
+	if (n_simd != n_scalar || !std::equal(simd_hits.begin(), simd_hits.begin() + n_simd, scalar_hits.begin())) {
+		printf("MISMATCH: circle kernels disagree\n");
+		++failures;
+	}
+	printf("circles: %zu pairs, %zu overlapping\n", n, n_simd);
+	printf("  simd    %10.1f M pairs/s\n", circ_simd / 1e6);
+	printf("  scalar  %10.1f M pairs/s  (%.2fx)\n", circ_scalar / 1e6, circ_simd / circ_scalar);
+
+	return failures;
+}
@@ -0,0 +1,214 @@
+// Load times of the sample assets (tools/build.py data assets): every sprite, tileset, particle emitter and level under the
+// asset directory is loaded over and over through the engine's loaders, after engine.boot has been read for the collider types.
+// Standalone; textures aren't uploaded (GPU_LoadImage is stubbed out here), so the times are file reading and parsing only.
+// Loaders never free their pools, so every repetition leaks one copy of each asset; keep the repetitions modest.
+// Results go to stderr; the loaders log to stdout at the default verbosity, so send that somewhere cheap.
+//
+//   g++ -O2 -std=c++14 -D__forceinline=inline -ffunction-sections -fdata-sections \
+//       $(sdl2-config --cflags) -I../src -I../lib/sdl-gpu/include -I../lib/angelscript-sdk/include -I../lib/angelscript-sdk/addon \
+//       loading.cpp ../src/fileutil.cpp ../src/mappedfile.cpp ../src/sprite.cpp ../src/tileset.cpp ../src/particles.cpp \
+//       ../src/level.cpp ../src/levelstream.cpp ../src/tilegrid.cpp ../src/tileanim.cpp ../src/tilebatch.cpp ../src/hitbox.cpp \
+//       ../src/gjk.cpp ../src/vectors.cpp ../src/transform.cpp ../src/assetmanager.cpp ../src/cstrkey.cpp ../src/error.cpp \
+//       ../src/result.cpp -Wl,--gc-sections -lpthread -o loading
+//   ./loading [project dir, with engine.boot] [repetitions] > /dev/null
+
+#include "assetmanager.h"
+#include "fileutil.h"
+#include "hitbox.h"
+#include "sprite.h"
+#include "tileset.h"
+#include "particles.h"
+#include "level.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+GPU_Image* GPU_LoadImage(const char* filename) {
+	static GPU_Image image;
+	return &image;
+}
+
+GPU_ErrorObject GPU_PopErrorCode() {
+	return GPU_ErrorObject();
+}
+
+// =========================================================================================
+// ==== Bootloader ====
+// =========================================================================================
+
+// Reads engine.boot up to and including the collider types, like main does, without creating any controllers.
+// Returns the asset directory it names.
+static bool read_bootloader(const std::string& project, std::string& asset_dir) {
+	auto bytes = read_file((project + "/engine.boot").c_str());
+	if (!bytes) {
+		fprintf(stderr, "Can't read engine.boot: %s\n", std::to_string(bytes.err).c_str());
+		return false;
+	}
+	BinaryReader reader(bytes.value);
+	if (!check_header(reader, "PlatEboot")) {
+		fprintf(stderr, "engine.boot has the wrong magic number\n");
+		return false;
+	}
+
+	// Controller types, then controllers, which have a binding per axis direction and button of their type
+	auto skip = [&]() -> Result<> {
+		char buffer[256];
+		uint16_t width, height;
+		check_void(reader.read_string<uint16_t>(buffer)); // title
+		check_void(reader.read_string<uint16_t>(buffer)); // icon
+		check_void(reader.read(width));
+		check_void(reader.read(height));
+		check_void(reader.read_string<uint16_t>(buffer));
+		asset_dir = project + "/" + buffer;
+		check_void(reader.read_string<uint16_t>(buffer)); // scripts
+
+		std::unordered_map<std::string, size_t> n_bindings;
+		uint16_t n_types;
+		check_void(reader.read(n_types));
+		for (uint16_t i = 0; i < n_types; ++i) {
+			check_void(reader.read_string<uint16_t>(buffer));
+			std::string name = buffer;
+			uint16_t n_axes, n_buttons;
+			check_void(reader.read(n_axes));
+			for (uint16_t a = 0; a < n_axes; ++a) check_void(reader.read_string<uint16_t>(buffer));
+			check_void(reader.read(n_buttons));
+			for (uint16_t b = 0; b < n_buttons; ++b) check_void(reader.read_string<uint16_t>(buffer));
+			n_bindings[name] = n_axes * 2 + n_buttons;
+		}
+		uint16_t n_controllers;
+		check_void(reader.read(n_controllers));
+		for (uint16_t i = 0; i < n_controllers; ++i) {
+			check_void(reader.read_string<uint16_t>(buffer));
+			check_void(reader.read_string<uint16_t>(buffer));
+			size_t n = n_bindings[buffer];
+			for (size_t b = 0; b < n; ++b) check_void(reader.read_string<uint16_t>(buffer));
+		}
+		return Result<>::success;
+	};
+	auto skipped = skip();
+	if (!skipped) {
+		fprintf(stderr, "engine.boot: %s\n", std::to_string(skipped.err).c_str());
+		return false;
+	}
+
+	auto types = ColliderType::init(reader);
+	if (!types) {
+		fprintf(stderr, "engine.boot: %s\n", std::to_string(types.err).c_str());
+		return false;
+	}
+	return true;
+}
+
+// =========================================================================================
+// ==== Timing ====
+// =========================================================================================
+
+struct Asset {
+	std::string path; // from the asset root, the way assets refer to each other
+	std::string kind;
+	size_t bytes;
+};
+
+static void find_assets(const std::string& root, const std::string& dir, std::vector<Asset>& out) {
+	DIR* d = opendir((root + dir).c_str());
+	if (d == nullptr) return;
+
+	while (dirent* entry = readdir(d)) {
+		if (entry->d_name[0] == '.') continue;
+		std::string path = dir + "/" + entry->d_name;
+
+		struct stat info;
+		if (stat((root + path).c_str(), &info) != 0) continue;
+		if (S_ISDIR(info.st_mode)) {
+			find_assets(root, path, out);
+			continue;
+		}
+
+		size_t dot = path.rfind('.');
+		if (dot == std::string::npos) continue;
+		std::string kind = path.substr(dot + 1);
+		if (kind == "sprite" || kind == "tileset" || kind == "emitter" || kind == "level") {
+			out.push_back({ path, kind, (size_t) info.st_size });
+		}
+	}
+	closedir(d);
+}
+
+// Every call has to give back a new asset, or what's being timed is the asset cache
+static const void* load(const Asset& asset) {
+	const char* path = asset.path.c_str();
+	if (asset.kind == "sprite") {
+		auto r = load_sprite(path);
+		return r ? (const void*) r.value : nullptr;
+	}
+	if (asset.kind == "tileset") {
+		auto r = load_tileset(path);
+		return r ? (const void*) r.value : nullptr;
+	}
+	if (asset.kind == "emitter") {
+		auto r = load_emitter(path);
+		return r ? (const void*) r.value : nullptr;
+	}
+	auto r = load_level(path);
+	return r ? (const void*) r.value : nullptr;
+}
+
+int main(int argc, char* argv[]) {
+	std::string project = argc > 1 ? argv[1] : "..";
+	int reps = argc > 2 ? atoi(argv[2]) : 1000;
+
+	std::string asset_dir;
+	if (!read_bootloader(project, asset_dir)) return 1;
+	if (!AssetManager::set_root_dir(asset_dir.c_str())) {
+		fprintf(stderr, "Bad asset directory %s\n", asset_dir.c_str());
+		return 1;
+	}
+
+	std::vector<Asset> assets;
+	find_assets(asset_dir, "", assets);
+	if (assets.empty()) {
+		fprintf(stderr, "No built assets under %s (run tools/build.py first)\n", asset_dir.c_str());
+		return 1;
+	}
+	std::sort(assets.begin(), assets.end(), [](const Asset& a, const Asset& b) { return a.path < b.path; });
+
+	fprintf(stderr, "%d loads of each asset under %s\n\n", reps, asset_dir.c_str());
+	fprintf(stderr, "%-32s %8s %10s %10s %10s\n", "asset", "bytes", "first us", "mean us", "min us");
+
+	using clock = std::chrono::high_resolution_clock;
+	double total = 0;
+	for (const Asset& asset : assets) {
+		auto t0 = clock::now();
+		const void* first = load(asset);
+		double first_us = std::chrono::duration<double, std::micro>(clock::now() - t0).count();
+		if (first == nullptr) {
+			fprintf(stderr, "%-32s failed to load\n", asset.path.c_str());
+			continue;
+		}
+
+		double sum = 0, best = 1e30;
+		bool cached = false;
+		for (int i = 0; i < reps; ++i) {
+			auto start = clock::now();
+			const void* loaded = load(asset);
+			double us = std::chrono::duration<double, std::micro>(clock::now() - start).count();
+			sum += us;
+			best = std::min(best, us);
+			cached |= loaded == first;
+		}
+		total += sum / reps;
+
+		fprintf(stderr, "%-32s %8zu %10.2f %10.2f %10.2f%s\n", asset.path.c_str(), asset.bytes, first_us, sum / reps, best,
+			cached ? "  (came from the asset cache)" : "");
+	}
+	fprintf(stderr, "\nAll assets once: %.2f us\n", total);
+
+	return 0;
+}
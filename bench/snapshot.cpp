@@ -0,0 +1,198 @@
+// Time to save and restore snapshots of a scene of script-driven entities (10k by default), through the same calls
+// Engine::save_snapshot and Engine::load_snapshot make for the entity section, plus the file envelope (checksum and
+// optional compression). Every restore is checked against the scene it came from.
+// Standalone; no window, level or controllers. Needs AngelScript built from lib/angelscript-sdk and the SDL2 headers;
+// everything that would pull in the rest of the engine is dropped by the linker.
+//
+//   g++ -O2 -std=c++14 -D__forceinline=inline -ffunction-sections -fdata-sections \
+//       $(sdl2-config --cflags) -I../src -I../lib/sdl-gpu/include -I../lib/angelscript-sdk/include -I../lib/angelscript-sdk/addon \
+//       snapshot.cpp ../src/entity.cpp ../src/snapshot.cpp ../src/executor.cpp ../src/rng.cpp ../src/hitbox.cpp ../src/gjk.cpp \
+//       ../src/vectors.cpp ../src/transform.cpp ../src/level.cpp ../src/tilegrid.cpp ../src/raycast.cpp ../src/spatialhash.cpp ../src/sprite.cpp \
+//       ../src/fileutil.cpp ../src/mappedfile.cpp ../src/assetmanager.cpp ../src/error.cpp ../src/result.cpp \
+//       ../lib/angelscript-sdk/addon/scriptarray/scriptarray.cpp ../lib/angelscript-sdk/addon/scriptstdstring/scriptstdstring.cpp \
+//       -L<angelscript lib dir> -langelscript -Wl,--gc-sections -lpthread -o snapshot
+//   ./snapshot [entities] [repetitions]
+
+#include "entity.h"
+#include "snapshot.h"
+#include "fileutil.h"
+#include "hitbox.h"
+#include "vectors.h"
+#include "rng.h"
+
+#include "scriptarray/scriptarray.h"
+#include "scriptstdstring/scriptstdstring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+GPU_Image* GPU_LoadImage(const char* filename) {
+	static GPU_Image image;
+	return &image;
+}
+
+GPU_ErrorObject GPU_PopErrorCode() {
+	return GPU_ErrorObject();
+}
+
+static const char* SCRIPT =
+	"class Bullet {\n"
+	"	float speed = 3.f;\n"
+	"	int hits = 0;\n"
+	"	string tag = \"bullet\";\n"
+	"	array<float> trail = { 1.f, 2.f, 3.f, 4.f };\n"
+	"	Entity@ target;\n"
+	"	void init(Entity@ self) {}\n"
+	"}\n";
+
+static const char* SNAPSHOT_FILE = "bench.snapshot";
+
+static void message_callback(const asSMessageInfo* msg, void*) {
+	fprintf(stderr, "%s (%d, %d): %s\n", msg->section, msg->row, msg->col, msg->message);
+}
+
+static asIScriptEngine* create_engine() {
+	asIScriptEngine* engine = asCreateScriptEngine();
+	engine->SetMessageCallback(asFUNCTION(message_callback), nullptr, asCALL_CDECL);
+
+	// No custom collider types or channels
+	const uint8_t boot[] = { 0, 0, 0, 0 };
+	BinaryReader reader(boot, sizeof(boot));
+	if (!ColliderType::init(reader) || !ColliderChannel::init(reader)) return nullptr;
+
+	RegisterScriptArray(engine, true);
+	RegisterStdString(engine);
+	engine->RegisterFuncdef("void ErrorCallback(int, const string &in)");
+	RegisterVector2(engine);
+	RegisterRandomTypes(engine);
+	if (RegisterColliderTypes(engine) < 0) return nullptr;
+	RegisterEntityTypes(engine);
+
+	asIScriptModule* mod = engine->GetModule("bench", asGM_ALWAYS_CREATE);
+	if (mod->AddScriptSection("bench", SCRIPT) < 0 || mod->Build() < 0) return nullptr;
+	return engine;
+}
+
+static size_t file_size(const char* filename) {
+	FILE* file = fopen(filename, "rb");
+	if (file == nullptr) return 0;
+	fseek(file, 0, SEEK_END);
+	size_t size = (size_t) ftell(file);
+	fclose(file);
+	return size;
+}
+
+// Something to check restores against: id, position and velocity of every entity, by id
+struct EntityState {
+	EntityId id;
+	Point2 position;
+	Vector2 velocity;
+
+	bool operator < (const EntityState& other) const { return id < other.id; }
+	bool operator == (const EntityState& other) const {
+		return id == other.id && position.x == other.position.x && position.y == other.position.y &&
+			velocity.x == other.velocity.x && velocity.y == other.velocity.y;
+	}
+};
+
+static std::vector<EntityState> fingerprint(EntitySystem& system) {
+	std::vector<EntityState> out;
+	auto range = system.render_iter();
+	for (auto it = range.first; it != range.second; ++it) {
+		out.push_back({ (*it)->id, (*it)->position, (*it)->velocity });
+	}
+	std::sort(out.begin(), out.end());
+	return out;
+}
+
+int main(int argc, char* argv[]) {
+	int n_entities = argc > 1 ? atoi(argv[1]) : 10000;
+	int reps = argc > 2 ? atoi(argv[2]) : 20;
+
+	asIScriptEngine* engine = create_engine();
+	if (engine == nullptr) {
+		fprintf(stderr, "Couldn't set up the script engine\n");
+		return 1;
+	}
+	asITypeInfo* type = engine->GetModule("bench")->GetTypeInfoByName("Bullet");
+
+	EntitySystem system;
+	Random& rng = get_thread_rng();
+	for (int i = 0; i < n_entities; ++i) {
+		asIScriptObject* comp = static_cast<asIScriptObject*>(engine->CreateScriptObject(type));
+		auto ent = system.spawn(comp);
+		comp->Release();
+		if (!ent) {
+			fprintf(stderr, "Spawn failed: %s\n", std::to_string(ent.err).c_str());
+			return 1;
+		}
+		ent.value->position = { rng.interval(0.f, 4096.f), rng.interval(0.f, 4096.f) };
+		ent.value->velocity = { rng.interval(-50.f, 50.f), rng.interval(-50.f, 50.f) };
+	}
+	system.apply_changes();
+	const std::vector<EntityState> expected = fingerprint(system);
+
+	fprintf(stderr, "%d entities, %d repetitions\n\n", n_entities, reps);
+	fprintf(stderr, "%-12s %10s %10s %10s %10s %12s\n", "", "save ms", "write ms", "read ms", "restore ms", "file bytes");
+
+	using clock = std::chrono::high_resolution_clock;
+	auto ms = [](clock::time_point a, clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+
+	for (bool compress : { false, true }) {
+		double save = 0, write = 0, read = 0, restore = 0;
+		size_t bytes = 0;
+		for (int r = 0; r < reps; ++r) {
+			auto t0 = clock::now();
+			SnapshotWriter writer;
+			system.save(writer);
+			writer.finish();
+			auto t1 = clock::now();
+			auto written = write_snapshot_file(SNAPSHOT_FILE, writer, compress);
+			auto t2 = clock::now();
+			auto file = read_snapshot_file(SNAPSHOT_FILE);
+			auto t3 = clock::now();
+			if (!written || !file) {
+				fprintf(stderr, "Snapshot file: %s\n", std::to_string(written ? file.err : written.err).c_str());
+				return 1;
+			}
+
+			SnapshotReader reader(file.value.data(), file.value.size());
+			EntitySystem::Staged staged;
+			Result<> res = Result<>::success;
+			try {
+				reader.read_type_table(engine);
+			}
+			catch (Error& err) {
+				res = err;
+			}
+			if (res) res = system.read_snapshot(reader, engine, staged);
+			if (!res) {
+				fprintf(stderr, "Restore failed: %s\n", std::to_string(res.err).c_str());
+				return 1;
+			}
+			system.restore(staged);
+			auto t4 = clock::now();
+
+			if (fingerprint(system) != expected) {
+				fprintf(stderr, "Restored entities differ from the saved ones\n");
+				return 1;
+			}
+
+			save += ms(t0, t1);
+			write += ms(t1, t2);
+			read += ms(t2, t3);
+			restore += ms(t3, t4);
+			bytes = file_size(SNAPSHOT_FILE);
+		}
+		fprintf(stderr, "%-12s %10.3f %10.3f %10.3f %10.3f %12zu\n", compress ? "compressed" : "raw",
+			save / reps, write / reps, read / reps, restore / reps, bytes);
+	}
+
+	remove(SNAPSHOT_FILE);
+
+	// The executor's workers never return, and tearing it down under them can hang, so skip static destructors
+	std::quick_exit(0);
+}
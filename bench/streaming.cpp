@@ -0,0 +1,272 @@
+// Streamed levels only keep the chunks around the camera resident, so whatever collides with the level elsewhere keeps
+// the chunks around itself resident too (EntitySystem::level_anchors, passed to stream_level). This drops a box far outside
+// the camera's streaming margin onto the ground, with and without anchors, then times streaming updates with many entities
+// spread over the level. The level is made in memory: every chunk is stored, with its bottom row of tiles solid.
+// Standalone; no window or assets. Needs AngelScript built from lib/angelscript-sdk and the SDL2 headers;
+// everything that would pull in the rest of the engine is dropped by the linker.
+//
+//   g++ -O2 -std=c++14 -D__forceinline=inline -ffunction-sections -fdata-sections \
+//       $(sdl2-config --cflags) -I../src -I../lib/sdl-gpu/include -I../lib/angelscript-sdk/include -I../lib/angelscript-sdk/addon \
+//       streaming.cpp ../src/entity.cpp ../src/snapshot.cpp ../src/executor.cpp ../src/rng.cpp ../src/hitbox.cpp ../src/gjk.cpp \
+//       ../src/vectors.cpp ../src/transform.cpp ../src/level.cpp ../src/levelstream.cpp ../src/tilegrid.cpp ../src/tileanim.cpp \
+//       ../src/tilebatch.cpp ../src/raycast.cpp ../src/spatialhash.cpp ../src/collisionkernels.cpp ../src/sprite.cpp \
+//       ../src/fileutil.cpp ../src/mappedfile.cpp ../src/assetmanager.cpp ../src/cstrkey.cpp ../src/error.cpp ../src/result.cpp \
+//       ../lib/angelscript-sdk/addon/scriptarray/scriptarray.cpp ../lib/angelscript-sdk/addon/scriptstdstring/scriptstdstring.cpp \
+//       -L<angelscript lib dir> -langelscript -Wl,--gc-sections -lpthread -o streaming
+//   ./streaming [entities] [updates]
+
+#include "entity.h"
+#include "level.h"
+#include "fileutil.h"
+#include "levelstream.h"
+#include "tileset.h"
+#include "hitbox.h"
+#include "vectors.h"
+#include "rng.h"
+
+#include "scriptarray/scriptarray.h"
+#include "scriptstdstring/scriptstdstring.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+GPU_Image* GPU_LoadImage(const char* filename) {
+	static GPU_Image image;
+	return &image;
+}
+
+GPU_ErrorObject GPU_PopErrorCode() {
+	return GPU_ErrorObject();
+}
+
+static const char* SCRIPT =
+	"class Crate {\n"
+	"	void init(Entity@ self) {}\n"
+	"}\n";
+
+// Level size in chunks, and tile size in level units
+static const size_t CHUNKS_WIDE = 128, CHUNKS_HIGH = 64;
+static const float TILE = 16.f;
+static const float GRAVITY = 600.f;
+
+static void message_callback(const asSMessageInfo* msg, void*) {
+	fprintf(stderr, "%s (%d, %d): %s\n", msg->section, msg->row, msg->col, msg->message);
+}
+
+static asIScriptEngine* create_engine() {
+	asIScriptEngine* engine = asCreateScriptEngine();
+	engine->SetMessageCallback(asFUNCTION(message_callback), nullptr, asCALL_CDECL);
+
+	// No custom collider types or channels
+	const uint8_t boot[] = { 0, 0, 0, 0 };
+	BinaryReader reader(boot, sizeof(boot));
+	if (!ColliderType::init(reader) || !ColliderChannel::init(reader)) return nullptr;
+
+	RegisterScriptArray(engine, true);
+	RegisterStdString(engine);
+	engine->RegisterFuncdef("void ErrorCallback(int, const string &in)");
+	RegisterVector2(engine);
+	RegisterRandomTypes(engine);
+	if (RegisterColliderTypes(engine) < 0) return nullptr;
+	RegisterEntityTypes(engine);
+
+	asIScriptModule* mod = engine->GetModule("bench", asGM_ALWAYS_CREATE);
+	if (mod->AddScriptSection("bench", SCRIPT) < 0 || mod->Build() < 0) return nullptr;
+	return engine;
+}
+
+// =========================================================================================
+// ==== Level ====
+// =========================================================================================
+
+// One solid tile type. Tiles have a union with a non-trivial Hitbox in it, so this is made the way the loader makes them.
+static const Tileset* make_tileset() {
+	static uint8_t storage[sizeof(Tile)];
+	memset(storage, 0, sizeof(storage));
+	Tile* tile = reinterpret_cast<Tile*>(storage);
+	tile->solidity.type = Tile::Solidity::Full;
+
+	static Tileset tileset;
+	tileset.name = "bench";
+	tileset.tilesheet = nullptr;
+	tileset.tile_width = (uint16_t) TILE;
+	tileset.tile_height = (uint16_t) TILE;
+	tileset.tile_data = Array<const Tile>(tile, 1);
+	return &tileset;
+}
+
+// A streamed level whose "file" is a buffer in memory: every chunk stored, each with its bottom row solid
+static const Level* make_level() {
+	const size_t n_chunks = CHUNKS_WIDE * CHUNKS_HIGH;
+	const size_t chunk_bytes = TILE_CHUNK_SIZE * TILE_CHUNK_SIZE * sizeof(uint16_t);
+
+	// Offset 0 means a blank chunk, so the chunks start after some padding
+	static std::vector<uint8_t> file(chunk_bytes * (n_chunks + 1));
+	static std::vector<uint32_t> offsets(n_chunks);
+	uint16_t tiles[TILE_CHUNK_SIZE * TILE_CHUNK_SIZE] = {};
+	for (size_t x = 0; x < TILE_CHUNK_SIZE; ++x) tiles[(TILE_CHUNK_SIZE - 1) * TILE_CHUNK_SIZE + x] = 1;
+	for (size_t i = 0; i < n_chunks; ++i) {
+		offsets[i] = (uint32_t) (chunk_bytes * (i + 1));
+		memcpy(&file[offsets[i]], tiles, chunk_bytes);
+	}
+	static Array<const uint32_t> layer_offsets(offsets.data(), n_chunks);
+
+	static Tilemap layer;
+	layer.tileset = make_tileset();
+	layer.tiles = TileGrid::allocate(CHUNKS_WIDE * TILE_CHUNK_SIZE, CHUNKS_HIGH * TILE_CHUNK_SIZE, false);
+	layer.z_order = 0;
+	layer.offset = { 0.f, 0.f };
+	layer.scale = { 1.f, 1.f };
+	layer.parallax = { 1.f, 1.f };
+	layer.solid = true;
+
+	static Level level;
+	level.file.data = file.data();
+	level.file.size = file.size();
+	level.name = "bench";
+	level.boundary = { 0.f, CHUNKS_WIDE * TILE_CHUNK_SIZE * TILE, 0.f, CHUNKS_HIGH * TILE_CHUNK_SIZE * TILE };
+	level.layers = Array<const Tilemap>(&layer, 1);
+	level.chunk_offsets = Array<const Array<const uint32_t>>(&layer_offsets, 1);
+	level.streamed = true;
+	return &level;
+}
+
+// Top of the ground row of the chunk row containing y
+static float ground_below(float y) {
+	const float chunk = TILE_CHUNK_SIZE * TILE;
+	return floorf(y / chunk) * chunk + (TILE_CHUNK_SIZE - 1) * TILE;
+}
+
+// =========================================================================================
+// ==== Entities ====
+// =========================================================================================
+
+static Frame frame;
+static FrameTiming timing = { 1.f, &frame };
+static Animation animation;
+
+// A 16x16 box, solid and falling
+static Entity* spawn_crate(EntitySystem& system, asITypeInfo* type, Point2 position) {
+	asIScriptObject* comp = static_cast<asIScriptObject*>(type->GetEngine()->CreateScriptObject(type));
+	auto ent = system.spawn(comp);
+	comp->Release();
+	if (!ent) return nullptr;
+
+	Entity* e = ent.value;
+	e->animation = &animation;
+	e->frame = &frame;
+	e->position = position;
+	e->last_pos = position; // or it counts as having swept here from the origin
+	e->acceleration = { 0.f, GRAVITY };
+	return e;
+}
+
+// What Engine::update does with the level each update
+static void step(EntitySystem& system, asIScriptEngine* engine, LevelInstance* level, const Camera& camera, bool anchored, float dt) {
+	static std::vector<AABB> anchors;
+	anchors.clear();
+	if (anchored) system.level_anchors(anchors);
+	stream_level(level, camera, anchors);
+	refresh_tiles(level);
+	system.update(engine, level, dt);
+}
+
+// Drops a crate a couple of tiles above the ground, well outside the camera's streaming margin. Returns where it ends up.
+static Point2 drop_far_away(asIScriptEngine* engine, asITypeInfo* type, const Camera& camera, bool anchored) {
+	LevelInstance* level = instantiate_level(make_level());
+	EntitySystem system;
+
+	const Point2 start = { 100.5f * TILE_CHUNK_SIZE * TILE, 30.f * TILE_CHUNK_SIZE * TILE + 8.f * TILE };
+	Entity* crate = spawn_crate(system, type, start);
+	// A first update without the level puts it in the index, the way any update after it's spawned would
+	system.update(engine, nullptr, 0.f);
+
+	for (int i = 0; i < 120; ++i) {
+		step(system, engine, level, camera, anchored, 1.f / 60.f);
+	}
+	Point2 end = crate->position;
+
+	system.destroy(crate);
+	system.apply_changes();
+	destroy_level_instance(level);
+	return end;
+}
+
+int main(int argc, char* argv[]) {
+	int n_entities = argc > 1 ? atoi(argv[1]) : 10000;
+	int n_updates = argc > 2 ? atoi(argv[2]) : 120;
+
+	asIScriptEngine* engine = create_engine();
+	if (engine == nullptr) {
+		fprintf(stderr, "Couldn't set up the script engine\n");
+		return 1;
+	}
+	asITypeInfo* type = engine->GetModule("bench")->GetTypeInfoByName("Crate");
+
+	animation.frames = Array<const FrameTiming>(&timing, 1);
+	animation.solidity.hitbox.type = Hitbox::BOX;
+	animation.solidity.hitbox.box = { -8.f, 8.f, -8.f, 8.f };
+	animation.solidity.fixed = false;
+
+	const Camera camera = { { 0.f, 0.f }, { 640.f, 360.f } };
+
+	// ==== Falling through unloaded ground ====
+	const Point2 bare = drop_far_away(engine, type, camera, false);
+	const Point2 anchored = drop_far_away(engine, type, camera, true);
+	const float ground = ground_below(30.f * TILE_CHUNK_SIZE * TILE + 8.f * TILE);
+	fprintf(stderr, "Crate dropped %.0f chunks from the camera, ground at y = %.1f\n", 100.f, ground);
+	fprintf(stderr, "  without anchors: y = %.1f\n", bare.y);
+	fprintf(stderr, "  with anchors:    y = %.1f\n\n", anchored.y);
+	if (anchored.y + 8.f > ground + 1.f) {
+		fprintf(stderr, "The anchored crate fell through the ground\n");
+		return 1;
+	}
+
+	// ==== Streaming with many anchors ====
+	LevelInstance* level = instantiate_level(make_level());
+	EntitySystem system;
+	Random& rng = get_thread_rng();
+	for (int i = 0; i < n_entities; ++i) {
+		Point2 p = {
+			rng.interval(0.f, CHUNKS_WIDE * TILE_CHUNK_SIZE * TILE),
+			rng.interval(0.f, (CHUNKS_HIGH - 1) * TILE_CHUNK_SIZE * TILE)
+		};
+		if (spawn_crate(system, type, p) == nullptr) {
+			fprintf(stderr, "Spawn failed\n");
+			return 1;
+		}
+	}
+	system.update(engine, nullptr, 0.f);
+
+	using clock = std::chrono::high_resolution_clock;
+	auto ms = [](clock::time_point a, clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+
+	std::vector<AABB> anchors;
+	double first = 0, streaming = 0, total = 0;
+	for (int i = 0; i < n_updates; ++i) {
+		auto t0 = clock::now();
+		anchors.clear();
+		system.level_anchors(anchors);
+		stream_level(level, camera, anchors);
+		auto t1 = clock::now();
+		refresh_tiles(level);
+		system.update(engine, level, 1.f / 60.f);
+		auto t2 = clock::now();
+
+		if (i == 0) first = ms(t0, t1);
+		else streaming += ms(t0, t1);
+		total += ms(t0, t2);
+	}
+
+	fprintf(stderr, "%d entities over %zux%zu chunks, %d updates\n", n_entities, CHUNKS_WIDE, CHUNKS_HIGH, n_updates);
+	fprintf(stderr, "  first stream (waits for the chunks under every entity): %.3f ms\n", first);
+	fprintf(stderr, "  stream per update after that: %.3f ms\n", n_updates > 1 ? streaming / (n_updates - 1) : 0.0);
+	fprintf(stderr, "  whole update: %.3f ms\n", total / n_updates);
+	fprintf(stderr, "  resident: %.1f MiB\n", level->streamer->resident_bytes() / (1024.0 * 1024.0));
+
+	// The executor's workers never return, and tearing it down under them can hang, so skip static destructors
+	std::quick_exit(0);
+}
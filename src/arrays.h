@@ -29,7 +29,7 @@ public:
 	}
 
 	Array copy() { // Copies should be explicit.
-		unconst<T>::type* buf = new T[n_items];
+		typename std::remove_const<T>::type* buf = new typename std::remove_const<T>::type[n_items];
 		if (std::is_trivially_copyable<T>::value) {
 			memcpy((void*)buf, (const void*)items, n_items * sizeof(T));
 		}
@@ -134,15 +134,15 @@ public:
 	public:
 		iterator() { bit = 0; arr = nullptr; }
 		iterator(const Array* a, size_t i = 0) { bit = i; arr = a; }
-		iterator(iterator& it) { arr = it.arr; bit = it.bit; }
+		iterator(const iterator& it) { arr = it.arr; bit = it.bit; }
 		~iterator() {}
 
-		bool operator == (iterator& it) const { return bit == it.bit && arr == it.arr; }
-		__forceinline bool operator != (iterator& it) const { return !(*this == it); }
+		bool operator == (const iterator& it) const { return bit == it.bit && arr == it.arr; }
+		__forceinline bool operator != (const iterator& it) const { return !(*this == it); }
 
 		__forceinline const bool operator * () const { return (*arr)[bit]; }
 
-		__forceinline iterator& operator ++ () { ++bit; }
+		__forceinline iterator& operator ++ () { ++bit; return *this; }
 	};
 
 	iterator begin() const { return iterator(this); }
@@ -162,7 +162,7 @@ public:
 	__forceinline Array2D() {}
 	Array2D(T* data, size_t width, size_t height) : w(width), h(height), items(data) {}
 	Array2D(size_t width, size_t height) : w(width), h(height),
-		items(new T[width * height];) {}
+		items(new T[width * height]) {}
 
 	// avoid magical memory management
 	__forceinline void free() {
@@ -208,7 +208,7 @@ public:
 	Array2D(uint8_t* data, size_t width, size_t height) : w(width), h(height), bytes(data) {}
 	Array2D(size_t width, size_t height) : w(width), h(height),
 		bytes(new uint8_t[(width * height + 7) / 8]) {}
-	Array2D(Array2D& arr) : bytes(arr.bytes), w(arr.w), h(arr.h) {}
+	Array2D(const Array2D& arr) : bytes(arr.bytes), w(arr.w), h(arr.h) {}
 
 	void free() {
 		delete[] bytes;
@@ -232,15 +232,15 @@ public:
 	public:
 		iterator() { bit = 0; arr = nullptr; }
 		iterator(const Array2D* a, size_t i = 0) { bit = i; arr = a; }
-		iterator(iterator& it) { arr = it.arr; bit = it.bit; }
+		iterator(const iterator& it) { arr = it.arr; bit = it.bit; }
 		~iterator() {}
 
-		bool operator == (iterator& it) const { return bit == it.bit && arr == it.arr; }
-		__forceinline bool operator != (iterator& it) const { return !(*this == it); }
+		bool operator == (const iterator& it) const { return bit == it.bit && arr == it.arr; }
+		__forceinline bool operator != (const iterator& it) const { return !(*this == it); }
 
 		__forceinline const bool operator * () const { return (*arr)(bit % arr->w, bit / arr->h); }
 
-		__forceinline iterator& operator ++ () { ++bit; }
+		__forceinline iterator& operator ++ () { ++bit; return *this; }
 	};
 
 	iterator begin() const { return iterator(this); }
@@ -26,6 +26,13 @@ namespace AssetManager {
 		return &(iter->second);
 	}
 
+	const char* filename_of(const void* asset) {
+		for (const auto& entry : assets) {
+			if (entry.second.asset == asset) return entry.first.c_str();
+		}
+		return nullptr;
+	}
+
 	void free_asset(AssetEntry& entry) {
 		if (entry.asset == nullptr) return;
 
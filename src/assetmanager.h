@@ -44,6 +44,10 @@ namespace AssetManager {
 	void store_raw(const char* filename, const void* asset, const std::type_index& type);
 	const AssetEntry* retrieve_raw(const char* filename);
 
+	/// Reverse lookup of the name an asset was stored under (nullptr if not managed).
+	// Linear in the number of assets; callers doing many lookups should cache the result.
+	const char* filename_of(const void* asset);
+
 	bool set_root_dir(const char* dir);
 
 	// Asset Garbage Collection (slow- should probably only be allowed to be triggered on loading screens)
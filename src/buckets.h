@@ -69,6 +69,7 @@ public:
 		memcpy(new_items, items, n_items * sizeof(T));
 		delete[] items;
 		items = new_items;
+		capacity_ = new_capacity;
 	}
 
 	__forceinline T* begin() { return items; }
@@ -161,12 +162,12 @@ public:
 	}
 
 	Result<> remove(int offset) {
-		if (offset < 0 || offset >= n_items || !occupation[offset]) {
+		if (offset < 0 || offset >= capacity_ || !occupation[offset]) {
 			return Errors::BucketIllegalRemove;
 		}
 		// Unset the bit :O
 		occupation.unset(offset);
-		items[offset].~Data();
+		items[offset].~T();
 
 		// Avoid searching next time if this bucket was *just* full.
 		if (n_items >= capacity_) {
@@ -178,8 +179,8 @@ public:
 	}
 
 	Result<> remove(T* ptr) {
-		int offset = static_cast<int>(ptr - items) / sizeof(T);
-		if (offset < 0 || offset >= n_items || !occupation[offset]) {
+		int offset = static_cast<int>(ptr - items);
+		if (offset < 0 || offset >= capacity_ || !occupation[offset]) {
 			return Errors::BucketIllegalRemove;
 		}
 		// Unset the bit :O
@@ -203,7 +204,7 @@ public:
 		iterator(SparseBucket* bucket) {
 			b = bucket;
 			index = 0;
-			while (!b->occupation[index]) {
+			while (index < b->capacity_ && !b->occupation[index]) {
 				++index;
 			}
 		}
@@ -233,7 +234,7 @@ public:
 	__forceinline size_t capacity() const { return capacity_; }
 
 	inline bool contains_ptr(T* ptr) const {
-		return ptr >= items && ptr < items + n_items;
+		return ptr >= items && ptr < items + capacity_;
 	}
 };
 
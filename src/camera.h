@@ -0,0 +1,31 @@
+#pragma once
+
+#include "SDL_gpu.h"
+#include "vectors.h"
+
+/// The part of the level that's on screen.
+// Everything is drawn in level coordinates once the camera is applied to the render target;
+// tilemaps with a parallax other than {1, 1} shift themselves by parallax_shift.
+struct Camera {
+	Point2 position; // level coordinates of the screen's top-left corner
+	Vector2 size;    // width and height of the view, in level units
+
+	/// How far a layer with this parallax is drawn from where it would be if it moved with the level
+	inline Vector2 parallax_shift(Vector2 parallax) const {
+		return { position.x * (1.f - parallax.x), position.y * (1.f - parallax.y) };
+	}
+
+	/// Region of a layer with this parallax (in the level coordinates it was laid out in) that can be seen
+	inline AABB view(Vector2 parallax) const {
+		Point2 corner = { position.x * parallax.x, position.y * parallax.y };
+		return { corner.x, corner.x + size.x, corner.y, corner.y + size.y };
+	}
+
+	/// Makes the target draw level coordinates relative to the camera
+	inline void apply(GPU_Target* target) const {
+		GPU_Camera cam = GPU_GetDefaultCamera();
+		cam.x = position.x;
+		cam.y = position.y;
+		GPU_SetCamera(target, &cam);
+	}
+};
@@ -0,0 +1,103 @@
+#include "collisionkernels.h"
+
+#include <emmintrin.h>
+
+void BoxPairs::clear() {
+	a_left.clear(); a_right.clear(); a_top.clear(); a_bottom.clear();
+	b_left.clear(); b_right.clear(); b_top.clear(); b_bottom.clear();
+}
+
+void BoxPairs::reserve(size_t n) {
+	a_left.reserve(n); a_right.reserve(n); a_top.reserve(n); a_bottom.reserve(n);
+	b_left.reserve(n); b_right.reserve(n); b_top.reserve(n); b_bottom.reserve(n);
+}
+
+void CirclePairs::clear() {
+	a_x.clear(); a_y.clear(); a_radius.clear();
+	b_x.clear(); b_y.clear(); b_radius.clear();
+}
+
+void CirclePairs::reserve(size_t n) {
+	a_x.reserve(n); a_y.reserve(n); a_radius.reserve(n);
+	b_x.reserve(n); b_y.reserve(n); b_radius.reserve(n);
+}
+
+// Appends the lanes set in mask (bit i = pair base + i)
+static inline size_t emit_hits(int mask, uint32_t base, uint32_t* hits, size_t count) {
+	while (mask != 0) {
+		int lane = 0;
+		while (!(mask & (1 << lane))) ++lane;
+		hits[count++] = base + lane;
+		mask &= mask - 1;
+	}
+	return count;
+}
+
+size_t overlap_boxes(const BoxPairs& pairs, uint32_t* hits) {
+	const size_t n = pairs.size();
+	const size_t n4 = n & ~(size_t) 3;
+	size_t count = 0;
+
+	const float* al = pairs.a_left.data();
+	const float* ar = pairs.a_right.data();
+	const float* at = pairs.a_top.data();
+	const float* ab = pairs.a_bottom.data();
+	const float* bl = pairs.b_left.data();
+	const float* br = pairs.b_right.data();
+	const float* bt = pairs.b_top.data();
+	const float* bb = pairs.b_bottom.data();
+
+	for (size_t i = 0; i < n4; i += 4) {
+		__m128 x = _mm_and_ps(
+			_mm_cmplt_ps(_mm_loadu_ps(al + i), _mm_loadu_ps(br + i)),
+			_mm_cmpgt_ps(_mm_loadu_ps(ar + i), _mm_loadu_ps(bl + i)));
+		__m128 y = _mm_and_ps(
+			_mm_cmplt_ps(_mm_loadu_ps(at + i), _mm_loadu_ps(bb + i)),
+			_mm_cmpgt_ps(_mm_loadu_ps(ab + i), _mm_loadu_ps(bt + i)));
+
+		int mask = _mm_movemask_ps(_mm_and_ps(x, y));
+		if (mask != 0) count = emit_hits(mask, (uint32_t) i, hits, count);
+	}
+
+	for (size_t i = n4; i < n; ++i) {
+		if (al[i] < br[i] && ar[i] > bl[i] && at[i] < bb[i] && ab[i] > bt[i]) {
+			hits[count++] = (uint32_t) i;
+		}
+	}
+
+	return count;
+}
+
+size_t overlap_circles(const CirclePairs& pairs, uint32_t* hits) {
+	const size_t n = pairs.size();
+	const size_t n4 = n & ~(size_t) 3;
+	size_t count = 0;
+
+	const float* ax = pairs.a_x.data();
+	const float* ay = pairs.a_y.data();
+	const float* ar = pairs.a_radius.data();
+	const float* bx = pairs.b_x.data();
+	const float* by = pairs.b_y.data();
+	const float* br = pairs.b_radius.data();
+
+	for (size_t i = 0; i < n4; i += 4) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(ax + i), _mm_loadu_ps(bx + i));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(ay + i), _mm_loadu_ps(by + i));
+		__m128 r = _mm_add_ps(_mm_loadu_ps(ar + i), _mm_loadu_ps(br + i));
+
+		__m128 dist2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+		int mask = _mm_movemask_ps(_mm_cmplt_ps(dist2, _mm_mul_ps(r, r)));
+		if (mask != 0) count = emit_hits(mask, (uint32_t) i, hits, count);
+	}
+
+	for (size_t i = n4; i < n; ++i) {
+		float dx = ax[i] - bx[i];
+		float dy = ay[i] - by[i];
+		float r = ar[i] + br[i];
+		if (dx * dx + dy * dy < r * r) {
+			hits[count++] = (uint32_t) i;
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// SIMD overlap tests for the shape pairs that make up most of the narrow phase.
+// Pairs are stored structure-of-arrays and tested 4 at a time with SSE.
+// Nothing here depends on the rest of the engine, so the kernels can be benchmarked on their own.
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/// World-space axis-aligned box pairs; pair i is (a[i], b[i])
+struct BoxPairs {
+	std::vector<float> a_left, a_right, a_top, a_bottom;
+	std::vector<float> b_left, b_right, b_top, b_bottom;
+
+	inline size_t size() const { return a_left.size(); }
+
+	void clear();
+	void reserve(size_t n);
+
+	inline void push(float al, float ar, float at, float ab, float bl, float br, float bt, float bb) {
+		a_left.push_back(al); a_right.push_back(ar); a_top.push_back(at); a_bottom.push_back(ab);
+		b_left.push_back(bl); b_right.push_back(br); b_top.push_back(bt); b_bottom.push_back(bb);
+	}
+};
+
+/// World-space circle pairs; pair i is (a[i], b[i])
+struct CirclePairs {
+	std::vector<float> a_x, a_y, a_radius;
+	std::vector<float> b_x, b_y, b_radius;
+
+	inline size_t size() const { return a_x.size(); }
+
+	void clear();
+	void reserve(size_t n);
+
+	inline void push(float ax, float ay, float ar, float bx, float by, float br) {
+		a_x.push_back(ax); a_y.push_back(ay); a_radius.push_back(ar);
+		b_x.push_back(bx); b_y.push_back(by); b_radius.push_back(br);
+	}
+};
+
+/// Writes the index of every overlapping pair to hits (which needs room for pairs.size() entries),
+/// in increasing order, and returns how many there were.
+// Same strict comparisons as box_box_test and circle_circle_test, so touching shapes don't overlap.
+size_t overlap_boxes(const BoxPairs& pairs, uint32_t* hits);
+size_t overlap_circles(const CirclePairs& pairs, uint32_t* hits);
@@ -1,13 +1,17 @@
 
 #include <SDL2/SDL_timer.h>
+#include <algorithm>
+#include <vector>
 
 #include "engine.h"
 #include "entity.h"
+#include "particles.h"
 #include "vectors.h"
 #include "fileutil.h"
 #include "rng.h"
 #include "input.h"
 #include "config.h"
+#include "snapshot.h"
 
 #include "angelscript.h"
 #include "scriptmath/scriptmath.h"
@@ -20,8 +24,12 @@
 namespace Engine {
 	// === GLOBAL VARIABLES ===
 	static EntitySystem* entity_system = nullptr;
+	static ParticleSystem* particle_system = nullptr;
 
 	static LevelInstance* active_level = nullptr;
+	static std::string active_level_name;
+
+	static Camera camera = { { 0.f, 0.f }, { 0.f, 0.f } };
 
 	static asIScriptEngine* script_engine = nullptr;
 
@@ -37,6 +45,10 @@ namespace Engine {
 	static float min_timestep, max_timestep;
 	static float tick_remainder = 0.f;
 
+	// Snapshot requests from scripts
+	static std::string pending_save, pending_load;
+	static bool pending_save_compressed = true;
+
 	// === Scripting interface ===
 	static void load_main_script(const char* main_script);
 
@@ -113,6 +125,8 @@ namespace Engine {
 
 		check(RegisterColliderTypes(script_engine));
 		RegisterEntityTypes(script_engine);
+		RegisterParticleTypes(script_engine);
+		RegisterCastTypes(script_engine);
 
 		RegisterInputTypes(script_engine);
 		check(RegisterControllerTypes(script_engine));
@@ -131,6 +145,30 @@ namespace Engine {
 		check(script_engine->RegisterGlobalFunction("bool travel(const string &in)",
 			asFUNCTION(travel), asCALL_CDECL));
 
+		check(script_engine->RegisterGlobalFunction("Vector2 get_camera()",
+			asFUNCTION(get_camera), asCALL_CDECL));
+		check(script_engine->RegisterGlobalFunction("void set_camera(const Vector2 &in)",
+			asFUNCTION(set_camera), asCALL_CDECL));
+
+		check(script_engine->RegisterGlobalFunction("CastHit raycast(const Vector2 &in, const Vector2 &in, float, ChannelMask mask = ChannelMask::ALL, const Entity@ ignore = null)",
+			asFUNCTION(raycast), asCALL_CDECL));
+		check(script_engine->RegisterGlobalFunction("CastHit boxcast(const AABB &in, const Vector2 &in, float, ChannelMask mask = ChannelMask::ALL, const Entity@ ignore = null)",
+			asFUNCTION(boxcast), asCALL_CDECL));
+
+		check(script_engine->RegisterGlobalFunction("bool set_tile(uint, uint, uint, uint16)",
+			asFUNCTION(set_tile), asCALL_CDECL));
+		check(script_engine->RegisterGlobalFunction("uint16 get_tile(uint, uint, uint)",
+			asFUNCTION(get_tile), asCALL_CDECL));
+		check(script_engine->RegisterGlobalFunction("bool fill_rect(uint, uint, uint, uint, uint, uint16)",
+			asFUNCTION(fill_rect), asCALL_CDECL));
+		check(script_engine->RegisterGlobalFunction("bool blit_submap(uint, uint, uint, const string &in, uint, uint, uint, uint, uint)",
+			asFUNCTION(blit_submap), asCALL_CDECL));
+
+		check(script_engine->RegisterGlobalFunction("void save_snapshot(const string &in, bool compress = true)",
+			asFUNCTION(request_save_snapshot), asCALL_CDECL));
+		check(script_engine->RegisterGlobalFunction("void load_snapshot(const string &in)",
+			asFUNCTION(request_load_snapshot), asCALL_CDECL));
+
 		check(script_engine->SetDefaultNamespace(""));
 
 		// ==================================================================
@@ -138,6 +176,9 @@ namespace Engine {
 		entity_system = new EntitySystem();
 		check(script_engine->RegisterGlobalProperty("__EntitySystem__ EntitySystem", entity_system));
 
+		particle_system = new ParticleSystem();
+		check(script_engine->RegisterGlobalProperty("__ParticleSystem__ Particles", particle_system));
+
 		// Now onto customizable initialization
 		load_main_script(main_script);
 	}
@@ -161,16 +202,47 @@ namespace Engine {
 		init_time = SDL_GetTicks();
 	}
 
+	// Snapshots can only be taken between updates, when no scripts are running
+	static void apply_snapshot_requests() {
+		if (!pending_save.empty()) {
+			auto res = save_snapshot(pending_save.c_str(), pending_save_compressed);
+			if (!res) {
+				ERR("%s\n", std::to_string(res.err).c_str());
+			}
+			pending_save.clear();
+		}
+		if (!pending_load.empty()) {
+			auto res = load_snapshot(pending_load.c_str());
+			if (!res) {
+				ERR("%s\n", std::to_string(res.err).c_str());
+			}
+			pending_load.clear();
+		}
+	}
+
 	void update(int delta_time) {
 		float delta_seconds = static_cast<float>(delta_time) / 1000.f;
 		if (delta_seconds > max_timestep) delta_seconds = max_timestep;
 
+		apply_snapshot_requests();
+
 		update_inputs(delta_seconds);
 
 		executor.run_deferred();
 
+		// Take in streamed chunks and catch the chunk metadata up with tile edits from last update, before anything collides with it
+		if (active_level != nullptr) {
+			static std::vector<AABB> anchors;
+			anchors.clear();
+			entity_system->level_anchors(anchors);
+			stream_level(active_level, camera, anchors);
+			refresh_tiles(active_level);
+		}
+
 		if (!paused) {
 			entity_system->update(script_engine, active_level, delta_seconds);
+			particle_system->update(active_level, delta_seconds);
+			if (active_level != nullptr) update_tile_animations(active_level, delta_seconds);
 		}
 
 		auto ctx = script_engine->RequestContext();
@@ -190,22 +262,72 @@ namespace Engine {
 	}
 
 	void render(GPU_Target* screen) {
+		camera.size = { static_cast<float>(screen->w), static_cast<float>(screen->h) };
+		camera.apply(screen);
+
+		// Layers and the scene objects in view, in z order (layers first on ties), interleaved with the entities (which come sorted by z order)
+		struct Backdrop {
+			int z_order;
+			bool is_object;
+			uint32_t index;
+		};
+		static std::vector<Backdrop> backdrop;
+		static std::vector<uint32_t> visible;
+		backdrop.clear();
 		if (active_level != nullptr) {
-			render_tilemap(screen, &(active_level->layers[0]));
+			const Level* level = active_level->base;
+			for (uint32_t i = 0; i < active_level->layers.size(); ++i) {
+				backdrop.push_back({ active_level->layers[i].z_order, false, i });
+			}
+
+			visible.clear();
+			objects_in(*level, camera.view({ 1.f, 1.f }), visible);
+			for (uint32_t i : visible) backdrop.push_back({ level->objects[i].z_order, true, i });
+
+			std::sort(backdrop.begin(), backdrop.end(), [](const Backdrop& a, const Backdrop& b) {
+				if (a.z_order != b.z_order) return a.z_order < b.z_order;
+				if (a.is_object != b.is_object) return b.is_object;
+				return a.index < b.index;
+			});
 		}
 
-		// TODO: interleaving
+		auto draw_backdrop = [screen](const Backdrop& item) {
+			if (item.is_object) {
+				render_scene_object(screen, active_level->base->objects[item.index]);
+			}
+			else {
+				size_t i = item.index;
+				active_level->batches[i].render(screen, active_level->layers[i], active_level->tile_clocks[i], active_level->clocks, camera);
+			}
+		};
 
+		auto next = backdrop.begin();
 		auto entities = entity_system->render_iter();
 		for (auto iter = entities.first; iter != entities.second; ++iter) {
+			for (; next != backdrop.end() && next->z_order <= (*iter)->z_order; ++next) {
+				draw_backdrop(*next);
+			}
 			(*iter)->render(screen);
 		}
+		for (; next != backdrop.end(); ++next) {
+			draw_backdrop(*next);
+		}
+
+		particle_system->render(screen);
 	}
 
 	void event(const SDL_Event& event) {
 
 	}
 
+	Vector2 get_camera() {
+		return camera.position;
+	}
+
+	void set_camera(const Vector2& position) {
+		camera.position = position;
+	}
+
 	float get_time() {
 		return static_cast<float>(SDL_GetTicks() - init_time) / 1000.f;
 	}
@@ -303,8 +425,233 @@ namespace Engine {
 				destroy_level_instance(active_level);
 			}
 			active_level = instantiate_level(res.value);
+			active_level_name = levelname;
 			return true;
 		}
 		else return false;
 	}
+
+	CastHit raycast(const Vector2& origin, const Vector2& direction, float max_distance, uint64_t channel_mask, const Entity* ignore) {
+		CastHit hit = CastHit::miss();
+		if (active_level != nullptr) hit = ::raycast(*active_level, origin, direction, max_distance);
+		if (entity_system != nullptr) {
+			CastHit ent = ::raycast(*entity_system, origin, direction, fminf(max_distance, hit.distance), channel_mask, ignore);
+			if (ent.hit && ent.distance <= hit.distance) hit = ent;
+		}
+		return hit;
+	}
+
+	CastHit boxcast(const AABB& box, const Vector2& direction, float max_distance, uint64_t channel_mask, const Entity* ignore) {
+		CastHit hit = CastHit::miss();
+		if (active_level != nullptr) hit = ::boxcast(*active_level, box, direction, max_distance);
+		if (entity_system != nullptr) {
+			CastHit ent = ::boxcast(*entity_system, box, direction, fminf(max_distance, hit.distance), channel_mask, ignore);
+			if (ent.hit && ent.distance <= hit.distance) hit = ent;
+		}
+		return hit;
+	}
+
+	// Scripts also edit tiles from entity updates, while the other workers are colliding with the same layers.
+	// Edits made on a worker are queued and applied on the master once the batch is over (so before the next
+	// refresh_tiles and collision pass); edits made on the master apply right away.
+	struct TileEdit {
+		LevelInstance* level; // edits queued for a level that has since been left are dropped
+		uint32_t layer, x, y, width, height;
+		uint16_t tile;
+	};
+	struct SubmapEdit {
+		LevelInstance* level;
+		uint32_t layer, x, y;
+		std::string* submap_level; // owned by the edit; deferred calls only carry plain data
+		uint32_t submap_layer, sx, sy, width, height;
+	};
+
+	// What can be checked without touching tiles, for edits about to be queued
+	static bool can_edit(uint32_t layer, uint16_t tile) {
+		if (active_level == nullptr || layer >= active_level->layers.size()) return false;
+		return tile <= active_level->layers[layer].tileset->tile_data.size();
+	}
+
+	static bool apply_blit_submap(LevelInstance* level, uint32_t layer, uint32_t x, uint32_t y, const std::string& submap_level,
+		uint32_t submap_layer, uint32_t sx, uint32_t sy, uint32_t width, uint32_t height) {
+		// Levels are cached by the asset manager, so this only reads the file the first time
+		auto submap = load_level(submap_level.c_str());
+		if (!submap) {
+			ERR("%s\n", std::to_string(submap.err).c_str());
+			return false;
+		}
+		// A streamed level's layers have no tiles in memory to copy from
+		if (submap.value->streamed || submap_layer >= submap.value->layers.size()) return false;
+
+		return ::blit_submap(level, layer, x, y, submap.value->layers[submap_layer], sx, sy, width, height);
+	}
+
+	static void set_tile_wrapper(TileEdit* edit) {
+		if (edit->level != active_level) return;
+		::set_tile(edit->level, edit->layer, edit->x, edit->y, edit->tile);
+	}
+
+	static void fill_rect_wrapper(TileEdit* edit) {
+		if (edit->level != active_level) return;
+		fill_tiles(edit->level, edit->layer, edit->x, edit->y, edit->width, edit->height, edit->tile);
+	}
+
+	static void blit_submap_wrapper(SubmapEdit* edit) {
+		if (edit->level == active_level && !apply_blit_submap(edit->level, edit->layer, edit->x, edit->y, *edit->submap_level,
+			edit->submap_layer, edit->sx, edit->sy, edit->width, edit->height)) {
+			ERR("Couldn't blit layer %u of %s\n", edit->submap_layer, edit->submap_level->c_str());
+		}
+		delete edit->submap_level;
+	}
+
+	bool set_tile(uint32_t layer, uint32_t x, uint32_t y, uint16_t tile) {
+		if (Executor::thread_index() < 0) {
+			return active_level != nullptr && ::set_tile(active_level, layer, x, y, tile);
+		}
+		if (!can_edit(layer, tile)) return false;
+		return executor.defer(set_tile_wrapper, TileEdit{ active_level, layer, x, y, 1, 1, tile });
+	}
+
+	uint16_t get_tile(uint32_t layer, uint32_t x, uint32_t y) {
+		if (active_level == nullptr || layer >= active_level->layers.size()) return TILE_BLANK;
+		const TileGrid& tiles = active_level->layers[layer].tiles;
+		if (x >= tiles.width() || y >= tiles.height()) return TILE_BLANK;
+		return tiles(x, y);
+	}
+
+	bool fill_rect(uint32_t layer, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t tile) {
+		if (Executor::thread_index() < 0) {
+			return active_level != nullptr && fill_tiles(active_level, layer, x, y, width, height, tile);
+		}
+		if (!can_edit(layer, tile)) return false;
+		return executor.defer(fill_rect_wrapper, TileEdit{ active_level, layer, x, y, width, height, tile });
+	}
+
+	bool blit_submap(uint32_t layer, uint32_t x, uint32_t y, const std::string& submap_level, uint32_t submap_layer,
+		uint32_t sx, uint32_t sy, uint32_t width, uint32_t height) {
+		if (active_level == nullptr) return false;
+		if (Executor::thread_index() < 0) {
+			return apply_blit_submap(active_level, layer, x, y, submap_level, submap_layer, sx, sy, width, height);
+		}
+
+		// The submap is only looked up on the master, since the asset manager isn't safe to use from the workers
+		if (layer >= active_level->layers.size()) return false;
+		SubmapEdit edit = { active_level, layer, x, y, new std::string(submap_level), submap_layer, sx, sy, width, height };
+		if (!executor.defer(blit_submap_wrapper, edit)) {
+			delete edit.submap_level;
+			return false;
+		}
+		return true;
+	}
+
+#define SNAPSHOT_ENGINE SNAPSHOT_TAG('E', 'N', 'G', 'N')
+
+	// Payload layout: engine (every thread's RNG, level name), level state, controllers, entities, then the script type table
+	Result<> save_snapshot(const char* filename, bool compress) {
+		SnapshotWriter writer;
+		try {
+			writer.begin_section(SNAPSHOT_ENGINE);
+			const std::vector<Random>& rngs = get_all_rngs();
+			writer.write<uint32_t>((uint32_t) rngs.size());
+			for (const Random& rng : rngs) writer.write(rng);
+			writer.write_string(active_level_name.c_str(), (uint32_t) active_level_name.size());
+
+			save_level_state(writer, active_level);
+			save_controllers(writer);
+			entity_system->save(writer);
+
+			writer.finish();
+		}
+		catch (Error& err) {
+			// A script property the snapshot can't hold; nothing has been written to disk yet
+			return err;
+		}
+
+		return write_snapshot_file(filename, writer, compress);
+	}
+
+	// Everything is read and checked before anything is restored, so a bad snapshot leaves the world as it was
+	Result<> load_snapshot(const char* filename) {
+		auto file = read_snapshot_file(filename);
+		if (!file) {
+			return file.err;
+		}
+		const std::vector<uint8_t>& data = file.value;
+
+		SnapshotReader reader(data.data(), data.size());
+		std::vector<Random> rngs;
+		std::string levelname;
+		try {
+			reader.read_type_table(script_engine);
+
+			reader.expect_section(SNAPSHOT_ENGINE);
+			uint32_t n_rngs = reader.read<uint32_t>();
+			if (n_rngs == 0) {
+				return Error(Errors::SnapshotBadSection, "No RNG state");
+			}
+			rngs.reserve(n_rngs);
+			for (uint32_t i = 0; i < n_rngs; ++i) {
+				rngs.emplace_back(0u);
+				reader.read_bytes(&rngs.back(), sizeof(Random));
+			}
+
+			uint32_t len;
+			const char* str = reader.read_string(len);
+			levelname.assign(str, len);
+		}
+		catch (Error& err) {
+			return err;
+		}
+
+		// A snapshot of another level is checked against a fresh instance of it, which only replaces the active one on success
+		LevelInstance* level = active_level;
+		if (levelname != active_level_name || active_level == nullptr) {
+			if (levelname.empty()) {
+				return Errors::SnapshotMissingAsset;
+			}
+			auto maybe = load_level(levelname.c_str());
+			if (!maybe) {
+				return Error(Errors::SnapshotMissingAsset, levelname);
+			}
+			level = instantiate_level(maybe.value);
+		}
+
+		LevelSnapshot level_state;
+		std::vector<ControllerSnapshot> controllers;
+		EntitySystem::Staged staged;
+		Result<> res = read_level_state(reader, level, level_state);
+		if (res) res = read_controllers(reader, controllers);
+		if (res) res = entity_system->read_snapshot(reader, script_engine, staged);
+		if (!res) {
+			if (level != active_level) destroy_level_instance(level);
+			return res.err;
+		}
+
+		// Nothing below can fail
+		if (level != active_level) {
+			if (active_level != nullptr) destroy_level_instance(active_level);
+			active_level = level;
+			active_level_name = levelname;
+		}
+		restore_level_state(active_level, level_state);
+		restore_controllers(controllers);
+		entity_system->restore(staged);
+
+		// Workers that didn't exist when the snapshot was saved keep their own streams
+		std::vector<Random>& live_rngs = get_all_rngs();
+		for (size_t i = 0; i < rngs.size() && i < live_rngs.size(); ++i) {
+			live_rngs[i].restore(rngs[i]);
+		}
+
+		return Result<>::success;
+	}
+
+	void request_save_snapshot(const std::string& filename, bool compress) {
+		pending_save = filename;
+		pending_save_compressed = compress;
+	}
+
+	void request_load_snapshot(const std::string& filename) {
+		pending_load = filename;
+	}
 }
\ No newline at end of file
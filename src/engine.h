@@ -6,6 +6,7 @@
 #include "error.h"
 #include "entity.h"
 #include "level.h"
+#include "raycast.h"
 
 #include "angelscript.h"
 
@@ -39,5 +40,33 @@ namespace  Engine {
 
 	bool travel(const std::string& levelname);
 
+	/// Level coordinates of the top-left corner of the screen
+	Vector2 get_camera();
+	void set_camera(const Vector2& position);
+
+	/// Casts against the solid layers of the active level and every entity in the channel mask; the nearest hit wins.
+	// Safe to call from parallel entity updates.
+	CastHit raycast(const Vector2& origin, const Vector2& direction, float max_distance, uint64_t channel_mask, const Entity* ignore);
+	CastHit boxcast(const AABB& box, const Vector2& direction, float max_distance, uint64_t channel_mask, const Entity* ignore);
+
+	/// Tile editing on the active level's layers; see ::set_tile and friends in level.h.
+	// Submaps are layers of other level assets, named the same way as for travel.
+	// Edits from parallel entity updates are queued until the batch is over. Those only return false for a missing
+	// layer or tile; anything else that stops them (and a missing submap) is found out when they're applied.
+	bool set_tile(uint32_t layer, uint32_t x, uint32_t y, uint16_t tile);
+	uint16_t get_tile(uint32_t layer, uint32_t x, uint32_t y);
+	bool fill_rect(uint32_t layer, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t tile);
+	bool blit_submap(uint32_t layer, uint32_t x, uint32_t y, const std::string& submap_level, uint32_t submap_layer,
+		uint32_t sx, uint32_t sy, uint32_t width, uint32_t height);
+
+	/// Save states of the whole simulation.
+	// These act immediately, so they must only be called between updates.
+	Result<> save_snapshot(const char* filename, bool compress = true);
+	Result<> load_snapshot(const char* filename);
+
+	// Script-facing variants; carried out at the start of the next update
+	void request_save_snapshot(const std::string& filename, bool compress);
+	void request_load_snapshot(const std::string& filename);
+
 	asIScriptEngine* getScriptEngine();
 }
\ No newline at end of file
@@ -4,13 +4,60 @@
 #include "transform.h"
 #include "util.h"
 #include "level.h"
+#include "snapshot.h"
+#include "raycast.h"
+
+#include "scriptarray/scriptarray.h"
 
 #include <algorithm>
 #include <cmath>
+#include <mutex>
 
-static void detect_collisions(const Entity* a, const Entity* b);
+static bool detect_collisions(CollisionBuffer& buffer, const std::vector<SeparatingAxis>& axes, const Entity* a, const Entity* b);
+static void carry_axes(CollisionBuffer& buffer, const std::vector<SeparatingAxis>& axes, const Entity* a, const Entity* b);
+static void flush_collision_buffer(const void*, CollisionBuffer* buffer);
 static void move_to_contact_position(Entity* a, Entity* b);
 static void entity_level_collision(Entity* e, const LevelInstance* level);
+static void entity_level_sweep(Entity* e, const LevelInstance* level);
+
+// The script methods an entity calls, looked up once per component class and kept on the class as user data;
+// parsing the declarations costs far more than the rest of making an entity.
+struct EntityMethods {
+	asIScriptFunction* init;
+	asIScriptFunction* update;
+	asIScriptFunction* on_collision_enter;
+	asIScriptFunction* on_collision_stay;
+	asIScriptFunction* on_collision_exit;
+};
+
+static const asPWORD ENTITY_METHODS_USERDATA = 0x454E5449; // 'ENTI'
+static std::mutex entity_methods_mutex;
+
+static const EntityMethods* get_entity_methods(asITypeInfo* cls) {
+	auto methods = static_cast<const EntityMethods*>(cls->GetUserData(ENTITY_METHODS_USERDATA));
+	if (methods != nullptr) return methods;
+
+	// Entities are spawned from the workers too; only one of them fills in a class
+	std::lock_guard<std::mutex> lock(entity_methods_mutex);
+	methods = static_cast<const EntityMethods*>(cls->GetUserData(ENTITY_METHODS_USERDATA));
+	if (methods != nullptr) return methods;
+
+	EntityMethods* found = new EntityMethods;
+	found->init = cls->GetMethodByDecl("void init(Entity@)");
+	found->update = cls->GetMethodByDecl("void update(Entity@, float)");
+	found->on_collision_enter = cls->GetMethodByDecl(
+		"void on_collision_enter(Entity@, Entity@, const ColliderType@, const ColliderType@)");
+	found->on_collision_stay = cls->GetMethodByDecl(
+		"void on_collision_stay(Entity@, Entity@, const ColliderType@, const ColliderType@)");
+	found->on_collision_exit = cls->GetMethodByDecl(
+		"void on_collision_exit(Entity@, Entity@, const ColliderType@, const ColliderType@)");
+	cls->SetUserData(found, ENTITY_METHODS_USERDATA);
+	return found;
+}
+
+static void free_entity_methods(asITypeInfo* cls) {
+	delete static_cast<EntityMethods*>(cls->GetUserData(ENTITY_METHODS_USERDATA));
+}
 
 Entity::Entity(EntityId id, asIScriptObject* behavior) : id(id) {
 	assert(behavior != nullptr);
@@ -19,7 +66,11 @@ Entity::Entity(EntityId id, asIScriptObject* behavior) : id(id) {
 	rootclass = behavior->GetObjectType();
 	assert(rootclass != nullptr);
 
-	updatefunc = rootclass->GetMethodByDecl("void update(Entity@, float)");
+	const EntityMethods* methods = get_entity_methods(rootclass);
+	updatefunc = methods->update;
+	on_collision_enter = methods->on_collision_enter;
+	on_collision_stay = methods->on_collision_stay;
+	on_collision_exit = methods->on_collision_exit;
 
 	rootcomp->AddRef();
 }
@@ -30,7 +81,7 @@ Entity::~Entity() {
 
 // In order to keep errors as return values (not throwing exceptions), init must be separate;
 Result<> Entity::init(asIScriptEngine* engine) {
-	asIScriptFunction* func = rootclass->GetMethodByDecl("void init(Entity@)");
+	asIScriptFunction* func = get_entity_methods(rootclass)->init;
 	if (func == nullptr) {
 		return Errors::EntityMissingInit;
 	}
@@ -83,6 +134,38 @@ Result<> Entity::update(asIScriptEngine* engine, float delta_time) {
 	return Result<>::success;
 }
 
+// Called from the master thread only. The context is supplied by the caller so a whole batch of events can share it.
+Result<> Entity::collision_event(asIScriptContext* ctx, CollisionEvent ev, const Contact& contact) {
+	asIScriptFunction* func;
+	switch (ev) {
+	case CollisionEvent::Enter: func = on_collision_enter; break;
+	case CollisionEvent::Stay:  func = on_collision_stay; break;
+	case CollisionEvent::Exit:  func = on_collision_exit; break;
+	default: func = nullptr; break;
+	}
+	if (func == nullptr) return Result<>::success;
+
+	ctx->Prepare(func);
+	ctx->SetObject(rootcomp);
+	ctx->SetArgObject(0, this);
+	ctx->SetArgObject(1, contact.target);
+	ctx->SetArgObject(2, const_cast<ColliderType*>(contact.actor_type));
+	ctx->SetArgObject(3, const_cast<ColliderType*>(contact.target_type));
+
+	int r = ctx->Execute();
+	Result<> ret = Result<>::success;
+	if (r == asEXECUTION_FINISHED) {
+	}
+	else if (r == asEXECUTION_EXCEPTION) {
+		ret = Error(Errors::EntityCollisionException, GetExceptionDetails(ctx));
+	}
+	else {
+		ret = Errors::EntityCollisionUnknownFailure;
+	}
+	ctx->Unprepare();
+	return ret;
+}
+
 void Entity::render(GPU_Target* screen) const {
 	const Frame* frame = animation->frames[anim_frame].frame;
 	Vector2 display = frame->display;
@@ -100,10 +183,132 @@ void Entity::render(GPU_Target* screen) const {
 	render_colliders(screen, tx, frame->colliders);
 }
 
-EntitySystem::EntitySystem() : allocator(), entities() {
+EntitySystem::EntitySystem() : allocator(), entities(), collision_buffers(executor.thread_count()) {
 	next_id = 1000;
 }
 
+void EntitySystem::clear() {
+	for (Entity* e : entities) allocator.free(e);
+	for (Entity* e : spawned) allocator.free(e);
+	entities.clear();
+	spawned.clear();
+	destroyed.clear();
+	by_id.clear();
+
+	contacts.clear();
+	last_contacts.clear();
+	separating_axes.clear();
+	pair_cache.clear();
+	index.clear();
+	index.build();
+	ordered = false;
+}
+
+// Union of the solidity hitbox and every collider of the current frame, in world space
+// Hitboxes thinner than this still get substepped as if they were this thick
+#define CCD_MIN_EXTENT 2.f
+// Upper bound on substeps per hitbox pair, spread over the part of the update where their swept bounds overlap
+#define CCD_MAX_SUBSTEPS 16
+// Times a fast mover may hit a tile and slide along it in one update
+#define CCD_MAX_SLIDES 3
+// Gap left between a fast mover and the tile it was stopped at
+#define CCD_SKIN 0.01f
+
+// Smallest half-extent over the entity's hitboxes.
+// Moving further than this in one update can carry a hitbox clean past something, so it needs continuous checks.
+static float min_half_extent(const Entity* e) {
+	if (e->animation == nullptr) return INFINITY;
+
+	float extent = INFINITY;
+	auto visit = [e, &extent](const Hitbox& hitbox) {
+		AABB box = hitbox_aabb(hitbox);
+		if (box.left > box.right) return;
+		float w = 0.5f * (box.right - box.left) * fabsf(e->scale.x);
+		float h = 0.5f * (box.bottom - box.top) * fabsf(e->scale.y);
+		extent = fminf(extent, fmaxf(fminf(w, h), CCD_MIN_EXTENT));
+	};
+
+	visit(e->animation->solidity.hitbox);
+	for (const Collider& coll : e->frame->colliders) {
+		visit(coll.hitbox);
+	}
+	return extent;
+}
+
+// Only valid once the entity's collider cache is current
+static inline bool is_fast_mover(const Entity* e) {
+	return distance(e->last_pos, e->position) > e->world.min_half_extent;
+}
+
+// Transforms the solidity hitbox and current frame's colliders into the world once for this update
+static void update_collider_cache(const void*, Entity* e) {
+	ColliderCache& cache = e->world;
+	cache.shapes.clear();
+	cache.vertices.clear();
+
+	if (e->animation == nullptr) {
+		cache.shapes.resize(1);
+		cache.shapes[0].type = Hitbox::NONE;
+		cache.shapes[0].aabb = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+		cache.bounds = cache.shapes[0].aabb;
+		cache.has_oneway = false;
+		cache.n_colliders = 0;
+		cache.min_half_extent = INFINITY;
+		cache.solid = e->solid;
+		cache.channel_id = e->channel_id;
+		return;
+	}
+
+	const Transform tx = e->get_transform();
+	const auto& solidity = e->animation->solidity;
+	const auto& colliders = e->frame->colliders;
+
+	cache.shapes.resize(1 + colliders.size());
+	transform_hitbox(solidity.hitbox, solidity.fixed ? Transform::scal_trans(e->scale, e->position) : tx,
+		cache.shapes, cache.vertices, 0);
+	cache.bounds = cache.shapes[0].aabb;
+
+	for (size_t i = 0; i < colliders.size(); ++i) {
+		transform_hitbox(colliders[i].hitbox, tx, cache.shapes, cache.vertices, 1 + i);
+		cache.bounds |= cache.shapes[1 + i].aabb;
+	}
+
+	cache.has_oneway = std::any_of(cache.shapes.begin(), cache.shapes.end(),
+		[](const WorldHitbox& shape) { return shape.type == Hitbox::ONEWAY; });
+	cache.n_colliders = (uint32_t) colliders.size();
+	cache.min_half_extent = min_half_extent(e);
+	cache.solid = e->solid;
+	cache.channel_id = e->channel_id;
+}
+
+// Fast movers are indexed by the whole area they swept this update, so the broadphase pairs them
+// with everything they passed through.
+static AABB entity_bounds(const Entity* e) {
+	if (e->world.bounds.left > e->world.bounds.right) { // no hitboxes at all
+		return { e->position.x, e->position.x, e->position.y, e->position.y };
+	}
+
+	AABB box = e->world.bounds;
+	if (is_fast_mover(e)) {
+		box |= box + (e->last_pos - e->position);
+	}
+	return box;
+}
+
+void EntitySystem::rebuild_index() {
+	executor.set_batch_job(&update_collider_cache, false);
+	for (Entity* e : entities) {
+		executor.submit(e);
+	}
+	executor.run_batch();
+
+	index.clear();
+	for (Entity* e : entities) {
+		index.insert(e, entity_bounds(e));
+	}
+	index.build();
+}
+
 EntitySystem::~EntitySystem() {
 	// The allocator should auto-delete entities.
 
@@ -123,7 +328,8 @@ Result<Entity*> EntitySystem::spawn(asIScriptObject* rootcomp) {
 	auto res = entity->init(engine);
 
 	if (res) {
-		entities.push_back(entity);
+		spawned.push_back(entity);
+		by_id.emplace(entity->id, entity);
 
 		return entity;
 	}
@@ -135,28 +341,286 @@ Result<Entity*> EntitySystem::spawn(asIScriptObject* rootcomp) {
 }
 
 Result<> EntitySystem::destroy(Entity* ent) {
-	auto ind = std::find(entities.begin(), entities.end(), ent);
-	if (ind != entities.end()) {
-		allocator.free(ent);
-		entities.erase(ind);
-		return Result<>::success;
-	}
-	else {
+	if (ent == nullptr || ent->system != this || ent->pending_destroy) {
 		return Errors::EntityNotFound;
 	}
+	ent->pending_destroy = true;
+	destroyed.push_back(ent);
+	return Result<>::success;
 }
 
 Result<> EntitySystem::destroy(EntityId id) {
-	auto ind = std::find_if(entities.begin(), entities.end(),
-		[id](Entity* e) -> bool { return e->id == id; });
-	if (ind != entities.end()) {
-		allocator.free(*ind);
-		entities.erase(ind);
-		return nullptr;
-	}
-	else {
+	auto iter = by_id.find(id);
+	if (iter == by_id.end()) {
 		return Errors::EntityNotFound;
 	}
+	return destroy(iter->second);
+}
+
+void EntitySystem::compact() {
+	EIter out = entities.begin();
+	for (Entity* e : entities) {
+		if (e->pending_destroy) {
+			by_id.erase(e->id);
+			allocator.free(e);
+		}
+		else {
+			*out++ = e;
+		}
+	}
+	entities.erase(out, entities.end());
+}
+
+void EntitySystem::apply_changes() {
+	if (!spawned.empty()) {
+		entities.insert(entities.end(), spawned.begin(), spawned.end());
+		spawned.clear();
+
+		// Removal keeps the relative order, so only new entities can break the sort
+		ordered = false;
+	}
+
+	if (!destroyed.empty()) {
+		// Forget contacts involving entities that are about to disappear so that no events reference them
+		last_contacts.erase(
+			std::remove_if(last_contacts.begin(), last_contacts.end(),
+				[](const Contact& c) -> bool { return c.actor->pending_destroy || c.target->pending_destroy; }),
+			last_contacts.end());
+
+		// Entities spawned and destroyed in the same frame were appended above, so everything is in the main list
+		compact();
+		destroyed.clear();
+	}
+}
+
+// Looks up the frame from the animation's timeline, so large time steps and seeks cost the same as small ones
+static __forceinline void seek_animation(Entity* e, float time) {
+	const Animation* anim = e->animation;
+	e->anim_time = anim->wrap(time);
+	uint32_t index = anim->frame_at(e->anim_time);
+	if (index != e->anim_frame) {
+		e->anim_frame = index;
+		e->frame = anim->frames[index].frame;
+	}
+}
+
+// Fixed-size portion of an entity in a snapshot. Written and read as one contiguous array.
+struct EntitySnapshot {
+	EntityId id;
+	uint32_t type; // root component type (index into the snapshot's type table)
+
+	Point2 position;
+	Vector2 velocity;
+	Vector2 acceleration;
+	Point2 last_pos;
+	AABB vel_range;
+	Vector2 ground_normal;
+	uint8_t level_contacts;
+
+	float rotation;
+	Vector2 scale;
+
+	int32_t sprite;    // index into the section's sprite table, -1 if none
+	int32_t animation;
+	float anim_time;
+	int32_t z_order;
+
+	uint64_t channel_mask;
+	uint8_t channel_id;
+
+	enum Flags : uint8_t {
+		PHYSICS   = 1 << 0,
+		COLLISION = 1 << 1,
+		ANIMATION = 1 << 2,
+		RENDERING = 1 << 3,
+		SOLID     = 1 << 4
+	};
+	uint8_t flags;
+};
+
+#define SNAPSHOT_ENTITIES SNAPSHOT_TAG('E', 'N', 'T', 'S')
+
+void EntitySystem::save(SnapshotWriter& writer) const {
+	writer.begin_section(SNAPSHOT_ENTITIES);
+	writer.write<uint32_t>(next_id);
+
+	// Entities that already asked to be destroyed are left out
+	std::vector<const Entity*> live;
+	live.reserve(entities.size() + spawned.size());
+	for (const Entity* e : entities) if (!e->pending_destroy) live.push_back(e);
+	for (const Entity* e : spawned) if (!e->pending_destroy) live.push_back(e);
+
+	// Sprites are stored once by filename and referred to by index
+	std::unordered_map<const Sprite*, int32_t> sprite_indices;
+	std::vector<const char*> sprite_names;
+	for (const Entity* e : live) {
+		if (e->sprite != nullptr && sprite_indices.find(e->sprite) == sprite_indices.end()) {
+			sprite_indices.emplace(e->sprite, (int32_t) sprite_names.size());
+			sprite_names.push_back(AssetManager::filename_of(e->sprite));
+		}
+	}
+	writer.write<uint32_t>((uint32_t) sprite_names.size());
+	for (const char* name : sprite_names) {
+		writer.write_string(name);
+	}
+
+	std::vector<EntitySnapshot> records(live.size());
+	for (size_t i = 0; i < live.size(); ++i) {
+		const Entity* e = live[i];
+		EntitySnapshot& rec = records[i];
+		memset(&rec, 0, sizeof(rec)); // keep padding deterministic for the checksum
+
+		rec.id = e->id;
+		rec.type = writer.type_index(e->rootclass);
+		rec.position = e->position;
+		rec.velocity = e->velocity;
+		rec.acceleration = e->acceleration;
+		rec.last_pos = e->last_pos;
+		rec.vel_range = e->vel_range;
+		rec.ground_normal = e->ground_normal;
+		rec.level_contacts = e->level_contacts;
+		rec.rotation = e->rotation;
+		rec.scale = e->scale;
+		rec.sprite = e->sprite == nullptr ? -1 : sprite_indices[e->sprite];
+		rec.animation = e->animation == nullptr ? -1 : (int32_t) (e->animation - e->sprite->animations.data());
+		rec.anim_time = e->anim_time;
+		rec.z_order = e->z_order;
+		rec.channel_mask = e->channel_mask;
+		rec.channel_id = e->channel_id;
+		rec.flags =
+			(e->physics_enabled   ? EntitySnapshot::PHYSICS   : 0) |
+			(e->collision_enabled ? EntitySnapshot::COLLISION : 0) |
+			(e->animation_enabled ? EntitySnapshot::ANIMATION : 0) |
+			(e->rendering_enabled ? EntitySnapshot::RENDERING : 0) |
+			(e->solid             ? EntitySnapshot::SOLID     : 0);
+	}
+	writer.write<uint32_t>((uint32_t) records.size());
+	writer.write_bytes(records.data(), records.size() * sizeof(EntitySnapshot));
+
+	// Script components last, so that entity handles can be resolved no matter the order
+	for (const Entity* e : live) {
+		writer.write_script_object(e->rootcomp);
+	}
+}
+
+Result<> EntitySystem::read_snapshot(SnapshotReader& reader, asIScriptEngine* engine, Staged& out) {
+	out.entities.clear();
+	try {
+		reader.expect_section(SNAPSHOT_ENTITIES);
+		EntityId saved_next_id = reader.read<uint32_t>();
+
+		// Load everything that can fail before making any entities
+		uint32_t n_sprites = reader.read<uint32_t>();
+		std::vector<const Sprite*> sprites(n_sprites);
+		for (uint32_t i = 0; i < n_sprites; ++i) {
+			uint32_t len;
+			const char* str = reader.read_string(len);
+			std::string name(str, len);
+			auto maybesprite = load_sprite(name.c_str());
+			if (!maybesprite) {
+				return Error(Errors::SnapshotMissingAsset, name);
+			}
+			sprites[i] = maybesprite.value;
+		}
+
+		uint32_t n_entities = reader.read<uint32_t>();
+		std::vector<EntitySnapshot> records(n_entities);
+		reader.read_bytes(records.data(), n_entities * sizeof(EntitySnapshot));
+
+		for (const EntitySnapshot& rec : records) {
+			if (rec.sprite >= (int32_t) n_sprites ||
+				(rec.sprite >= 0 && rec.animation >= (int32_t) sprites[rec.sprite]->animations.size())) {
+				return Error(Errors::SnapshotMissingAsset, "Animation index out of range");
+			}
+			reader.type_at(rec.type);
+		}
+
+		out.next_id = saved_next_id;
+		out.entities.reserve(n_entities);
+		reader.entity_lookup.clear();
+
+		for (const EntitySnapshot& rec : records) {
+			// Default construct the component; its properties are overwritten below
+			asIScriptObject* comp = static_cast<asIScriptObject*>(engine->CreateScriptObject(reader.type_at(rec.type)));
+			if (comp == nullptr) {
+				discard(out);
+				return Error(Errors::SnapshotTypeMismatch, "Entity component has no default constructor");
+			}
+
+			Entity* e = allocator.alloc();
+			if (e == nullptr) {
+				comp->Release();
+				discard(out);
+				return Errors::BadAlloc;
+			}
+			new(e) Entity(rec.id, comp);
+			comp->Release(); // the entity holds its own reference
+			e->system = this;
+
+			e->position = rec.position;
+			e->velocity = rec.velocity;
+			e->acceleration = rec.acceleration;
+			e->last_pos = rec.last_pos;
+			e->vel_range = rec.vel_range;
+			e->ground_normal = rec.ground_normal;
+			e->level_contacts = rec.level_contacts;
+			e->rotation = rec.rotation;
+			e->scale = rec.scale;
+			if (rec.sprite >= 0) {
+				e->sprite = sprites[rec.sprite];
+				e->animation = &e->sprite->animations[rec.animation < 0 ? 0 : rec.animation];
+				e->anim_time = e->animation->wrap(rec.anim_time);
+				e->anim_frame = e->animation->frame_at(e->anim_time);
+				e->frame = e->animation->frames[e->anim_frame].frame;
+			}
+			e->z_order = rec.z_order;
+			e->channel_mask = rec.channel_mask;
+			e->channel_id = rec.channel_id;
+			e->physics_enabled   = (rec.flags & EntitySnapshot::PHYSICS) != 0;
+			e->collision_enabled = (rec.flags & EntitySnapshot::COLLISION) != 0;
+			e->animation_enabled = (rec.flags & EntitySnapshot::ANIMATION) != 0;
+			e->rendering_enabled = (rec.flags & EntitySnapshot::RENDERING) != 0;
+			e->solid             = (rec.flags & EntitySnapshot::SOLID) != 0;
+
+			out.entities.push_back(e);
+			reader.entity_lookup.emplace(e->id, e);
+		}
+
+		for (Entity* e : out.entities) {
+			reader.read_script_object(e->rootcomp);
+		}
+	}
+	catch (Error& err) {
+		discard(out);
+		return err;
+	}
+
+	return Result<>::success;
+}
+
+void EntitySystem::level_anchors(std::vector<AABB>& out) const {
+	for (uint32_t i = 0; i < index.size(); ++i) {
+		const SpatialHash::Item& item = index[i];
+		const Entity* e = item.entity;
+		// The same ones entity_level_collision doesn't skip
+		if (e->pending_destroy || !e->solid || e->animation == nullptr) continue;
+		if (e->animation->solidity.hitbox.type == Hitbox::NONE) continue;
+		out.push_back(item.box);
+	}
+}
+
+void EntitySystem::restore(Staged& staged) {
+	clear();
+	next_id = staged.next_id;
+	entities.swap(staged.entities);
+	for (Entity* e : entities) by_id.emplace(e->id, e);
+
+	rebuild_index();
+}
+
+void EntitySystem::discard(Staged& staged) {
+	for (Entity* e : staged.entities) allocator.free(e);
+	staged.entities.clear();
 }
 
 struct EntityUpdate_1 {
@@ -168,16 +632,8 @@ static void entity_update_1(const EntityUpdate_1* shared, Entity* e) {
 	e->last_pos = e->position;
 
 	// Animations
-	if (e->animation_enabled && e->animation->frames[e->anim_frame].delay > 0.f) {
-		const auto& frames = e->animation->frames;
-		e->frame_time += shared->dt;
-		bool changed = false;
-		while (e->frame_time > frames[e->anim_frame].delay) {
-			e->frame_time -= frames[e->anim_frame].delay;
-			e->anim_frame = (e->anim_frame + 1) % frames.size();
-			changed = true;
-		}
-		if (changed) e->frame = frames[e->anim_frame].frame;
+	if (e->animation_enabled && e->animation != nullptr) {
+		seek_animation(e, e->anim_time + shared->dt);
 	}
 
 	// Update via the script component
@@ -203,25 +659,107 @@ static void entity_update_1(const EntityUpdate_1* shared, Entity* e) {
 		e->position += shared->dt * e->velocity - error;
 	}
 
+	// Stop fast movers at the first tile in their path
+	entity_level_sweep(e, shared->level);
+
 	// Level overlap
 	entity_level_collision(e, shared->level);
 }
 
+static inline PairRecord make_pair_record(const Entity* a, const Entity* b) {
+	PairRecord record;
+	record.offset = b->position - a->position;
+	record.rotation_a = a->rotation;
+	record.rotation_b = b->rotation;
+	record.scale_a = a->scale;
+	record.scale_b = b->scale;
+	record.animation_a = a->animation;
+	record.animation_b = b->animation;
+	record.frame_a = a->frame;
+	record.frame_b = b->frame;
+	record.solid_a = a->solid;
+	record.solid_b = b->solid;
+	record.collision_a = a->collision_enabled;
+	record.collision_b = b->collision_enabled;
+	record.solid_hit = false;
+	record.seen = 0;
+	return record;
+}
+
+// True if the pair would test exactly the same as when last was recorded
+static inline bool same_pair_state(const PairRecord& last, const PairRecord& cur) {
+	return
+		last.offset.x == cur.offset.x && last.offset.y == cur.offset.y &&
+		last.rotation_a == cur.rotation_a && last.rotation_b == cur.rotation_b &&
+		last.scale_a.x == cur.scale_a.x && last.scale_a.y == cur.scale_a.y &&
+		last.scale_b.x == cur.scale_b.x && last.scale_b.y == cur.scale_b.y &&
+		last.animation_a == cur.animation_a && last.animation_b == cur.animation_b &&
+		last.frame_a == cur.frame_a && last.frame_b == cur.frame_b &&
+		last.solid_a == cur.solid_a && last.solid_b == cur.solid_b &&
+		last.collision_a == cur.collision_a && last.collision_b == cur.collision_b;
+}
+
+// Copies the contacts a pair produced last update (either entity can be the actor)
+static void reuse_contacts(std::vector<Contact>& out, const std::vector<Contact>& last, const Entity* a, const Entity* b) {
+	const uint64_t pairs[2] = {
+		(static_cast<uint64_t>(a->id) << 32) | b->id,
+		(static_cast<uint64_t>(b->id) << 32) | a->id
+	};
+	for (uint64_t pair : pairs) {
+		auto it = std::lower_bound(last.begin(), last.end(), pair,
+			[](const Contact& contact, uint64_t p) { return contact.pair < p; });
+		for (; it != last.end() && it->pair == pair; ++it) {
+			out.push_back(*it);
+		}
+	}
+}
+
+struct EntityUpdate_2_Shared {
+	CollisionBuffer* collision_buffers;
+	const std::vector<SeparatingAxis>* separating_axes;
+	const std::unordered_map<uint64_t, PairRecord>* pair_cache;
+	const std::vector<Contact>* last_contacts;
+};
 struct EntityUpdate_2 {
 	const Entity* a;
 	const Entity* b;
 };
-static void entity_update_2(const void* shr, EntityUpdate_2* data) {
-	detect_collisions(data->a, data->b);
+static void entity_update_2(const EntityUpdate_2_Shared* shared, EntityUpdate_2* data) {
+	// Each worker only ever touches its own buffer, so no locking is needed
+	CollisionBuffer& buffer = shared->collision_buffers[Executor::thread_index()];
+
+	// Pairs are kept in id order so they find their records from earlier updates
+	const Entity* a = data->a;
+	const Entity* b = data->b;
+	if (a->id > b->id) std::swap(a, b);
+
+	uint64_t key = (static_cast<uint64_t>(a->id) << 32) | b->id;
+	PairRecord record = make_pair_record(a, b);
+
+	// Entities resting on each other or riding along together haven't moved relative to each other,
+	// so last update's result still holds. One-ways are the exception since they care about motion.
+	auto last = shared->pair_cache->find(key);
+	if (last != shared->pair_cache->end() && !last->second.solid_hit &&
+		!a->world.has_oneway && !b->world.has_oneway && same_pair_state(last->second, record)) {
+		reuse_contacts(buffer.contacts, *shared->last_contacts, a, b);
+		carry_axes(buffer, *shared->separating_axes, a, b);
+	}
+	else {
+		record.solid_hit = detect_collisions(buffer, *shared->separating_axes, a, b);
+	}
+	buffer.pairs.push_back({ key, record });
 }
 
 // High level algorithm:
 // Run update scripts, which are allowed to spawn entities
 // Move entities and advance animations in parallel
-// Collision detection in parallel -> generating events in shared buffer
+// Apply queued spawns/destroys as one batch
+// Collision detection in parallel -> generating contacts and queued box/circle tests in per-thread buffers
+//   (pairs that haven't moved relative to each other since last update reuse its contacts instead)
+// Rewind entities that hit something part way through the update to their earliest hit, and separate those pairs
+// Run the queued tests with the SIMD kernels, one buffer per worker
 // Process events in main thread (cross-entity interactions are not threadsafe)
 void EntitySystem::update(asIScriptEngine* engine, LevelInstance* level, const float dt) {
-
 	// 'Dumb' update step- each entity behaves as if it's the only thing in existence [Parallelizable]
 	executor.set_batch_job(&entity_update_1, EntityUpdate_1{engine, level, dt}, false);
 
@@ -233,27 +771,116 @@ void EntitySystem::update(asIScriptEngine* engine, LevelInstance* level, const f
 
 	executor.run_deferred();
 
+	// Spawns and destroys requested by scripts (this frame or since the last update) all land here
+	apply_changes();
+	rebuild_index();
+
 	// COLLISION DETECTION O_O
-	executor.set_batch_job(entity_update_2);
-	EIter end = entities.end();
-	for (EIter aiter = entities.begin(); aiter != end; ++aiter) {
-		Entity* a = *aiter;
+	for (auto& buffer : collision_buffers) {
+		buffer.clear();
+	}
+	executor.set_batch_job(&entity_update_2, EntityUpdate_2_Shared{
+		collision_buffers.data(), &separating_axes, &pair_cache, &last_contacts
+	});
+
+	// Broadphase: only pairs whose bounds overlap are handed to the narrow phase
+	for (uint32_t i = 0; i < index.size(); ++i) {
+		const SpatialHash::Item& item = index[i];
+		if (item.entity->frame == nullptr) continue;
+
+		index.query(item.box, [i, &item](uint32_t j, const SpatialHash::Item& other) {
+			if (j > i && other.entity->frame != nullptr) {
+				executor.submit(EntityUpdate_2{ item.entity, other.entity });
+			}
+		});
+	}
 
-		for (EIter biter = aiter + 1; biter != end; ++biter) {
-			Entity* b = *biter;
+	executor.run_batch();
+	resolve_impacts();
+	executor.run_deferred();
 
-			executor.submit(EntityUpdate_2{a, b});
+	update_pair_cache();
+
+	executor.set_batch_job(&flush_collision_buffer, false);
+	for (auto& buffer : collision_buffers) {
+		if (buffer.boxes.size() > 0 || buffer.circles.size() > 0) {
+			executor.submit(&buffer);
 		}
 	}
-
 	executor.run_batch();
-	executor.run_deferred();
+
+	dispatch_collision_events(engine);
+}
+
+// Replaces last update's separating axes and pair records with the ones the workers just produced.
+// Pairs the broadphase didn't produce this time are forgotten.
+void EntitySystem::update_pair_cache() {
+	separating_axes.clear();
+	for (const auto& buffer : collision_buffers) {
+		separating_axes.insert(separating_axes.end(), buffer.axes.begin(), buffer.axes.end());
+	}
+	std::sort(separating_axes.begin(), separating_axes.end(),
+		[](const SeparatingAxis& x, const SeparatingAxis& y) { return x.key < y.key; });
+
+	++pair_update;
+	for (const auto& buffer : collision_buffers) {
+		for (const auto& entry : buffer.pairs) {
+			PairRecord& record = pair_cache[entry.first];
+			record = entry.second;
+			record.seen = pair_update;
+		}
+	}
+	for (auto it = pair_cache.begin(); it != pair_cache.end();) {
+		if (it->second.seen != pair_update) it = pair_cache.erase(it);
+		else ++it;
+	}
+}
+
+// Merges the per-thread contact buffers, compares them with last frame's contacts,
+// and fires enter/stay/exit callbacks in one batch on the master thread.
+void EntitySystem::dispatch_collision_events(asIScriptEngine* engine) {
+	contacts.clear();
+	for (const auto& buffer : collision_buffers) {
+		contacts.insert(contacts.end(), buffer.contacts.begin(), buffer.contacts.end());
+	}
+	std::sort(contacts.begin(), contacts.end());
+
+	if (contacts.empty() && last_contacts.empty()) return;
+
+	asIScriptContext* ctx = engine->RequestContext();
+
+	auto fire = [ctx](CollisionEvent ev, const Contact& contact) {
+		auto res = contact.actor->collision_event(ctx, ev, contact);
+		if (!res) {
+			ERR("%s\n", std::to_string(res.err).c_str());
+		}
+	};
+
+	// Both lists are sorted, so a single merge pass classifies every contact
+	auto cur = contacts.begin(), cur_end = contacts.end();
+	auto last = last_contacts.begin(), last_end = last_contacts.end();
+	while (cur != cur_end || last != last_end) {
+		if (last == last_end || (cur != cur_end && *cur < *last)) {
+			fire(CollisionEvent::Enter, *cur++);
+		}
+		else if (cur == cur_end || *last < *cur) {
+			fire(CollisionEvent::Exit, *last++);
+		}
+		else {
+			fire(CollisionEvent::Stay, *cur++);
+			++last;
+		}
+	}
+
+	engine->ReturnContext(ctx);
+
+	std::swap(contacts, last_contacts);
 }
 
 std::pair<EntitySystem::EIter, EntitySystem::EIter> EntitySystem::render_iter() {
-	// Sort the entities for display purposes
+	// Sort the entities for display purposes. Stable, so entities on the same layer keep their draw order from frame to frame.
 	if (!ordered) {
-		std::sort(entities.begin(), entities.end(),
+		std::stable_sort(entities.begin(), entities.end(),
 			[](Entity* a, Entity* b) -> bool {
 				if (a->rendering_enabled == b->rendering_enabled) {
 					return a->z_order < b->z_order;
@@ -340,12 +967,20 @@ static void move_to_contact_position(Entity* a, Entity* b) {
 			b->position.y += overlap.y * (bDis.y / relDis.y);
 		}
 	}
-	else if (hitA.type == Hitbox::CIRCLE && hitB.type == Hitbox::CIRCLE &&
-		float_eq(a->scale.x, a->scale.y) && float_eq(b->scale.x, b->scale.y)) {
-		
-	}
-	else { // The general case is... insane
-		// TODO
+	else {
+		// Push them apart the shortest way out, each in proportion to how far it moved
+		Transform aSolid = a->animation->solidity.fixed ? Transform::scal_trans(a->scale, a->position) : aTx;
+		Transform bSolid = b->animation->solidity.fixed ? Transform::scal_trans(b->scale, b->position) : bTx;
+
+		Vector2 normal;
+		float depth;
+		if (!hitboxes_penetration(hitA, aSolid, hitB, bSolid, normal, depth)) return;
+
+		float aMoved = aDis.magnitude();
+		float bMoved = bDis.magnitude();
+		float aShare = aMoved + bMoved > 0.f ? aMoved / (aMoved + bMoved) : 0.5f;
+		a->position += normal * (depth * aShare);
+		b->position -= normal * (depth * (1.f - aShare));
 	}
 }
 
@@ -357,61 +992,321 @@ static void move_to_contact_wrapper(EntityPair* d) {
 	move_to_contact_position(d->a, d->b);
 }
 
-static void detect_collisions(const Entity* a, const Entity* b) {
-	Transform aTx = a->get_transform();
+static inline Contact make_contact(const Entity* actor, const Collider& actColl, const Entity* target, const Collider& targColl) {
+	return Contact{
+		const_cast<Entity*>(actor), const_cast<Entity*>(target),
+		actColl.type, targColl.type,
+		(static_cast<uint64_t>(actor->id) << 32) | target->id,
+		(static_cast<uint32_t>(actColl.type->id) << 16) | static_cast<uint16_t>(targColl.type->id)
+	};
+}
+
+// Rewinds every entity that hit something part way through the update to the earliest of its hits, then resolves those pairs as usual.
+// Each entity is rewound once however many pairs it's in, so the rewinds don't compound.
+void EntitySystem::resolve_impacts() {
+	struct Rewind {
+		Entity* e;
+		float t;
+	};
+	thread_local std::vector<TimeOfImpact> impacts;
+	thread_local std::vector<Rewind> rewinds;
+	impacts.clear();
+	rewinds.clear();
+	for (const auto& buffer : collision_buffers) {
+		impacts.insert(impacts.end(), buffer.impacts.begin(), buffer.impacts.end());
+	}
+	if (impacts.empty()) return;
+
+	for (const TimeOfImpact& impact : impacts) {
+		rewinds.push_back({ impact.a, impact.t });
+		rewinds.push_back({ impact.b, impact.t });
+	}
+	std::sort(rewinds.begin(), rewinds.end(), [](const Rewind& x, const Rewind& y) {
+		return x.e < y.e || (x.e == y.e && x.t < y.t);
+	});
+	for (size_t i = 0; i < rewinds.size(); ++i) {
+		if (i > 0 && rewinds[i].e == rewinds[i - 1].e) continue; // only the earliest
+		Entity* e = rewinds[i].e;
+		e->position = lerp(e->last_pos, e->position, rewinds[i].t);
+	}
+
+	for (const TimeOfImpact& impact : impacts) {
+		move_to_contact_position(impact.a, impact.b);
+	}
+}
+
+// Transform at the start of the update (rotation and scale are not interpolated, so later ones are just translated).
+// Fixed hitboxes (see Animation::Solidity) aren't rotated at all.
+static inline Transform start_transform(const Entity* e, bool fixed = false) {
+	return fixed ? Transform::scal_trans(e->scale, e->last_pos) : Transform::scal_rot_trans(e->scale, e->rotation, e->last_pos);
+}
+
+// Fractions of the update during which two world bounds overlap, given their placements at the end of it and how far
+// each moved to get there. Returns false if they never do.
+static bool swept_overlap(const AABB& a, Vector2 aDis, const AABB& b, Vector2 bDis, float& t0, float& t1) {
+	// With b held still, a starts back along the relative displacement
+	const Vector2 rel = aDis - bDis;
+	const AABB start = a - rel;
+	t0 = 0.f;
+	t1 = 1.f;
+
+	auto slab = [&t0, &t1](float amin, float amax, float bmin, float bmax, float v) -> bool {
+		if (v == 0.f) return amax >= bmin && amin <= bmax;
+		float enter = (bmin - amax) / v;
+		float exit = (bmax - amin) / v;
+		if (enter > exit) std::swap(enter, exit);
+		t0 = fmaxf(t0, enter);
+		t1 = fminf(t1, exit);
+		return t0 <= t1;
+	};
+	return slab(start.left, start.right, b.left, b.right, rel.x) &&
+		slab(start.top, start.bottom, b.top, b.bottom, rel.y);
+}
+
+void CollisionBuffer::clear() {
+	contacts.clear();
+	axes.clear();
+	pairs.clear();
+	impacts.clear();
+	boxes.clear();
+	box_tests.clear();
+	circles.clear();
+	circle_tests.clear();
+}
+
+// Queues the test for the batched kernels if both colliders are the same simple shape.
+// Returns false if the pair needs the general world_hitboxes_overlap instead.
+static bool queue_collision(CollisionBuffer& buffer, const QueuedCollision& test, const WorldHitbox& worldA, const WorldHitbox& worldB) {
+	// Cached boxes are only still boxes if they stayed axis-aligned, and likewise for uniformly scaled circles
+	if (worldA.type == Hitbox::BOX && worldB.type == Hitbox::BOX) {
+		const AABB& boxA = worldA.box;
+		const AABB& boxB = worldB.box;
+		buffer.boxes.push(boxA.left, boxA.right, boxA.top, boxA.bottom, boxB.left, boxB.right, boxB.top, boxB.bottom);
+		buffer.box_tests.push_back(test);
+		return true;
+	}
+	if (worldA.type == Hitbox::CIRCLE && worldB.type == Hitbox::CIRCLE) {
+		const Circle& circA = worldA.circle;
+		const Circle& circB = worldB.circle;
+		buffer.circles.push(circA.center.x, circA.center.y, circA.radius, circB.center.x, circB.center.y, circB.radius);
+		buffer.circle_tests.push_back(test);
+		return true;
+	}
+	return false;
+}
+
+static inline void add_contacts(std::vector<Contact>& contacts, const QueuedCollision& test) {
+	// Events are reported to whichever side is doing the acting
+	if (test.fwd) contacts.push_back(make_contact(test.a, *test.collA, test.b, *test.collB));
+	if (test.bkwd) contacts.push_back(make_contact(test.b, *test.collB, test.a, *test.collA));
+}
+
+static void flush_collision_buffer(const void*, CollisionBuffer* buffer) {
+	buffer->hits.resize(SDL_max(buffer->boxes.size(), buffer->circles.size()));
+
+	size_t n_hits = overlap_boxes(buffer->boxes, buffer->hits.data());
+	for (size_t i = 0; i < n_hits; ++i) {
+		add_contacts(buffer->contacts, buffer->box_tests[buffer->hits[i]]);
+	}
+
+	n_hits = overlap_circles(buffer->circles, buffer->hits.data());
+	for (size_t i = 0; i < n_hits; ++i) {
+		add_contacts(buffer->contacts, buffer->circle_tests[buffer->hits[i]]);
+	}
+}
+
+// Identifies a pair of hitbox slots (0 for solidity, 1 + i for collider i) on a pair of entities.
+// Two pairs sharing a key only costs GJK a worse starting direction.
+static inline uint64_t axis_key(const Entity* a, const Entity* b, uint32_t slotA, uint32_t slotB) {
+	uint64_t pair = (static_cast<uint64_t>(a->id) << 32) | b->id;
+	return pair ^ ((static_cast<uint64_t>(slotA) << 16 | slotB) * 0x9E3779B97F4A7C15ull);
+}
+
+static inline Vector2 find_axis(const std::vector<SeparatingAxis>& axes, uint64_t key) {
+	auto it = std::lower_bound(axes.begin(), axes.end(), key,
+		[](const SeparatingAxis& axis, uint64_t k) { return axis.key < k; });
+	return it != axes.end() && it->key == key ? it->axis : Vector2{ 0.f, 0.f };
+}
+
+// Keeps the axes of a pair that reused last update's result instead of running detect_collisions,
+// so GJK still has them to start from once the pair moves again
+static void carry_axes(CollisionBuffer& buffer, const std::vector<SeparatingAxis>& axes, const Entity* a, const Entity* b) {
+	auto carry = [&](uint32_t slotA, uint32_t slotB) {
+		uint64_t key = axis_key(a, b, slotA, slotB);
+		Vector2 axis = find_axis(axes, key);
+		if (axis.x != 0.f || axis.y != 0.f) buffer.axes.push_back({ key, axis });
+	};
+
+	if (a->solid && b->solid) carry(0, 0);
+	if (!a->collision_enabled || !b->collision_enabled) return;
+
+	const auto& collsA = a->frame->colliders;
+	const auto& collsB = b->frame->colliders;
+	for (size_t i = 0; i < collsA.size(); ++i) {
+		for (size_t j = 0; j < collsB.size(); ++j) {
+			if (ColliderType::acts_on(collsA[i].type, collsB[j].type) || ColliderType::acts_on(collsB[j].type, collsA[i].type)) {
+				carry(1 + (uint32_t) i, 1 + (uint32_t) j);
+			}
+		}
+	}
+}
+
+// Pairs whose relative motion outruns their smallest hitbox are tested at evenly spaced substeps instead of just at their
+// final positions, so they can't pass through each other between updates. The substeps only cover the part of the update
+// where the two hitboxes' swept bounds overlap, which is never longer than their combined size however fast they move.
+// Solid hits before the end of the update are left in the buffer for resolve_impacts.
+// Box-box and circle-circle collider tests at a single step are queued rather than run here.
+// Other single step tests start GJK from the axis that separated the pair last frame, and record the new one.
+// Returns true if the solidity hitboxes overlapped.
+static bool detect_collisions(CollisionBuffer& buffer, const std::vector<SeparatingAxis>& axes, const Entity* a, const Entity* b) {
 	Vector2 aDis = a->position - a->last_pos;
-	Transform bTx = b->get_transform();
 	Vector2 bDis = b->position - b->last_pos;
 
-	if (a->solid && b->solid && hitboxes_overlap(
-		a->animation->solidity.hitbox, aTx, aDis,
-		b->animation->solidity.hitbox, bTx, bDis
-	)) {
-		executor.defer(move_to_contact_wrapper, EntityPair{ const_cast<Entity*>(a), const_cast<Entity*>(b) });
+	const float rel_dist = (aDis - bDis).magnitude();
+	const float extent = fminf(a->world.min_half_extent, b->world.min_half_extent);
+	const bool fast = rel_dist > extent;
+
+	// Transforms at the start of the update, for the colliders and then the solidity hitboxes. Only needed for fast movers;
+	// otherwise the collider caches already hold everything at the entities' current placement.
+	Transform aTx, bTx, aSolidTx, bSolidTx;
+	if (fast) {
+		aTx = start_transform(a);
+		bTx = start_transform(b);
+		aSolidTx = a->animation->solidity.fixed ? start_transform(a, true) : aTx;
+		bSolidTx = b->animation->solidity.fixed ? start_transform(b, true) : bTx;
 	}
+	const WorldShapes aWorld = a->world.view();
+	const WorldShapes bWorld = b->world.view();
+
+	// Fraction of the update at which the hitboxes meet (1 if they only overlap at the end), or -1 if they don't
+	auto first_overlap = [&](uint32_t slotA, const Hitbox& hitA, const WorldHitbox& worldA, const Transform& txA,
+		uint32_t slotB, const Hitbox& hitB, const WorldHitbox& worldB, const Transform& txB) -> float {
+		if (!fast) {
+			uint64_t key = axis_key(a, b, slotA, slotB);
+			Vector2 axis = find_axis(axes, key);
+			if (world_hitboxes_overlap(aWorld, worldA, aDis, bWorld, worldB, bDis, &axis)) return 1.f;
+
+			if (axis.x != 0.f || axis.y != 0.f) buffer.axes.push_back({ key, axis });
+			return -1.f;
+		}
 
-	for (const Collider& collA : a->frame->colliders) {
-		for (const Collider& collB : b->frame->colliders) {
+		float t0, t1;
+		if (!swept_overlap(worldA.aabb, aDis, worldB.aabb, bDis, t0, t1)) return -1.f;
+
+		// From where the bounds first touch to where they part. A hit counts from the last substep they were still apart,
+		// which for a pair of boxes is exactly where they touch.
+		const int substeps = SDL_max(SDL_min((int) ceilf(rel_dist * (t1 - t0) / extent), CCD_MAX_SUBSTEPS), 1);
+		const float span = (t1 - t0) / substeps;
+		float apart = t0;
+		for (int i = 0; i <= substeps; ++i) {
+			float t = i == substeps ? t1 : t0 + span * i;
+			if (hitboxes_overlap(hitA, Transform::translation(aDis * t) * txA, aDis * span,
+				hitB, Transform::translation(bDis * t) * txB, bDis * span)) {
+				return apart;
+			}
+			apart = t;
+		}
+		return -1.f;
+	};
+
+	bool solid_hit = false;
+	if (a->solid && b->solid) {
+		float t = first_overlap(0, a->animation->solidity.hitbox, a->world.solidity(), aSolidTx,
+			0, b->animation->solidity.hitbox, b->world.solidity(), bSolidTx);
+		if (t >= 1.f) {
+			executor.defer(move_to_contact_wrapper, EntityPair{ const_cast<Entity*>(a), const_cast<Entity*>(b) });
+		}
+		else if (t >= 0.f) {
+			buffer.impacts.push_back({ const_cast<Entity*>(a), const_cast<Entity*>(b), t });
+		}
+		solid_hit = t >= 0.f;
+	}
+
+	if (!a->collision_enabled || !b->collision_enabled) return solid_hit;
+
+	const auto& collsA = a->frame->colliders;
+	const auto& collsB = b->frame->colliders;
+	for (size_t i = 0; i < collsA.size(); ++i) {
+		const Collider& collA = collsA[i];
+		const WorldHitbox& worldA = a->world.collider(i);
+
+		for (size_t j = 0; j < collsB.size(); ++j) {
+			const Collider& collB = collsB[j];
+			const WorldHitbox& worldB = b->world.collider(j);
 
 			bool fwd = ColliderType::acts_on(collA.type, collB.type);
 			bool bkwd = ColliderType::acts_on(collB.type, collA.type);
 
 			if (fwd || bkwd) {
-				if (hitboxes_overlap(
-					collA.hitbox, aTx, aDis,
-					collB.hitbox, bTx, bDis
-				)) {
-					// TODO: report events to interested parties
-					//if (ColliderGroup::acts_on(collA.type, collB.type)) {
-					//}
-					//else {
-					//}
+				QueuedCollision test = { a, &collA, b, &collB, fwd, bkwd };
+				if (!fast && queue_collision(buffer, test, worldA, worldB)) continue;
+
+				if (first_overlap(1 + (uint32_t) i, collA.hitbox, worldA, aTx, 1 + (uint32_t) j, collB.hitbox, worldB, bTx) >= 0.f) {
+					add_contacts(buffer.contacts, test);
 				}
 			}
 		}
 	}
+	return solid_hit;
+}
+
+// Casts a fast mover's solidity bounds from last_pos along its motion, stopping it at the first tile in the way
+// and letting whatever motion is left slide along that tile's surface.
+// Slow movers are left to the overlap test, which can't miss anything at their speed.
+static void entity_level_sweep(Entity* e, const LevelInstance* level) {
+	if (level == nullptr || !e->solid || e->animation == nullptr) return;
+	const auto& solidity = e->animation->solidity;
+	if (solidity.hitbox.type == Hitbox::NONE) return;
+
+	Vector2 dis = e->position - e->last_pos;
+	float dist = dis.magnitude();
+	if (dist <= min_half_extent(e)) return;
+
+	const Transform tx = solidity.fixed ?
+		Transform::scal_trans(e->scale, e->last_pos) :
+		Transform::scal_rot_trans(e->scale, e->rotation, e->last_pos);
+	AABB box = tx * hitbox_aabb(solidity.hitbox);
+
+	Point2 pos = e->last_pos;
+	for (int i = 0; i < CCD_MAX_SLIDES && dist > 0.f; ++i) {
+		CastHit hit = boxcast(*level, box, dis, dist);
+		if (!hit.hit || (hit.normal.x == 0.f && hit.normal.y == 0.f)) {
+			// Clear path, or already inside something (which depenetration deals with)
+			pos += dis;
+			break;
+		}
+
+		Vector2 step = dis * (fmaxf(hit.distance - CCD_SKIN, 0.f) / dist);
+		pos += step;
+		box += step;
+
+		dis -= step;
+		dis -= hit.normal * dis.dot(hit.normal);
+		dist = dis.magnitude();
+
+		float into = e->velocity.dot(hit.normal);
+		if (into < 0.f) e->velocity -= hit.normal * into;
+	}
+
+	e->position = pos;
 }
 
 static void entity_level_collision(Entity* e, const LevelInstance* level) {
 	if (level == nullptr || e == nullptr) return;
-	if (!e->solid || e->animation->solidity.hitbox.type == Hitbox::NONE) return; // Ignore disabled/empty hitboxes
 
-	// Then check each tilemap for collision
+	bool grounded = (e->level_contacts & LevelContact::GROUND) != 0;
+	e->level_contacts = 0;
+	e->ground_normal = { 0.f, 0.f };
+
+	if (!e->solid || e->animation == nullptr) return;
+	if (e->animation->solidity.hitbox.type == Hitbox::NONE) return; // Ignore disabled/empty hitboxes
+
 	for (const auto& tilemap : level->layers) {
-		if (tilemap.solid && entity_tilemap_collision(e, tilemap)) {
-			// TODO: depenetrate
-
-			// IDEA:
-			// depenetrate from nearest tiles to original position first
-			// ignore nonsolid tiles
-			// for full and partial tiles, treat them as aabb hitboxes and depenetrate normally
-			// for topleft=false sloped tiles check only foot position when depenetrating upward
-			//   (which should be moved to the animation and be auto-calculated)
-			// for topleft=true sloped tiles do the vertical reverse
-			// otherwise use a more generalized algorithm
-			break;
+		if (tilemap.solid) {
+			resolve_tilemap_collision(e, tilemap, grounded);
 		}
 	}
+	resolve_object_collision(e, *level->base);
 }
 
 // =========================================================================================
@@ -424,7 +1319,7 @@ static void SetEntitySprite(Entity* entity, const std::string& filename) {
 		entity->sprite = maybesprite;
 		entity->animation = &(entity->sprite->animations[0]);
 		entity->frame = entity->animation->frames[0].frame;
-		entity->frame_time = 0.f;
+		entity->anim_time = 0.f;
 		entity->anim_frame = 0;
 	}
 	else {
@@ -445,7 +1340,7 @@ static void SetEntityAnimationByIndex(Entity* entity, int index) {
 	else {
 		entity->animation = &(entity->sprite->animations[index]);
 		entity->frame = entity->animation->frames[0].frame;
-		entity->frame_time = 0.f;
+		entity->anim_time = 0.f;
 		entity->anim_frame = 0;
 	}
 }
@@ -467,11 +1362,45 @@ static void SetEntityAnimationByName(Entity* entity, const std::string& name) {
 	else {
 		entity->animation = anim;
 		entity->frame = anim->frames[0].frame;
-		entity->frame_time = 0.f;
+		entity->anim_time = 0.f;
 		entity->anim_frame = 0;
 	}
 }
 
+static bool EntityOnGround(const Entity* entity) {
+	return (entity->level_contacts & LevelContact::GROUND) != 0;
+}
+
+static bool EntityOnCeiling(const Entity* entity) {
+	return (entity->level_contacts & LevelContact::CEILING) != 0;
+}
+
+static bool EntityTouchingWall(const Entity* entity) {
+	return (entity->level_contacts & (LevelContact::WALL_LEFT | LevelContact::WALL_RIGHT)) != 0;
+}
+
+static bool EntityTouchingWallLeft(const Entity* entity) {
+	return (entity->level_contacts & LevelContact::WALL_LEFT) != 0;
+}
+
+static bool EntityTouchingWallRight(const Entity* entity) {
+	return (entity->level_contacts & LevelContact::WALL_RIGHT) != 0;
+}
+
+static float GetEntityAnimationTime(const Entity* entity) {
+	return entity->anim_time;
+}
+
+static void SetEntityAnimationTime(Entity* entity, float time) {
+	if (entity->animation == nullptr) {
+		asIScriptContext* ctx = asGetActiveContext();
+		ctx->SetException("Sprite has not been initialized");
+	}
+	else {
+		seek_animation(entity, time);
+	}
+}
+
 static void SetEntitySpriteCompound(Entity* entity, const std::string& filename, const std::string& animname) {
 	auto maybesprite = load_sprite(filename.c_str());
 	if (maybesprite) {
@@ -533,6 +1462,49 @@ static void DestroyDeferred(Entity* ent, asIScriptFunction* callback) {
 	executor.defer(destroy_wrapper, EntityDestroy{ ent, callback });
 }
 
+// Results are gathered into a per-thread scratch buffer and copied into the caller's array,
+// so repeated queries into the same array don't allocate once both have grown large enough.
+template <class Filter>
+static unsigned int QueryEntities(const EntitySystem* system, const AABB& region, CScriptArray* out, Filter&& filter) {
+	thread_local std::vector<Entity*> found;
+	found.clear();
+
+	system->get_index().query(region, [&](uint32_t, const SpatialHash::Item& item) {
+		if (!item.entity->pending_destroy && filter(item)) {
+			found.push_back(item.entity);
+		}
+	});
+
+	if (out != nullptr) {
+		out->Resize((asUINT) found.size());
+		for (size_t i = 0; i < found.size(); ++i) {
+			// Entities aren't reference counted, so the handles can be written directly
+			*static_cast<Entity**>(out->At((asUINT) i)) = found[i];
+		}
+	}
+	return (unsigned int) found.size();
+}
+
+static unsigned int QueryAABB(const EntitySystem* system, const AABB& region, CScriptArray* out) {
+	return QueryEntities(system, region, out, [](const SpatialHash::Item&) { return true; });
+}
+
+static unsigned int QueryCircle(const EntitySystem* system, const Vector2& center, float radius, CScriptArray* out) {
+	AABB region = { center.x - radius, center.x + radius, center.y - radius, center.y + radius };
+	return QueryEntities(system, region, out, [center, radius](const SpatialHash::Item& item) {
+		// Distance from the center to the closest point of the box
+		float dx = center.x - SDL_max(item.box.left, SDL_min(center.x, item.box.right));
+		float dy = center.y - SDL_max(item.box.top, SDL_min(center.y, item.box.bottom));
+		return dx * dx + dy * dy <= radius * radius;
+	});
+}
+
+static unsigned int QueryChannel(const EntitySystem* system, const AABB& region, uint64_t mask, CScriptArray* out) {
+	return QueryEntities(system, region, out, [mask](const SpatialHash::Item& item) {
+		return (mask & BIT64(item.entity->world.channel_id)) != 0;
+	});
+}
+
 static int GetSpriteZOrder(Entity* ent) {
 	return ent->z_order;
 }
@@ -550,6 +1522,7 @@ void RegisterEntityTypes(asIScriptEngine* engine) {
 	// ==============
 
 	r = engine->RegisterObjectType("Entity", 0, asOBJ_REF | asOBJ_NOCOUNT); assert(r >= 0);
+	engine->SetTypeInfoUserDataCleanupCallback(free_entity_methods, ENTITY_METHODS_USERDATA);
 
 	// metadata
 	r = engine->RegisterObjectProperty("Entity", "const uint id", asOFFSET(Entity, id)); assert(r >= 0);
@@ -562,6 +1535,19 @@ void RegisterEntityTypes(asIScriptEngine* engine) {
 	r = engine->RegisterObjectProperty("Entity", "Vector2 acceleration", asOFFSET(Entity, acceleration)); assert(r >= 0);
 	r = engine->RegisterObjectProperty("Entity", "AABB vel_range", asOFFSET(Entity, vel_range)); assert(r >= 0);
 
+	// Contacts with the level, as of the end of the last update
+	r = engine->RegisterObjectMethod("Entity", "bool get_on_ground() const",
+		asFUNCTION(EntityOnGround), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("Entity", "bool get_on_ceiling() const",
+		asFUNCTION(EntityOnCeiling), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("Entity", "bool get_touching_wall() const",
+		asFUNCTION(EntityTouchingWall), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("Entity", "bool get_touching_wall_left() const",
+		asFUNCTION(EntityTouchingWallLeft), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("Entity", "bool get_touching_wall_right() const",
+		asFUNCTION(EntityTouchingWallRight), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectProperty("Entity", "const Vector2 ground_normal", asOFFSET(Entity, ground_normal)); assert(r >= 0);
+
 	// rendering
 	r = engine->RegisterObjectProperty("Entity", "float rotation", asOFFSET(Entity, rotation)); assert(r >= 0);
 	r = engine->RegisterObjectProperty("Entity", "Vector2 scale", asOFFSET(Entity, scale)); assert(r >= 0);
@@ -583,6 +1569,10 @@ void RegisterEntityTypes(asIScriptEngine* engine) {
 		asFUNCTION(SetEntityAnimationByName), asCALL_CDECL_OBJFIRST); assert(r >= 0);
 	r = engine->RegisterObjectMethod("Entity", "void set_animation(int)",
 		asFUNCTION(SetEntityAnimationByIndex), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("Entity", "float get_animation_time() const",
+		asFUNCTION(GetEntityAnimationTime), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("Entity", "void set_animation_time(float)",
+		asFUNCTION(SetEntityAnimationTime), asCALL_CDECL_OBJFIRST); assert(r >= 0);
 
 	r = engine->RegisterObjectMethod("Entity", "void set_sprite(const string &in, const string &in)",
 		asFUNCTIONPR(SetEntitySpriteCompound, (Entity*, const std::string&, const std::string&), void),
@@ -614,5 +1604,13 @@ void RegisterEntityTypes(asIScriptEngine* engine) {
 
 	r = engine->RegisterObjectMethod("__EntitySystem__", "void spawn(EntityComponent@, ErrorCallback@ err = null)",
 		asFUNCTION(SpawnDeferred), asCALL_CDECL_OBJFIRST); assert(r >= 0);
-	
+
+	// Region queries fill the given array (resizing it) and return the number of entities found
+	r = engine->RegisterObjectMethod("__EntitySystem__", "uint query_aabb(const AABB &in, array<Entity@>@ found = null) const",
+		asFUNCTION(QueryAABB), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("__EntitySystem__", "uint query_circle(const Vector2 &in, float, array<Entity@>@ found = null) const",
+		asFUNCTION(QueryCircle), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("__EntitySystem__", "uint query_channel(const AABB &in, ChannelMask, array<Entity@>@ found = null) const",
+		asFUNCTION(QueryChannel), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <cmath>
 #include <cassert>
 #include <vector>
+#include <unordered_map>
 
 #include "sprite.h"
 #include "hitbox.h"
@@ -12,6 +13,8 @@
 #include "buckets.h"
 #include "transform.h"
 #include "executor.h"
+#include "spatialhash.h"
+#include "collisionkernels.h"
 
 #include "angelscript.h"
 
@@ -26,12 +29,61 @@ namespace Errors {
 		EntityInitException        = { 302, "Entity behavior component init() threw an exception" },
 		EntityInitUnknownFailure   = { 309, "Entity behavior component init() failed in an unexpected way" },
 		EntityUpdateException      = { 312, "Entity behavior component update() threw an exception" },
-		EntityUpdateUnknownFailure = { 319, "Entity behavior component update() failed in an unexpected way" };
+		EntityUpdateUnknownFailure = { 319, "Entity behavior component update() failed in an unexpected way" },
+		EntityCollisionException      = { 322, "Entity behavior component collision callback threw an exception" },
+		EntityCollisionUnknownFailure = { 329, "Entity behavior component collision callback failed in an unexpected way" };
 }
 
 typedef uint32_t EntityId;
 class EntitySystem;
+class SnapshotWriter;
+class SnapshotReader;
 struct ControllerInstance;
+struct Entity;
+
+/// An overlap between two colliders where the actor's collider type acts on the target's
+struct Contact {
+	Entity* actor;
+	Entity* target;
+	const ColliderType* actor_type;
+	const ColliderType* target_type;
+
+	// Sort key so that matching contacts from consecutive frames line up
+	uint64_t pair;  // actor id << 32 | target id
+	uint32_t types; // actor type id << 16 | target type id
+
+	inline bool operator < (const Contact& other) const {
+		return pair < other.pair || (pair == other.pair && types < other.types);
+	}
+	inline bool operator == (const Contact& other) const {
+		return pair == other.pair && types == other.types;
+	}
+};
+
+enum class CollisionEvent : char {
+	Enter,
+	Stay,
+	Exit
+};
+
+// An entity's hitboxes in world space, rebuilt once per update along with the broadphase.
+// The narrow phase reads these instead of transforming hitboxes for every pair.
+struct ColliderCache {
+	// [0] is the solidity hitbox, [1 + i] is frame collider i, and composite children come after those
+	std::vector<WorldHitbox> shapes;
+	std::vector<Point2> vertices;
+	AABB bounds; // everything above together
+	bool has_oneway; // one-way results depend on motion, not just placement
+	uint32_t n_colliders; // frame colliders, not counting composite children
+	float min_half_extent; // smallest half-extent over the hitboxes, for telling fast movers apart
+	// As of the same update. Scripts may change the entity's own while casts and queries run on other workers.
+	bool solid;
+	uint8_t channel_id;
+
+	inline WorldShapes view() const { return { shapes.data(), vertices.data() }; }
+	inline const WorldHitbox& solidity() const { return shapes[0]; }
+	inline const WorldHitbox& collider(size_t i) const { return shapes[1 + i]; }
+};
 
 // Instances of entities
 struct Entity {
@@ -39,6 +91,9 @@ struct Entity {
 	const EntityId id;
 	EntitySystem* system;
 
+	// Set when a destroy has been requested; the entity is removed when the system applies its pending changes.
+	bool pending_destroy = false;
+
 // === Physics Data ===
 	Point2 position       = { 0.f,0.f };
 
@@ -51,6 +106,10 @@ struct Entity {
 	// Other movement stuffs
 	AABB vel_range = { -INFINITY, INFINITY, -INFINITY, INFINITY }; // Velocity range
 
+	// Sides that touched solid tiles at the end of the last update (LevelContact flags)
+	uint8_t level_contacts = 0;
+	Vector2 ground_normal = { 0.f, 0.f }; // zero while in the air
+
 // === Transform Data ===
 	float rotation = 0.f;
 	Vector2 scale = { 1.f, 1.f };
@@ -60,7 +119,7 @@ struct Entity {
 	const Animation* animation = nullptr;
 	const Frame* frame = nullptr;
 	uint32_t anim_frame = 0;
-	float frame_time = 0.f;
+	float anim_time = 0.f; // time since the start of the current animation
 
 	int z_order = 0;
 
@@ -75,11 +134,19 @@ struct Entity {
 	bool rendering_enabled = true;
 	bool solid = true;
 
+// === Collision Data ===
+	ColliderCache world;
+
 // === Script Interface ===
 	asIScriptObject* rootcomp = nullptr;
 	asITypeInfo* rootclass = nullptr;
 	asIScriptFunction* updatefunc = nullptr;
 
+	// Optional collision callbacks
+	asIScriptFunction* on_collision_enter = nullptr;
+	asIScriptFunction* on_collision_stay = nullptr;
+	asIScriptFunction* on_collision_exit = nullptr;
+
 // === Functionality ===
 	Entity(EntityId id, asIScriptObject* behavior);
 	~Entity();
@@ -87,6 +154,7 @@ struct Entity {
 	// In order to keep errors as return values (not throwing exceptions), init must be separate;
 	Result<> init(asIScriptEngine* engine);
 	Result<> update(asIScriptEngine* engine, float delta_time);
+	Result<> collision_event(asIScriptContext* ctx, CollisionEvent ev, const Contact& contact);
 
 	void render(GPU_Target* screen) const;
 
@@ -97,6 +165,62 @@ struct Entity {
 
 struct LevelInstance;
 
+// Collider pair whose overlap test has been queued for a SIMD kernel
+struct QueuedCollision {
+	const Entity* a;
+	const Collider* collA;
+	const Entity* b;
+	const Collider* collB;
+	bool fwd, bkwd; // which sides get a contact if they overlap
+};
+
+// Last known separating direction of a pair of hitboxes, used to warm-start GJK on the next frame
+struct SeparatingAxis {
+	uint64_t key; // see axis_key in entity.cpp
+	Vector2 axis;
+};
+
+// What the narrow phase saw for a pair of entities (a has the lower id).
+// If nothing it depends on has changed by the next update, the pair reuses last frame's contacts untested.
+struct PairRecord {
+	Vector2 offset; // b->position - a->position
+	float rotation_a, rotation_b;
+	Vector2 scale_a, scale_b;
+	const Animation* animation_a;
+	const Animation* animation_b;
+	const Frame* frame_a;
+	const Frame* frame_b;
+	bool solid_a, solid_b;
+	bool collision_a, collision_b;
+
+	bool solid_hit; // the solidity hitboxes overlapped (the pair is always retested while this is set)
+	uint32_t seen;  // update in which this was last refreshed
+};
+
+// Solid pair that first touched part way through the update
+struct TimeOfImpact {
+	Entity* a;
+	Entity* b;
+	float t; // fraction of this update's motion
+};
+
+// Narrow phase state owned by a single worker thread
+struct CollisionBuffer {
+	std::vector<Contact> contacts;
+	std::vector<SeparatingAxis> axes;
+	std::vector<std::pair<uint64_t, PairRecord>> pairs; // records for EntitySystem::pair_cache
+	std::vector<TimeOfImpact> impacts; // rewound and resolved by EntitySystem::resolve_impacts once the narrow phase is done
+
+	// Box-box and circle-circle tests, grouped by shape so they can be run 4 at a time
+	BoxPairs boxes;
+	std::vector<QueuedCollision> box_tests;
+	CirclePairs circles;
+	std::vector<QueuedCollision> circle_tests;
+	std::vector<uint32_t> hits;
+
+	void clear();
+};
+
 class EntitySystem {
 	typedef std::vector<Entity*> EntityList;
 	typedef EntityList::iterator EIter;
@@ -106,6 +230,38 @@ private:
 	EntityList entities;
 	EntityId next_id;
 
+	// Every entity in either list, for destroys by id
+	std::unordered_map<EntityId, Entity*> by_id;
+
+	// Spawns and destroys are batched up and applied all at once by apply_changes()
+	EntityList spawned;
+	EntityList destroyed;
+
+	// Removes (and frees) entities pending destruction while keeping the survivors in order
+	void compact();
+
+	// Frees every entity (including pending spawns) and forgets all contacts
+	void clear();
+
+	// Contacts and queued tests of each worker thread during the parallel narrow phase (indexed by Executor::thread_index)
+	std::vector<CollisionBuffer> collision_buffers;
+	// Separating axes found by last frame's narrow phase, sorted by key
+	std::vector<SeparatingAxis> separating_axes;
+	// Every pair the broadphase produced last update, keyed by lower id << 32 | higher id. Read-only during the narrow phase.
+	std::unordered_map<uint64_t, PairRecord> pair_cache;
+	uint32_t pair_update = 0;
+	void update_pair_cache();
+	void resolve_impacts();
+	// Merged and sorted contacts from this frame and the last one
+	std::vector<Contact> contacts, last_contacts;
+
+	void dispatch_collision_events(asIScriptEngine* engine);
+
+	// World-space bounds of every entity, rebuilt once per frame after spawns and destroys are applied.
+	// Serves both as the collision broadphase and for region queries from scripts.
+	SpatialHash index;
+	void rebuild_index();
+
 public:
 	bool ordered = false;
 
@@ -119,12 +275,35 @@ public:
 	Result<> destroy(EntityId id);
 	Result<> destroy(Entity* ent);
 
+	/// Applies all queued spawns and destroys in one pass. Survivors keep their order, so destroys alone don't force a re-sort.
+	void apply_changes();
+
+	/// Serializes every live entity (and its script component) into a snapshot.
+	// Must be called between updates.
+	void save(SnapshotWriter& writer) const;
+	/// Entities read back from a snapshot, script components and all, that aren't live yet
+	struct Staged {
+		EntityId next_id;
+		EntityList entities;
+	};
+	/// Reads what save wrote into new entities, leaving the live ones alone. Frees whatever it made if it fails.
+	Result<> read_snapshot(SnapshotReader& reader, asIScriptEngine* engine, Staged& out);
+	/// Replaces every entity with staged ones from read_snapshot
+	void restore(Staged& staged);
+	/// Frees staged entities that won't be restored after all
+	void discard(Staged& staged);
+
 	void update(asIScriptEngine* engine, LevelInstance* level, const float delta_time);
 
 	/// Iterator set for entities - allows for interleaved rendering
 	std::pair<EIter, EIter> render_iter();
+
+	/// Region queries by bounding box. Threadsafe; results reflect positions as of the last rebuild.
+	// Entities moving faster than their smallest hitbox are indexed by the area they swept since the last update.
+	inline const SpatialHash& get_index() const { return index; }
+
+	/// Indexed bounds of every entity that collides with the level, for keeping the tiles around them loaded
+	void level_anchors(std::vector<AABB>& out) const;
 };
 
 void RegisterEntityTypes(asIScriptEngine* engine);
-
-// TODO: SOA/SIMD particle system
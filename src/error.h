@@ -14,32 +14,32 @@
 #define LOG_VERBOSITY LOGLEVEL_VERBOSE
 
 #if LOG_VERBOSITY >= LOGLEVEL_VERBOSE
-#define LOG_VERBOSE(fmt, ...) printf(fmt, __VA_ARGS__)
-#define ERR_VERBOSE(fmt, ...) fprintf(stderr, fmt, __VA_ARGS__)
+#define LOG_VERBOSE(fmt, ...) printf(fmt, ##__VA_ARGS__)
+#define ERR_VERBOSE(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
 #else
 #define LOG_VERBOSE(fmt, ...) do {} while(false)
 #define ERR_VERBOSE(fmt, ...) do {} while(false)
 #endif
 
 #if LOG_VERBOSITY >= LOGLEVEL_DEBUG
-#define LOG_DEBUG(fmt, ...) printf(fmt, __VA_ARGS__)
-#define ERR_DEBUG(fmt, ...) fprintf(stderr, fmt, __VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) printf(fmt, ##__VA_ARGS__)
+#define ERR_DEBUG(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
 #else
 #define LOG_DEBUG(fmt, ...) do {} while(false)
 #define ERR_DEBUG(fmt, ...) do {} while(false)
 #endif
 
 #if LOG_VERBOSITY >= LOGLEVEL_NORMAL
-#define LOG(fmt, ...) printf(fmt, __VA_ARGS__)
-#define ERR(fmt, ...) fprintf(stderr, fmt, __VA_ARGS__)
+#define LOG(fmt, ...) printf(fmt, ##__VA_ARGS__)
+#define ERR(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
 #else
 #define LOG(fmt, ...) do {} while(false)
 #define ERR(fmt, ...) do {} while(false)
 #endif
 
 #if LOG_VERBOSITY >= LOGLEVEL_RELEASE
-#define LOG_RELEASE(fmt, ...) printf(fmt, __VA_ARGS__)
-#define ERR_RELEASE(fmt, ...) fprintf(stderr, fmt, __VA_ARGS__)
+#define LOG_RELEASE(fmt, ...) printf(fmt, ##__VA_ARGS__)
+#define ERR_RELEASE(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
 #else
 #define LOG_RELEASE(fmt, ...) do {} while(false)
 #define LOG_RELEASE(fmt, ...) do {} while(false)
@@ -65,6 +65,8 @@ namespace Errors {
 // 300-499: Entity related errors
 // 500-599: Event related errors
 // 600-699: Level related errors
+// 800-899: Particle/effect related errors
+// 900-999: Snapshot (save state) related errors
 // 2000-2199: Scripting related errors
 
 //typedef Errors::error_data Error;
@@ -5,16 +5,21 @@
 
 Executor Executor::singleton(std::thread::hardware_concurrency());
 
+static thread_local int worker_index = -1;
+
+int Executor::thread_index() {
+	return worker_index;
+}
+
+// There's always at least one slave, since batches only ever run on slaves (hardware_concurrency can also be 0 if unknown)
 Executor::Executor(uint32_t num_threads) :
-	n_threads(num_threads),
-	thread_mask(BIT32(num_threads) - 1)
+	n_threads(num_threads > 0 ? num_threads : 1),
+	thread_mask(BIT32(n_threads) - 1)
 {
 	running_threads = 0;
-	if (n_threads > 1) {
-		for (int i = 0; i < num_threads; ++i) {
-			thread_pool.push_back(std::thread([=]() {(*this)(i);}));
-			thread_pool[i].detach(); // The slave thread will never return, so detach it.
-		}
+	for (int i = 0; i < n_threads; ++i) {
+		thread_pool.push_back(std::thread([=]() {(*this)(i);}));
+		thread_pool[i].detach(); // The slave thread will never return, so detach it.
 	}
 }
 
@@ -39,6 +44,7 @@ Executor::~Executor() {
 void Executor::operator() (const int me) {
 	const unsigned int flag = BIT8(me);
 	const unsigned int antiflag = ~flag & thread_mask;
+	worker_index = me;
 	while (true) {
 		BatchFunc func;
 		{
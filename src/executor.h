@@ -119,6 +119,13 @@ public:
 
 	static Executor singleton;
 
+	/// Number of slave threads that batch jobs are split across
+	inline int thread_count() const { return n_threads; }
+
+	/// Index of the slave thread running the current batch item, or -1 if called from the master thread
+	// Lets batch jobs write to per-thread buffers without locking
+	static int thread_index();
+
 	template<typename SharedT, typename ItemT>
 	void set_batch_job(void(*func)(const SharedT*, ItemT*), const SharedT& share_data, bool byValue = true) {
 		static_assert(sizeof(SharedT) <= SHARED_DATA_MAXSIZE, "Shared data too large");
@@ -166,10 +173,11 @@ public:
 
 	/// Add a call to the deferred group or run it this was called from some call descendant of a call to run_deferred()
 	template<typename T>
-	Result<> defer(void(*func)(T*), T& data) {
+	Result<> defer(void(*func)(T*), const T& data) {
 		if (deferred.running) {
 			// This was called from a run_deferred() call, so we can just run right now
-			func(&data);
+			T copy = data;
+			func(&copy);
 			return Result<>::success;
 		}
 		else {
@@ -196,14 +204,14 @@ public:
 
 	/// Add a drawing call to the drawing list
 	template<typename T>
-	void defer_draw(void(*func)(GPU_Target*, T*), T& data, int z_order) {
+	Result<> defer_draw(void(*func)(GPU_Target*, T*), const T& data, int z_order) {
 		assert(!drawing.running);
 		std::unique_lock<std::mutex> lock(drawing.mutex);
 		if (drawing.n_entries >= MAX_DEFERRED_DRAWS) {
 			return Errors::TooManyDeferredDraws;
 		}
 		int index = drawing.n_entries++;
-		T* dptr = mempool.alloc<T>();
+		T* dptr = drawing.mempool.alloc<T>();
 		if (dptr == nullptr) {
 			return Errors::BadAlloc;
 		}
@@ -6,69 +6,52 @@
 #include <cstdio>
 #include <cerrno>
 
-Hitbox read_hitbox(FILE* stream, MemoryPool& pool) {
+Result<Hitbox> read_hitbox(BinaryReader& reader, MemoryPool& pool) {
 	Hitbox result;
 
-	result.type = read<Hitbox::Type>(stream);
+	check_void(reader.read(result.type));
 	switch (result.type) {
 	case Hitbox::BOX:
-		result.box = read<AABB>(stream);
+		check_void(reader.read(result.box));
 		break;
 	case Hitbox::CIRCLE:
-		result.circle = read<Circle>(stream);
+		check_void(reader.read(result.circle));
 		break;
 	case Hitbox::LINE:
 	case Hitbox::ONEWAY:
-		result.line = read<Line>(stream);
+		check_void(reader.read(result.line));
 		break;
 	case Hitbox::POLYGON:
 	{
-		size_t n_vertices = read<uint32_t>(stream);
-		Vector2* vertices = pool.alloc<Vector2>(n_vertices);
-		for (int i = 0; i < n_vertices; ++i) {
-			vertices[i] = read<Vector2>(stream);
-		}
-		new(&result.polygon.vertices) Array<const Vector2>(vertices, n_vertices);
-		//result.polygon.aabb = get_aabb(result.polygon.vertices);
+		uint32_t n_vertices;
+		check_void(reader.read(n_vertices));
+		new(&result.polygon.vertices) Array<const Vector2>();
+		check_void(reader.read_span(n_vertices, pool, result.polygon.vertices));
+		result.polygon.aabb = poly_to_aabb(result.polygon.vertices);
 		break;
 	}
 	case Hitbox::COMPOSITE:
 	{
-		size_t n_subs = read<uint32_t>(stream);
-		Hitbox* subs = pool.alloc<Hitbox>(n_subs);
-		for (int i = 0; i < n_subs; ++i) {
-			subs[i] = read_hitbox(stream, pool);
+		uint32_t n_subs;
+		check_void(reader.read(n_subs));
+		Hitbox* subs = n_subs <= INT_MAX ? pool.alloc<Hitbox>((int) n_subs) : nullptr;
+		if (subs == nullptr && n_subs > 0) return Error(Errors::BadAlloc, "composite children");
+		for (uint32_t i = 0; i < n_subs; ++i) {
+			check_assign(subs[i], read_hitbox(reader, pool));
 		}
-		new(&result.composite.hitboxes) Array<const Hitbox>(subs, n_subs);
+		result = make_composite(subs, n_subs, pool);
 		break;
 	}
 	case Hitbox::NONE:
 		break;
 	default:
 		char type[2] = { result.type, 0 };
-		throw Error(Errors::InvalidHitboxType, std::string(type));
+		return Error(Errors::InvalidHitboxType, std::string(type));
 	}
 
 	return result;
 }
 
-Array<const Collider> read_colliders(FILE* stream, uint32_t n_colliders, MemoryPool& pool) {
-	Collider* colliders = pool.alloc<Collider>(n_colliders);
-	for (int i = 0; i < n_colliders; ++i) {
-		Collider& cur_coll = colliders[i];
-
-		size_t typestrlen = read<uint32_t>(stream);
-
-		char namebuffer[51];
-		fread(namebuffer, 1, typestrlen, stream);
-		namebuffer[typestrlen] = 0;
-		cur_coll.type = ColliderType::by_name(namebuffer);
-
-		cur_coll.hitbox = read_hitbox(stream, pool);
-	}
-	return Array<const Collider>(colliders, n_colliders);
-}
-
 Result<FILE*> open(const char* filename, const char* mode) {
 	FILE* file = fopen(filename, mode);
 
@@ -101,31 +84,43 @@ char* read_all(FILE* f) {
 	return buffer;
 }
 
-const char* read_string(FILE* stream, unsigned int len, MemoryPool& pool) {
-	char* str = pool.alloc<char>(len + 1);
-
-	if (str == nullptr) return nullptr; // MemoryPool is full
+Result<std::vector<uint8_t>> read_file(const char* filename) {
+	auto file = open(filename, "rb");
+	if (!file) {
+		return file.err;
+	}
+	FILE* stream = file;
 
-	if (fread(str, 1, len, stream) != len) return nullptr;
+	std::vector<uint8_t> bytes(size(stream));
+	size_t bytes_read = fread(bytes.data(), 1, bytes.size(), stream);
+	fclose(stream);
 
-	str[len] = 0;
-	return str;
+	if (bytes_read != bytes.size()) {
+		return Error(Errors::IncompleteFileRead, filename);
+	}
+	return bytes;
 }
 
-const char* read_string(FILE* stream, unsigned int len) {
-	char* str = new char[len + 1];
+Result<> BinaryReader::read_string(uint32_t len, MemoryPool& pool, const char*& out) {
+	if (remaining() < len) return Error(Errors::IncompleteFileRead, "string");
 
-	if (fread(str, 1, len, stream) != len) return nullptr;
+	char* str = len < INT_MAX ? pool.alloc<char>((int) len + 1) : nullptr;
+	if (str == nullptr) return Error(Errors::BadAlloc, "string"); // MemoryPool is full
 
+	read_span(str, len);
 	str[len] = 0;
-	return str;
+	out = str;
+	return Result<>::success;
 }
 
-const char* read_string(FILE* stream, unsigned int len, char* str) {
-	if (fread(str, 1, len, stream) != len) return nullptr;
+Result<> BinaryReader::read_string(uint32_t len, const char*& out) {
+	if (remaining() < len) return Error(Errors::IncompleteFileRead, "string");
 
+	char* str = new char[len + 1];
+	read_span(str, len);
 	str[len] = 0;
-	return str;
+	out = str;
+	return Result<>::success;
 }
 
 GPU_Image* load_texture(const char* texname) {
@@ -144,15 +139,18 @@ GPU_Image* load_texture(const char* texname) {
 	return real;
 }
 
-GPU_Image* read_referenced_texture(FILE* stream, uint32_t filenamelen, const DirContext& context) {
+Result<GPU_Image*> read_referenced_texture(BinaryReader& reader, uint32_t filenamelen, const DirContext& context) {
 	char texname[1024];
-	fread(texname, 1, filenamelen, stream);
-	texname[filenamelen] = 0;
+	check_void(reader.read_string(filenamelen, texname));
+
+	return load_referenced_texture(texname, context);
+}
 
+GPU_Image* load_referenced_texture(const char* texname, const DirContext& context) {
 	auto maybe = context.resolve(texname);
 	if (maybe) return load_texture(maybe.value.c_str());
 	else {
 		ERR("Unable to load referenced texture: %s", std::to_string(maybe.err).c_str());
 		return nullptr;
 	}
-}
\ No newline at end of file
+}
@@ -7,64 +7,141 @@
 #include "error.h"
 #include "util.h"
 #include "hitbox.h"
-#include <SDL2\SDL_endian.h>
+#include <SDL2/SDL_endian.h>
 #include <type_traits>
-#include <cassert>
+#include <typeinfo>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <climits>
 
 namespace Errors {
 	const error_data
 		CannotOpenFile = { 1, "File could not be opened." },
-		IncompleteFileRead = { 2, "Did not get all the bytes expected from an fread call." };
+		IncompleteFileRead = { 2, "File ended before all of its data could be read." },
+		StringTooLong = { 5, "String in file is too long for its buffer." };
 }
 
-template <class T, bool checked = true>
-T read(FILE* stream) {
-	static_assert(std::is_pod<T>::value, "read<T>(FILE*) can only be used for POD types");
-	alignas(T) unsigned char buffer[sizeof(T)];
+/// Converts a value read from an asset file (little-endian) to the engine's byte order.
+// The one place byte order is dealt with. Structs are converted as a run of 32-bit fields, so they can only be made of those.
+template <class T>
+__forceinline T from_little_endian(T value) {
+	static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value || (sizeof(T) % 4 == 0 && alignof(T) == 4),
+		"Structs read from asset files can only be made of 32-bit fields");
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	uint8_t* bytes = reinterpret_cast<uint8_t*>(&value);
+	if (std::is_arithmetic<T>::value || std::is_enum<T>::value) std::reverse(bytes, bytes + sizeof(T));
+	else for (size_t i = 0; i < sizeof(T); i += 4) std::reverse(bytes + i, bytes + i + 4);
+#endif
+	return value;
+}
+
+/// Sequential reader over an asset file that's already in memory, either read whole (read_file) or mapped.
+// Every read is bounds-checked and returns a Result; nothing is read (and out isn't touched) when there aren't enough bytes left.
+// Success comes back as Result<>(nullptr) rather than a copy of Result<>::success, so the checks fold away once inlined.
+class BinaryReader {
+private:
+	const uint8_t* const begin;
+	const uint8_t* pos;
+	const uint8_t* const end;
+
+	__forceinline size_t remaining() const { return (size_t) (end - pos); }
+
+public:
+	BinaryReader(const uint8_t* data, size_t len) : begin(data), pos(data), end(data + len) {}
+	explicit BinaryReader(const std::vector<uint8_t>& bytes) : BinaryReader(bytes.data(), bytes.size()) {}
 
-	if (!fread(buffer, sizeof(T), 1, stream) && checked) {
-		throw Error(Errors::IncompleteFileRead, typeid(T).name()); // one of the few exceptions actually used in the codebase.
+	template <class T>
+	__forceinline Result<> read(T& out) {
+		static_assert(std::is_trivially_copyable<T>::value, "BinaryReader::read<T> can only be used for trivially copyable types");
+		if (remaining() < sizeof(T)) return Error(Errors::IncompleteFileRead, typeid(T).name());
+		memcpy(&out, pos, sizeof(T));
+		pos += sizeof(T);
+		out = from_little_endian(out);
+		return nullptr;
 	}
 
-	// V - TODO? - V
+	/// Reads n values into out with a single bounds check
+	template <class T>
+	Result<> read_span(T* out, size_t n) {
+		static_assert(std::is_trivially_copyable<T>::value, "BinaryReader::read_span<T> can only be used for trivially copyable types");
+		if (n > remaining() / sizeof(T)) return Error(Errors::IncompleteFileRead, typeid(T).name());
+		memcpy(out, pos, n * sizeof(T));
+		pos += n * sizeof(T);
 #if SDL_BYTEORDER == SDL_BIG_ENDIAN
-	// reverse buffer
-	// reflection?...
+		for (size_t i = 0; i < n; ++i) out[i] = from_little_endian(out[i]);
 #endif
+		return nullptr;
+	}
 
-	return *reinterpret_cast<T*>(buffer);
-}
+	/// Reads n values into the pool
+	template <class T>
+	Result<> read_span(size_t n, MemoryPool& pool, Array<const T>& out) {
+		if (n > remaining() / sizeof(T)) return Error(Errors::IncompleteFileRead, typeid(T).name());
+		if (n == 0) {
+			out = Array<const T>();
+			return nullptr;
+		}
+
+		T* items = n <= INT_MAX ? pool.alloc<T>((int) n) : nullptr;
+		if (items == nullptr) return Error(Errors::BadAlloc, typeid(T).name());
+		check_void(read_span(items, n));
+		out = Array<const T>(items, n);
+		return nullptr;
+	}
+
+	/// Copies len chars and a terminator into the pool
+	Result<> read_string(uint32_t len, MemoryPool& pool, const char*& out);
+	/// Copies len chars and a terminator into a new[]'d buffer
+	Result<> read_string(uint32_t len, const char*& out);
+	/// Copies len chars and a terminator into buffer
+	template <size_t N>
+	Result<> read_string(uint32_t len, char (&buffer)[N]) {
+		if (len >= N) return Error(Errors::StringTooLong, std::to_string(len));
+		check_void(read_span(buffer, len));
+		buffer[len] = 0;
+		return nullptr;
+	}
+
+	/// Strings prefixed by their length, as a Header
+	template <class Header>
+	inline Result<> read_string(const char*& out) {
+		static_assert(std::is_integral<Header>::value, "read_string<Header> is only compatible with int types");
+		Header len;
+		check_void(read(len));
+		return read_string(len, out);
+	}
+	template <class Header, size_t N>
+	inline Result<> read_string(char (&buffer)[N]) {
+		static_assert(std::is_integral<Header>::value, "read_string<Header> is only compatible with int types");
+		Header len;
+		check_void(read(len));
+		return read_string(len, buffer);
+	}
+
+	/// Skips past the magic number if the file starts with it
+	inline bool check_magic(const char* expected, size_t len) {
+		if (remaining() < len || memcmp(pos, expected, len) != 0) return false;
+		pos += len;
+		return true;
+	}
+
+	inline size_t tell() const { return pos - begin; }
+	inline bool at_end() const { return pos == end; }
+};
 
 Result<FILE*> open(const char* file, const char* mode);
 size_t size(FILE* f);
 char* read_all(FILE* f);
+/// The whole file, with a single read
+Result<std::vector<uint8_t>> read_file(const char* filename);
 
-Hitbox read_hitbox(FILE* stream, MemoryPool& pool);
-Array<const Collider> read_colliders(FILE* stream, uint32_t n_colliders, MemoryPool& pool);
-GPU_Image* read_referenced_texture(FILE* stream, uint32_t filenamelen, const DirContext& context);
-const char* read_string(FILE* stream, unsigned int len, MemoryPool& pool);
-const char* read_string(FILE* stream, unsigned int len, char* buffer);
-const char* read_string(FILE* stream, unsigned int len);
-
-template <class Header>
-inline const char* read_string(FILE* stream) {
-	static_assert(std::is_integral<Header>::value, "read_string<Header> is only compatible with int types");
-	return read_string(stream, read<Header>(stream));
-}
+Result<Hitbox> read_hitbox(BinaryReader& reader, MemoryPool& pool);
+/// Fails only if the name can't be read; a texture that can't be loaded is logged and comes back as nullptr
+Result<GPU_Image*> read_referenced_texture(BinaryReader& reader, uint32_t filenamelen, const DirContext& context);
+GPU_Image* load_referenced_texture(const char* texname, const DirContext& context);
 
-template <class Header>
-inline const char* read_string(FILE* stream, char* buffer) {
-	static_assert(std::is_integral<Header>::value, "read_string<Header> is only compatible with int types");
-	return read_string(stream, read<Header>(stream), buffer);
-}
-
-#define check_header(stream, expected) __check_header__(stream, expected, sizeof(expected) - 1)
-inline bool __check_header__(FILE* stream, const char* expected, size_t len) {
-	assert(len > 0 && len < 32);
-	char headbytes[32];
-	if (fread(headbytes, 1, len, stream) != len) return false;
-	headbytes[len] = 0;
-	return strcmp(headbytes, expected) == 0;
-}
+#define check_header(reader, expected) (reader).check_magic(expected, sizeof(expected) - 1)
 
 GPU_Image* load_texture(const char* texname);
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "gjk.h"
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#define GJK_MAX_ITERATIONS 32
+#define EPA_MAX_ITERATIONS 32
+// EPA stops once a new support point would move the closest edge by less than this
+#define EPA_TOLERANCE 0.01f
+
+Point2 ConvexSupport::operator () (Vector2 d) const {
+	const Point2* pts = points();
+	Point2 best = pts[0];
+	float best_dot = best.dot(d);
+	for (uint32_t i = 1; i < n; ++i) {
+		float dot = pts[i].dot(d);
+		if (dot > best_dot) {
+			best_dot = dot;
+			best = pts[i];
+		}
+	}
+
+	if (radius > 0.f) {
+		float len = d.magnitude();
+		if (len > 0.f) best += d * (radius / len);
+	}
+	return best + offset;
+}
+
+Point2 ConvexSupport::center() const {
+	const Point2* pts = points();
+	Vector2 sum = { 0.f, 0.f };
+	for (uint32_t i = 0; i < n; ++i) {
+		sum += pts[i];
+	}
+	return sum / (float) n + offset;
+}
+
+// Support point of the Minkowski difference a - b
+static inline Point2 minkowski(const ConvexSupport& a, const ConvexSupport& b, Vector2 d) {
+	return a(d) - b(-d);
+}
+
+// Perpendicular of edge, on the side facing toward
+static inline Vector2 perp_toward(Vector2 edge, Vector2 toward) {
+	Vector2 perp = { -edge.y, edge.x };
+	return perp.dot(toward) < 0.f ? -perp : perp;
+}
+
+// Reduces the simplex to the feature closest to the origin and picks the next search direction.
+// Returns true once the simplex encloses the origin.
+static bool update_simplex(GjkSimplex& s, Vector2& d) {
+	if (s.n == 2) {
+		Point2 a = s.points[1], b = s.points[0];
+		Vector2 ab = b - a, ao = -a;
+		if (ab.dot(ao) > 0.f) {
+			d = perp_toward(ab, ao); // if the origin is on the segment, either side will do
+		}
+		else {
+			s.points[0] = a;
+			s.n = 1;
+			d = ao;
+		}
+		return false;
+	}
+
+	// Triangle; a is the newest point, so the origin can't be beyond bc
+	Point2 a = s.points[2], b = s.points[1], c = s.points[0];
+	Vector2 ab = b - a, ac = c - a, ao = -a;
+	Vector2 ab_out = -perp_toward(ab, ac);
+	Vector2 ac_out = -perp_toward(ac, ab);
+
+	if (ab_out.dot(ao) > 0.f) {
+		s.points[0] = b;
+		s.points[1] = a;
+		s.n = 2;
+		d = ab_out;
+		return false;
+	}
+	if (ac_out.dot(ao) > 0.f) {
+		s.points[0] = c;
+		s.points[1] = a;
+		s.n = 2;
+		d = ac_out;
+		return false;
+	}
+	return true;
+}
+
+bool gjk_overlap(const ConvexSupport& a, const ConvexSupport& b, Vector2& axis, GjkSimplex* simplex) {
+	Vector2 d = axis;
+	if (d.x == 0.f && d.y == 0.f) d = b.center() - a.center();
+	if (d.x == 0.f && d.y == 0.f) d = { 1.f, 0.f };
+
+	GjkSimplex s;
+	s.points[0] = minkowski(a, b, d);
+	s.n = 1;
+	if (s.points[0].dot(d) <= 0.f) {
+		axis = d;
+		return false;
+	}
+	d = -s.points[0];
+
+	for (int i = 0; i < GJK_MAX_ITERATIONS; ++i) {
+		if (d.x == 0.f && d.y == 0.f) return false; // the origin is a vertex: touching
+
+		Point2 p = minkowski(a, b, d);
+		if (p.dot(d) <= 0.f) {
+			axis = d;
+			return false;
+		}
+
+		// No progress means the origin is on the boundary
+		for (int j = 0; j < s.n; ++j) {
+			if (p.x == s.points[j].x && p.y == s.points[j].y) return false;
+		}
+
+		s.points[s.n++] = p;
+		if (update_simplex(s, d)) {
+			if (simplex != nullptr) *simplex = s;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool epa_penetration(const ConvexSupport& a, const ConvexSupport& b, const GjkSimplex& simplex, Vector2& normal, float& depth) {
+	if (simplex.n < 3) return false;
+
+	thread_local std::vector<Point2> poly;
+	poly.assign(simplex.points, simplex.points + 3);
+
+	// Counterclockwise, so (e.y, -e.x) points out of every edge
+	float area = (poly[1] - poly[0]).cross(poly[2] - poly[0]);
+	if (area == 0.f) return false;
+	if (area < 0.f) std::swap(poly[1], poly[2]);
+
+	Vector2 best_normal = { 0.f, 0.f };
+	float best_dist = 0.f;
+	for (int iter = 0; iter < EPA_MAX_ITERATIONS; ++iter) {
+		// Edge closest to the origin
+		size_t edge = 0;
+		best_dist = INFINITY;
+		for (size_t i = 0; i < poly.size(); ++i) {
+			Vector2 e = poly[(i + 1) % poly.size()] - poly[i];
+			Vector2 n = Vector2{ e.y, -e.x }.normalized();
+			float dist = n.dot(poly[i]);
+			if (dist < best_dist) {
+				best_dist = dist;
+				best_normal = n;
+				edge = i;
+			}
+		}
+
+		Point2 p = minkowski(a, b, best_normal);
+		if (p.dot(best_normal) - best_dist < EPA_TOLERANCE) break;
+
+		poly.insert(poly.begin() + edge + 1, p);
+	}
+
+	normal = -best_normal;
+	depth = best_dist;
+	return true;
+}
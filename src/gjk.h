@@ -0,0 +1,40 @@
+#pragma once
+
+// GJK intersection and EPA penetration depth for 2D convex shapes.
+// Shapes are described only by their support function, so one routine covers boxes, circles, lines and polygons.
+
+#include <cstdint>
+
+#include "vectors.h"
+
+/// A convex point set (optionally rounded by a radius), translated by an offset
+struct ConvexSupport {
+	const Point2* external; // vertices owned elsewhere (polygons), or null to use the inline ones
+	Point2 inline_points[4];
+	uint32_t n;
+	float radius;
+	Vector2 offset;
+
+	inline const Point2* points() const { return external != nullptr ? external : inline_points; }
+
+	/// Farthest point of the shape in direction d
+	Point2 operator () (Vector2 d) const;
+
+	/// Some point inside the shape
+	Point2 center() const;
+};
+
+/// Up to 3 points of the Minkowski difference a - b
+struct GjkSimplex {
+	Point2 points[3];
+	int n;
+};
+
+/// True if the shapes overlap. Touching shapes do not.
+// axis is a hint for where the origin lies relative to a - b (zero for none). It is updated with the separating
+// direction when the shapes are apart, so passing last frame's value back in usually ends the search immediately.
+bool gjk_overlap(const ConvexSupport& a, const ConvexSupport& b, Vector2& axis, GjkSimplex* simplex = nullptr);
+
+/// Expands a simplex that encloses the origin (from gjk_overlap) to find how far apart the shapes need to be moved.
+// normal: direction to move a out of b. Returns false if the simplex was degenerate.
+bool epa_penetration(const ConvexSupport& a, const ConvexSupport& b, const GjkSimplex& simplex, Vector2& normal, float& depth);
@@ -3,8 +3,12 @@
 #include "hitbox.h"
 #include "transform.h"
 #include "fileutil.h"
+#include "gjk.h"
+#include "mempool.h"
 #include <SDL_gpu.h>
+#include <algorithm>
 #include <cstring>
+#include <string>
 #include <cassert>
 
 Hitbox::Hitbox(const Hitbox& other) {
@@ -71,47 +75,47 @@ const ColliderType* ColliderType::by_name(const char* name) {
 constexpr std::initializer_list<ColliderType> BUILTIN_COLLIDER_TYPES = {};
 constexpr int N_BUILTIN_COLLIDER_TYPES = BUILTIN_COLLIDER_TYPES.size();
 
-Result<> ColliderType::init(FILE* bootloader) {
-	try {
-		int n_types = read<uint16_t>(bootloader) + N_BUILTIN_COLLIDER_TYPES;
+Result<> ColliderType::init(BinaryReader& reader) {
+	uint16_t n_custom;
+	check_void(reader.read(n_custom));
+	int n_types = n_custom + N_BUILTIN_COLLIDER_TYPES;
 
-		ColliderType* types = new ColliderType[n_types];
-		ColliderType::table = Array2D<bool>(n_types, n_types);
-		table.clear();
+	ColliderType* types = new ColliderType[n_types];
+	ColliderType::table = Array2D<bool>(n_types, n_types);
+	table.clear();
 
-		int i = 0;
+	int i = 0;
+	std::vector<uint16_t> relations;
 
-		// init intrinsics
-		for (const ColliderType& intrinsic : BUILTIN_COLLIDER_TYPES) {
-			types[i] = intrinsic;
-			types[i].id = i;
-			++i;
-		}
+	// init intrinsics
+	for (const ColliderType& intrinsic : BUILTIN_COLLIDER_TYPES) {
+		types[i] = intrinsic;
+		types[i].id = i;
+		++i;
+	}
 
-		for (; i < n_types; ++i) {
-			types[i].name = read_string(bootloader, read<uint16_t>(bootloader));
-			types[i].id = i;
-			uint8_t
-				r = read<uint8_t>(bootloader),
-				g = read<uint8_t>(bootloader),
-				b = read<uint8_t>(bootloader);
-			types[i].color = { r, g, b, 255 };
-
-			int n_rel = read<uint16_t>(bootloader);
-			for (int rel = 0; rel < n_rel; ++rel) {
-				table.set(i, read<uint16_t>(bootloader));
-			}
+	for (; i < n_types; ++i) {
+		check_void(reader.read_string<uint16_t>(types[i].name));
+		types[i].id = i;
+		uint8_t rgb[3];
+		check_void(reader.read_span(rgb, 3));
+		types[i].color = { rgb[0], rgb[1], rgb[2], 255 };
+
+		uint16_t n_relations;
+		check_void(reader.read(n_relations));
+		relations.resize(n_relations);
+		check_void(reader.read_span(relations.data(), relations.size()));
+		for (uint16_t rel : relations) {
+			table.set(i, rel);
 		}
+	}
 
-		ColliderType::types = Array<const ColliderType>(types, n_types);
+	ColliderType::types = Array<const ColliderType>(types, n_types);
 
-		return Result<>::success;
-	}
-	catch (Error& e) {
-		return e;
-	}
+	return Result<>::success;
 }
 
+
 Array<const ColliderChannel> ColliderChannel::channels;
 
 constexpr const char* BUILTIN_COLLIDER_CHANNELS[] = {
@@ -120,31 +124,28 @@ constexpr const char* BUILTIN_COLLIDER_CHANNELS[] = {
 };
 constexpr int N_BUILTIN_COLLIDER_CHANNELS = sizeof(BUILTIN_COLLIDER_CHANNELS) / sizeof(const char*);
 
-Result<> ColliderChannel::init(FILE* stream) {
-	try {
-		int n_chans = read<uint16_t>(stream) + N_BUILTIN_COLLIDER_CHANNELS;
+Result<> ColliderChannel::init(BinaryReader& reader) {
+	uint16_t n_custom;
+	check_void(reader.read(n_custom));
+	int n_chans = n_custom + N_BUILTIN_COLLIDER_CHANNELS;
 
-		if (n_chans > 64) return Errors::TooManyColliderChannels;
+	if (n_chans > 64) return Errors::TooManyColliderChannels;
 
-		ColliderChannel* chans = new ColliderChannel[n_chans];
+	ColliderChannel* chans = new ColliderChannel[n_chans];
 
-		int i = 0;
-		for (; i < N_BUILTIN_COLLIDER_CHANNELS; ++i) {
-			chans[i].name = BUILTIN_COLLIDER_CHANNELS[i];
-			chans[i].id = i;
-		}
-
-		for (; i < n_chans; ++i) {
-			chans[i].name = read_string(stream, read<uint16_t>(stream));
-			chans[i].id = i;
-		}
-		new(&channels) Array<const ColliderChannel>(chans, n_chans);
-
-		return Result<>::success;
+	int i = 0;
+	for (; i < N_BUILTIN_COLLIDER_CHANNELS; ++i) {
+		chans[i].name = BUILTIN_COLLIDER_CHANNELS[i];
+		chans[i].id = i;
 	}
-	catch (Error& e) {
-		return e;
+
+	for (; i < n_chans; ++i) {
+		check_void(reader.read_string<uint16_t>(chans[i].name));
+		chans[i].id = i;
 	}
+	new(&channels) Array<const ColliderChannel>(chans, n_chans);
+
+	return Result<>::success;
 }
 
 #pragma region ScriptChannelMaskOps
@@ -221,6 +222,10 @@ static void PrintChannelMask(uint64_t chan) {
 static void PrintChannelID(uint8_t id) {
 	printf("%s\n", ColliderChannel::channels[id].name);
 }
+
+static std::string GetColliderTypeName(const ColliderType* type) {
+	return std::string(type->name);
+}
 #pragma endregion
 
 static uint64_t AllChannels = 0xFFFFffffFFFFffff;
@@ -303,11 +308,85 @@ int RegisterColliderTypes(asIScriptEngine* engine) {
 	check(engine->RegisterGlobalFunction("void println(const ChannelID)",
 		asFUNCTION(PrintChannelID), asCALL_CDECL));
 
+	// Collider types are static data that live for the whole program, so no refcounting needed
+	check(engine->RegisterObjectType("ColliderType", 0, asOBJ_REF | asOBJ_NOCOUNT));
+	check(engine->RegisterObjectProperty("ColliderType", "const int id", asOFFSET(ColliderType, id)));
+	check(engine->RegisterObjectMethod("ColliderType", "string get_name() const",
+		asFUNCTION(GetColliderTypeName), asCALL_CDECL_OBJFIRST));
+
 	return 0;
 }
 
 // Core logic
 
+AABB hitbox_aabb(const Hitbox& hitbox) {
+	switch (hitbox.type) {
+	case Hitbox::BOX:
+		return hitbox.box;
+	case Hitbox::CIRCLE:
+		return {
+			hitbox.circle.center.x - hitbox.circle.radius,
+			hitbox.circle.center.x + hitbox.circle.radius,
+			hitbox.circle.center.y - hitbox.circle.radius,
+			hitbox.circle.center.y + hitbox.circle.radius
+		};
+	case Hitbox::LINE:
+	case Hitbox::ONEWAY:
+		return {
+			SDL_min(hitbox.line.p1.x, hitbox.line.p2.x),
+			SDL_max(hitbox.line.p1.x, hitbox.line.p2.x),
+			SDL_min(hitbox.line.p1.y, hitbox.line.p2.y),
+			SDL_max(hitbox.line.p1.y, hitbox.line.p2.y)
+		};
+	case Hitbox::POLYGON:
+		return hitbox.polygon.aabb;
+	case Hitbox::COMPOSITE:
+		return hitbox.composite.aabb;
+	default:
+		return { INFINITY, -INFINITY, INFINITY, -INFINITY };
+	}
+}
+
+// Composites with at most this many children aren't split any further
+#define COMPOSITE_LEAF_SIZE 4
+
+Hitbox make_composite(Hitbox* subs, size_t n, MemoryPool& pool) {
+	Hitbox result;
+	result.type = Hitbox::COMPOSITE;
+
+	AABB bounds = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+	AABB centers = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+	for (size_t i = 0; i < n; ++i) {
+		AABB box = hitbox_aabb(subs[i]);
+		bounds |= box;
+		Point2 center = { (box.left + box.right) / 2.f, (box.top + box.bottom) / 2.f };
+		centers |= AABB{ center.x, center.x, center.y, center.y };
+	}
+
+	Hitbox* halves = n > COMPOSITE_LEAF_SIZE ? pool.alloc<Hitbox>(2) : nullptr;
+	if (halves != nullptr) {
+		bool split_x = centers.right - centers.left >= centers.bottom - centers.top;
+		auto center_of = [split_x](const Hitbox& hitbox) {
+			AABB box = hitbox_aabb(hitbox);
+			return split_x ? box.left + box.right : box.top + box.bottom;
+		};
+
+		size_t half = n / 2;
+		std::nth_element(subs, subs + half, subs + n, [&center_of](const Hitbox& a, const Hitbox& b) {
+			return center_of(a) < center_of(b);
+		});
+		halves[0] = make_composite(subs, half, pool);
+		halves[1] = make_composite(subs + half, n - half, pool);
+		new(&result.composite.hitboxes) Array<const Hitbox>(halves, 2);
+	}
+	else {
+		new(&result.composite.hitboxes) Array<const Hitbox>(subs, n);
+	}
+
+	result.composite.aabb = bounds;
+	return result;
+}
+
 void render_hitbox(GPU_Target* context, const Transform& tx, const Hitbox& hitbox, const SDL_Color& color) {
 	SDL_Color stroke, fill;
 	stroke = color;
@@ -396,14 +475,17 @@ void render_colliders(GPU_Target* context, const Transform& tx, const Array<cons
 }
 
 static bool box_box_test(AABB a, AABB b);
-static bool box_circle_test(AABB box, Circle circle);
-static bool box_line_test(AABB box, Line line);
 static bool circle_circle_test(Circle a, Circle b);
-static bool circle_line_test(Circle circle, Line line);
-static bool line_line_test(Line a, Line b);
-static bool poly_poly_test(Array<Point2> a, Array<Point2> b);
-static bool poly_line_test(Array<Point2> poly, Line line);
-static bool poly_circle_test(Array<Point2> poly, Circle radius);
+
+// Places a hitbox in the given scratch lists for a one-off test
+static WorldShapes scratch_world(const Hitbox& hitbox, const Transform& tx,
+	std::vector<WorldHitbox>& shapes, std::vector<Point2>& vertices) {
+	shapes.clear();
+	vertices.clear();
+	shapes.resize(1);
+	transform_hitbox(hitbox, tx, shapes, vertices, 0);
+	return { shapes.data(), vertices.data() };
+}
 
 bool hitboxes_overlap(
 	const Hitbox& a, const Transform& aTx, Vector2 aDis, // aDis and bDis are the displacement since last frame
@@ -411,171 +493,253 @@ bool hitboxes_overlap(
 ) {
 	if (a.type == Hitbox::NONE || b.type == Hitbox::NONE) return false;
 
-	if (a.type == Hitbox::ONEWAY) {
-		if (b.type == Hitbox::ONEWAY) return false; // One-ways don't collide with each other
-		else return hitboxes_overlap(b, bTx, bDis, a, aTx, aDis); // And they can only be acted upon
-	}
+	thread_local std::vector<WorldHitbox> aShapes, bShapes;
+	thread_local std::vector<Point2> aVertices, bVertices;
+	WorldShapes aSet = scratch_world(a, aTx, aShapes, aVertices);
+	WorldShapes bSet = scratch_world(b, bTx, bShapes, bVertices);
+	return world_hitboxes_overlap(aSet, aShapes[0], aDis, bSet, bShapes[0], bDis);
+}
 
-	if (a.type == Hitbox::COMPOSITE) {
-		// TODO: AABB check
-		for (const Hitbox& subHit : a.composite.hitboxes) {
-			if (hitboxes_overlap(subHit, aTx, aDis, b, bTx, bDis)) return true;
-		}
-		return false;
-	}
+bool hitboxes_penetration(const Hitbox& a, const Transform& aTx, const Hitbox& b, const Transform& bTx,
+	Vector2& normal, float& depth) {
+	if (a.type == Hitbox::NONE || b.type == Hitbox::NONE) return false;
 
-	if (b.type == Hitbox::COMPOSITE) {
-		// TODO: AABB check
-		for (const Hitbox& subHit : b.composite.hitboxes) {
-			if (hitboxes_overlap(a, aTx, aDis, subHit, bTx, bDis)) return true;
-		}
-		return false;
+	thread_local std::vector<WorldHitbox> aShapes, bShapes;
+	thread_local std::vector<Point2> aVertices, bVertices;
+	WorldShapes aSet = scratch_world(a, aTx, aShapes, aVertices);
+	WorldShapes bSet = scratch_world(b, bTx, bShapes, bVertices);
+	return world_hitboxes_penetration(aSet, aShapes[0], bSet, bShapes[0], normal, depth);
+}
+
+// Circles that get stretched are approximated by this many vertices
+#define WORLD_CIRCLE_VERTICES 12
+
+static AABB points_aabb(const Point2* points, size_t n) {
+	AABB box = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+	for (size_t i = 0; i < n; ++i) {
+		box |= AABB{ points[i].x, points[i].x, points[i].y, points[i].y };
 	}
+	return box;
+}
 
-	if (a.type == Hitbox::BOX) {
-		if (b.type == Hitbox::BOX) {
-			if (aTx.is_rect_invariant() && bTx.is_rect_invariant()) {
-				return box_box_test(aTx * a.box, bTx * b.box);
-			}
-			else {
-				if (!box_box_test(aTx * a.box, bTx * b.box)) return false;
-
-				Vector2 polyA[4], polyB[4];
-				aabb_to_poly(a.box, polyA);
-				aabb_to_poly(b.box, polyB);
-				for (int i = 0; i < 4; ++i) {
-					polyA[i] = aTx * polyA[i];
-					polyB[i] = bTx * polyB[i];
-				}
-				return poly_poly_test(Array<Point2>(polyA, 4), Array<Point2>(polyB, 4));
-			}
+void transform_hitbox(const Hitbox& hitbox, const Transform& tx,
+	std::vector<WorldHitbox>& shapes, std::vector<Point2>& vertices, size_t slot) {
+	WorldHitbox world;
+	world.type = hitbox.type;
+
+	switch (hitbox.type) {
+	case Hitbox::BOX:
+		if (tx.is_rect_invariant()) {
+			world.box = tx * hitbox.box;
+			world.aabb = world.box;
 		}
-		else if (b.type == Hitbox::CIRCLE) {
-			if (aTx.is_rect_invariant() && bTx.is_uniform_scale()) {
-				return box_circle_test(aTx * a.box, bTx * b.circle);
-			}
-			else {
-				// TODO approximate with polygons
+		else {
+			Point2 corners[4];
+			aabb_to_poly(hitbox.box, corners);
+
+			world.type = Hitbox::POLYGON;
+			world.polygon = { (uint32_t) vertices.size(), 4 };
+			for (const Point2& corner : corners) {
+				vertices.push_back(tx * corner);
 			}
+			world.aabb = points_aabb(&vertices[world.polygon.first], 4);
 		}
-		else if (b.type == Hitbox::LINE || b.type == Hitbox::ONEWAY) {
-			// TODO
+		break;
+	case Hitbox::CIRCLE:
+		if (tx.is_uniform_scale()) {
+			world.circle = tx * hitbox.circle;
+			world.aabb = {
+				world.circle.center.x - world.circle.radius,
+				world.circle.center.x + world.circle.radius,
+				world.circle.center.y - world.circle.radius,
+				world.circle.center.y + world.circle.radius
+			};
 		}
-	}
-	else if (a.type == Hitbox::CIRCLE) {
-		if (b.type == Hitbox::CIRCLE) {
-			if (aTx.is_uniform_scale() && bTx.is_uniform_scale()) {
-				return circle_circle_test(aTx * a.circle, bTx * b.circle);
-			}
-			else {
-				// TODO approximate with polygons
+		else {
+			world.type = Hitbox::POLYGON;
+			world.polygon = { (uint32_t) vertices.size(), WORLD_CIRCLE_VERTICES };
+			for (int i = 0; i < WORLD_CIRCLE_VERTICES; ++i) {
+				float angle = i * (2.f * 3.1415926535f / WORLD_CIRCLE_VERTICES);
+				vertices.push_back(tx * (hitbox.circle.center + Vector2::fromPolar(angle, hitbox.circle.radius)));
 			}
+			world.aabb = points_aabb(&vertices[world.polygon.first], WORLD_CIRCLE_VERTICES);
 		}
-		else if (b.type == Hitbox::LINE || b.type == Hitbox::ONEWAY) {
-			if (aTx.is_uniform_scale()) {
-				circle_line_test(aTx * a.circle, bTx * b.line);
-			}
-			else {
-				// TODO
-			}
+		break;
+	case Hitbox::LINE:
+	case Hitbox::ONEWAY:
+		world.line = tx * hitbox.line;
+		world.aabb = points_aabb(&world.line.p1, 2);
+		break;
+	case Hitbox::POLYGON:
+		world.polygon = { (uint32_t) vertices.size(), (uint32_t) hitbox.polygon.vertices.size() };
+		for (const Point2& p : hitbox.polygon.vertices) {
+			vertices.push_back(tx * p);
 		}
-		else if (b.type == Hitbox::BOX) {
-			return hitboxes_overlap(b, bTx, bDis, a, aTx, aDis);
+		world.aabb = points_aabb(vertices.data() + world.polygon.first, world.polygon.count);
+		break;
+	case Hitbox::COMPOSITE:
+	{
+		// Children are kept together so the composite can refer to them as one range
+		world.composite = { (uint32_t) shapes.size(), (uint32_t) hitbox.composite.hitboxes.size() };
+		world.aabb = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+		shapes.resize(world.composite.first + world.composite.count);
+		for (uint32_t i = 0; i < world.composite.count; ++i) {
+			transform_hitbox(hitbox.composite.hitboxes[i], tx, shapes, vertices, world.composite.first + i);
+			world.aabb |= shapes[world.composite.first + i].aabb;
 		}
+		break;
 	}
-	else if (a.type == Hitbox::LINE) {
-		if (b.type == Hitbox::LINE) {
-			return line_line_test(aTx * a.line, bTx * b.line);
-		}
-		else if (b.type == Hitbox::ONEWAY) {
-			Line lineA = aTx * a.line;
-			Line lineB = bTx * b.line;
-			if (!line_line_test(lineA, lineB)) return false;
-
-			// the lines intersect :O
-			Vector2 netDis = aDis - bDis;
-			Vector2 lineVec = lineB.p2 - lineB.p1;
-
-			// the lines are moving in the wrong direction
-			if (lineVec.cross(netDis) < 0.f) return false;
-
-			// check that the lines were not previously intersecting
-			// This (sort of) handles the case where an object barely crosses it while moving the wrong direction
-			// then reverses direction. (think of the launching glitch in line rider)
-			return !line_line_test(
-				{lineA.p1 + aDis, lineA.p2 + aDis},
-				{lineB.p1 + bDis, lineB.p2 + bDis}
-			);
-		}
-		else return hitboxes_overlap(b, bTx, bDis, a, aTx, aDis);
+	default:
+		world.type = Hitbox::NONE;
+		world.aabb = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+		break;
 	}
-	else if (a.type == Hitbox::POLYGON) {
 
+	shapes[slot] = world;
+}
+
+// Support function of a (non-composite) world hitbox
+static ConvexSupport support_of(const WorldShapes& set, const WorldHitbox& shape) {
+	ConvexSupport support;
+	support.external = nullptr;
+	support.n = 0;
+	support.radius = 0.f;
+	support.offset = { 0.f, 0.f };
+
+	switch (shape.type) {
+	case Hitbox::BOX:
+		aabb_to_poly(shape.box, support.inline_points);
+		support.n = 4;
+		break;
+	case Hitbox::CIRCLE:
+		support.inline_points[0] = shape.circle.center;
+		support.n = 1;
+		support.radius = shape.circle.radius;
+		break;
+	case Hitbox::LINE:
+	case Hitbox::ONEWAY:
+		support.inline_points[0] = shape.line.p1;
+		support.inline_points[1] = shape.line.p2;
+		support.n = 2;
+		break;
+	case Hitbox::POLYGON:
+		support.external = set.vertices + shape.polygon.first;
+		support.n = shape.polygon.count;
+		break;
+	default:
+		break;
 	}
-	//assert(false && "WARNING: Reached default case of hitboxes_overlap(...)\n");
-	return false;
+	return support;
 }
 
-bool box_box_test(AABB a, AABB b) {
-	return (
-		a.left < b.right && a.right > b.left &&
-		a.top < b.bottom && a.bottom > b.top
-	);
+static inline bool aabbs_touch(const AABB& a, const AABB& b) {
+	// Inclusive, so horizontal and vertical lines aren't rejected for having flat bounds
+	return !(a.left > b.right || b.left > a.right || a.top > b.bottom || b.top > a.bottom);
 }
 
-bool box_circle_test(AABB box, Circle circ) {
-	if (circ.center.x < box.left) {
-		// center is left of box
-		if (circ.center.y < box.top) {
-			// in top-left corner
-			float dx = circ.center.x - box.left;
-			float dy = circ.center.y - box.top;
-			return dx * dx + dy * dy < circ.radius * circ.radius;
-		}
-		else if (circ.center.y > box.bottom) {
-			// in bottom-left corner
-			float dx = circ.center.x - box.left;
-			float dy = circ.center.y - box.bottom;
-			return dx * dx + dy * dy < circ.radius * circ.radius;
-		}
-		else {
-			// just to the left
-			return circ.center.x < box.left - circ.radius;
+bool world_hitboxes_overlap(
+	const WorldShapes& aSet, const WorldHitbox& a, Vector2 aDis,
+	const WorldShapes& bSet, const WorldHitbox& b, Vector2 bDis,
+	Vector2* axis
+) {
+	if (a.type == Hitbox::NONE || b.type == Hitbox::NONE) return false;
+	if (!aabbs_touch(a.aabb, b.aabb)) return false;
+
+	// One-ways don't collide with each other
+	if (a.type == Hitbox::ONEWAY && b.type == Hitbox::ONEWAY) return false;
+
+	if (a.type == Hitbox::COMPOSITE) {
+		for (uint32_t i = 0; i < a.composite.count; ++i) {
+			if (world_hitboxes_overlap(aSet, aSet.shapes[a.composite.first + i], aDis, bSet, b, bDis, axis)) return true;
 		}
+		return false;
 	}
-	else if (circ.center.x > box.right) {
-		// center is left of box
-		if (circ.center.y < box.top) {
-			// in top-right corner
-			float dx = circ.center.x - box.right;
-			float dy = circ.center.y - box.top;
-			return dx * dx + dy * dy < circ.radius * circ.radius;
-		}
-		else if (circ.center.y > box.bottom) {
-			// in bottom-right corner
-			float dx = circ.center.x - box.right;
-			float dy = circ.center.y - box.bottom;
-			return dx * dx + dy * dy < circ.radius * circ.radius;
-		}
-		else {
-			// just to the right
-			return circ.center.x > box.right + circ.radius;
+
+	if (b.type == Hitbox::COMPOSITE) {
+		for (uint32_t i = 0; i < b.composite.count; ++i) {
+			if (world_hitboxes_overlap(aSet, a, aDis, bSet, bSet.shapes[b.composite.first + i], bDis, axis)) return true;
 		}
+		return false;
 	}
-	else {
-		if (circ.center.y < box.top) {
-			// above
-			return circ.center.y < box.top - circ.radius;
-		}
-		else if (circ.center.y > box.bottom) {
-			// below
-			return circ.center.y > box.bottom + circ.radius;
-		}
-		else {
-			// center is inside box
-			return true;
+
+	// Closed forms for the two most common pairs; everything else goes through GJK
+	if (a.type == Hitbox::BOX && b.type == Hitbox::BOX) return box_box_test(a.box, b.box);
+	if (a.type == Hitbox::CIRCLE && b.type == Hitbox::CIRCLE) return circle_circle_test(a.circle, b.circle);
+
+	Vector2 no_hint = { 0.f, 0.f };
+	ConvexSupport supA = support_of(aSet, a);
+	ConvexSupport supB = support_of(bSet, b);
+	if (!gjk_overlap(supA, supB, axis != nullptr ? *axis : no_hint)) return false;
+
+	if (a.type == Hitbox::ONEWAY || b.type == Hitbox::ONEWAY) {
+		const Line& line = a.type == Hitbox::ONEWAY ? a.line : b.line;
+
+		// the other shape is moving in the wrong direction relative to the line
+		Vector2 netDis = a.type == Hitbox::ONEWAY ? bDis - aDis : aDis - bDis;
+		if ((line.p2 - line.p1).cross(netDis) < 0.f) return false;
+
+		// check that they were not already overlapping at their previous positions
+		// This (sort of) handles the case where an object barely crosses it while moving the wrong direction
+		// then reverses direction. (think of the launching glitch in line rider)
+		supA.offset = -aDis;
+		supB.offset = -bDis;
+		Vector2 before = { 0.f, 0.f };
+		return !gjk_overlap(supA, supB, before);
+	}
+	return true;
+}
+
+bool world_hitboxes_penetration(
+	const WorldShapes& aSet, const WorldHitbox& a,
+	const WorldShapes& bSet, const WorldHitbox& b,
+	Vector2& normal, float& depth
+) {
+	if (a.type == Hitbox::NONE || b.type == Hitbox::NONE) return false;
+	if (!aabbs_touch(a.aabb, b.aabb)) return false;
+
+	// Composites report their deepest pair of children
+	if (a.type == Hitbox::COMPOSITE || b.type == Hitbox::COMPOSITE) {
+		bool split_a = a.type == Hitbox::COMPOSITE;
+		const WorldHitbox& comp = split_a ? a : b;
+		bool found = false;
+		for (uint32_t i = 0; i < comp.composite.count; ++i) {
+			const WorldHitbox& child = (split_a ? aSet : bSet).shapes[comp.composite.first + i];
+			Vector2 n;
+			float d;
+			bool hit = split_a ?
+				world_hitboxes_penetration(aSet, child, bSet, b, n, d) :
+				world_hitboxes_penetration(aSet, a, bSet, child, n, d);
+			if (hit && (!found || d > depth)) {
+				found = true;
+				normal = n;
+				depth = d;
+			}
 		}
+		return found;
 	}
+
+	if (a.type == Hitbox::CIRCLE && b.type == Hitbox::CIRCLE) {
+		Vector2 between = a.circle.center - b.circle.center;
+		float dist = between.magnitude();
+		depth = a.circle.radius + b.circle.radius - dist;
+		if (depth <= 0.f) return false;
+		normal = dist > 0.f ? between / dist : Vector2{ 0.f, -1.f };
+		return true;
+	}
+
+	ConvexSupport supA = support_of(aSet, a);
+	ConvexSupport supB = support_of(bSet, b);
+	Vector2 axis = { 0.f, 0.f };
+	GjkSimplex simplex;
+	if (!gjk_overlap(supA, supB, axis, &simplex)) return false;
+	return epa_penetration(supA, supB, simplex, normal, depth);
+}
+
+bool box_box_test(AABB a, AABB b) {
+	return (
+		a.left < b.right && a.right > b.left &&
+		a.top < b.bottom && a.bottom > b.top
+	);
 }
 
 bool circle_circle_test(Circle a, Circle b) {
@@ -585,41 +749,3 @@ bool circle_circle_test(Circle a, Circle b) {
 
 	return dx * dx + dy * dy < dist * dist;
 }
-
-bool circle_line_test(Circle circle, Line line) {
-	// TODO: Optimize
-
-	Vector2 parallel = line.p2 - line.p1;
-	float parlen = parallel.magnitude();
-	parallel /= parlen;
-	Vector2 to_circle = circle.center - line.p1;
-	// project center onto line
-	float projpos = to_circle.dot(parallel);
-	if (projpos < 0) { // outside the line on the first point side
-		// distance to endpoint
-		return to_circle.x * to_circle.x + to_circle.y * to_circle.y 
-			            < circle.radius * circle.radius;
-	}
-	else if (projpos > parlen) { // outside the line on the second point side
-		Vector2 other = circle.center - line.p2;
-		// distance to endpoint
-		return other.x * other.x + other.y * other.y
-			            < circle.radius * circle.radius;
-	}
-	return fabs(to_circle.cross(parallel)) < circle.radius;
-}
-
-static bool line_line_test(Line a, Line b) {
-	Vector2 aVec = a.p2 - a.p1;
-	Vector2 bVec = b.p2 - b.p1;
-	// test intersection via rotation directions
-	// i.e. if for both lines the endpoints of the other line lie on opposite sides of the line
-	// TODO: Unwind and simplify (optimize)
-	return
-		signbit(aVec.cross(b.p1 - a.p1)) != signbit(aVec.cross(b.p2 - a.p1)) &&
-		signbit(bVec.cross(a.p1 - b.p1)) != signbit(bVec.cross(a.p2 - b.p1));
-}
-
-static bool poly_poly_test(Array<Point2> a, Array<Point2> b) {
-	return false;
-}
\ No newline at end of file
@@ -11,8 +11,12 @@
 #include "transform.h"
 #include "SDL_gpu.h"
 #include <cstdio>
+#include <vector>
 #include "angelscript.h"
 
+class MemoryPool;
+class BinaryReader;
+
 namespace Errors {
 	const error_data
 		InvalidHitboxType = { 180, "Hitbox type is invalid." },
@@ -60,7 +64,7 @@ private:
 	static Array<const ColliderType> types;
 
 public:
-	static Result<> init(FILE* stream);
+	static Result<> init(BinaryReader& reader);
 	inline static bool acts_on(const ColliderType* a, const ColliderType* b) {
 		if (a == nullptr || b == nullptr) return false;
 		else return table(a->id, b->id);
@@ -80,7 +84,7 @@ struct ColliderChannel {
 
 	static Array<const ColliderChannel> channels;
 
-	static Result<> init(FILE* stream);
+	static Result<> init(BinaryReader& reader);
 	static const ColliderChannel* by_name(const char* name);
 };
 
@@ -94,6 +98,15 @@ struct Collider {
 	Hitbox hitbox;
 };
 
+/// Local-space bounds of a hitbox. NONE gives an inverted (empty) box that vanishes when combined with |
+AABB hitbox_aabb(const Hitbox& hitbox);
+
+/// Makes a composite out of subs (reordering them) with its bounds filled in.
+// Composites with more than a few children are split at the median along their longer axis, recursively,
+// into a tree of nested composites, so overlap tests can skip whole groups with one bounds check.
+// The tree needs at most n more hitboxes from pool; if it runs out, the remaining groups are left flat.
+Hitbox make_composite(Hitbox* subs, size_t n, MemoryPool& pool);
+
 void render_hitbox(GPU_Target* context, const Transform& tx, const Hitbox& hitbox, const SDL_Color& color);
 void render_colliders(GPU_Target* context, const Transform& tx, const Array<const Collider>& colliders);
 
@@ -103,4 +116,57 @@ bool hitboxes_overlap(
 	const Hitbox& b, const Transform& bTx, Vector2 bDis
 );
 
+/// How far a has to move along normal to stop overlapping b. False if they don't overlap.
+// Composites report their deepest pair of children.
+bool hitboxes_penetration(
+	const Hitbox& a, const Transform& aTx,
+	const Hitbox& b, const Transform& bTx,
+	Vector2& normal, float& depth
+);
+
+/// A hitbox that has already been placed in the world.
+// Transforms are applied once, so tests between world hitboxes are pure geometry.
+// Boxes that don't stay axis-aligned, and circles that don't scale uniformly, become polygons.
+struct WorldHitbox {
+	Hitbox::Type type;
+	AABB aabb; // world bounds, inverted for NONE
+
+	union {
+		AABB box;
+		Line line;
+		Circle circle;
+		struct {
+			uint32_t first, count; // range in the owner's vertex list
+		} polygon;
+		struct {
+			uint32_t first, count; // range in the owner's shape list
+		} composite;
+	};
+};
+
+/// Shapes and vertices that WorldHitbox ranges refer to
+struct WorldShapes {
+	const WorldHitbox* shapes;
+	const Point2* vertices;
+};
+
+/// Transforms a hitbox into shapes[slot] (which must exist); composites append their children to shapes
+void transform_hitbox(const Hitbox& hitbox, const Transform& tx,
+	std::vector<WorldHitbox>& shapes, std::vector<Point2>& vertices, size_t slot);
+
+/// Same as hitboxes_overlap, for hitboxes that are already in world space
+// axis optionally carries a separating direction for this pair from one frame to the next (see gjk_overlap).
+bool world_hitboxes_overlap(
+	const WorldShapes& aSet, const WorldHitbox& a, Vector2 aDis,
+	const WorldShapes& bSet, const WorldHitbox& b, Vector2 bDis,
+	Vector2* axis = nullptr
+);
+
+/// Same as hitboxes_penetration, for hitboxes that are already in world space
+bool world_hitboxes_penetration(
+	const WorldShapes& aSet, const WorldHitbox& a,
+	const WorldShapes& bSet, const WorldHitbox& b,
+	Vector2& normal, float& depth
+);
+
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "util.h"
 #include "cstrkey.h"
 #include "fileutil.h"
+#include "snapshot.h"
 #include <new>
 #include <vector>
 #include <algorithm>
@@ -163,61 +164,63 @@ std::vector<ControllerInstance*> get_controllers_by_typename(const char* name) {
 	return result;
 }
 
-Result<> init_controller_types(FILE* stream) {
-	try {
-		int n_controllers = read<uint16_t>(stream);
+Result<> init_controller_types(BinaryReader& reader) {
+	uint16_t n_controllers;
+	check_void(reader.read(n_controllers));
 
-		for (int i = 0; i < n_controllers; ++i) {
-			const char* name = read_string<uint16_t>(stream);
-			Array<const char*> axes(read<uint16_t>(stream));
-			for (auto& n : axes) {
-				n = read_string<uint16_t>(stream);
-			}
-			Array<const char*> buttons(read<uint16_t>(stream));
-			for (auto& n : buttons) {
-				n = read_string<uint16_t>(stream);
-			}
-			create_controller_type(name, axes, buttons);
+	for (int i = 0; i < n_controllers; ++i) {
+		const char* name;
+		check_void(reader.read_string<uint16_t>(name));
+		uint16_t n_axes;
+		check_void(reader.read(n_axes));
+		Array<const char*> axes(n_axes);
+		for (auto& n : axes) {
+			check_void(reader.read_string<uint16_t>(n));
 		}
-
-		return Result<>::success;
-	}
-	catch (Error& e) {
-		return e;
+		uint16_t n_buttons;
+		check_void(reader.read(n_buttons));
+		Array<const char*> buttons(n_buttons);
+		for (auto& n : buttons) {
+			check_void(reader.read_string<uint16_t>(n));
+		}
+		create_controller_type(name, axes, buttons);
 	}
+
+	return Result<>::success;
 }
 
-Result<> init_controllers(FILE* stream) {
-	try {
-		int n_controllers = read<uint16_t>(stream);
+Result<> init_controllers(BinaryReader& reader) {
+	uint16_t n_controllers;
+	check_void(reader.read(n_controllers));
 
-		for (int i = 0; i < n_controllers; ++i) {
-			const char* name = read_string<uint16_t>(stream);
-			const char* tname = read_string<uint16_t>(stream);
+	for (int i = 0; i < n_controllers; ++i) {
+		const char* name;
+		const char* tname;
+		check_void(reader.read_string<uint16_t>(name));
+		check_void(reader.read_string<uint16_t>(tname));
 
-			const VirtualController* type = get_controller_type_by_name(tname);
-			if (type == nullptr) return Error(Errors::NoSuchControllerType, tname);
+		const VirtualController* type = get_controller_type_by_name(tname);
+		if (type == nullptr) return Error(Errors::NoSuchControllerType, tname);
 
-			ControllerInstance* inst = create_controller(type, name);
+		ControllerInstance* inst = create_controller(type, name);
 
-			char buffer[256];
+		char buffer[256];
 
-			auto n_axes = type->axis_names.size();
-			for (int axis = 0; axis < n_axes; ++axis) {
-				bind_spec_pos(inst, axis, read_string<uint16_t>(stream, buffer));
-				bind_spec_neg(inst, axis, read_string<uint16_t>(stream, buffer));
-			}
+		auto n_axes = type->axis_names.size();
+		for (int axis = 0; axis < n_axes; ++axis) {
+			check_void(reader.read_string<uint16_t>(buffer));
+			bind_spec_pos(inst, axis, buffer);
+			check_void(reader.read_string<uint16_t>(buffer));
+			bind_spec_neg(inst, axis, buffer);
+		}
 
-			auto n_btns = type->button_names.size();
-			for (int btn = 0; btn < n_btns; ++btn) {
-				bind_spec(inst, btn, read_string<uint16_t>(stream, buffer));
-			}
+		auto n_btns = type->button_names.size();
+		for (int btn = 0; btn < n_btns; ++btn) {
+			check_void(reader.read_string<uint16_t>(buffer));
+			bind_spec(inst, btn, buffer);
 		}
-		return Result<>::success;
-	}
-	catch (Error& e) {
-		return e;
 	}
+	return Result<>::success;
 }
 
 #pragma endregion
@@ -268,6 +271,77 @@ void update_inputs(float dt) {
 	}
 }
 
+#define SNAPSHOT_CONTROLLERS SNAPSHOT_TAG('C', 'T', 'R', 'L')
+
+void save_controllers(SnapshotWriter& writer) {
+	writer.begin_section(SNAPSHOT_CONTROLLERS);
+	writer.write<uint32_t>((uint32_t) controllers.size());
+
+	for (const InstEntry& entry : controllers) {
+		const ControllerInstance* inst = entry.inst;
+		writer.write_string(entry.name);
+		writer.write<uint32_t>((uint32_t) inst->axes.size());
+		writer.write<uint32_t>((uint32_t) inst->buttons.size());
+
+		for (const VirtualAxisState& axis : inst->axes) {
+			writer.write<float>(axis.position);
+			writer.write<float>(axis.velocity);
+		}
+		for (const VirtualButtonState& button : inst->buttons) {
+			writer.write<uint8_t>(button.state | (button.pressed << 1) | (button.released << 2));
+		}
+	}
+}
+
+Result<> read_controllers(SnapshotReader& reader, std::vector<ControllerSnapshot>& out) {
+	try {
+		reader.expect_section(SNAPSHOT_CONTROLLERS);
+		uint32_t n_controllers = reader.read<uint32_t>();
+
+		for (uint32_t i = 0; i < n_controllers; ++i) {
+			uint32_t len;
+			const char* str = reader.read_string(len);
+			std::string name(str, len);
+			uint32_t n_axes = reader.read<uint32_t>();
+			uint32_t n_buttons = reader.read<uint32_t>();
+
+			ControllerInstance* inst = get_controller_by_name(name.c_str());
+			if (inst == nullptr || inst->axes.size() != n_axes || inst->buttons.size() != n_buttons) {
+				return Error(Errors::SnapshotBadSection, "Controller " + name + " differs");
+			}
+
+			out.emplace_back();
+			ControllerSnapshot& saved = out.back();
+			saved.inst = inst;
+			saved.axes.resize(n_axes * 2);
+			reader.read_bytes(saved.axes.data(), saved.axes.size() * sizeof(float));
+			saved.buttons.resize(n_buttons);
+			reader.read_bytes(saved.buttons.data(), n_buttons);
+		}
+	}
+	catch (Error& err) {
+		return err;
+	}
+	return Result<>::success;
+}
+
+void restore_controllers(const std::vector<ControllerSnapshot>& saved) {
+	for (const ControllerSnapshot& cont : saved) {
+		const float* axis_values = cont.axes.data();
+		for (VirtualAxisState& axis : cont.inst->axes) {
+			axis.position = *axis_values++;
+			axis.velocity = *axis_values++;
+		}
+		const uint8_t* button_bits = cont.buttons.data();
+		for (VirtualButtonState& button : cont.inst->buttons) {
+			uint8_t bits = *button_bits++;
+			button.state = (bits & 1) != 0;
+			button.pressed = (bits & 2) != 0;
+			button.released = (bits & 4) != 0;
+		}
+	}
+}
+
 static float get_axis_value(RealInput& input) {
 	switch (input.type) {
 	case RealInput::NONE:
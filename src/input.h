@@ -11,6 +11,7 @@
 #include <SDL2/SDL_keycode.h>
 
 #include <array>
+#include <vector>
 
 namespace Errors {
 	const error_data
@@ -160,8 +161,10 @@ ControllerInstance* get_controller_by_name(const char* name);
 
 std::vector<ControllerInstance*> get_controllers_by_typename(const char* name);
 
-Result<> init_controller_types(FILE* stream);
-Result<> init_controllers(FILE* stream);
+class BinaryReader;
+
+Result<> init_controller_types(BinaryReader& reader);
+Result<> init_controllers(BinaryReader& reader);
 
 void RegisterInputTypes(asIScriptEngine* engine);
 int RegisterControllerTypes(asIScriptEngine* engine);
@@ -169,4 +172,21 @@ int RegisterControllerTypes(asIScriptEngine* engine);
 VirtualController* create_controller_type(const char* name, Array<const char*> axis_names, Array<const char*> button_names);
 
 void bind_from_ini(const char* controller, const char* input, const char* spec);
-void dump_controller_config(FILE* stream);
\ No newline at end of file
+void dump_controller_config(FILE* stream);
+
+class SnapshotWriter;
+class SnapshotReader;
+
+/// One controller's axis and button state read back from a snapshot, but not applied yet
+struct ControllerSnapshot {
+	ControllerInstance* inst;
+	std::vector<float> axes;      // position and velocity of each axis
+	std::vector<uint8_t> buttons; // state | pressed << 1 | released << 2
+};
+
+/// Writes the current axis and button state of every controller instance (bindings are config, not state)
+void save_controllers(SnapshotWriter& writer);
+/// Reads what save_controllers wrote, checking it against the controllers that exist. Doesn't touch them.
+Result<> read_controllers(SnapshotReader& reader, std::vector<ControllerSnapshot>& out);
+/// Applies state from read_controllers
+void restore_controllers(const std::vector<ControllerSnapshot>& saved);
\ No newline at end of file
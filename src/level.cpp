@@ -4,12 +4,58 @@
 #include "error.h"
 #include "fileutil.h"
 #include "assetmanager.h"
+#include "snapshot.h"
+#include "levelstream.h"
 #include "SDL_gpu.h"
-
-__forceinline static Result<const Level*> read_level(FILE* stream, MemoryPool& pool,
-	uint32_t namelen, AABB boundary, uint32_t n_tilemaps, uint32_t n_objects,
-	uint32_t n_entities, uint32_t n_areas, uint32_t n_edge_triggers,
-	const DirContext& context);
+#include "transform.h"
+#include "util.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+// Layout of a level file, after the magic number (see tools/buildlevel.py).
+// Strings, the chunk index and polygon vertices are used where they lie in the mapped file. Tile chunks are
+// stored at the end, a whole chunk at a time, and are copied out of the mapping as layers take them in.
+struct LevelHeader {
+	uint32_t name; // in the string table
+	AABB boundary;
+	FileSection strings, tilemaps, chunk_index, objects, colliders, hitboxes, vertices, entities, areas, edge_triggers;
+	uint32_t n_stored_chunks; // chunks that aren't blank
+};
+
+struct TilemapRecord {
+	uint32_t tileset; // filename, in the string table
+	uint32_t width, height;
+	int32_t z_order;
+	Vector2 offset, scale, parallax;
+	uint32_t solid;
+	uint32_t chunks; // first entry of the layer in the chunk index, which holds a file offset per chunk (row-major), 0 if it's blank
+};
+
+struct SceneObjectRecord {
+	uint32_t sprite; // filename, in the string table
+	GPU_Rect clip;
+	Vector2 display, position;
+	int32_t z_order;
+	float rotation;
+	Vector2 scale;
+	RecordRange colliders;
+};
+
+/// Sections of a mapped level file, in place
+struct LevelImage {
+	LevelHeader header;
+	MappedShapes shapes;
+	const TilemapRecord* tilemaps;
+	const uint32_t* chunk_index;
+	const SceneObjectRecord* objects;
+};
+
+__forceinline static Result<const Level*> read_level(const MappedFile& file, const LevelImage& image, MemoryPool& pool,
+	bool streamed, const DirContext& context);
+
+static size_t rtree_node_count(size_t n_items);
 
 Result<const Level*> load_level(const char* filename, const DirContext& context) {
 	std::string realfile;
@@ -20,108 +66,187 @@ Result<const Level*> load_level(const char* filename, const DirContext& context)
 		if (maybe != nullptr) return maybe;
 	}
 
-	auto file = open(realfile.c_str(), "rb");
-
-	if (!file) {
-		return file.err;
+	auto mapped = MappedFile::map(realfile.c_str());
+	if (!mapped) {
+		return mapped.err;
 	}
-	FILE* stream = file;
-
-	size_t filesize = size(file);
+	MappedFile file = mapped;
 
-	if (!check_header(stream, LEVEL_MAGIC_NUMBER)) {
+	LevelImage image;
+	if (file.size < LEVEL_MAGIC_NUMBER_LENGTH || memcmp(file.data, LEVEL_MAGIC_NUMBER, LEVEL_MAGIC_NUMBER_LENGTH) != 0 ||
+		!file.copy(LEVEL_MAGIC_NUMBER_LENGTH, image.header)) {
+		file.unmap();
 		return Errors::InvalidLevelHeader;
 	}
+	const LevelHeader& header = image.header;
 
-	uint32_t namelen, n_tilemaps, n_objects, n_entities, n_areas, n_edge_triggers,
-		tn_tiles, tn_colliders, tn_nested_hitboxes;
-	AABB boundary;
-
+	// Every section has to lie within the file before the header's counts are trusted to size the pool
 	try {
-		namelen = read<uint32_t>(stream);
-		boundary = read<AABB>(stream);
-		n_tilemaps = read<uint32_t>(stream);
-		n_objects = read<uint32_t>(stream);
-		n_entities = read<uint32_t>(stream);
-		n_areas = read<uint32_t>(stream);
-		n_edge_triggers = read<uint32_t>(stream);
-		tn_tiles = read<uint32_t>(stream);
-		tn_colliders = read<uint32_t>(stream);
-		tn_nested_hitboxes = read<uint32_t>(stream);
+		StringTable strings;
+		strings.init(file, header.strings);
+		image.shapes.init(file, strings, header.hitboxes, header.vertices, header.colliders);
+		image.tilemaps = file.view<TilemapRecord>(header.tilemaps);
+		image.chunk_index = file.view<uint32_t>(header.chunk_index);
+		image.objects = file.view<SceneObjectRecord>(header.objects);
+
+		// Chunks are read straight out of the mapping later (on the streaming thread, for streamed levels), so they're checked now
+		for (uint32_t i = 0; i < header.chunk_index.count; ++i) {
+			uint32_t offset = image.chunk_index[i];
+			if (offset != 0 && (size_t) offset + TILE_CHUNK_SIZE * TILE_CHUNK_SIZE * sizeof(uint16_t) > file.size) {
+				throw Error(Errors::InvalidMappedData, "tile chunk");
+			}
+		}
 	}
 	catch (Error& err) {
-		fclose(stream);
+		file.unmap();
 		return err;
 	}
 
 	size_t poolsize =
 		sizeof(Level) +
-		namelen + 1 + (8 - (namelen + 1) % 8) +
-		n_tilemaps * sizeof(Tilemap) +
-		n_objects * sizeof(SceneObject) +
-		n_entities * sizeof(EntitySpawnPoint) +
-		n_areas * sizeof(LevelArea) +
-		n_edge_triggers * sizeof(EdgeTrigger) +
-		tn_tiles * sizeof(uint16_t) +
-		tn_colliders * sizeof(Collider) +
-		tn_nested_hitboxes * sizeof(Hitbox);
-
-	if (LEVEL_BALLPARK_CHECKED && !ballpark(poolsize, filesize)) {
-		fprintf(stderr, "Size suggested by header (%zd bytes) is significantly different than the file's size. (%zd bytes) "
-			"Perhaps the asset is corrupted or incorrectly formatted.\n", poolsize, filesize);
-		if (LEVEL_BALLPARK_REQUIRED) return Errors::InvalidLevelHeaderSizes;
-	}
+		header.tilemaps.count * (sizeof(Tilemap) + sizeof(Array<const uint32_t>)) +
+		header.objects.count * sizeof(SceneObject) +
+		header.entities.count * sizeof(EntitySpawnPoint) +
+		header.areas.count * sizeof(LevelArea) +
+		header.edge_triggers.count * sizeof(EdgeTrigger) +
+		header.colliders.count * sizeof(Collider) +
+		header.hitboxes.count * 2 * sizeof(Hitbox) + // composites get up to one extra hitbox per child for their trees
+		(rtree_node_count(header.objects.count) + rtree_node_count(header.areas.count)) * sizeof(Level::RTree);
+
+	bool streamed = (size_t) header.n_stored_chunks * TILE_CHUNK_SIZE * TILE_CHUNK_SIZE * sizeof(uint16_t) > LEVEL_STREAM_THRESHOLD;
 
 	LOG_VERBOSE("Number of bytes needed for level data: %zd\n", poolsize);
 	MemoryPool pool(poolsize);
 
 	check_assign_ref(const DirContext& subcontext, context + filename, sctx);
-	auto result = read_level(stream, pool,
-		namelen, boundary, n_tilemaps, n_objects, n_entities, n_areas, n_edge_triggers,
-		subcontext);
+	auto result = read_level(file, image, pool, streamed, subcontext);
 
 	LOG_VERBOSE("Read level data with %zd/%zd bytes of slack in memory pool\n", pool.get_slack(), pool.get_size());
 
-	fclose(stream);
-
 	if (result) {
 		AssetManager::store(filename, result.value);
 	}
 	else {
 		// Clean up from the error
 		pool.free();
+		file.unmap();
 	}
 
 	return result;
 }
 
-__forceinline static Result<const Level*> read_level(FILE* stream, MemoryPool& pool,
-	uint32_t namelen, AABB boundary, uint32_t n_tilemaps, uint32_t n_objects,
-	uint32_t n_entities, uint32_t n_areas, uint32_t n_edge_triggers,
-	const DirContext& context) {
+// World bounds of what an object draws and what it collides with
+static AABB scene_object_bounds(const SceneObject& obj) {
+	Transform tx = Transform::scal_rot_trans(obj.scale, obj.rotation, obj.position);
+
+	AABB bounds = tx * AABB{ -obj.display.x, obj.clip.w - obj.display.x, -obj.display.y, obj.clip.h - obj.display.y };
+	for (const Collider& collider : obj.colliders) {
+		if (collider.hitbox.type != Hitbox::NONE) bounds |= tx * hitbox_aabb(collider.hitbox);
+	}
+	return bounds;
+}
+
+// Nodes an STR tree over n items takes: every level has ceil(n / M) nodes for the n entries below it
+static size_t rtree_node_count(size_t n_items) {
+	if (n_items == 0) return 0;
+
+	size_t count = 0;
+	do {
+		n_items = (n_items + RTREE_MAX_CHILDREN - 1) / RTREE_MAX_CHILDREN;
+		count += n_items;
+	} while (n_items > 1);
+	return count;
+}
+
+// Sort-Tile-Recursive: the entries are sorted by x and cut into sqrt(P) vertical slices (P being the number of nodes
+// they need), each slice is sorted by y and packed M at a time, and the nodes made that way are the entries of the
+// level above, until one node is left.
+static const Level::RTree* pack_rtree(std::vector<Level::RTree::Child>& entries, MemoryPool& pool) {
+	using Child = Level::RTree::Child;
+	const size_t M = RTREE_MAX_CHILDREN;
+
+	thread_local std::vector<Child> parents;
+	for (;;) {
+		const size_t n = entries.size();
+		const size_t n_nodes = (n + M - 1) / M;
+		const size_t n_slices = (size_t) ceil(sqrt((double) n_nodes));
+		const size_t slice_size = n_slices * M; // a multiple of M, so no node straddles two slices
+
+		std::sort(entries.begin(), entries.end(), [](const Child& a, const Child& b) {
+			return a.bounds.left + a.bounds.right < b.bounds.left + b.bounds.right;
+		});
+		for (size_t first = 0; first < n; first += slice_size) {
+			std::sort(entries.begin() + first, entries.begin() + SDL_min(first + slice_size, n), [](const Child& a, const Child& b) {
+				return a.bounds.top + a.bounds.bottom < b.bounds.top + b.bounds.bottom;
+			});
+		}
+
+		Level::RTree* nodes = pool.alloc<Level::RTree>(n_nodes);
+		parents.clear();
+		for (size_t k = 0; k < n_nodes; ++k) {
+			Level::RTree& node = nodes[k];
+			node.n_children = SDL_min(M, n - k * M);
+			node.bounding_rect = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+			for (size_t c = 0; c < node.n_children; ++c) {
+				node.children[c] = entries[k * M + c];
+				node.bounding_rect |= node.children[c].bounds;
+			}
+
+			Child parent;
+			parent.bounds = node.bounding_rect;
+			parent.subtree = &node;
+			parent.isLeaf = false;
+			parents.push_back(parent);
+		}
+
+		if (n_nodes == 1) return nodes;
+		entries.swap(parents);
+	}
+}
+
+// Anything with an aabb can be indexed; items are referred to by their index in the array
+template <class T>
+static const Level::RTree* build_rtree(const Array<const T>& items, MemoryPool& pool) {
+	if (items.size() == 0) return nullptr;
+
+	std::vector<Level::RTree::Child> entries(items.size());
+	for (size_t i = 0; i < items.size(); ++i) {
+		entries[i].bounds = items[i].aabb;
+		entries[i].item = (uint32_t) i;
+		entries[i].isLeaf = true;
+	}
+	return pack_rtree(entries, pool);
+}
+
+__forceinline static Result<const Level*> read_level(const MappedFile& file, const LevelImage& image, MemoryPool& pool,
+	bool streamed, const DirContext& context) {
 
 	try {
+		const LevelHeader& header = image.header;
+		const StringTable& strings = image.shapes.strings;
+		const uint32_t n_tilemaps = header.tilemaps.count, n_objects = header.objects.count;
+		const uint32_t n_entities = header.entities.count, n_areas = header.areas.count, n_edge_triggers = header.edge_triggers.count;
+
 		Level* level = pool.alloc<Level>();
 
-		level->name = read_string(stream, namelen, pool);
-		level->boundary = boundary;
+		level->file = file;
+		level->name = strings.at(header.name);
+		level->boundary = header.boundary;
+		level->streamed = streamed;
 
 		Tilemap* tilemaps = pool.alloc<Tilemap>(n_tilemaps);
-		for (int i = 0; i < n_tilemaps; ++i) {
+		Array<const uint32_t>* chunk_offsets = pool.alloc<Array<const uint32_t>>(n_tilemaps);
+		for (uint32_t i = 0; i < n_tilemaps; ++i) {
+			const TilemapRecord& record = image.tilemaps[i];
 			auto& tmap = tilemaps[i];
 
-			uint32_t tilesetnamelen = read<uint32_t>(stream);
-			uint32_t width = read<uint32_t>(stream);
-			uint32_t height = read<uint32_t>(stream);
-			uint32_t area = width * height;
+			tmap.z_order = record.z_order;
+			tmap.offset = record.offset;
+			tmap.scale = record.scale;
+			tmap.parallax = record.parallax;
+			tmap.solid = record.solid != 0;
 
-			tmap.z_order = read<int32_t>(stream);
-			tmap.offset = read<Vector2>(stream);
-			tmap.scale = read<Vector2>(stream);
-			tmap.parallax = read<Vector2>(stream);
-			tmap.solid = read<bool>(stream);
-
-			auto tileset = read_referenced_tileset(stream, tilesetnamelen, context);
+			auto tileset = load_tileset(strings.at(record.tileset), context);
 			if (tileset) {
 				tmap.tileset = tileset;
 			}
@@ -130,28 +255,31 @@ __forceinline static Result<const Level*> read_level(FILE* stream, MemoryPool& p
 				return tileset.err;
 			}
 
-			uint16_t* tiles = pool.alloc<uint16_t>(area);
-			for (int xy = 0; xy < area; ++xy) {
-				tiles[xy] = read<uint16_t>(stream);
+			size_t n_chunks = TileGrid::chunk_count(record.width, record.height);
+			if (!RecordRange{ record.chunks, (uint32_t) n_chunks }.within(header.chunk_index.count)) {
+				throw Error(Errors::InvalidLevelHeaderSizes, "tile chunk index");
 			}
-			new(&tmap.tiles) Array2D<uint16_t>(tiles, width, height);
+			new(&chunk_offsets[i]) Array<const uint32_t>(image.chunk_index + record.chunks, n_chunks);
+
+			tmap.tiles = TileGrid::allocate(record.width, record.height, false);
 		}
 
 		new(&level->layers) Array<const Tilemap>(tilemaps, n_tilemaps);
+		new(&level->chunk_offsets) Array<const Array<const uint32_t>>(chunk_offsets, n_tilemaps);
 
 		SceneObject* objects = pool.alloc<SceneObject>(n_objects);
-		for (int i = 0; i < n_objects; ++i) {
+		for (uint32_t i = 0; i < n_objects; ++i) {
+			const SceneObjectRecord& record = image.objects[i];
 			auto& obj = objects[i];
 
-			uint32_t texnamelen = read<uint32_t>(stream);
-			obj.display = read<Vector2>(stream);
-			obj.position = read<Vector2>(stream);
-			obj.z_order = read<int32_t>(stream);
-			obj.rotation = read<float>(stream);
-			obj.scale = read<Vector2>(stream);
-			uint32_t n_colliders = read<uint32_t>(stream);
+			obj.clip = record.clip;
+			obj.display = record.display;
+			obj.position = record.position;
+			obj.z_order = record.z_order;
+			obj.rotation = record.rotation;
+			obj.scale = record.scale;
 
-			auto sprite = read_referenced_sprite(stream, texnamelen, context);
+			auto sprite = load_sprite(strings.at(record.sprite), context);
 			if (sprite) {
 				obj.sprite = sprite;
 			}
@@ -159,24 +287,49 @@ __forceinline static Result<const Level*> read_level(FILE* stream, MemoryPool& p
 				ERR_RELEASE("Unable to load referenced sprite (%s).\n", std::to_string(sprite.err).c_str());
 				return sprite.err;
 			}
+
+			obj.colliders = image.shapes.collider_range(record.colliders, pool);
+			obj.aabb = scene_object_bounds(obj);
 		}
 
 		EntitySpawnPoint* entities = pool.alloc<EntitySpawnPoint>(n_entities);
-		for (int i = 0; i < n_entities; ++i) {
+		for (uint32_t i = 0; i < n_entities; ++i) {
 			assert(false && "NOT IMPLEMENTED!");
 		}
 
 		LevelArea* areas = pool.alloc<LevelArea>(n_areas);
-		for (int i = 0; i < n_areas; ++i) {
+		for (uint32_t i = 0; i < n_areas; ++i) {
 			assert(false && "NOT IMPLEMENTED!");
 		}
 
 		EdgeTrigger* edge_triggers = pool.alloc<EdgeTrigger>(n_edge_triggers);
-		for (int i = 0; i < n_edge_triggers; ++i) {
+		for (uint32_t i = 0; i < n_edge_triggers; ++i) {
 			assert(false && "NOT IMPLEMENTED!");
 		}
 
 		new(&level->objects) Array<const SceneObject>(objects, n_objects);
+		new(&level->areas) Array<const LevelArea>(areas, n_areas);
+
+		level->spacial_index = build_rtree(level->objects, pool);
+		level->area_index = build_rtree(level->areas, pool);
+
+		// Streamed levels leave their chunks in the file for LevelStreamer
+		if (!streamed) {
+			for (uint32_t i = 0; i < n_tilemaps; ++i) {
+				TileGrid& grid = tilemaps[i].tiles;
+				const auto& offsets = chunk_offsets[i];
+				for (size_t cy = 0; cy < grid.chunks_high(); ++cy) {
+					for (size_t cx = 0; cx < grid.chunks_wide(); ++cx) {
+						TileChunk* chunk = TileGrid::new_chunk();
+						grid.swap_chunk(cx, cy, chunk);
+
+						uint32_t offset = offsets[cy * grid.chunks_wide() + cx];
+						if (offset != 0) memcpy(chunk->tiles, file.data + offset, sizeof(chunk->tiles)); // else blank
+					}
+				}
+				grid.update(*tilemaps[i].tileset);
+			}
+		}
 
 		return level;
 	}
@@ -185,73 +338,73 @@ __forceinline static Result<const Level*> read_level(FILE* stream, MemoryPool& p
 	}
 }
 
-void render_tilemap(GPU_Target* context, const Tilemap* map) {
-	const Tileset* tset = map->tileset;
-	GPU_Image* texture = tset->tilesheet;
-	auto& tdata = tset->tile_data;
-	auto& tiles = map->tiles;
-	auto w = tiles.width();
-	auto h = tiles.height();
-	float width = static_cast<float>(tset->tile_width);
-	float height = static_cast<float>(tset->tile_height);
-	uint16_t n_tiles = tset->tile_data.size();
-	
-	GPU_Rect dest = { 0.f, 0.f, width * fabsf(map->scale.x), height * fabsf(map->scale.y)};
-	GPU_Rect src = { 0.f, 0.f, width, height };
-
-	for (size_t x_ind = 0; x_ind < w; ++x_ind) {
-		dest.x = x_ind * width + map->offset.x;
-		for (size_t y_ind = 0; y_ind < h; ++y_ind) {
-			uint16_t t = tiles(x_ind, y_ind);
-			if (t != TILE_BLANK) {
-				if (t > n_tiles) {
-					assert(false);
-					ERR("Tile index out of bounds (%hd > %hd)\n", t, n_tiles);
-					continue;
-				}
-				dest.y = y_ind * height + map->offset.y;
-
-				--t; // Because tiles are 1-indexed
-
-				// TODO: tile animation
-				auto& frame = tdata[t].animation[0];
-				src.x = frame.x_ind * width;
-				src.y = frame.y_ind * height;
+static inline bool boxes_touch(const AABB& a, const AABB& b) {
+	return a.left <= b.right && b.left <= a.right && a.top <= b.bottom && b.top <= a.bottom;
+}
 
-				GPU_BlitRectX(texture, &src, context, &dest, 0.f, 0.f, 0.f, frame.flip);
-			}
+// Calls visit with every item whose bounds touch the region
+template <class F>
+static void visit_rtree(const Level::RTree* root, const AABB& region, F&& visit) {
+	if (root == nullptr || !boxes_touch(root->bounding_rect, region)) return;
+
+	// STR trees are balanced, so this holds a tree of 4^21 items
+	const Level::RTree* stack[64];
+	size_t top = 0;
+	stack[top++] = root;
+	while (top > 0) {
+		const Level::RTree* node = stack[--top];
+		for (size_t c = 0; c < node->n_children; ++c) {
+			const auto& child = node->children[c];
+			if (!boxes_touch(child.bounds, region)) continue;
+			if (child.isLeaf) visit(child.item);
+			else stack[top++] = child.subtree;
 		}
 	}
 }
 
+void objects_in(const Level& level, const AABB& region, std::vector<uint32_t>& out) {
+	visit_rtree(level.spacial_index, region, [&out](uint32_t i) { out.push_back(i); });
+}
+
+void areas_in(const Level& level, const AABB& region, std::vector<uint32_t>& out) {
+	visit_rtree(level.area_index, region, [&out](uint32_t i) { out.push_back(i); });
+}
+
+void render_scene_object(GPU_Target* context, const SceneObject& obj) {
+	GPU_BlitTransformX(
+		obj.sprite->texture, const_cast<GPU_Rect*>(&obj.clip), context,
+		obj.position.x, obj.position.y, -obj.display.x, -obj.display.y,
+		rad_to_deg(obj.rotation), obj.scale.x, obj.scale.y
+	);
+}
+
 LevelInstance* instantiate_level(const Level* level) {
 	size_t poolsize = sizeof(LevelInstance);
 	size_t n_layers = level->layers.size();
 
 	for (auto& layer : level->layers) {
-		poolsize += sizeof(uint16_t) * layer.tiles.size();
-		poolsize += sizeof(TileAnimationState) * layer.tileset->tile_data.size();
+		poolsize += sizeof(uint32_t) * layer.tileset->tile_data.size();
 	}
-	poolsize += (sizeof(Tilemap) + sizeof(Array<TileAnimationState>)) * n_layers;
+	poolsize += (sizeof(Tilemap) + sizeof(Array<uint32_t>) + sizeof(TileBatchCache)) * n_layers;
 
 	MemoryPool pool(poolsize);
 
 	LevelInstance* inst = pool.alloc<LevelInstance>();
 
 	inst->base = level;
+	new(&inst->clocks) TileClocks();
 
 	Tilemap* layers = pool.alloc<Tilemap>(n_layers);
-	Array<TileAnimationState>* anim_states = pool.alloc<Array<TileAnimationState>>(n_layers);
+	Array<uint32_t>* tile_clocks = pool.alloc<Array<uint32_t>>(n_layers);
+	TileBatchCache* batches = pool.alloc<TileBatchCache>(n_layers);
 	for (int i = 0; i < n_layers; ++i) {
 		auto& layer = layers[i];
 		const auto& orig = level->layers[i];
-		size_t mapsize = orig.tiles.size();
-
-		uint16_t* tilemap_raw = pool.alloc<uint16_t>(mapsize);
 
-		memcpy(tilemap_raw, orig.tiles.data(), mapsize * sizeof(uint16_t));
-
-		new(&layer.tiles) Array2D<uint16_t>(tilemap_raw, orig.tiles.width(), orig.tiles.height());
+		// Chunk metadata (including the solidity bit planes) comes along with the tiles, and is only redone for dirty chunks.
+		// Streamed levels start with nothing resident.
+		layer.tiles = level->streamed ? TileGrid::allocate(orig.tiles.width(), orig.tiles.height(), false) : orig.tiles.clone();
+		layer.tiles.update(*orig.tileset);
 		layer.tileset = orig.tileset;
 		layer.offset = orig.offset;
 		layer.parallax = orig.parallax;
@@ -259,27 +412,210 @@ LevelInstance* instantiate_level(const Level* level) {
 		layer.solid = orig.solid;
 		layer.z_order = orig.z_order;
 
-		size_t n_tilestates = orig.tileset->tile_data.size();
-		TileAnimationState* anim_state = pool.alloc<TileAnimationState>(n_tilestates);
+		// Layers that share a tileset share its clocks, so each animated tile type is only advanced once
+		int shared = -1;
+		for (int j = 0; j < i; ++j) {
+			if (layers[j].tileset == orig.tileset) {
+				shared = j;
+				break;
+			}
+		}
 
-		const Tile* tile = orig.tileset->tile_data;
-		for (int j = 0; j < n_tilestates; ++j, ++tile) {
-			anim_state[j] = {
-				tile,
-				0.f,
-				0
-			};
+		if (shared >= 0) {
+			new(&tile_clocks[i]) Array<uint32_t>(tile_clocks[shared]);
+		}
+		else {
+			size_t n_tiles = orig.tileset->tile_data.size();
+			uint32_t* clock_of = pool.alloc<uint32_t>(n_tiles);
+			for (size_t j = 0; j < n_tiles; ++j) {
+				clock_of[j] = inst->clocks.add(&orig.tileset->tile_data[j]);
+			}
+			new(&tile_clocks[i]) Array<uint32_t>(clock_of, n_tiles);
 		}
 
-		new(&anim_states[i]) Array<TileAnimationState>(anim_state, n_tilestates);
+		new(&batches[i]) TileBatchCache();
+		batches[i].reset(layer);
 	}
 
 	new(&inst->layers) Array<Tilemap>(layers, n_layers);
-	new(&inst->anim_state) Array<Array<TileAnimationState>>(anim_states, n_layers);
+	new(&inst->tile_clocks) Array<Array<uint32_t>>(tile_clocks, n_layers);
+	new(&inst->batches) Array<TileBatchCache>(batches, n_layers);
+	inst->streamer = level->streamed ? new LevelStreamer(level, LEVEL_STREAM_BUDGET) : nullptr;
 
 	return inst;
 }
 
+void destroy_level_instance(LevelInstance* inst) {
+	delete inst->streamer; // before the chunks it hands out go away
+	for (Tilemap& layer : inst->layers) {
+		layer.tiles.free();
+	}
+	for (TileBatchCache& cache : inst->batches) {
+		cache.~TileBatchCache();
+	}
+	inst->clocks.~TileClocks();
+	operator delete(inst);
+}
+
+void update_tile_animations(LevelInstance* inst, float dt) {
+	inst->clocks.advance(dt);
+	for (TileBatchCache& cache : inst->batches) {
+		cache.invalidate_changed(inst->clocks);
+	}
+}
+
+bool set_tile(LevelInstance* inst, size_t layer, size_t x, size_t y, uint16_t tile) {
+	if (layer >= inst->layers.size()) return false;
+	Tilemap& map = inst->layers[layer];
+	if (x >= map.tiles.width() || y >= map.tiles.height() || tile > map.tileset->tile_data.size()) return false;
+	if (!map.tiles.is_resident(x >> TILE_CHUNK_SHIFT, y >> TILE_CHUNK_SHIFT)) return false;
+
+	map.tiles.set(x, y, tile);
+	return true;
+}
+
+bool fill_tiles(LevelInstance* inst, size_t layer, size_t x, size_t y, size_t width, size_t height, uint16_t tile) {
+	if (layer >= inst->layers.size()) return false;
+	Tilemap& map = inst->layers[layer];
+	if (tile > map.tileset->tile_data.size()) return false;
+
+	map.tiles.fill(x, y, width, height, tile);
+	return true;
+}
+
+bool blit_submap(LevelInstance* inst, size_t layer, size_t x, size_t y, const Tilemap& src, size_t sx, size_t sy, size_t width, size_t height) {
+	if (layer >= inst->layers.size()) return false;
+	Tilemap& map = inst->layers[layer];
+	// Tile indices only mean the same thing within one tileset
+	if (src.tileset != map.tileset) return false;
+
+	map.tiles.blit(x, y, src.tiles, sx, sy, width, height);
+	return true;
+}
+
+void stream_level(LevelInstance* inst, const Camera& camera, const std::vector<AABB>& anchors) {
+	if (inst->streamer != nullptr) inst->streamer->update(inst, camera, anchors);
+}
+
+void refresh_tiles(LevelInstance* inst) {
+	for (Tilemap& layer : inst->layers) {
+		layer.tiles.update(*layer.tileset);
+	}
+}
+
+#define SNAPSHOT_LEVEL SNAPSHOT_TAG('L', 'E', 'V', 'L')
+
+// Layers are saved a chunk at a time: every chunk for levels that are fully loaded,
+// but only the edited ones for streamed levels, since the rest can be read from the level file again.
+struct ChunkSnapshotHeader {
+	uint32_t cx, cy;
+};
+
+void save_level_state(SnapshotWriter& writer, const LevelInstance* inst) {
+	writer.begin_section(SNAPSHOT_LEVEL);
+	uint32_t n_layers = inst == nullptr ? 0 : (uint32_t) inst->layers.size();
+	writer.write<uint32_t>(n_layers);
+
+	std::vector<ChunkSnapshotHeader> saved;
+	for (uint32_t i = 0; i < n_layers; ++i) {
+		const TileGrid& grid = inst->layers[i].tiles;
+		writer.write<uint32_t>((uint32_t) grid.width());
+		writer.write<uint32_t>((uint32_t) grid.height());
+
+		saved.clear();
+		for (uint32_t cy = 0; cy < grid.chunks_high(); ++cy) {
+			for (uint32_t cx = 0; cx < grid.chunks_wide(); ++cx) {
+				if (inst->streamer != nullptr ? inst->streamer->is_edited(inst, i, cx, cy) : grid.is_resident(cx, cy)) {
+					saved.push_back({ cx, cy });
+				}
+			}
+		}
+
+		writer.write<uint32_t>((uint32_t) saved.size());
+		for (const ChunkSnapshotHeader& chunk : saved) {
+			writer.write(chunk);
+			writer.write_bytes(grid.chunk(chunk.cx, chunk.cy).tiles, sizeof(TileChunk::tiles));
+		}
+	}
+
+	uint32_t n_clocks = inst == nullptr ? 0 : (uint32_t) inst->clocks.size();
+	writer.write<uint32_t>(n_clocks);
+	for (uint32_t c = 0; c < n_clocks; ++c) {
+		// Tile clocks only need their timers; which tile each one animates is worked out again by instantiate_level
+		writer.write(LevelSnapshot::Clock{ inst->clocks.time_left(c), inst->clocks.frame_of(c) });
+	}
+}
+
+Result<> read_level_state(SnapshotReader& reader, const LevelInstance* inst, LevelSnapshot& out) {
+	try {
+		reader.expect_section(SNAPSHOT_LEVEL);
+		uint32_t n_layers = reader.read<uint32_t>();
+		if (n_layers != (inst == nullptr ? 0 : inst->layers.size())) {
+			return Error(Errors::SnapshotBadSection, "Level layer count differs");
+		}
+
+		for (uint32_t i = 0; i < n_layers; ++i) {
+			const TileGrid& grid = inst->layers[i].tiles;
+			uint32_t w = reader.read<uint32_t>();
+			uint32_t h = reader.read<uint32_t>();
+			if (w != grid.width() || h != grid.height()) {
+				return Error(Errors::SnapshotBadSection, "Level layer dimensions differ");
+			}
+
+			uint32_t n_saved = reader.read<uint32_t>();
+			for (uint32_t j = 0; j < n_saved; ++j) {
+				auto header = reader.read<ChunkSnapshotHeader>();
+				if (header.cx >= grid.chunks_wide() || header.cy >= grid.chunks_high()) {
+					return Error(Errors::SnapshotBadSection, "Tile chunk out of bounds");
+				}
+				out.chunks.emplace_back();
+				LevelSnapshot::Chunk& chunk = out.chunks.back();
+				chunk.layer = i;
+				chunk.cx = header.cx;
+				chunk.cy = header.cy;
+				reader.read_bytes(chunk.tiles, sizeof(chunk.tiles));
+			}
+		}
+
+		uint32_t n_clocks = reader.read<uint32_t>();
+		if (n_clocks != (inst == nullptr ? 0 : inst->clocks.size())) {
+			return Error(Errors::SnapshotBadSection, "Animated tile count differs");
+		}
+		out.clocks.resize(n_clocks);
+		reader.read_bytes(out.clocks.data(), n_clocks * sizeof(LevelSnapshot::Clock));
+	}
+	catch (Error& err) {
+		return err;
+	}
+	return Result<>::success;
+}
+
+void restore_level_state(LevelInstance* inst, const LevelSnapshot& saved) {
+	if (inst == nullptr) return;
+
+	// Edits made since the snapshot go back to what's in the level file; the snapshot's own edits are adopted below
+	if (inst->streamer != nullptr) inst->streamer->revert(inst);
+
+	for (const LevelSnapshot::Chunk& saved_chunk : saved.chunks) {
+		if (inst->streamer != nullptr) {
+			inst->streamer->adopt(inst, saved_chunk.layer, saved_chunk.cx, saved_chunk.cy, saved_chunk.tiles);
+		}
+		else {
+			TileChunk* chunk = TileGrid::new_chunk();
+			memcpy(chunk->tiles, saved_chunk.tiles, sizeof(chunk->tiles));
+			delete inst->layers[saved_chunk.layer].tiles.swap_chunk(saved_chunk.cx, saved_chunk.cy, chunk);
+		}
+	}
+	for (Tilemap& layer : inst->layers) {
+		layer.tiles.update(*layer.tileset);
+	}
+
+	// Every restored chunk got a new revision from swap_chunk, so the batches rebuild with the restored frames
+	for (uint32_t c = 0; c < saved.clocks.size(); ++c) {
+		inst->clocks.set(c, saved.clocks[c].time_left, saved.clocks[c].frame);
+	}
+}
+
 TileRange tiles_in(const Tilemap& map, const AABB& region) {
 	AABB mregion = region - map.offset;
 	float w = map.tileset->tile_width;
@@ -289,130 +625,627 @@ TileRange tiles_in(const Tilemap& map, const AABB& region) {
 	mregion.top /= h;
 	mregion.bottom /= h;
 
-	TileRange range = {
-		0,
-		static_cast<uint16_t>(map.tiles.width() - 1),
-		0,
-		static_cast<uint16_t>(map.tiles.height() - 1)
+	const float max_x = (float) map.tiles.width() - 1.f;
+	const float max_y = (float) map.tiles.height() - 1.f;
+
+	// Regions that miss the map entirely give an empty range (left > right)
+	if (map.tiles.width() == 0 || map.tiles.height() == 0 ||
+		mregion.right < 0.f || mregion.bottom < 0.f || mregion.left > max_x + 1.f || mregion.top > max_y + 1.f) {
+		return { 1, 0, 1, 0 };
+	}
+
+	// Clamped as floats, so regions hanging off the map can't wrap around when narrowed
+	return {
+		static_cast<uint16_t>(SDL_max(floorf(mregion.left), 0.f)),
+		static_cast<uint16_t>(SDL_min(ceilf(mregion.right), max_x)),
+		static_cast<uint16_t>(SDL_max(floorf(mregion.top), 0.f)),
+		static_cast<uint16_t>(SDL_min(ceilf(mregion.bottom), max_y))
+	};
+}
+
+// Clips the tile's rectangle by the slope's dividing line (Sutherland-Hodgman against one half-plane)
+size_t slope_polygon(const Tile::Solidity& solidity, float w, float h, Point2 offset, Point2* out) {
+	const auto& slope = solidity.slope;
+	const Point2 rect[4] = { { 0.f, 0.f }, { w, 0.f }, { w, h }, { 0.f, h } };
+
+	// > 0 inside the solid part
+	auto inside = [&slope](Point2 p) -> float {
+		float line_y = slope.position + slope.slope * p.x;
+		return slope.above ? line_y - p.y : p.y - line_y;
 	};
 
-	if (mregion.left > range.left) {
-		range.left = static_cast<uint16_t>(floorf(mregion.left));
+	size_t n = 0;
+	for (int i = 0; i < 4; ++i) {
+		Point2 a = rect[i], b = rect[(i + 1) % 4];
+		float da = inside(a), db = inside(b);
+		if (da >= 0.f) out[n++] = a + offset;
+		if ((da >= 0.f) != (db >= 0.f)) {
+			float t = da / (da - db);
+			out[n++] = lerp(a, b, t) + offset;
+		}
 	}
-	if (mregion.right < range.right) {
-		range.right = static_cast<uint16_t>(ceilf(mregion.right));
+	return n;
+}
+
+AABB partial_tile_box(const Tile::Solidity& solidity, float w, float h, Point2 offset) {
+	const auto& partial = solidity.partial;
+	AABB solid = { offset.x, offset.x + w, offset.y, offset.y + h };
+	if (partial.vertical) {
+		if (partial.topleft) solid.right = offset.x + partial.position;
+		else solid.left = offset.x + partial.position;
 	}
-	if (mregion.top > range.top) {
-		range.top = static_cast<uint16_t>(floorf(mregion.top));
+	else {
+		if (partial.topleft) solid.bottom = offset.y + partial.position;
+		else solid.top = offset.y + partial.position;
 	}
-	if (mregion.bottom < range.bottom) {
-		range.bottom = static_cast<uint16_t>(ceilf(mregion.bottom));
+	return solid;
+}
+
+// Calls visit(x, y, tile index, nontrivial) in row-major order for every tile touching the region that might be solid.
+// nontrivial is false only for tiles known to be Full, which can be handled without looking at the tileset.
+// Chunks whose solid content is nowhere near the region are skipped outright. Stops as soon as visit returns true.
+template <class F>
+static bool visit_solid_tiles(const Tilemap& map, const AABB& region, F&& visit) {
+	auto range = tiles_in(map, region);
+	if (range.left > range.right || range.top > range.bottom) return false;
+
+	const TileGrid& grid = map.tiles;
+	const AABB local = region - map.offset;
+	const size_t cx0 = range.left >> TILE_CHUNK_SHIFT, cx1 = range.right >> TILE_CHUNK_SHIFT;
+
+	for (size_t y = range.top; y <= range.bottom; ++y) {
+		for (size_t cx = cx0; cx <= cx1; ++cx) {
+			const TileChunk& chunk = grid.chunk(cx, y >> TILE_CHUNK_SHIFT);
+			uint32_t row = ~0u, nontrivial = ~0u;
+			if (chunk.is_clean()) {
+				const AABB& bounds = chunk.solid_bounds;
+				if ((chunk.flags & TileChunk::NONSOLID) || bounds.left > local.right || local.left > bounds.right ||
+					bounds.top > local.bottom || local.top > bounds.bottom) continue;
+				row = chunk.solid_rows[y & TILE_CHUNK_MASK];
+				nontrivial = chunk.nontrivial_rows[y & TILE_CHUNK_MASK];
+				if (row == 0) continue;
+			}
+
+			const uint16_t* tiles = &chunk.tiles[(y & TILE_CHUNK_MASK) * TILE_CHUNK_SIZE];
+			size_t x0 = SDL_max((size_t) range.left, cx << TILE_CHUNK_SHIFT);
+			size_t x1 = SDL_min((size_t) range.right, (cx << TILE_CHUNK_SHIFT) + TILE_CHUNK_MASK);
+			for (size_t x = x0; x <= x1; ++x) {
+				if (!(row >> (x & TILE_CHUNK_MASK) & 1)) continue;
+				uint16_t t_ind = tiles[x & TILE_CHUNK_MASK];
+				if (t_ind == TILE_BLANK) continue;
+				if (visit(x, y, t_ind, (nontrivial >> (x & TILE_CHUNK_MASK) & 1) != 0)) return true;
+			}
+		}
+	}
+	return false;
+}
+
+// True if the world box strictly overlaps a tile known to be Full. Only reads the solidity bits.
+static bool box_overlaps_full_tile(const Tilemap& map, const AABB& box) {
+	auto range = tiles_in(map, box);
+	if (range.left > range.right || range.top > range.bottom) return false;
+
+	// Narrow to the tiles the box strictly overlaps, with the same cell edges the exact test would use
+	const float w = map.tileset->tile_width;
+	const float h = map.tileset->tile_height;
+	int x0 = range.left, x1 = range.right, y0 = range.top, y1 = range.bottom;
+	if (!(box.left < fmaf((float) (x0 + 1), w, map.offset.x))) ++x0;
+	if (!(box.right > fmaf((float) x1, w, map.offset.x))) --x1;
+	if (!(box.top < fmaf((float) (y0 + 1), h, map.offset.y))) ++y0;
+	if (!(box.bottom > fmaf((float) y1, h, map.offset.y))) --y1;
+	if (x0 > x1 || y0 > y1) return false;
+
+	const TileGrid& grid = map.tiles;
+	for (int y = y0; y <= y1; ++y) {
+		for (int cx = x0 >> TILE_CHUNK_SHIFT; cx <= x1 >> TILE_CHUNK_SHIFT; ++cx) {
+			const TileChunk& chunk = grid.chunk(cx, y >> TILE_CHUNK_SHIFT);
+			if (!chunk.is_clean()) continue;
+
+			int lx0 = SDL_max(x0 - (cx << TILE_CHUNK_SHIFT), 0);
+			int lx1 = SDL_min(x1 - (cx << TILE_CHUNK_SHIFT), TILE_CHUNK_MASK);
+			uint32_t span = (2u << lx1) - (1u << lx0); // bits lx0 to lx1
+			uint32_t ly = y & TILE_CHUNK_MASK;
+			if (chunk.solid_rows[ly] & ~chunk.nontrivial_rows[ly] & span) return true;
+		}
 	}
+	return false;
+}
+
+bool hitbox_tilemap_collision(const Hitbox& hitbox, const Transform& tx, Vector2 dis, const Tilemap& map) {
+	if (hitbox.type == Hitbox::NONE) return false;
+
+	thread_local std::vector<WorldHitbox> shapes, tile_shapes;
+	thread_local std::vector<Point2> vertices, tile_vertices;
+	shapes.clear();
+	vertices.clear();
+	shapes.resize(1);
+	transform_hitbox(hitbox, tx, shapes, vertices, 0);
+	const WorldShapes set = { shapes.data(), vertices.data() };
+
+	auto overlaps = [&](const Hitbox& tile_hitbox, Point2 offset) {
+		tile_shapes.clear();
+		tile_vertices.clear();
+		tile_shapes.resize(1);
+		transform_hitbox(tile_hitbox, Transform::translation(offset), tile_shapes, tile_vertices, 0);
+		return world_hitboxes_overlap(set, shapes[0], dis,
+			{ tile_shapes.data(), tile_vertices.data() }, tile_shapes[0], { 0.f, 0.f });
+	};
+
+	// Boxes are the common case: any Full tile they strictly overlap settles it, and Full tiles they only touch never count
+	const bool is_box = shapes[0].type == Hitbox::BOX;
+	if (is_box && box_overlaps_full_tile(map, shapes[0].box)) return true;
+
+	float w = map.tileset->tile_width;
+	float h = map.tileset->tile_height;
+
+	return visit_solid_tiles(map, shapes[0].aabb, [&](size_t x, size_t y, uint16_t t_ind, bool nontrivial) {
+		if (is_box && !nontrivial) return false;
+
+		Point2 offset = {
+			fmaf((float) x, w, map.offset.x),
+			fmaf((float) y, h, map.offset.y)
+		};
+
+		// Solid part of the tile, tile-local
+		Hitbox solid;
+		Point2 slope_verts[5];
+		if (!nontrivial) {
+			solid.type = Hitbox::BOX;
+			solid.box = { 0.f, w, 0.f, h };
+			return overlaps(solid, offset);
+		}
+
+		const Tile& tile = map.tileset->tile_data[t_ind - 1];
+		switch (tile.solidity.type) {
+		case Tile::Solidity::Full:
+			solid.type = Hitbox::BOX;
+			solid.box = { 0.f, w, 0.f, h };
+			break;
+		case Tile::Solidity::Partial:
+			solid.type = Hitbox::BOX;
+			solid.box = partial_tile_box(tile.solidity, w, h, { 0.f, 0.f });
+			break;
+		case Tile::Solidity::Slope:
+		{
+			size_t n = slope_polygon(tile.solidity, w, h, { 0.f, 0.f }, slope_verts);
+			if (n < 3) return false;
+			solid.type = Hitbox::POLYGON;
+			new(&solid.polygon.vertices) Array<const Point2>(slope_verts, n);
+			solid.polygon.aabb = poly_to_aabb(solid.polygon.vertices);
+			break;
+		}
+		case Tile::Solidity::Complex:
+			return overlaps(tile.solidity.complex, offset);
+		default:
+			return false;
+		}
 
-	return range;
+		return overlaps(solid, offset);
+	});
 }
 
 bool entity_tilemap_collision(const Entity* e, const Tilemap& map) {
-	if (!e->solid) return false;
+	if (!e->solid || e->animation == nullptr) return false;
 
-	const Hitbox& hitbox = e->animation->solidity.hitbox;
-	if (hitbox.type == Hitbox::BOX && (float_eq(e->rotation, 0.f) || e->animation->solidity.fixed)) {
-		auto range = tiles_in(map, e->get_transform() * hitbox.box);
-		float w = map.tileset->tile_width;
-		float h = map.tileset->tile_height;
+	const auto& solidity = e->animation->solidity;
+	const Transform tx = solidity.fixed ?
+		Transform::scal_trans(e->scale, e->position) :
+		e->get_transform();
+	return hitbox_tilemap_collision(solidity.hitbox, tx, e->position - e->last_pos, map);
+}
 
-		for (int x = range.left; x <= range.right; ++x) {
-			for (int y = range.top; y <= range.bottom; ++y) {
-				uint16_t t_ind = map.tiles(x, y);
-				if (t_ind == TILE_BLANK) continue;
+bool tilemap_point_collision(const Tilemap& map, Point2 point) {
+	float w = map.tileset->tile_width;
+	float h = map.tileset->tile_height;
+	float fx = (point.x - map.offset.x) / w;
+	float fy = (point.y - map.offset.y) / h;
+	if (fx < 0.f || fy < 0.f || fx >= map.tiles.width() || fy >= map.tiles.height()) return false;
+
+	size_t x = static_cast<size_t>(fx);
+	size_t y = static_cast<size_t>(fy);
+	const TileChunk& chunk = map.tiles.chunk_at(x, y);
+	if (chunk.is_clean()) {
+		uint32_t lx = x & TILE_CHUNK_MASK, ly = y & TILE_CHUNK_MASK;
+		if (!(chunk.solid_rows[ly] >> lx & 1)) return false;
+		if (!(chunk.nontrivial_rows[ly] >> lx & 1)) return true;
+	}
 
-				const Tile& tile = map.tileset->tile_data[t_ind - 1];
+	uint16_t t_ind = map.tiles(x, y);
+	if (t_ind == TILE_BLANK) return false;
 
-				if (tile.solidity.type == Tile::Solidity::None) {
-					continue;
-				}
+	const Tile& tile = map.tileset->tile_data[t_ind - 1];
 
-				Vector2 offset = {
-					fmaf((float) x, w, map.offset.x),
-					fmaf((float) y, h, map.offset.y)
-				};
-
-				switch (tile.solidity.type) {
-				case Tile::Solidity::Full:
-					return true;
-				case Tile::Solidity::Partial:
-				{
-					const auto& partial = tile.solidity.partial;
-					if (partial.vertical) {
-						if (partial.topleft) {
-							if (hitbox.box.top < offset.y + partial.position ||
-								hitbox.box.bottom > offset.y ||
-								hitbox.box.left < offset.x + w ||
-								hitbox.box.right > offset.x) {
-								return true;
-							}
-						}
-						else {
-							if (hitbox.box.top < offset.y + h||
-								hitbox.box.bottom > offset.y + partial.position ||
-								hitbox.box.left < offset.x + w ||
-								hitbox.box.right > offset.x) {
-								return true;
-							}
-						}
-					}
-					else {
-						if (partial.topleft) {
-							if (hitbox.box.top < offset.y + h ||
-								hitbox.box.bottom > offset.y ||
-								hitbox.box.left < offset.x + partial.position||
-								hitbox.box.right > offset.x) {
-								return true;
-							}
-						}
-						else {
-							if (hitbox.box.top < offset.y + h ||
-								hitbox.box.bottom > offset.y ||
-								hitbox.box.left < offset.x + w ||
-								hitbox.box.right > offset.x + partial.position) {
-								return true;
-							}
-						}
-					}
-					break;
+	// position within the tile
+	float lx = point.x - fmaf((float) x, w, map.offset.x);
+	float ly = point.y - fmaf((float) y, h, map.offset.y);
+
+	switch (tile.solidity.type) {
+	case Tile::Solidity::Full:
+		return true;
+	case Tile::Solidity::Partial:
+	{
+		const auto& partial = tile.solidity.partial;
+		float along = partial.vertical ? lx : ly;
+		return partial.topleft ? along < partial.position : along >= partial.position;
+	}
+	case Tile::Solidity::Slope:
+	{
+		const auto& slope = tile.solidity.slope;
+		float line_y = slope.position + slope.slope * lx;
+		return slope.above ? ly < line_y : ly >= line_y;
+	}
+	case Tile::Solidity::Complex:
+	{
+		const Hitbox& hitbox = tile.solidity.complex;
+		switch (hitbox.type) {
+		case Hitbox::BOX:
+			return hitbox.box.contains({ lx, ly });
+		case Hitbox::CIRCLE:
+			return distance(hitbox.circle.center, { lx, ly }) < hitbox.circle.radius;
+		case Hitbox::NONE:
+			return false;
+		default:
+			return true; // close enough for anything that only needs a point test
+		}
+	}
+	default:
+		return false;
+	}
+}
+
+// =========================================================================================
+// ==== Entity depenetration ====
+// =========================================================================================
+
+// Overlap smaller than this is treated as touching
+#define DEPENETRATION_EPSILON 0.01f
+// How far past its sides an entity looks for tiles when filling in level_contacts
+#define CONTACT_PROBE 0.5f
+// Ledges up to this fraction of a tile above a grounded entity's feet are stepped onto instead of blocking it
+#define STEP_HEIGHT 0.25f
+
+// Solid part of a tile in world space, reduced to what axis-separated resolution needs
+struct TileSolid {
+	enum Kind : char {
+		Rect,   // box is solid
+		Surface // a line across box: y = y0 + slope * (x - box.left)
+	} kind;
+	AABB box;
+	float y0, slope;
+	bool blocks_down; // solid below the surface (floors)
+	bool blocks_up;   // solid above the surface (ceilings)
+	bool thick;       // everything in box on the solid side is solid (slope tiles), not just the line itself
+};
+
+static inline TileSolid solid_rect(const AABB& box) {
+	return { TileSolid::Rect, box, 0.f, 0.f, false, false, false };
+}
+
+static void add_complex_solids(const Hitbox& hitbox, Point2 offset, std::vector<TileSolid>& out) {
+	switch (hitbox.type) {
+	case Hitbox::BOX:
+		out.push_back(solid_rect(hitbox.box + offset));
+		break;
+	case Hitbox::LINE:
+	case Hitbox::ONEWAY:
+	{
+		Point2 p1 = hitbox.line.p1 + offset;
+		Point2 p2 = hitbox.line.p2 + offset;
+		if (p1.x == p2.x) { // walls are just thin boxes
+			out.push_back(solid_rect({ p1.x, p1.x, SDL_min(p1.y, p2.y), SDL_max(p1.y, p2.y) }));
+			break;
+		}
+
+		bool ltr = p1.x < p2.x;
+		if (!ltr) std::swap(p1, p2);
+
+		TileSolid solid;
+		solid.kind = TileSolid::Surface;
+		solid.box = { p1.x, p2.x, SDL_min(p1.y, p2.y), SDL_max(p1.y, p2.y) };
+		solid.y0 = p1.y;
+		solid.slope = (p2.y - p1.y) / (p2.x - p1.x);
+		// One way lines are solid from the top when drawn left to right
+		solid.blocks_down = hitbox.type == Hitbox::LINE || ltr;
+		solid.blocks_up = hitbox.type == Hitbox::LINE || !ltr;
+		solid.thick = false;
+		out.push_back(solid);
+		break;
+	}
+	case Hitbox::COMPOSITE:
+		for (const Hitbox& sub : hitbox.composite.hitboxes) {
+			add_complex_solids(sub, offset, out);
+		}
+		break;
+	case Hitbox::NONE:
+		break;
+	default: // circles and polygons are approximated by their bounds
+		out.push_back(solid_rect(hitbox_aabb(hitbox) + offset));
+		break;
+	}
+}
+
+// Gathers the solid parts of every tile in the region
+static void collect_tile_solids(const Tilemap& map, const AABB& region, std::vector<TileSolid>& out) {
+	float w = map.tileset->tile_width;
+	float h = map.tileset->tile_height;
+
+	visit_solid_tiles(map, region, [&](size_t x, size_t y, uint16_t t_ind, bool nontrivial) {
+		Point2 offset = {
+			fmaf((float) x, w, map.offset.x),
+			fmaf((float) y, h, map.offset.y)
+		};
+		AABB cell = { offset.x, offset.x + w, offset.y, offset.y + h };
+		if (!nontrivial) {
+			out.push_back(solid_rect(cell));
+			return false;
+		}
+
+		const Tile& tile = map.tileset->tile_data[t_ind - 1];
+
+		switch (tile.solidity.type) {
+		case Tile::Solidity::Full:
+			out.push_back(solid_rect(cell));
+			break;
+		case Tile::Solidity::Partial:
+			out.push_back(solid_rect(partial_tile_box(tile.solidity, w, h, offset)));
+			break;
+		case Tile::Solidity::Slope:
+		{
+			const auto& slope = tile.solidity.slope;
+			TileSolid solid;
+			solid.kind = TileSolid::Surface;
+			solid.box = cell;
+			solid.y0 = offset.y + slope.position;
+			solid.slope = slope.slope;
+			solid.blocks_down = !slope.above;
+			solid.blocks_up = slope.above;
+			solid.thick = true;
+			out.push_back(solid);
+			break;
+		}
+		case Tile::Solidity::Complex:
+			add_complex_solids(tile.solidity.complex, offset, out);
+			break;
+		default:
+			break;
+		}
+		return false;
+	});
+}
+
+static inline bool overlaps_strictly(const AABB& a, const AABB& b) {
+	return a.left < b.right - DEPENETRATION_EPSILON && b.left < a.right - DEPENETRATION_EPSILON &&
+		a.top < b.bottom - DEPENETRATION_EPSILON && b.top < a.bottom - DEPENETRATION_EPSILON;
+}
+
+static inline float surface_y(const TileSolid& solid, float x) {
+	return solid.y0 + solid.slope * (x - solid.box.left);
+}
+
+static inline bool surface_spans(const TileSolid& solid, float x) {
+	return x >= solid.box.left && x < solid.box.right;
+}
+
+// Horizontal then vertical pass against one tilemap.
+// Rects are pushed out along the axis of motion. Surfaces (slopes and lines) only act on the
+// solidity's head and foot at the entity's center column, so entities walk up and down them smoothly.
+void resolve_tilemap_collision(Entity* e, const Tilemap& map, bool grounded) {
+	const auto& solidity = e->animation->solidity;
+	const bool upright = solidity.fixed || float_eq(e->rotation, 0.f);
+
+	// Solidity bounds relative to the entity's position
+	AABB rel = Transform::scal_rot_trans(e->scale, upright ? 0.f : e->rotation, { 0.f, 0.f }) * hitbox_aabb(solidity.hitbox);
+	float head = rel.top, foot = rel.bottom;
+	if (upright) {
+		head = SDL_min(solidity.head * e->scale.y, solidity.foot * e->scale.y);
+		foot = SDL_max(solidity.head * e->scale.y, solidity.foot * e->scale.y);
+	}
+
+	const Point2 last = e->last_pos;
+	Point2 pos = e->position;
+	const Vector2 dis = pos - last;
+	const float step = grounded ? STEP_HEIGHT * map.tileset->tile_height : 0.f;
+
+	thread_local std::vector<TileSolid> solids;
+	solids.clear();
+	AABB region = ((rel + last) | (rel + pos));
+	region.left -= CONTACT_PROBE;
+	region.right += CONTACT_PROBE;
+	region.top -= CONTACT_PROBE + step;
+	region.bottom += CONTACT_PROBE;
+	collect_tile_solids(map, region, solids);
+	if (solids.empty()) return;
+
+	// Horizontal pass, at last update's height so floors and ceilings don't count as walls
+	AABB box = rel + Vector2{ pos.x, last.y };
+	for (const TileSolid& solid : solids) {
+		if (solid.kind != TileSolid::Rect || !overlaps_strictly(box, solid.box)) continue;
+		if (solid.box.top >= box.bottom - step) continue; // low enough to step onto
+
+		float push_left = solid.box.left - box.right;
+		float push_right = solid.box.right - box.left;
+		float push = dis.x > 0.f ? push_left :
+			dis.x < 0.f ? push_right :
+			(-push_left < push_right ? push_left : push_right);
+
+		pos.x += push;
+		box += Vector2{ push, 0.f };
+		if (push * e->velocity.x < 0.f) e->velocity.x = 0.f;
+	}
+
+	// Vertical pass
+	box = rel + pos;
+	for (const TileSolid& solid : solids) {
+		if (solid.kind != TileSolid::Rect || !overlaps_strictly(box, solid.box)) continue;
+
+		float push_up = solid.box.top - box.bottom;
+		float push_down = solid.box.bottom - box.top;
+		float push;
+		if (-push_up <= step) push = push_up;
+		else if (dis.y > 0.f) push = push_up;
+		else if (dis.y < 0.f) push = push_down;
+		else push = -push_up < push_down ? push_up : push_down;
+
+		pos.y += push;
+		box += Vector2{ 0.f, push };
+		if (push * e->velocity.y < 0.f) e->velocity.y = 0.f;
+	}
+	for (const TileSolid& solid : solids) {
+		if (solid.kind != TileSolid::Surface || !surface_spans(solid, pos.x)) continue;
+
+		float line_y = surface_y(solid, pos.x);
+		float last_line_y = surface_y(solid, last.x);
+
+		// Thick surfaces catch anything inside their cell; thin lines only catch what crossed them this update
+		if (solid.blocks_down && pos.y + foot > line_y + DEPENETRATION_EPSILON &&
+			(solid.thick ? pos.y + foot <= solid.box.bottom + DEPENETRATION_EPSILON :
+				last.y + foot <= last_line_y + DEPENETRATION_EPSILON)) {
+			pos.y = line_y - foot;
+			if (e->velocity.y > 0.f) e->velocity.y = 0.f;
+		}
+		else if (solid.blocks_up && pos.y + head < line_y - DEPENETRATION_EPSILON &&
+			(solid.thick ? pos.y + head >= solid.box.top - DEPENETRATION_EPSILON :
+				last.y + head >= last_line_y - DEPENETRATION_EPSILON)) {
+			pos.y = line_y - head;
+			if (e->velocity.y < 0.f) e->velocity.y = 0.f;
+		}
+	}
+
+	e->position = pos;
+
+	// Probe just past each side for contacts
+	box = rel + pos;
+	for (const TileSolid& solid : solids) {
+		if (solid.kind == TileSolid::Rect) {
+			bool spans_x = box.left < solid.box.right - DEPENETRATION_EPSILON && solid.box.left < box.right - DEPENETRATION_EPSILON;
+			bool spans_y = box.top < solid.box.bottom - DEPENETRATION_EPSILON && solid.box.top < box.bottom - DEPENETRATION_EPSILON;
+			if (spans_x && fabsf(solid.box.top - box.bottom) <= CONTACT_PROBE) {
+				if (!(e->level_contacts & LevelContact::GROUND)) e->ground_normal = { 0.f, -1.f };
+				e->level_contacts |= LevelContact::GROUND;
+			}
+			if (spans_x && fabsf(box.top - solid.box.bottom) <= CONTACT_PROBE) {
+				e->level_contacts |= LevelContact::CEILING;
+			}
+			if (spans_y && fabsf(solid.box.left - box.right) <= CONTACT_PROBE) {
+				e->level_contacts |= LevelContact::WALL_RIGHT;
+			}
+			if (spans_y && fabsf(box.left - solid.box.right) <= CONTACT_PROBE) {
+				e->level_contacts |= LevelContact::WALL_LEFT;
+			}
+		}
+		else if (surface_spans(solid, pos.x)) {
+			float line_y = surface_y(solid, pos.x);
+			if (solid.blocks_down && fabsf(pos.y + foot - line_y) <= CONTACT_PROBE) {
+				// Slopes take priority over flat ground for the normal
+				if (!(e->level_contacts & LevelContact::GROUND) || solid.slope != 0.f) {
+					e->ground_normal = Vector2{ solid.slope, -1.f }.normalized();
 				}
-				case Tile::Solidity::Slope:
-				{
-					const auto& slope = tile.solidity.slope;
-					if (slope.above) {
-						// TODO
-						if (hitbox.box.bottom > offset.y ||
-							hitbox.box.left < offset.x + w ||
-							hitbox.box.right > offset.x) {
-							return true;
-						}
-					}
-					else {
-						// TODO
-						if (hitbox.box.top < offset.y + h ||
-							hitbox.box.left < offset.x + w ||
-							hitbox.box.right > offset.x) {
-							return true;
-						}
-					}
+				e->level_contacts |= LevelContact::GROUND;
+			}
+			if (solid.blocks_up && fabsf(pos.y + head - line_y) <= CONTACT_PROBE) {
+				e->level_contacts |= LevelContact::CEILING;
+			}
+		}
+	}
+}
+
+// =========================================================================================
+// ==== Scene objects ====
+// =========================================================================================
+
+bool hitbox_object_collision(const Hitbox& hitbox, const Transform& tx, Vector2 dis, const Level& level, std::vector<uint32_t>* hits) {
+	if (hitbox.type == Hitbox::NONE) return false;
+
+	// Swept, so the displacement test can see objects passed through this update
+	AABB box = tx * hitbox_aabb(hitbox);
+	AABB region = box | (box - dis);
+
+	bool found = false;
+	visit_rtree(level.spacial_index, region, [&](uint32_t i) {
+		if (found && hits == nullptr) return;
+
+		const SceneObject& obj = level.objects[i];
+		Transform objTx = Transform::scal_rot_trans(obj.scale, obj.rotation, obj.position);
+		for (const Collider& collider : obj.colliders) {
+			if (hitboxes_overlap(hitbox, tx, dis, collider.hitbox, objTx, { 0.f, 0.f })) {
+				found = true;
+				if (hits != nullptr) hits->push_back(i);
+				break;
+			}
+		}
+	});
+	return found;
+}
+
+// Objects can be any shape at any angle, so they're resolved the way solid entities are between themselves:
+// a few rounds of pushing out along the deepest penetration.
+#define OBJECT_RESOLVE_ROUNDS 4
+
+void resolve_object_collision(Entity* e, const Level& level) {
+	if (level.spacial_index == nullptr) return;
+
+	const auto& solidity = e->animation->solidity;
+	const Hitbox& hitbox = solidity.hitbox;
+	auto solid_tx = [e, &solidity]() {
+		return solidity.fixed ? Transform::scal_trans(e->scale, e->position) : e->get_transform();
+	};
+
+	thread_local std::vector<uint32_t> nearby;
+	nearby.clear();
+	AABB region = solid_tx() * hitbox_aabb(hitbox);
+	region.left -= CONTACT_PROBE;
+	region.right += CONTACT_PROBE;
+	region.top -= CONTACT_PROBE;
+	region.bottom += CONTACT_PROBE;
+	objects_in(level, region, nearby);
+	if (nearby.empty()) return;
+
+	for (int round = 0; round < OBJECT_RESOLVE_ROUNDS; ++round) {
+		Vector2 normal, deepest_normal = { 0.f, 0.f };
+		float depth, deepest = DEPENETRATION_EPSILON;
+
+		Transform tx = solid_tx();
+		for (uint32_t i : nearby) {
+			const SceneObject& obj = level.objects[i];
+			Transform objTx = Transform::scal_rot_trans(obj.scale, obj.rotation, obj.position);
+			for (const Collider& collider : obj.colliders) {
+				if (hitboxes_penetration(hitbox, tx, collider.hitbox, objTx, normal, depth) && depth > deepest) {
+					deepest = depth;
+					deepest_normal = normal;
 				}
-				case Tile::Solidity::Complex:
-					if (hitboxes_overlap(
-						hitbox, e->get_transform(), e->position - e->last_pos,
-						tile.solidity.complex, Transform::translation(map.offset), { 0.f, 0.f }
-					)) {
-						return true;
-					}
-				default:
+			}
+		}
+		if (deepest_normal.x == 0.f && deepest_normal.y == 0.f) break;
+
+		e->position += deepest_normal * deepest;
+		float into = e->velocity.dot(deepest_normal);
+		if (into < 0.f) e->velocity -= deepest_normal * into;
+	}
+
+	// Probe just past each side for contacts
+	const Vector2 probes[] = { { 0.f, CONTACT_PROBE }, { 0.f, -CONTACT_PROBE }, { CONTACT_PROBE, 0.f }, { -CONTACT_PROBE, 0.f } };
+	const uint8_t sides[] = { LevelContact::GROUND, LevelContact::CEILING, LevelContact::WALL_RIGHT, LevelContact::WALL_LEFT };
+	for (size_t p = 0; p < 4; ++p) {
+		if (e->level_contacts & sides[p]) continue;
+
+		Transform tx = Transform::translation(probes[p]) * solid_tx();
+		for (uint32_t i : nearby) {
+			const SceneObject& obj = level.objects[i];
+			Transform objTx = Transform::scal_rot_trans(obj.scale, obj.rotation, obj.position);
+			bool touching = false;
+			for (const Collider& collider : obj.colliders) {
+				if (hitboxes_overlap(hitbox, tx, { 0.f, 0.f }, collider.hitbox, objTx, { 0.f, 0.f })) {
+					touching = true;
 					break;
 				}
 			}
+			if (touching) {
+				if (sides[p] == LevelContact::GROUND && e->ground_normal.x == 0.f && e->ground_normal.y == 0.f) {
+					e->ground_normal = { 0.f, -1.f };
+				}
+				e->level_contacts |= sides[p];
+				break;
+			}
 		}
 	}
-	return false;
-}
\ No newline at end of file
+}
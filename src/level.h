@@ -2,20 +2,30 @@
 
 #include "result.h"
 #include "tileset.h"
+#include "tilegrid.h"
+#include "camera.h"
+#include "tilebatch.h"
+#include "tileanim.h"
 #include "vectors.h"
 #include "arrays.h"
 #include "hitbox.h"
 #include "entity.h"
 #include "error.h"
-#include "SDL2\SDL_render.h"
+#include "mappedfile.h"
+#include "SDL2/SDL_render.h"
 #include <cstdint>
 #include <array>
+#include <vector>
 
 #define LEVEL_MAGIC_NUMBER "PlatElevel"
 #define LEVEL_MAGIC_NUMBER_LENGTH (sizeof(LEVEL_MAGIC_NUMBER) - 1)
 
-#define LEVEL_BALLPARK_CHECKED true
-#define LEVEL_BALLPARK_REQUIRED true
+// Levels with more than this many bytes of stored tile chunks leave them on disk, and instances stream them in
+#define LEVEL_STREAM_THRESHOLD (16 * 1024 * 1024)
+// Bytes of resident chunks a streamed instance tries to stay under (the chunks in view or around anchors are always kept)
+#define LEVEL_STREAM_BUDGET (32 * 1024 * 1024)
+// Chunks past each edge of the view that are loaded ahead of time
+#define LEVEL_STREAM_MARGIN 1
 
 namespace Errors {
 	const error_data
@@ -26,7 +36,7 @@ namespace Errors {
 /// Static tile-based level data. Tiles can be animated.
 struct Tilemap {
 	const Tileset* tileset;
-	Array2D<uint16_t> tiles;
+	TileGrid tiles; // chunk metadata is kept up to date with TileGrid::update
 	int z_order;
 
 	/// position of this tilemap's top-left corner relative to the level's origin
@@ -50,6 +60,7 @@ struct Tilemap {
 /// Static elements of the level. Logic cannot be attached.
 struct SceneObject {
 	const Sprite* sprite;
+	GPU_Rect clip; // of the sprite's texture
 
 	Vector2 display;
 	int z_order;
@@ -58,7 +69,11 @@ struct SceneObject {
 	float rotation;
 	Vector2 scale;
 
+	/// Solid to entities, like the tiles of a solid layer
+	Array<const Collider> colliders;
+
 // === Transient Fields ===
+	/// World bounds of the drawn clip and the colliders, worked out at load for the spatial index
 	AABB aabb;
 };
 
@@ -108,6 +123,7 @@ struct LevelArea {
 #define RTREE_MAX_CHILDREN 4
 
 struct Level {
+	MappedFile file; // the name, the chunk index and polygon vertices are used in place, and streamed chunks are copied out of it
 	const char* name;
 
 	/// the bounds of the level from the origin
@@ -128,45 +144,61 @@ struct Level {
 	// Overlapping triggers will take first-come-first serve priority
 	Array<const EdgeTrigger> edge_triggers;
 
+	// Tiles are stored at the end of the level file, a chunk at a time, found through a per-layer index
+	Array<const Array<const uint32_t>> chunk_offsets; // per layer, file offset of each chunk (row-major), 0 if it's blank
+	/// Too big to load at once: the layers have no resident chunks, and instances page them in around the camera
+	bool streamed;
+
 	// Script / save-relevant metadata
 	// ---- Something like this:
 	// Script* init_script;
 	// Array<Variable> variables; 
 
 // === Transient / Precalculated Cached T ===
+	/// Node of a static R-tree, bulk loaded once with Sort-Tile-Recursive packing so every node but the last of each level is full
 	struct RTree {
 		AABB bounding_rect;
 
 		size_t n_children;
-		struct {
+		struct Child {
+			AABB bounds;
 			union {
-				SceneObject* obj;
-				RTree* subtree;
+				uint32_t item; // index into the indexed array
+				const RTree* subtree;
 			};
 			bool isLeaf;
 		} children[RTREE_MAX_CHILDREN];
 	};
 
-	RTree* spacial_index;
+	const RTree* spacial_index; // over objects, nullptr if there are none
+	const RTree* area_index;    // over areas, nullptr if there are none
 };
 
+class LevelStreamer;
+
 /// Mutable variant of a Level
 struct LevelInstance {
 	const Level* base;
 	Array<Tilemap> layers;
-	Array<Array<TileAnimationState>> anim_state;
+	TileClocks clocks; // one per animated tile type, shared by every layer with the same tileset
+	Array<Array<uint32_t>> tile_clocks; // per layer, the clock of each of its tileset's tiles (TILE_NO_CLOCK if it doesn't animate)
+	Array<TileBatchCache> batches; // one per layer
+	LevelStreamer* streamer; // nullptr unless the level is streamed
 };
 
 // Note to self: scripts will probably be able to splice to Levels together
 // They will definitely be able to trigger side-warps
 
-// static to .cpp: RTree* build_spacial_index(Level*);
-
 Result<const Level*> load_level(const char* filename, const DirContext& context = DirContext());
 
 Result<> unload_level(const Level*);
 
-void render_tilemap(GPU_Target* context, const Tilemap* map); // TODO: camera/viewport
+/// Appends the index of every scene object whose bounds overlap the region (in no particular order)
+void objects_in(const Level& level, const AABB& region, std::vector<uint32_t>& out);
+/// Appends the index of every area whose bounds overlap the region (in no particular order)
+void areas_in(const Level& level, const AABB& region, std::vector<uint32_t>& out);
+
+void render_scene_object(GPU_Target* context, const SceneObject& obj);
 
 /// Range of tile indices, inclusive on both ends
 struct TileRange {
@@ -177,6 +209,83 @@ struct TileRange {
 TileRange tiles_in(const Tilemap& map, const AABB& region);
 
 LevelInstance* instantiate_level(const Level* level);
-inline void destroy_level_instance(LevelInstance* inst) { operator delete(inst); }
+void destroy_level_instance(LevelInstance* inst);
+
+/// Moves the instance's tile animations on by dt seconds, and invalidates the cached chunks of tiles that changed frame
+void update_tile_animations(LevelInstance* inst, float dt);
+
+// Runtime tile editing. Rectangles are clipped to the layer; edits return false (and change nothing)
+// if the layer doesn't exist or a tile index isn't part of the layer's tileset.
+// Edited chunks are marked dirty: collision treats them conservatively until refresh_tiles catches their metadata up,
+// and their render batches rebuild when next drawn. In streamed levels, tiles of chunks that aren't resident can't be changed.
+// Not safe while anything else is reading the layers, such as the entity updates; Engine queues scripts' edits for that.
+
+bool set_tile(LevelInstance* inst, size_t layer, size_t x, size_t y, uint16_t tile);
+bool fill_tiles(LevelInstance* inst, size_t layer, size_t x, size_t y, size_t width, size_t height, uint16_t tile);
+/// Copies a block of tiles from src (typically a layer of another level asset, used as a submap) into the layer.
+/// Both have to use the same tileset.
+bool blit_submap(LevelInstance* inst, size_t layer, size_t x, size_t y, const Tilemap& src, size_t sx, size_t sy, size_t width, size_t height);
+
+/// Works out the chunk metadata of every edited chunk. Only the dirty region of each layer is visited.
+void refresh_tiles(LevelInstance* inst);
+
+/// For streamed levels: pages chunks in around the camera and out when over budget. Does nothing for other levels.
+// Anchors are the world bounds of whatever collides with the level (see LevelStreamer::update); the solid layers stay loaded around them.
+void stream_level(LevelInstance* inst, const Camera& camera, const std::vector<AABB>& anchors);
+
+class SnapshotWriter;
+class SnapshotReader;
+
+/// Tiles and tile animation state read back from a snapshot, checked against the level but not applied yet
+struct LevelSnapshot {
+	struct Chunk {
+		uint32_t layer, cx, cy;
+		uint16_t tiles[TILE_CHUNK_SIZE * TILE_CHUNK_SIZE];
+	};
+	struct Clock {
+		float time_left;
+		uint16_t frame;
+	};
+	std::vector<Chunk> chunks;
+	std::vector<Clock> clocks;
+};
+
+/// Writes the mutable parts of a level instance (tiles and tile animation state)
+void save_level_state(SnapshotWriter& writer, const LevelInstance* inst);
+/// Reads what save_level_state wrote, checking that it fits an instance of the same level. Doesn't touch the instance.
+Result<> read_level_state(SnapshotReader& reader, const LevelInstance* inst, LevelSnapshot& out);
+/// Applies state from read_level_state to the instance it was checked against
+void restore_level_state(LevelInstance* inst, const LevelSnapshot& saved);
+
+/// True if the hitbox overlaps the solid part of any tile. dis is its displacement since last update (for one-ways).
+bool hitbox_tilemap_collision(const Hitbox& hitbox, const Transform& tx, Vector2 dis, const Tilemap& map);
+/// True if a solid entity's solidity hitbox overlaps the solid part of any tile
+bool entity_tilemap_collision(const Entity* e, const Tilemap& map);
+
+/// True if the hitbox overlaps a collider of any scene object. Appends the index of each such object to hits, if given.
+bool hitbox_object_collision(const Hitbox& hitbox, const Transform& tx, Vector2 dis, const Level& level, std::vector<uint32_t>* hits = nullptr);
+/// Pushes a solid entity out of the scene objects' colliders, shortest way out, and adds the sides that touch to its level_contacts.
+void resolve_object_collision(Entity* e, const Level& level);
+
+/// Writes the solid part of a slope tile (tile-local, then moved by offset) to out, which needs room for 5 points
+size_t slope_polygon(const Tile::Solidity& solidity, float w, float h, Point2 offset, Point2* out);
+/// The solid part of a partial tile (tile-local, then moved by offset)
+AABB partial_tile_box(const Tile::Solidity& solidity, float w, float h, Point2 offset);
+
+/// Sides of an entity touching solid tiles, as bit flags in Entity::level_contacts
+namespace LevelContact {
+	enum : uint8_t {
+		GROUND     = 1 << 0,
+		CEILING    = 1 << 1,
+		WALL_LEFT  = 1 << 2,
+		WALL_RIGHT = 1 << 3
+	};
+}
+
+/// Pushes a solid entity out of the tilemap's solid tiles (x first, then y) and records which sides touch.
+/// Only modifies the entity, so it is safe to run for many entities in parallel.
+// grounded: whether the entity was on the ground last update (lets it step up small ledges)
+void resolve_tilemap_collision(Entity* e, const Tilemap& map, bool grounded);
 
-bool entity_tilemap_collision(const Entity* e, const Tilemap& map);
\ No newline at end of file
+/// True if the point lies within the solid part of a tile
+bool tilemap_point_collision(const Tilemap& map, Point2 point);
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include "levelstream.h"
+#include "level.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+LevelStreamer::LevelStreamer(const Level* level, size_t budget_bytes) : level(level),
+	budget(budget_bytes / sizeof(TileChunk)), n_resident(0), tick(0), must_wait(true),
+	in_flight(0), stopping(false) {
+
+	slots.resize(level->layers.size());
+	for (size_t i = 0; i < slots.size(); ++i) {
+		slots[i].assign(level->layers[i].tiles.n_chunks(), Slot{ UNLOADED, 0, 0 });
+	}
+
+	loader = std::thread(&LevelStreamer::load_chunks, this);
+}
+
+LevelStreamer::~LevelStreamer() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	loader.join();
+
+	// Chunks that were read but never taken in
+	for (const Arrival& arrival : arrivals) delete arrival.chunk;
+}
+
+// Loader thread
+void LevelStreamer::load_chunks() {
+	for (;;) {
+		Request req;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !requests.empty(); });
+			if (stopping) break;
+			req = requests.back();
+			requests.pop_back();
+			++in_flight;
+		}
+
+		// Offsets were checked against the file at load. Touching the mapping here keeps its page faults off the main thread.
+		TileChunk* chunk = TileGrid::new_chunk();
+		memcpy(chunk->tiles, level->file.data + req.offset, sizeof(chunk->tiles));
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			arrivals.push_back({ req.layer, req.cx, req.cy, chunk });
+			--in_flight;
+		}
+		arrived.notify_all();
+	}
+}
+
+void LevelStreamer::make_resident(LevelInstance* inst, size_t layer, size_t cx, size_t cy, TileChunk* chunk) {
+	TileGrid& grid = inst->layers[layer].tiles;
+	TileChunk* old = grid.swap_chunk(cx, cy, chunk);
+	if (old == nullptr) ++n_resident;
+	else delete old;
+
+	inst->batches[layer].invalidate(cx, cy);
+
+	Slot& slot = slots[layer][cy * grid.chunks_wide() + cx];
+	slot.state = RESIDENT;
+	slot.revision = chunk->revision;
+}
+
+void LevelStreamer::unload(LevelInstance* inst, size_t layer, size_t cx, size_t cy) {
+	TileGrid& grid = inst->layers[layer].tiles;
+	delete grid.swap_chunk(cx, cy, nullptr);
+	inst->batches[layer].release(cx, cy);
+
+	slots[layer][cy * grid.chunks_wide() + cx].state = UNLOADED;
+	--n_resident;
+}
+
+void LevelStreamer::receive(LevelInstance* inst) {
+	std::vector<Arrival> batch;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		batch.swap(arrivals);
+	}
+
+	for (const Arrival& arrival : batch) {
+		const TileGrid& grid = inst->layers[arrival.layer].tiles;
+		if (slots[arrival.layer][arrival.cy * grid.chunks_wide() + arrival.cx].state == RESIDENT) {
+			delete arrival.chunk; // adopted while it was being read
+			continue;
+		}
+		make_resident(inst, arrival.layer, arrival.cx, arrival.cy, arrival.chunk);
+	}
+}
+
+bool LevelStreamer::want(LevelInstance* inst, uint32_t layer, size_t cx, size_t cy, float distance, std::vector<Request>& wanted) {
+	const size_t index = cy * inst->layers[layer].tiles.chunks_wide() + cx;
+	Slot& slot = slots[layer][index];
+	slot.last_wanted = tick;
+	if (slot.state != UNLOADED) return slot.state == RESIDENT;
+
+	uint32_t offset = level->chunk_offsets[layer][index];
+	if (offset == 0) {
+		// Blank on disk, so there's nothing to read
+		make_resident(inst, layer, cx, cy, TileGrid::new_chunk());
+		return true;
+	}
+
+	slot.state = REQUESTED;
+	wanted.push_back({ layer, (uint32_t) cx, (uint32_t) cy, offset, distance });
+	return false;
+}
+
+void LevelStreamer::update(LevelInstance* inst, const Camera& camera, const std::vector<AABB>& anchors) {
+	++tick;
+	receive(inst);
+
+	thread_local std::vector<Request> wanted;
+	wanted.clear();
+
+	for (uint32_t i = 0; i < inst->layers.size(); ++i) {
+		const Tilemap& map = inst->layers[i];
+		const TileGrid& grid = map.tiles;
+
+		auto range = tiles_in(map, camera.view(map.parallax));
+		if (range.left > range.right || range.top > range.bottom) continue;
+
+		const size_t cx0 = SDL_max((int) (range.left >> TILE_CHUNK_SHIFT) - LEVEL_STREAM_MARGIN, 0);
+		const size_t cy0 = SDL_max((int) (range.top >> TILE_CHUNK_SHIFT) - LEVEL_STREAM_MARGIN, 0);
+		const size_t cx1 = SDL_min((size_t) (range.right >> TILE_CHUNK_SHIFT) + LEVEL_STREAM_MARGIN, grid.chunks_wide() - 1);
+		const size_t cy1 = SDL_min((size_t) (range.bottom >> TILE_CHUNK_SHIFT) + LEVEL_STREAM_MARGIN, grid.chunks_high() - 1);
+		const float mid_x = (range.left + range.right + 1) * 0.5f / TILE_CHUNK_SIZE;
+		const float mid_y = (range.top + range.bottom + 1) * 0.5f / TILE_CHUNK_SIZE;
+
+		for (size_t cy = cy0; cy <= cy1; ++cy) {
+			for (size_t cx = cx0; cx <= cx1; ++cx) {
+				float dx = cx + 0.5f - mid_x, dy = cy + 0.5f - mid_y;
+				want(inst, i, cx, cy, sqrtf(dx * dx + dy * dy), wanted);
+			}
+		}
+	}
+
+	// Whatever collides with the level needs the solid layers around it, in view or not. The chunks it overlaps
+	// can't wait for the loader; the margin around them is read ahead of time like the view's, so that's rare.
+	bool anchor_missing = false;
+	for (const AABB& box : anchors) {
+		for (uint32_t i = 0; i < inst->layers.size(); ++i) {
+			const Tilemap& map = inst->layers[i];
+			if (!map.solid) continue;
+			const TileGrid& grid = map.tiles;
+
+			auto range = tiles_in(map, box);
+			if (range.left > range.right || range.top > range.bottom) continue;
+
+			const size_t ox0 = range.left >> TILE_CHUNK_SHIFT, oy0 = range.top >> TILE_CHUNK_SHIFT;
+			const size_t ox1 = range.right >> TILE_CHUNK_SHIFT, oy1 = range.bottom >> TILE_CHUNK_SHIFT;
+			const size_t cx0 = SDL_max((int) ox0 - LEVEL_STREAM_MARGIN, 0);
+			const size_t cy0 = SDL_max((int) oy0 - LEVEL_STREAM_MARGIN, 0);
+			const size_t cx1 = SDL_min(ox1 + LEVEL_STREAM_MARGIN, grid.chunks_wide() - 1);
+			const size_t cy1 = SDL_min(oy1 + LEVEL_STREAM_MARGIN, grid.chunks_high() - 1);
+
+			for (size_t cy = cy0; cy <= cy1; ++cy) {
+				for (size_t cx = cx0; cx <= cx1; ++cx) {
+					const bool overlapped = cx >= ox0 && cx <= ox1 && cy >= oy0 && cy <= oy1;
+					// Overlapped chunks go to the front of the queue
+					if (!want(inst, i, cx, cy, overlapped ? 0.f : 1.f, wanted) && overlapped) anchor_missing = true;
+				}
+			}
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// Requests that went out of view before the loader got to them are dropped
+		auto stale = std::remove_if(requests.begin(), requests.end(), [this, inst](const Request& req) {
+			Slot& slot = slots[req.layer][req.cy * inst->layers[req.layer].tiles.chunks_wide() + req.cx];
+			if (slot.last_wanted == tick) return false;
+			slot.state = UNLOADED;
+			return true;
+		});
+		requests.erase(stale, requests.end());
+
+		if (!wanted.empty()) {
+			requests.insert(requests.end(), wanted.begin(), wanted.end());
+			std::stable_sort(requests.begin(), requests.end(), [](const Request& a, const Request& b) {
+				return a.distance > b.distance;
+			});
+		}
+	}
+	if (!wanted.empty()) wake.notify_one();
+
+	// Nothing should start out over ground that isn't there yet, or be left standing on ground that isn't
+	if (must_wait || anchor_missing) {
+		finish(inst);
+		must_wait = false;
+	}
+
+	evict(inst);
+}
+
+void LevelStreamer::finish(LevelInstance* inst) {
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		arrived.wait(lock, [this] { return requests.empty() && in_flight == 0; });
+	}
+	receive(inst);
+}
+
+void LevelStreamer::evict(LevelInstance* inst) {
+	if (n_resident <= budget) return;
+
+	// Down to 7/8 of the budget, so the scan doesn't happen again every update while right at the limit
+	const size_t target = budget - budget / 8;
+
+	struct Candidate {
+		uint32_t last_wanted;
+		uint32_t layer;
+		uint32_t index;
+	};
+	thread_local std::vector<Candidate> candidates;
+	candidates.clear();
+
+	for (uint32_t i = 0; i < slots.size(); ++i) {
+		const TileGrid& grid = inst->layers[i].tiles;
+		for (uint32_t index = 0; index < slots[i].size(); ++index) {
+			const Slot& slot = slots[i][index];
+			if (slot.state != RESIDENT || slot.last_wanted == tick) continue;
+			if (grid.chunk(index % grid.chunks_wide(), index / grid.chunks_wide()).revision != slot.revision) continue; // edited
+			candidates.push_back({ slot.last_wanted, i, index });
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+		return a.last_wanted < b.last_wanted;
+	});
+
+	for (const Candidate& c : candidates) {
+		if (n_resident <= target) break;
+		const size_t cw = inst->layers[c.layer].tiles.chunks_wide();
+		unload(inst, c.layer, c.index % cw, c.index / cw);
+	}
+}
+
+bool LevelStreamer::is_edited(const LevelInstance* inst, size_t layer, size_t cx, size_t cy) const {
+	const TileGrid& grid = inst->layers[layer].tiles;
+	const Slot& slot = slots[layer][cy * grid.chunks_wide() + cx];
+	return slot.state == RESIDENT && grid.chunk(cx, cy).revision != slot.revision;
+}
+
+void LevelStreamer::adopt(LevelInstance* inst, size_t layer, size_t cx, size_t cy, const uint16_t* tiles) {
+	Slot& slot = slots[layer][cy * inst->layers[layer].tiles.chunks_wide() + cx];
+	if (slot.state == REQUESTED) {
+		// If the loader already took the request, receive throws the chunk away when it arrives
+		std::lock_guard<std::mutex> lock(mutex);
+		requests.erase(std::remove_if(requests.begin(), requests.end(), [=](const Request& req) {
+			return req.layer == layer && req.cx == cx && req.cy == cy;
+		}), requests.end());
+	}
+
+	TileChunk* chunk = TileGrid::new_chunk();
+	memcpy(chunk->tiles, tiles, sizeof(chunk->tiles));
+	make_resident(inst, layer, cx, cy, chunk);
+	slot.revision = chunk->revision - 1; // so it counts as edited
+}
+
+void LevelStreamer::revert(LevelInstance* inst) {
+	for (size_t i = 0; i < slots.size(); ++i) {
+		const size_t cw = inst->layers[i].tiles.chunks_wide();
+		for (size_t index = 0; index < slots[i].size(); ++index) {
+			if (is_edited(inst, i, index % cw, index / cw)) unload(inst, i, index % cw, index / cw);
+		}
+	}
+	must_wait = true;
+}
+
+size_t LevelStreamer::resident_bytes() const {
+	return n_resident * sizeof(TileChunk);
+}
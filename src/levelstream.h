@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "camera.h"
+
+struct Level;
+struct LevelInstance;
+struct TileChunk;
+
+/// Pages the tile chunks of a streamed level in and out around the camera, and around anything else that collides with the level.
+// Chunks are copied out of the mapped level file on a background thread; update hands the finished ones to the layers and,
+// while the resident chunks are over budget, unloads the ones that have been out of view the longest.
+// Edited chunks are never unloaded, since the copy on disk no longer matches them.
+class LevelStreamer {
+	struct Request {
+		uint32_t layer, cx, cy;
+		uint32_t offset; // in the level file
+		float distance;  // from the middle of the view, in chunks, or 0 under an anchor. Nearer chunks are read first.
+	};
+	struct Arrival {
+		uint32_t layer, cx, cy;
+		TileChunk* chunk;
+	};
+
+	enum State : uint8_t { UNLOADED, REQUESTED, RESIDENT };
+	struct Slot {
+		State state;
+		uint32_t revision;    // of the chunk as it arrived, to tell whether it's been edited since
+		uint32_t last_wanted; // update the chunk was last near the view
+	};
+
+	const Level* level;
+	size_t budget; // in chunks
+	std::vector<std::vector<Slot>> slots; // per layer, per chunk
+	size_t n_resident;
+	uint32_t tick;
+	bool must_wait; // the next update waits for the view to be loaded (set at the start, and after a revert)
+
+	// Shared with the loader thread
+	std::mutex mutex;
+	std::condition_variable wake;    // main -> loader: there are requests, or it's time to stop
+	std::condition_variable arrived; // loader -> main: a chunk was read
+	std::vector<Request> requests;   // taken from the back, so they're kept furthest first
+	std::vector<Arrival> arrivals;
+	size_t in_flight;                // requests taken but not arrived yet
+	bool stopping;
+	std::thread loader;
+
+	void load_chunks();
+	void receive(LevelInstance* inst);
+	void unload(LevelInstance* inst, size_t layer, size_t cx, size_t cy);
+	void evict(LevelInstance* inst);
+	void make_resident(LevelInstance* inst, size_t layer, size_t cx, size_t cy, TileChunk* chunk);
+	bool want(LevelInstance* inst, uint32_t layer, size_t cx, size_t cy, float distance, std::vector<Request>& wanted);
+
+public:
+	LevelStreamer(const Level* level, size_t budget_bytes);
+	LevelStreamer(const LevelStreamer&) = delete;
+	~LevelStreamer();
+
+	/// Takes in the chunks that have been read, requests the ones near the camera that aren't resident, and evicts what's over budget.
+	// Anchors are world-space regions that keep the chunks of the solid layers under and around them resident wherever the camera is;
+	// if any chunk an anchor overlaps isn't resident yet, this waits for it.
+	void update(LevelInstance* inst, const Camera& camera, const std::vector<AABB>& anchors);
+	/// Waits until every requested chunk has been read, and takes them in
+	void finish(LevelInstance* inst);
+
+	/// True if the chunk is resident and its tiles have changed since it was read
+	bool is_edited(const LevelInstance* inst, size_t layer, size_t cx, size_t cy) const;
+	/// Makes a chunk resident with the given tiles (TILE_CHUNK_SIZE^2, row-major), counting it as edited. For snapshots.
+	void adopt(LevelInstance* inst, size_t layer, size_t cx, size_t cy, const uint16_t* tiles);
+	/// Unloads every edited chunk, so its tiles are read from the level file again
+	void revert(LevelInstance* inst);
+
+	size_t resident_bytes() const;
+};
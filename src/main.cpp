@@ -37,31 +37,31 @@ int main(int argc, char* argv[]) {
 		const char* title;
 		const char* iconfile;
 		uint16_t virtual_width, virtual_height;
-		try {
-#define check(EXPR, CODE) do {auto res = (EXPR); if (!res) return CODE;} while(0)
-			auto bootloader = open("engine.boot", "rb");
+		{
+#define check(EXPR, CODE) do {auto res = (EXPR); if (!res) { ERR("%s\n", std::to_string(res.err).c_str()); return CODE; }} while(0)
+			auto bootloader = read_file("engine.boot");
 
 			if (!bootloader) {
 				ERR("Unable to open engine.boot: %s", std::to_string(bootloader.err).c_str());
 				return EXIT_BOOTLOADER_MISSING;
 			}
-			FILE* stream = bootloader;
+			BinaryReader reader(bootloader.value);
 
-			if (!check_header(stream, "PlatEboot")) {
+			if (!check_header(reader, "PlatEboot")) {
 				ERR("Bootloader did not start with \"" BOOTLOADER_MAGIC_NUMBER "\"");
 				return EXIT_BOOTLOADER_BAD_HEADER;
 			}
 
-			title = read_string<uint16_t>(stream);
-			iconfile = read_string<uint16_t>(stream);
+			check(reader.read_string<uint16_t>(title), EXIT_BOOTLOADER_ERROR);
+			check(reader.read_string<uint16_t>(iconfile), EXIT_BOOTLOADER_ERROR);
 
 			// size of the virtual screen at all physical resolutions
-			virtual_width = read<uint16_t>(stream);
-			virtual_height = read<uint16_t>(stream);
+			check(reader.read(virtual_width), EXIT_BOOTLOADER_ERROR);
+			check(reader.read(virtual_height), EXIT_BOOTLOADER_ERROR);
 
 			{
 				char asset_dir[256];
-				read_string(stream, read<uint16_t>(stream), asset_dir);
+				check(reader.read_string<uint16_t>(asset_dir), EXIT_BOOTLOADER_ERROR);
 				if (!AssetManager::set_root_dir(asset_dir)) {
 					return EXIT_BOOTLOADER_ERROR;
 				}
@@ -69,24 +69,18 @@ int main(int argc, char* argv[]) {
 
 			{
 				char script_dir[256];
-				read_string<uint16_t>(stream, script_dir);
+				check(reader.read_string<uint16_t>(script_dir), EXIT_BOOTLOADER_ERROR);
 				// TODO: do something with it!
 			}
 
-			check(init_controller_types(stream), EXIT_BOOTLOADER_ERROR);
-			check(init_controllers(stream), EXIT_BOOTLOADER_ERROR);
+			check(init_controller_types(reader), EXIT_BOOTLOADER_ERROR);
+			check(init_controllers(reader), EXIT_BOOTLOADER_ERROR);
 			// TODO: init controller instances and their binding defaults
 
-			check(ColliderType::init(stream), EXIT_BOOTLOADER_ERROR);
-			check(ColliderChannel::init(stream), EXIT_BOOTLOADER_ERROR);
-
-			fclose(stream);
+			check(ColliderType::init(reader), EXIT_BOOTLOADER_ERROR);
+			check(ColliderChannel::init(reader), EXIT_BOOTLOADER_ERROR);
 #undef check
 		}
-		catch (Error& e) {
-			ERR("%s\n", std::to_string(e).c_str());
-			return EXIT_BOOTLOADER_ERROR;
-		}
 
 		atexit(SDL_Quit);
 
@@ -0,0 +1,183 @@
+#include "mappedfile.h"
+#include "mempool.h"
+#include "assetmanager.h"
+#include "fileutil.h"
+
+#include <cerrno>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+Result<MappedFile> MappedFile::map(const char* filename) {
+	MappedFile file;
+	file.handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file.handle == INVALID_HANDLE_VALUE) {
+		return Error(Errors::CannotOpenFile, filename);
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file.handle, &size) || size.QuadPart == 0 || (uint64_t) size.QuadPart > SIZE_MAX) {
+		CloseHandle(file.handle);
+		return Error(Errors::CannotMapFile, filename);
+	}
+	file.size = (size_t) size.QuadPart;
+
+	file.mapping = CreateFileMappingA(file.handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (file.mapping == nullptr) {
+		CloseHandle(file.handle);
+		return Error(Errors::CannotMapFile, filename);
+	}
+
+	file.data = static_cast<const uint8_t*>(MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0));
+	if (file.data == nullptr) {
+		CloseHandle(file.mapping);
+		CloseHandle(file.handle);
+		return Error(Errors::CannotMapFile, filename);
+	}
+
+	return file;
+}
+
+void MappedFile::unmap() {
+	UnmapViewOfFile(data);
+	CloseHandle(mapping);
+	CloseHandle(handle);
+	data = nullptr;
+	size = 0;
+}
+
+#else
+
+static Error map_error(const Errors::error_data& err, const char* filename) {
+	std::string detail(strerror(errno));
+	detail += '(';
+	detail += filename;
+	detail += ')';
+	return Error(err, detail);
+}
+
+Result<MappedFile> MappedFile::map(const char* filename) {
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) {
+		return map_error(Errors::CannotOpenFile, filename);
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		close(fd);
+		return Error(Errors::CannotMapFile, filename);
+	}
+
+	// The mapping holds its own reference to the file
+	void* data = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return map_error(Errors::CannotMapFile, filename);
+	}
+
+	MappedFile file;
+	file.data = static_cast<const uint8_t*>(data);
+	file.size = (size_t) info.st_size;
+	return file;
+}
+
+void MappedFile::unmap() {
+	munmap(const_cast<uint8_t*>(data), size);
+	data = nullptr;
+	size = 0;
+}
+
+#endif
+
+void StringTable::init(const MappedFile& file, const FileSection& section) {
+	chars = file.view<char>(section);
+	size = section.count;
+	if (size > 0 && chars[size - 1] != 0) {
+		throw Error(Errors::InvalidMappedData, "unterminated string table");
+	}
+}
+
+const char* StringTable::at(uint32_t offset) const {
+	if (offset >= size) throw Error(Errors::InvalidMappedData, "string");
+	return chars + offset;
+}
+
+void MappedShapes::init(const MappedFile& file, const StringTable& strs,
+	const FileSection& hitbox_section, const FileSection& vertex_section, const FileSection& collider_section) {
+	strings = strs;
+	hitboxes = file.view<HitboxRecord>(hitbox_section);
+	n_hitboxes = hitbox_section.count;
+	vertices = file.view<Point2>(vertex_section);
+	n_vertices = vertex_section.count;
+	colliders = file.view<ColliderRecord>(collider_section);
+	n_colliders = collider_section.count;
+}
+
+Hitbox MappedShapes::hitbox(uint32_t index, MemoryPool& pool) const {
+	if (index >= n_hitboxes) throw Error(Errors::InvalidMappedData, "hitbox");
+	const HitboxRecord& record = hitboxes[index];
+
+	Hitbox result;
+	result.type = record.type;
+	switch (record.type) {
+	case Hitbox::BOX:
+		result.box = record.box;
+		break;
+	case Hitbox::CIRCLE:
+		result.circle = record.circle;
+		break;
+	case Hitbox::LINE:
+	case Hitbox::ONEWAY:
+		result.line = record.line;
+		break;
+	case Hitbox::POLYGON:
+		if (!record.vertices.within(n_vertices)) throw Error(Errors::InvalidMappedData, "polygon vertices");
+		new(&result.polygon.vertices) Array<const Point2>(vertices + record.vertices.first, record.vertices.count);
+		result.polygon.aabb = poly_to_aabb(result.polygon.vertices);
+		break;
+	case Hitbox::COMPOSITE:
+	{
+		// Children always come after their composite, so a bad file can't make this loop
+		if (!record.children.within(n_hitboxes) || record.children.first <= index) {
+			throw Error(Errors::InvalidMappedData, "composite children");
+		}
+		Hitbox* subs = pool.alloc<Hitbox>(record.children.count);
+		if (subs == nullptr && record.children.count > 0) throw Error(Errors::BadAlloc, "composite children");
+		for (uint32_t i = 0; i < record.children.count; ++i) {
+			subs[i] = hitbox(record.children.first + i, pool);
+		}
+		result = make_composite(subs, record.children.count, pool);
+		break;
+	}
+	case Hitbox::NONE:
+		break;
+	default:
+		char type[2] = { record.type, 0 };
+		throw Error(Errors::InvalidHitboxType, std::string(type));
+	}
+
+	return result;
+}
+
+Array<const Collider> MappedShapes::collider_range(const RecordRange& range, MemoryPool& pool) const {
+	if (!range.within(n_colliders)) throw Error(Errors::InvalidMappedData, "colliders");
+
+	Collider* result = pool.alloc<Collider>(range.count);
+	if (result == nullptr && range.count > 0) throw Error(Errors::BadAlloc, "colliders");
+	for (uint32_t i = 0; i < range.count; ++i) {
+		const ColliderRecord& record = colliders[range.first + i];
+		result[i].type = ColliderType::by_name(strings.at(record.type));
+		result[i].hitbox = hitbox(record.hitbox, pool);
+	}
+	return Array<const Collider>(result, range.count);
+}
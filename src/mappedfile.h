@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <typeinfo>
+#include <SDL2/SDL_endian.h>
+#include "result.h"
+#include "error.h"
+#include "arrays.h"
+#include "hitbox.h"
+
+namespace Errors {
+	const error_data
+		CannotMapFile = { 3, "File could not be mapped into memory." },
+		InvalidMappedData = { 4, "Mapped file refers to data outside of itself." };
+}
+
+// Mapped assets are used in place, so their records have to match the engine's layout byte for byte
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+#error "Mapped asset files are little-endian"
+#endif
+
+/// Range of records in a mapped file, as stored in its header
+struct FileSection {
+	uint32_t offset; // from the start of the file
+	uint32_t count;  // of records
+};
+
+/// Range of records within a section, by index
+struct RecordRange {
+	uint32_t first;
+	uint32_t count;
+
+	/// True if the range lies within a section of n records
+	inline bool within(uint32_t n) const { return first <= n && count <= n - first; }
+};
+
+/// A whole file, mapped read-only into memory.
+// Assets made from one point into it for their strings and flat arrays, so it stays mapped for as long as they're loaded.
+struct MappedFile {
+	const uint8_t* data;
+	size_t size;
+#ifdef _WIN32
+	void* handle;
+	void* mapping;
+#endif
+
+	static Result<MappedFile> map(const char* filename);
+	void unmap();
+
+	/// Records of a section in place. Throws if the section runs past the end of the file or isn't aligned for T.
+	template <class T>
+	const T* view(const FileSection& section) const {
+		if ((uint64_t) section.offset + (uint64_t) section.count * sizeof(T) > size || section.offset % alignof(T) != 0) {
+			throw Error(Errors::InvalidMappedData, typeid(T).name());
+		}
+		return reinterpret_cast<const T*>(data + section.offset);
+	}
+
+	/// Copies a T out from offset, which doesn't have to be aligned. False if the file is too short.
+	template <class T>
+	bool copy(size_t offset, T& out) const {
+		static_assert(std::is_pod<T>::value, "MappedFile::copy can only be used for POD types");
+		if (offset + sizeof(T) > size) return false;
+		memcpy(&out, data + offset, sizeof(T));
+		return true;
+	}
+};
+
+/// NUL-terminated strings that records refer to by byte offset
+struct StringTable {
+	const char* chars;
+	uint32_t size;
+
+	void init(const MappedFile& file, const FileSection& section);
+	/// Throws if the offset is outside the table
+	const char* at(uint32_t offset) const;
+};
+
+struct HitboxRecord {
+	Hitbox::Type type;
+	uint8_t padding[3];
+	union {
+		AABB box;
+		Line line;
+		Circle circle;
+		RecordRange vertices; // POLYGON: in the vertex section
+		RecordRange children; // COMPOSITE: in the hitbox section, always after this record
+	};
+};
+static_assert(sizeof(HitboxRecord) == 20, "HitboxRecord has to match HitboxRecord in tools/hitbox.py");
+
+struct ColliderRecord {
+	uint32_t type;   // name of the collider type, in the string table
+	uint32_t hitbox; // in the hitbox section
+};
+
+/// Hitboxes and colliders of a mapped asset, which are stored as flat tables that other records index into
+struct MappedShapes {
+	StringTable strings;
+	const HitboxRecord* hitboxes;
+	uint32_t n_hitboxes;
+	const Point2* vertices;
+	uint32_t n_vertices;
+	const ColliderRecord* colliders;
+	uint32_t n_colliders;
+
+	void init(const MappedFile& file, const StringTable& strings,
+		const FileSection& hitboxes, const FileSection& vertices, const FileSection& colliders);
+
+	/// Polygons use their vertices in place; composites are built into the pool like read_hitbox builds them.
+	/// Throws on records that refer outside their sections, and when the pool runs out
+	// (the section sizes don't bound it, since several records can share one range of children).
+	Hitbox hitbox(uint32_t index, MemoryPool& pool) const;
+	Array<const Collider> collider_range(const RecordRange& range, MemoryPool& pool) const;
+};
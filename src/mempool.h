@@ -92,7 +92,9 @@ public:
 	template <class T>
 	T* alloc(size_t n_elements = 1) {
 		if ((intptr_t)nextAlloc - (intptr_t)pool + n_elements * sizeof(T) > size) return nullptr;
-		T* result = (T*)std::align(nextAlloc);
+		intptr_t aligned = ((intptr_t)nextAlloc + alignof(T) - 1) & ~(intptr_t)(alignof(T) - 1);
+		if (aligned - (intptr_t)pool + n_elements * sizeof(T) > size) return nullptr;
+		T* result = (T*)aligned;
 		nextAlloc = result + n_elements;
 		return result;
 	}
@@ -0,0 +1,414 @@
+#include "particles.h"
+#include "mempool.h"
+#include "fileutil.h"
+#include "level.h"
+#include "rng.h"
+#include "util.h"
+
+#include <emmintrin.h>
+#include <algorithm>
+#include <cstring>
+
+// =========================================================================================
+// ==== Emitter Loading ====
+// =========================================================================================
+
+__forceinline static Result<const ParticleEmitter*> read_emitter(BinaryReader& reader, MemoryPool& pool,
+	uint32_t namelen, uint32_t texnamelen, const DirContext& context);
+
+Result<const ParticleEmitter*> load_emitter(const char* filename, const DirContext& context) {
+	std::string realfile;
+	check_assign(realfile, context.resolve(filename));
+
+	{
+		const ParticleEmitter* maybe = AssetManager::retrieve<ParticleEmitter>(realfile.c_str());
+		if (maybe != nullptr) return maybe;
+	}
+
+	std::vector<uint8_t> bytes;
+	check_assign(bytes, read_file(realfile.c_str()));
+	BinaryReader reader(bytes);
+
+	// Check the magic number
+	if (!check_header(reader, EMITTER_MAGIC_NUMBER)) {
+		return Errors::InvalidEmitterHeader;
+	}
+
+	uint32_t namelen, texnamelen;
+
+	check_void(reader.read(namelen));
+	check_void(reader.read(texnamelen));
+
+	size_t poolsize = sizeof(ParticleEmitter) + namelen + 1;
+
+	LOG_VERBOSE("Number of bytes needed for emitter data: %zd\n", poolsize);
+	MemoryPool pool(poolsize);
+
+	check_assign_ref(const DirContext& subcontext, context + filename, sctx);
+	auto result = read_emitter(reader, pool, namelen, texnamelen, subcontext);
+
+	if (result) {
+		AssetManager::store(filename, result.value);
+	}
+	else {
+		// Clean up from the error
+		pool.free();
+	}
+
+	return result;
+}
+
+__forceinline static Result<const ParticleEmitter*> read_emitter(BinaryReader& reader, MemoryPool& pool,
+	uint32_t namelen, uint32_t texnamelen, const DirContext& context) {
+	ParticleEmitter* emitter = pool.alloc<ParticleEmitter>();
+	if (emitter == nullptr) return Errors::BadAlloc;
+
+	uint32_t clip[4];
+	check_void(reader.read_span(clip, 4));
+	emitter->clip = { (float) clip[0], (float) clip[1], (float) clip[2], (float) clip[3] };
+
+	check_void(reader.read(emitter->burst));
+	check_void(reader.read(emitter->capacity));
+
+	check_void(reader.read(emitter->life_min));
+	check_void(reader.read(emitter->life_max));
+	check_void(reader.read(emitter->speed_min));
+	check_void(reader.read(emitter->speed_max));
+	check_void(reader.read(emitter->angle_min));
+	check_void(reader.read(emitter->angle_max));
+
+	check_void(reader.read(emitter->gravity));
+	check_void(reader.read(emitter->drag));
+
+	check_void(reader.read(emitter->collision));
+	check_void(reader.read(emitter->restitution));
+
+	switch (emitter->collision) {
+	case ParticleEmitter::NONE:
+	case ParticleEmitter::KILL:
+	case ParticleEmitter::BOUNCE:
+		break;
+	default:
+		char mode[2] = { emitter->collision, 0 };
+		return Error(Errors::InvalidEmitterCollision, std::string(mode));
+	}
+
+	check_void(reader.read_string(namelen, pool, emitter->name));
+	check_assign(emitter->texture, read_referenced_texture(reader, texnamelen, context));
+
+	return emitter;
+}
+
+// =========================================================================================
+// ==== Storage ====
+// =========================================================================================
+
+static float* alloc_lane(size_t capacity) {
+	float* lane = static_cast<float*>(_mm_malloc(capacity * sizeof(float), 16));
+	memset(lane, 0, capacity * sizeof(float));
+	return lane;
+}
+
+ParticlePool::ParticlePool(const ParticleEmitter* emitter) : emitter(emitter), count(0) {
+	size_t cap = emitter->capacity > 0 ? emitter->capacity : PARTICLE_DEFAULT_CAPACITY;
+	capacity = (cap + 3) & ~(size_t) 3; // padding lets SSE run off the end of the live particles
+
+	x = alloc_lane(capacity);
+	y = alloc_lane(capacity);
+	vx = alloc_lane(capacity);
+	vy = alloc_lane(capacity);
+	life = alloc_lane(capacity);
+}
+
+ParticlePool::~ParticlePool() {
+	_mm_free(x);
+	_mm_free(y);
+	_mm_free(vx);
+	_mm_free(vy);
+	_mm_free(life);
+}
+
+ParticleSystem::ParticleSystem() : pools() {
+	vertices = new float[PARTICLE_QUADS_PER_BATCH * 16];
+	indices = new uint16_t[PARTICLE_QUADS_PER_BATCH * 6];
+
+	// The index pattern never changes, so build it once
+	for (uint16_t q = 0; q < PARTICLE_QUADS_PER_BATCH; ++q) {
+		uint16_t* quad = indices + q * 6;
+		uint16_t base = q * 4;
+		quad[0] = base;
+		quad[1] = base + 1;
+		quad[2] = base + 2;
+		quad[3] = base;
+		quad[4] = base + 2;
+		quad[5] = base + 3;
+	}
+}
+
+ParticleSystem::~ParticleSystem() {
+	for (ParticlePool* pool : pools) {
+		delete pool;
+	}
+	delete[] vertices;
+	delete[] indices;
+}
+
+ParticlePool* ParticleSystem::get_pool(const ParticleEmitter* emitter) {
+	// There are only ever a handful of emitter types alive at once, so a linear search is fine
+	for (ParticlePool* pool : pools) {
+		if (pool->emitter == emitter) return pool;
+	}
+	// Pools drawing from the same texture are kept next to each other so render() can batch them together
+	auto pos = std::find_if(pools.rbegin(), pools.rend(),
+		[emitter](const ParticlePool* p) -> bool { return p->emitter->texture == emitter->texture; });
+	ParticlePool* pool = new ParticlePool(emitter);
+	pools.insert(pos.base(), pool);
+	return pool;
+}
+
+void ParticleSystem::emit(const ParticleEmitter* emitter, Point2 position, int count) {
+	assert(emitter != nullptr);
+	ParticlePool* pool = get_pool(emitter);
+
+	if (count < 0) count = emitter->burst;
+	size_t n = std::min<size_t>(count, pool->capacity - pool->count);
+
+	Random& rng = get_thread_rng();
+	for (size_t i = pool->count; i < pool->count + n; ++i) {
+		Vector2 vel = Vector2::fromPolar(
+			rng.interval(emitter->angle_min, emitter->angle_max),
+			rng.interval(emitter->speed_min, emitter->speed_max)
+		);
+		pool->x[i] = position.x;
+		pool->y[i] = position.y;
+		pool->vx[i] = vel.x;
+		pool->vy[i] = vel.y;
+		pool->life[i] = rng.interval(emitter->life_min, emitter->life_max);
+	}
+	pool->count += n;
+}
+
+size_t ParticleSystem::size() const {
+	size_t total = 0;
+	for (const ParticlePool* pool : pools) {
+		total += pool->count;
+	}
+	return total;
+}
+
+void ParticleSystem::clear() {
+	for (ParticlePool* pool : pools) {
+		pool->count = 0;
+	}
+}
+
+// =========================================================================================
+// ==== Simulation ====
+// =========================================================================================
+
+struct ParticleStep {
+	const LevelInstance* level;
+	float dt;
+};
+
+struct ParticleChunk {
+	ParticlePool* pool;
+	uint32_t begin, end;
+};
+
+static bool particle_hits_level(const LevelInstance* level, Point2 point) {
+	for (const Tilemap& layer : level->layers) {
+		if (layer.solid && tilemap_point_collision(layer, point)) return true;
+	}
+	return false;
+}
+
+static void particle_collide(const ParticleStep* shared, ParticlePool* pool, uint32_t begin, uint32_t end) {
+	const ParticleEmitter* emitter = pool->emitter;
+	const float dt = shared->dt;
+
+	for (uint32_t i = begin; i < end; ++i) {
+		if (pool->life[i] <= 0.f) continue;
+		if (!particle_hits_level(shared->level, { pool->x[i], pool->y[i] })) continue;
+
+		if (emitter->collision == ParticleEmitter::KILL) {
+			pool->life[i] = 0.f;
+			continue;
+		}
+
+		// Back up to where the particle was and figure out which axis it came in on
+		float px = pool->x[i] - pool->vx[i] * dt;
+		float py = pool->y[i] - pool->vy[i] * dt;
+		bool hitx = particle_hits_level(shared->level, { pool->x[i], py });
+		bool hity = particle_hits_level(shared->level, { px, pool->y[i] });
+		if (!hitx && !hity) hitx = hity = true; // corner
+
+		if (hitx) pool->vx[i] = -pool->vx[i] * emitter->restitution;
+		if (hity) pool->vy[i] = -pool->vy[i] * emitter->restitution;
+		pool->x[i] = px;
+		pool->y[i] = py;
+	}
+}
+
+// Integrates velocity, position, and lifetime four particles at a time.
+static void particle_step(const ParticleStep* shared, ParticleChunk* chunk) {
+	ParticlePool* pool = chunk->pool;
+	const ParticleEmitter* emitter = pool->emitter;
+	const float dt = shared->dt;
+
+	const __m128 dt4 = _mm_set1_ps(dt);
+	const __m128 gx = _mm_set1_ps(emitter->gravity.x * dt);
+	const __m128 gy = _mm_set1_ps(emitter->gravity.y * dt);
+	const __m128 damp = _mm_set1_ps(fmaxf(0.f, 1.f - emitter->drag * dt));
+
+	// The pool is padded to a multiple of 4, so rounding up never runs past the end of the lanes
+	const uint32_t end = (chunk->end + 3) & ~3u;
+	for (uint32_t i = chunk->begin; i < end; i += 4) {
+		__m128 vx = _mm_load_ps(pool->vx + i);
+		__m128 vy = _mm_load_ps(pool->vy + i);
+
+		vx = _mm_mul_ps(_mm_add_ps(vx, gx), damp);
+		vy = _mm_mul_ps(_mm_add_ps(vy, gy), damp);
+
+		_mm_store_ps(pool->vx + i, vx);
+		_mm_store_ps(pool->vy + i, vy);
+		_mm_store_ps(pool->x + i, _mm_add_ps(_mm_load_ps(pool->x + i), _mm_mul_ps(vx, dt4)));
+		_mm_store_ps(pool->y + i, _mm_add_ps(_mm_load_ps(pool->y + i), _mm_mul_ps(vy, dt4)));
+		_mm_store_ps(pool->life + i, _mm_sub_ps(_mm_load_ps(pool->life + i), dt4));
+	}
+
+	if (emitter->collision != ParticleEmitter::NONE && shared->level != nullptr) {
+		particle_collide(shared, pool, chunk->begin, chunk->end);
+	}
+}
+
+// Removes dead particles by moving the last live particle into their slot. Order is not preserved.
+static void compact_pool(ParticlePool* pool) {
+	size_t i = 0;
+	size_t n = pool->count;
+	while (i < n) {
+		if (pool->life[i] > 0.f) {
+			++i;
+			continue;
+		}
+		--n;
+		pool->x[i] = pool->x[n];
+		pool->y[i] = pool->y[n];
+		pool->vx[i] = pool->vx[n];
+		pool->vy[i] = pool->vy[n];
+		pool->life[i] = pool->life[n];
+	}
+	pool->count = n;
+}
+
+void ParticleSystem::update(const LevelInstance* level, const float dt) {
+	executor.set_batch_job(&particle_step, ParticleStep{ level, dt });
+
+	for (ParticlePool* pool : pools) {
+		for (size_t begin = 0; begin < pool->count; begin += PARTICLE_CHUNK_SIZE) {
+			executor.submit(ParticleChunk{
+				pool,
+				static_cast<uint32_t>(begin),
+				static_cast<uint32_t>(std::min<size_t>(begin + PARTICLE_CHUNK_SIZE, pool->count))
+			});
+		}
+	}
+
+	executor.run_batch();
+
+	for (ParticlePool* pool : pools) {
+		compact_pool(pool);
+	}
+}
+
+// =========================================================================================
+// ==== Rendering ====
+// =========================================================================================
+
+void ParticleSystem::render(GPU_Target* screen) {
+	GPU_Image* batch_texture = nullptr;
+	size_t n = 0;
+
+	auto flush = [&]() {
+		if (n == 0) return;
+		GPU_TriangleBatch(batch_texture, screen,
+			static_cast<unsigned short>(n * 4), vertices,
+			static_cast<unsigned int>(n * 6), indices,
+			GPU_BATCH_XY_ST);
+		n = 0;
+	};
+
+	for (const ParticlePool* pool : pools) {
+		if (pool->count == 0) continue;
+
+		const ParticleEmitter* emitter = pool->emitter;
+		GPU_Image* texture = emitter->texture;
+		if (texture == nullptr) continue;
+		if (texture != batch_texture) {
+			flush();
+			batch_texture = texture;
+		}
+
+		const float hw = emitter->clip.w * 0.5f;
+		const float hh = emitter->clip.h * 0.5f;
+		const float s0 = emitter->clip.x / texture->w;
+		const float s1 = (emitter->clip.x + emitter->clip.w) / texture->w;
+		const float t0 = emitter->clip.y / texture->h;
+		const float t1 = (emitter->clip.y + emitter->clip.h) / texture->h;
+
+		for (size_t i = 0; i < pool->count; ++i) {
+			if (n == PARTICLE_QUADS_PER_BATCH) flush();
+
+			float* v = vertices + n * 16;
+			const float x = pool->x[i];
+			const float y = pool->y[i];
+			v[0]  = x - hw; v[1]  = y - hh; v[2]  = s0; v[3]  = t0;
+			v[4]  = x + hw; v[5]  = y - hh; v[6]  = s1; v[7]  = t0;
+			v[8]  = x + hw; v[9]  = y + hh; v[10] = s1; v[11] = t1;
+			v[12] = x - hw; v[13] = y + hh; v[14] = s0; v[15] = t1;
+			++n;
+		}
+	}
+	flush();
+}
+
+// =========================================================================================
+// ==== AngelScript Interface ====
+// =========================================================================================
+
+struct ParticleEmit {
+	ParticleSystem* system;
+	const ParticleEmitter* emitter;
+	Vector2 position;
+	int count;
+};
+static void emit_wrapper(ParticleEmit* d) {
+	d->system->emit(d->emitter, d->position, d->count);
+}
+static void EmitDeferred(ParticleSystem* system, const std::string& filename, const Vector2& position, int count) {
+	auto maybe = load_emitter(filename.c_str());
+	if (!maybe) {
+		ForwardErrorAsScriptException(maybe.err);
+		return;
+	}
+
+	ParticleEmit data = { system, maybe.value, position, count };
+	executor.defer(emit_wrapper, data);
+}
+
+static uint32_t GetParticleCount(ParticleSystem* system) {
+	return static_cast<uint32_t>(system->size());
+}
+
+void RegisterParticleTypes(asIScriptEngine* engine) {
+	int r;
+
+	r = engine->RegisterObjectType("__ParticleSystem__", 0, asOBJ_REF | asOBJ_NOCOUNT); assert(r >= 0);
+
+	r = engine->RegisterObjectMethod("__ParticleSystem__", "void emit(const string &in, const Vector2 &in, int count = -1)",
+		asFUNCTION(EmitDeferred), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("__ParticleSystem__", "uint get_count()",
+		asFUNCTION(GetParticleCount), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("__ParticleSystem__", "void clear()",
+		asMETHOD(ParticleSystem, clear), asCALL_THISCALL); assert(r >= 0);
+}
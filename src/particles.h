@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "arrays.h"
+#include "vectors.h"
+#include "result.h"
+#include "error.h"
+#include "assetmanager.h"
+#include "executor.h"
+
+#include "angelscript.h"
+
+#include "SDL_gpu.h"
+
+#define EMITTER_MAGIC_NUMBER "PlatEemitter"
+
+// Particles are stepped in chunks of this many per executor job. Must be a multiple of 4 (SSE width).
+#define PARTICLE_CHUNK_SIZE 4096
+#define PARTICLE_DEFAULT_CAPACITY 4096
+
+// GPU_TriangleBatch takes 16-bit indices, so each draw call can hold at most this many quads
+#define PARTICLE_QUADS_PER_BATCH (65536 / 4 - 1)
+
+namespace Errors {
+	const error_data
+		InvalidEmitterHeader = { 801, "Emitter does not begin with the string \"" EMITTER_MAGIC_NUMBER "\"" },
+		InvalidEmitterCollision = { 802, "Emitter has an invalid collision mode." };
+}
+
+/// Immutable particle emitter definition. Baked by tools/buildemitter.py
+struct ParticleEmitter {
+	const char* name;
+	GPU_Image* texture;
+	GPU_Rect clip;
+
+	uint32_t burst;    // number of particles emitted when no count is given
+	uint32_t capacity; // maximum number of live particles for this emitter
+
+	float life_min, life_max;   // seconds
+	float speed_min, speed_max; // pixels per second
+	float angle_min, angle_max; // radians, clockwise from the right
+
+	Vector2 gravity;
+	float drag; // fraction of velocity lost per second
+
+	// How particles interact with solid tiles
+	enum Collision : char {
+		NONE   =  0,  // fly through everything
+		KILL   = 'k', // die on contact
+		BOUNCE = 'b'  // reflect off of the tile
+	} collision;
+	float restitution; // fraction of speed kept after a bounce
+};
+
+Result<const ParticleEmitter*> load_emitter(const char* filename, const DirContext& context = DirContext());
+
+struct LevelInstance;
+
+/// Structure-of-arrays storage for every live particle of one emitter
+// All arrays are 16-byte aligned and padded to a multiple of 4 so they can be stepped with SSE.
+struct ParticlePool {
+	const ParticleEmitter* emitter;
+
+	size_t count;
+	size_t capacity;
+
+	float* x;
+	float* y;
+	float* vx;
+	float* vy;
+	float* life;
+
+	ParticlePool(const ParticleEmitter* emitter);
+	ParticlePool(const ParticlePool&) = delete;
+	~ParticlePool();
+};
+
+class ParticleSystem {
+private:
+	std::vector<ParticlePool*> pools;
+
+	// Scratch buffers reused by every draw call
+	float* vertices;
+	uint16_t* indices;
+
+	ParticlePool* get_pool(const ParticleEmitter* emitter);
+
+public:
+	ParticleSystem();
+	ParticleSystem(const ParticleSystem&) = delete;
+	~ParticleSystem();
+
+	/// Emits particles at the given position. Not threadsafe; scripts go through the executor's deferred queue.
+	void emit(const ParticleEmitter* emitter, Point2 position, int count = -1);
+
+	void update(const LevelInstance* level, const float delta_time);
+
+	/// Draws every pool with one batched draw call per texture, however many emitters share it
+	void render(GPU_Target* screen);
+
+	size_t size() const;
+	void clear();
+};
+
+void RegisterParticleTypes(asIScriptEngine* engine);
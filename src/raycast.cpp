@@ -0,0 +1,495 @@
+#include "raycast.h"
+#include "tileset.h"
+#include "transform.h"
+#include "util.h"
+
+#include <vector>
+#include <algorithm>
+
+// =========================================================================================
+// ==== Swept separating axis test ====
+// =========================================================================================
+
+// Every solid shape is reduced to a convex polygon (2 vertices for lines) in world space.
+// A box moving along `motion` hits it at the latest time its projections start overlapping on any axis,
+// provided that is before the earliest time they stop overlapping. A ray is just a box with no size.
+struct Sweep {
+	AABB box;
+	Vector2 motion; // full length of the cast
+};
+
+struct SweepResult {
+	float t;        // fraction of the motion
+	Vector2 normal;
+};
+
+static __forceinline void project_box(const AABB& box, Vector2 axis, float& lo, float& hi) {
+	float center = 0.5f * ((box.left + box.right) * axis.x + (box.top + box.bottom) * axis.y);
+	float extent = 0.5f * ((box.right - box.left) * fabsf(axis.x) + (box.bottom - box.top) * fabsf(axis.y));
+	lo = center - extent;
+	hi = center + extent;
+}
+
+static __forceinline void project_poly(const Point2* verts, size_t n, Vector2 axis, float& lo, float& hi) {
+	lo = hi = verts[0].dot(axis);
+	for (size_t i = 1; i < n; ++i) {
+		float p = verts[i].dot(axis);
+		lo = fminf(lo, p);
+		hi = fmaxf(hi, p);
+	}
+}
+
+// Narrows [t_enter, t_exit] by one axis. Returns false once the sweep is known to miss.
+static __forceinline bool sweep_axis(const Point2* verts, size_t n, const Sweep& sweep, Vector2 axis,
+	float& t_enter, float& t_exit, Vector2& normal) {
+	float plo, phi, blo, bhi;
+	project_poly(verts, n, axis, plo, phi);
+	project_box(sweep.box, axis, blo, bhi);
+	float v = sweep.motion.dot(axis);
+
+	if (v == 0.f) {
+		return !(bhi < plo || blo > phi);
+	}
+
+	float t0 = (plo - bhi) / v;
+	float t1 = (phi - blo) / v;
+	if (t0 > t1) std::swap(t0, t1);
+
+	if (t0 > t_enter) {
+		t_enter = t0;
+		normal = v > 0.f ? -axis : axis; // the face being hit points against the motion
+	}
+	if (t1 < t_exit) t_exit = t1;
+
+	return t_enter <= t_exit;
+}
+
+// oneway_normal: if non-zero, the shape only blocks motion into that side
+static bool sweep_polygon(const Point2* verts, size_t n, const Sweep& sweep, SweepResult& result,
+	Vector2 oneway_normal = { 0.f, 0.f }) {
+	if (n == 0) return false;
+
+	float t_enter = -INFINITY, t_exit = INFINITY;
+	Vector2 normal = { 0.f, 0.f };
+
+	if (!sweep_axis(verts, n, sweep, Vector2{ 1.f, 0.f }, t_enter, t_exit, normal)) return false;
+	if (!sweep_axis(verts, n, sweep, Vector2{ 0.f, 1.f }, t_enter, t_exit, normal)) return false;
+
+	size_t n_edges = n == 2 ? 1 : n;
+	for (size_t i = 0; i < n_edges; ++i) {
+		Vector2 edge = verts[(i + 1) % n] - verts[i];
+		if (edge.x == 0.f || edge.y == 0.f) continue; // already covered by the box axes
+		Vector2 axis = edge.rotated90CW().normalized();
+		if (!sweep_axis(verts, n, sweep, axis, t_enter, t_exit, normal)) return false;
+	}
+
+	if (t_enter > 1.f || t_exit < 0.f) return false;
+
+	if (t_enter < 0.f) { // started overlapping
+		if (oneway_normal.x != 0.f || oneway_normal.y != 0.f) return false;
+		result.t = 0.f;
+		result.normal = { 0.f, 0.f };
+		return true;
+	}
+
+	if (oneway_normal.x != 0.f || oneway_normal.y != 0.f) {
+		if (sweep.motion.dot(oneway_normal) >= 0.f) return false;
+		normal = oneway_normal;
+	}
+
+	result.t = t_enter;
+	result.normal = normal;
+	return true;
+}
+
+// Circles are treated as their circumscribed octagon. Slightly generous, but keeps every shape convex-polygonal.
+static void circle_to_poly(Point2 center, float radius, Point2* out) {
+	const float r = radius * 1.0823922f; // 1 / cos(pi / 8)
+	const float d = r * 0.70710678f;
+	out[0] = { center.x + r, center.y };
+	out[1] = { center.x + d, center.y + d };
+	out[2] = { center.x, center.y + r };
+	out[3] = { center.x - d, center.y + d };
+	out[4] = { center.x - r, center.y };
+	out[5] = { center.x - d, center.y - d };
+	out[6] = { center.x, center.y - r };
+	out[7] = { center.x + d, center.y - d };
+}
+
+static inline void box_to_poly(const Transform& tx, const AABB& box, Point2* out) {
+	out[0] = tx * Vector2{ box.left, box.top };
+	out[1] = tx * Vector2{ box.right, box.top };
+	out[2] = tx * Vector2{ box.right, box.bottom };
+	out[3] = tx * Vector2{ box.left, box.bottom };
+}
+
+// Sweeps against any hitbox placed with the given transform, keeping the earliest hit
+static bool sweep_hitbox(const Hitbox& hitbox, const Transform& tx, const Sweep& sweep, SweepResult& best) {
+	Point2 verts[8];
+	SweepResult res;
+	bool hit = false;
+
+	switch (hitbox.type) {
+	case Hitbox::BOX:
+		box_to_poly(tx, hitbox.box, verts);
+		hit = sweep_polygon(verts, 4, sweep, res);
+		break;
+	case Hitbox::CIRCLE:
+		circle_to_poly(tx * hitbox.circle.center,
+			fmaxf(fabsf(tx.get_scaleX()), fabsf(tx.get_scaleY())) * hitbox.circle.radius, verts);
+		hit = sweep_polygon(verts, 8, sweep, res);
+		break;
+	case Hitbox::LINE:
+	case Hitbox::ONEWAY:
+	{
+		verts[0] = tx * hitbox.line.p1;
+		verts[1] = tx * hitbox.line.p2;
+		Vector2 oneway = { 0.f, 0.f };
+		if (hitbox.type == Hitbox::ONEWAY) {
+			// Solid from the top for left-to-right lines
+			oneway = (verts[1] - verts[0]).rotated90CCW().normalized();
+		}
+		hit = sweep_polygon(verts, 2, sweep, res, oneway);
+		break;
+	}
+	case Hitbox::POLYGON:
+	{
+		thread_local std::vector<Point2> scratch;
+		scratch.resize(hitbox.polygon.vertices.size());
+		for (size_t i = 0; i < scratch.size(); ++i) {
+			scratch[i] = tx * hitbox.polygon.vertices[i];
+		}
+		hit = sweep_polygon(scratch.data(), scratch.size(), sweep, res);
+		break;
+	}
+	case Hitbox::COMPOSITE:
+	{
+		bool any = false;
+		for (const Hitbox& sub : hitbox.composite.hitboxes) {
+			any = sweep_hitbox(sub, tx, sweep, best) || any;
+		}
+		return any;
+	}
+	default:
+		return false;
+	}
+
+	if (hit && res.t < best.t) {
+		best = res;
+		return true;
+	}
+	return false;
+}
+
+// Same as sweep_hitbox, for a hitbox already placed in the world (an entity's collider cache)
+static bool sweep_world_hitbox(const WorldShapes& set, const WorldHitbox& shape, const Sweep& sweep, SweepResult& best) {
+	Point2 verts[8];
+	SweepResult res;
+	bool hit = false;
+
+	switch (shape.type) {
+	case Hitbox::BOX:
+		aabb_to_poly(shape.box, verts);
+		hit = sweep_polygon(verts, 4, sweep, res);
+		break;
+	case Hitbox::CIRCLE:
+		circle_to_poly(shape.circle.center, shape.circle.radius, verts);
+		hit = sweep_polygon(verts, 8, sweep, res);
+		break;
+	case Hitbox::LINE:
+	case Hitbox::ONEWAY:
+	{
+		verts[0] = shape.line.p1;
+		verts[1] = shape.line.p2;
+		Vector2 oneway = { 0.f, 0.f };
+		if (shape.type == Hitbox::ONEWAY) {
+			oneway = (verts[1] - verts[0]).rotated90CCW().normalized();
+		}
+		hit = sweep_polygon(verts, 2, sweep, res, oneway);
+		break;
+	}
+	case Hitbox::POLYGON:
+		hit = sweep_polygon(set.vertices + shape.polygon.first, shape.polygon.count, sweep, res);
+		break;
+	case Hitbox::COMPOSITE:
+	{
+		bool any = false;
+		for (uint32_t i = 0; i < shape.composite.count; ++i) {
+			any = sweep_world_hitbox(set, set.shapes[shape.composite.first + i], sweep, best) || any;
+		}
+		return any;
+	}
+	default:
+		return false;
+	}
+
+	if (hit && res.t < best.t) {
+		best = res;
+		return true;
+	}
+	return false;
+}
+
+// =========================================================================================
+// ==== Tilemaps ====
+// =========================================================================================
+
+// Sweeps against the solid part of one tile
+static bool sweep_tile(const Tilemap& map, int x, int y, const Sweep& sweep, SweepResult& best) {
+	if (!map.tiles.maybe_solid(x, y)) return false; // also covers whole chunks with nothing solid
+
+	uint16_t t_ind = map.tiles(x, y);
+	if (t_ind == TILE_BLANK) return false;
+
+	const Tile& tile = map.tileset->tile_data[t_ind - 1];
+	float w = map.tileset->tile_width;
+	float h = map.tileset->tile_height;
+	Point2 offset = {
+		fmaf((float) x, w, map.offset.x),
+		fmaf((float) y, h, map.offset.y)
+	};
+
+	Point2 verts[8];
+	size_t n = 0;
+
+	switch (tile.solidity.type) {
+	case Tile::Solidity::Full:
+		box_to_poly(Transform::translation(offset), { 0.f, w, 0.f, h }, verts);
+		n = 4;
+		break;
+	case Tile::Solidity::Partial:
+		box_to_poly(Transform::translation(offset), partial_tile_box(tile.solidity, w, h, { 0.f, 0.f }), verts);
+		n = 4;
+		break;
+	case Tile::Solidity::Slope:
+		n = slope_polygon(tile.solidity, w, h, offset, verts);
+		break;
+	case Tile::Solidity::Complex:
+		return sweep_hitbox(tile.solidity.complex, Transform::translation(offset), sweep, best);
+	default:
+		return false;
+	}
+
+	SweepResult res;
+	if (n > 0 && sweep_polygon(verts, n, sweep, res) && res.t < best.t) {
+		best = res;
+		return true;
+	}
+	return false;
+}
+
+// Amanatides & Woo traversal of the cells visited by the box's center.
+// At each cell, every tile the box could touch while its center is inside that cell is tested.
+// Cells are visited in order of entry time, so the walk can stop as soon as a hit happens before the next cell.
+static CastHit sweep_tilemap(const Tilemap& map, const AABB& box, Vector2 direction, float max_distance) {
+	CastHit result = CastHit::miss();
+	if (map.tiles.width() == 0 || map.tiles.height() == 0) return result;
+
+	float len = direction.magnitude();
+	if (len == 0.f || max_distance <= 0.f) return result;
+	direction /= len;
+
+	const float w = map.tileset->tile_width;
+	const float h = map.tileset->tile_height;
+	const int map_w = (int) map.tiles.width();
+	const int map_h = (int) map.tiles.height();
+
+	Sweep sweep = { box, direction * max_distance };
+	Point2 start = { 0.5f * (box.left + box.right), 0.5f * (box.top + box.bottom) };
+	float half_w = 0.5f * (box.right - box.left);
+	float half_h = 0.5f * (box.bottom - box.top);
+
+	// Center position in cell units, relative to the map
+	float px = (start.x - map.offset.x) / w;
+	float py = (start.y - map.offset.y) / h;
+	float dx = sweep.motion.x / w;
+	float dy = sweep.motion.y / h;
+
+	// How many extra cells the box reaches past its center
+	int reach_x = (int) ceilf(half_w / w);
+	int reach_y = (int) ceilf(half_h / h);
+
+	// Clip the walk to the map, widened by the box's reach
+	float t_min = 0.f, t_max = 1.f;
+	{
+		float lo_x = (float) -reach_x, hi_x = (float) (map_w + reach_x);
+		float lo_y = (float) -reach_y, hi_y = (float) (map_h + reach_y);
+		auto clip = [&t_min, &t_max](float p, float d, float lo, float hi) -> bool {
+			if (d == 0.f) return p >= lo && p <= hi;
+			float t0 = (lo - p) / d, t1 = (hi - p) / d;
+			if (t0 > t1) std::swap(t0, t1);
+			t_min = fmaxf(t_min, t0);
+			t_max = fminf(t_max, t1);
+			return t_min <= t_max;
+		};
+		if (!clip(px, dx, lo_x, hi_x) || !clip(py, dy, lo_y, hi_y)) return result;
+	}
+
+	int cx = (int) floorf(px + dx * t_min);
+	int cy = (int) floorf(py + dy * t_min);
+	int step_x = dx > 0.f ? 1 : (dx < 0.f ? -1 : 0);
+	int step_y = dy > 0.f ? 1 : (dy < 0.f ? -1 : 0);
+	float t_delta_x = step_x != 0 ? fabsf(1.f / dx) : INFINITY;
+	float t_delta_y = step_y != 0 ? fabsf(1.f / dy) : INFINITY;
+	float t_next_x = step_x > 0 ? ((float) (cx + 1) - px) / dx : (step_x < 0 ? ((float) cx - px) / dx : INFINITY);
+	float t_next_y = step_y > 0 ? ((float) (cy + 1) - py) / dy : (step_y < 0 ? ((float) cy - py) / dy : INFINITY);
+
+	SweepResult best = { INFINITY, { 0.f, 0.f } };
+	int best_x = -1, best_y = -1;
+	float t_cell = t_min;
+
+	while (t_cell <= t_max && t_cell <= best.t) {
+		int x0 = SDL_max(cx - reach_x, 0), x1 = SDL_min(cx + reach_x + 1, map_w - 1);
+		int y0 = SDL_max(cy - reach_y, 0), y1 = SDL_min(cy + reach_y + 1, map_h - 1);
+		for (int y = y0; y <= y1; ++y) {
+			for (int x = x0; x <= x1; ++x) {
+				if (sweep_tile(map, x, y, sweep, best)) {
+					best_x = x;
+					best_y = y;
+				}
+			}
+		}
+
+		if (t_next_x < t_next_y) {
+			t_cell = t_next_x;
+			t_next_x += t_delta_x;
+			cx += step_x;
+		}
+		else {
+			t_cell = t_next_y;
+			t_next_y += t_delta_y;
+			cy += step_y;
+		}
+		if (t_cell == INFINITY) break; // zero-length motion
+	}
+
+	if (best_x >= 0) {
+		result.hit = true;
+		result.distance = best.t * max_distance;
+		result.point = start + sweep.motion * best.t;
+		result.normal = best.normal;
+		result.tile_x = best_x;
+		result.tile_y = best_y;
+	}
+	return result;
+}
+
+CastHit raycast(const Tilemap& map, Point2 origin, Vector2 direction, float max_distance) {
+	return sweep_tilemap(map, { origin.x, origin.x, origin.y, origin.y }, direction, max_distance);
+}
+
+CastHit boxcast(const Tilemap& map, const AABB& box, Vector2 direction, float max_distance) {
+	return sweep_tilemap(map, box, direction, max_distance);
+}
+
+static CastHit sweep_level(const LevelInstance& level, const AABB& box, Vector2 direction, float max_distance) {
+	CastHit result = CastHit::miss();
+	for (const Tilemap& map : level.layers) {
+		if (!map.solid) continue;
+		// Anything past the nearest hit so far can't win
+		CastHit hit = sweep_tilemap(map, box, direction, fminf(max_distance, result.distance));
+		if (hit.hit && hit.distance < result.distance) result = hit;
+	}
+	return result;
+}
+
+CastHit raycast(const LevelInstance& level, Point2 origin, Vector2 direction, float max_distance) {
+	return sweep_level(level, { origin.x, origin.x, origin.y, origin.y }, direction, max_distance);
+}
+
+CastHit boxcast(const LevelInstance& level, const AABB& box, Vector2 direction, float max_distance) {
+	return sweep_level(level, box, direction, max_distance);
+}
+
+// =========================================================================================
+// ==== Entities ====
+// =========================================================================================
+
+static CastHit sweep_entities(const EntitySystem& system, const AABB& box, Vector2 direction, float max_distance,
+	uint64_t channel_mask, const Entity* ignore) {
+	CastHit result = CastHit::miss();
+
+	float len = direction.magnitude();
+	if (len == 0.f || max_distance <= 0.f) return result;
+	direction /= len;
+
+	Sweep sweep = { box, direction * max_distance };
+	AABB swept = box | (box + sweep.motion);
+
+	SweepResult best = { INFINITY, { 0.f, 0.f } };
+	system.get_index().query(swept, [&](uint32_t, const SpatialHash::Item& item) {
+		// Scripts on other workers may be moving these entities, so only their collider caches are safe to read;
+		// those stay as placed at the last index rebuild until the next one
+		const Entity* e = item.entity;
+		const ColliderCache& world = e->world;
+		if (e == ignore || e->pending_destroy) return;
+		if ((channel_mask & BIT64(world.channel_id)) == 0) return;
+
+		const WorldShapes set = world.view();
+		bool hit = false;
+		if (world.solid) {
+			hit = sweep_world_hitbox(set, world.solidity(), sweep, best);
+		}
+		for (uint32_t i = 0; i < world.n_colliders; ++i) {
+			hit = sweep_world_hitbox(set, world.collider(i), sweep, best) || hit;
+		}
+		if (hit) {
+			result.entity = const_cast<Entity*>(e);
+		}
+	});
+
+	if (result.entity != nullptr) {
+		Point2 start = { 0.5f * (box.left + box.right), 0.5f * (box.top + box.bottom) };
+		result.hit = true;
+		result.distance = best.t * max_distance;
+		result.point = start + sweep.motion * best.t;
+		result.normal = best.normal;
+	}
+	return result;
+}
+
+CastHit raycast(const EntitySystem& system, Point2 origin, Vector2 direction, float max_distance,
+	uint64_t channel_mask, const Entity* ignore) {
+	return sweep_entities(system, { origin.x, origin.x, origin.y, origin.y }, direction, max_distance, channel_mask, ignore);
+}
+
+CastHit boxcast(const EntitySystem& system, const AABB& box, Vector2 direction, float max_distance,
+	uint64_t channel_mask, const Entity* ignore) {
+	return sweep_entities(system, box, direction, max_distance, channel_mask, ignore);
+}
+
+// =========================================================================================
+// ==== AngelScript Interface ====
+// =========================================================================================
+
+static CastHit RaycastEntities(const EntitySystem* system, const Vector2& origin, const Vector2& direction,
+	float max_distance, uint64_t mask, const Entity* ignore) {
+	return raycast(*system, origin, direction, max_distance, mask, ignore);
+}
+
+static CastHit BoxcastEntities(const EntitySystem* system, const AABB& box, const Vector2& direction,
+	float max_distance, uint64_t mask, const Entity* ignore) {
+	return boxcast(*system, box, direction, max_distance, mask, ignore);
+}
+
+void RegisterCastTypes(asIScriptEngine* engine) {
+	int r;
+
+	r = engine->RegisterObjectType("CastHit", sizeof(CastHit),
+		asOBJ_VALUE | asOBJ_POD | asGetTypeTraits<CastHit>()); assert(r >= 0);
+
+	r = engine->RegisterObjectProperty("CastHit", "const bool hit", asOFFSET(CastHit, hit)); assert(r >= 0);
+	r = engine->RegisterObjectProperty("CastHit", "const float distance", asOFFSET(CastHit, distance)); assert(r >= 0);
+	r = engine->RegisterObjectProperty("CastHit", "const Vector2 point", asOFFSET(CastHit, point)); assert(r >= 0);
+	r = engine->RegisterObjectProperty("CastHit", "const Vector2 normal", asOFFSET(CastHit, normal)); assert(r >= 0);
+	r = engine->RegisterObjectProperty("CastHit", "Entity@ entity", asOFFSET(CastHit, entity)); assert(r >= 0);
+	r = engine->RegisterObjectProperty("CastHit", "const int tile_x", asOFFSET(CastHit, tile_x)); assert(r >= 0);
+	r = engine->RegisterObjectProperty("CastHit", "const int tile_y", asOFFSET(CastHit, tile_y)); assert(r >= 0);
+
+	r = engine->RegisterObjectMethod("__EntitySystem__",
+		"CastHit raycast(const Vector2 &in, const Vector2 &in, float, ChannelMask mask = ChannelMask::ALL, const Entity@ ignore = null) const",
+		asFUNCTION(RaycastEntities), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+	r = engine->RegisterObjectMethod("__EntitySystem__",
+		"CastHit boxcast(const AABB &in, const Vector2 &in, float, ChannelMask mask = ChannelMask::ALL, const Entity@ ignore = null) const",
+		asFUNCTION(BoxcastEntities), asCALL_CDECL_OBJFIRST); assert(r >= 0);
+}
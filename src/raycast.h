@@ -0,0 +1,45 @@
+#pragma once
+
+// Ray and box casts against tilemaps and entity hitboxes.
+// Everything here is read-only, so casts may be made from parallel entity updates.
+
+#include <cstdint>
+
+#include "vectors.h"
+#include "level.h"
+#include "entity.h"
+
+#include "angelscript.h"
+
+/// Result of a cast. Script-visible as a POD value type.
+struct CastHit {
+	bool hit;
+	float distance;  // along the (normalized) direction, from the ray origin or the box's starting position
+	Point2 point;    // ray: the contact point; box: the box's center at the time of contact
+	Vector2 normal;  // surface normal at the contact, zero if the cast started inside something
+	Entity* entity;  // null for tile hits
+	int32_t tile_x;  // -1 for entity hits
+	int32_t tile_y;
+
+	static inline CastHit miss() {
+		return { false, INFINITY, { 0.f, 0.f }, { 0.f, 0.f }, nullptr, -1, -1 };
+	}
+};
+
+/// Grid traversal of the tilemap; hits follow each tile's Solidity (full, partial, slope or complex)
+CastHit raycast(const Tilemap& map, Point2 origin, Vector2 direction, float max_distance);
+CastHit boxcast(const Tilemap& map, const AABB& box, Vector2 direction, float max_distance);
+
+/// Nearest hit over every solid layer of the level
+CastHit raycast(const LevelInstance& level, Point2 origin, Vector2 direction, float max_distance);
+CastHit boxcast(const LevelInstance& level, const AABB& box, Vector2 direction, float max_distance);
+
+/// Casts against the solidity hitbox and colliders of every entity whose channel is in the mask.
+// Candidates come from the entity system's broadphase index, and are hit where they were placed when it was last rebuilt,
+// so casts from update scripts never read entities other workers are moving.
+CastHit raycast(const EntitySystem& system, Point2 origin, Vector2 direction, float max_distance,
+	uint64_t channel_mask, const Entity* ignore = nullptr);
+CastHit boxcast(const EntitySystem& system, const AABB& box, Vector2 direction, float max_distance,
+	uint64_t channel_mask, const Entity* ignore = nullptr);
+
+void RegisterCastTypes(asIScriptEngine* engine);
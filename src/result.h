@@ -48,8 +48,8 @@ struct Result {
 		}
 	}
 
-	inline T orElse(T default) const {
-		return isDefined ? value : default;
+	inline T orElse(T fallback) const {
+		return isSuccess ? value : fallback;
 	}
 
 	inline operator bool() const { return isSuccess; }
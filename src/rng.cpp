@@ -1,9 +1,10 @@
 
 #include "rng.h"
+#include "executor.h"
 #include <ctime>
 #include <cassert>
 #include <cmath>
-#include <thread>
+#include <cstring>
 
 // algorithms were lifted from Wikipedia. Yay!
 
@@ -37,6 +38,12 @@ void Random::set_seed(uint32_t seed) {
 	carry = x;
 }
 
+void Random::restore(const Random& saved) {
+	memcpy(seq, saved.seq, sizeof(seq));
+	carry = saved.carry;
+	ind = saved.ind;
+}
+
 uint32_t Random::raw() {
 	constexpr uint64_t a = CMWC_MULTIPLIER;
 	constexpr uint32_t mask = CMWC_MASK;
@@ -250,8 +257,19 @@ void RegisterRandomTypes(asIScriptEngine* engine) {
 		asMETHOD(LightRandom, die), asCALL_THISCALL); assert(r >= 0);
 }
 
+// Kept in one table rather than thread_local so that snapshots can reach every thread's stream
+std::vector<Random>& get_all_rngs() {
+	static std::vector<Random> rngs = []() {
+		std::vector<Random> seeded;
+		int n = executor.thread_count() + 1;
+		seeded.reserve(n);
+		uint32_t seed = (uint32_t) time(nullptr);
+		for (int i = 0; i < n; ++i) seeded.emplace_back(seed + i * 0x9E3779B9u);
+		return seeded;
+	}();
+	return rngs;
+}
+
 Random& get_thread_rng() {
-	static std::hash<std::thread::id> hash;
-	thread_local Random rng = Random(time(nullptr) ^ hash(std::this_thread::get_id()));
-	return rng;
+	return get_all_rngs()[Executor::thread_index() + 1];
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
 #include "angelscript.h"
 #include "scriptarray/scriptarray.h"
 
@@ -25,6 +26,8 @@ public:
 	explicit Random(const Random&) = default; // Copies must be explicit
 
 	void set_seed(uint32_t seed);
+	/// Picks up another RNG's sequence where it is (for restoring saved state)
+	void restore(const Random& saved);
 
 	uint32_t raw();
 	uint64_t big();
@@ -42,7 +45,11 @@ public:
 	float interval(float low, float high); /// float in interval [low, high] | [low, high)
 };
 
+/// The calling thread's RNG: the master's, or the worker's running the current batch item
 Random& get_thread_rng();
+/// Every thread's RNG, the master's first and then each worker's in Executor::thread_index order.
+// Only touch it between batches, while the workers are idle.
+std::vector<Random>& get_all_rngs();
 
 /// Random Number Generator using xorshift128
 /// Suitable for creating local copies.
@@ -0,0 +1,395 @@
+#include "snapshot.h"
+#include "entity.h"
+#include "fileutil.h"
+
+#include "scriptarray/scriptarray.h"
+
+#include <string>
+#include <cstdio>
+#include <algorithm>
+
+#define SNAPSHOT_COMPRESSED 0x1
+
+struct SnapshotHeader {
+	uint32_t version;
+	uint32_t flags;
+	uint32_t raw_size;    // size of the payload once decompressed
+	uint32_t stored_size; // size of the payload as it is on disk
+	uint32_t checksum;    // of the uncompressed payload
+};
+
+// FNV-1a. Not cryptographic, but catches truncation and bit rot at memory speed.
+static uint32_t checksum(const uint8_t* data, size_t len) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static uint32_t checksum(const char* str) {
+	return checksum(reinterpret_cast<const uint8_t*>(str), strlen(str));
+}
+
+// =========================================================================================
+// ==== Compression ====
+// =========================================================================================
+
+// PackBits-style run length encoding.
+// Snapshots are mostly zeroed flags, repeated tile ids, and small integers, so this gets most of
+// the benefit of a general purpose compressor without a dependency or a noticeable time cost.
+// Control byte c:
+//   0..127   -> copy the next c + 1 bytes literally
+//   128..255 -> repeat the next byte c - 125 times (3..130)
+static void compress(const std::vector<uint8_t>& in, std::vector<uint8_t>& out) {
+	out.clear();
+	out.reserve(in.size() / 2);
+
+	const uint8_t* data = in.data();
+	size_t size = in.size();
+	size_t i = 0;
+	size_t literal_start = 0;
+
+	auto flush_literals = [&](size_t until) {
+		while (literal_start < until) {
+			size_t n = std::min(until - literal_start, (size_t) 128);
+			out.push_back(static_cast<uint8_t>(n - 1));
+			out.insert(out.end(), data + literal_start, data + literal_start + n);
+			literal_start += n;
+		}
+	};
+
+	while (i < size) {
+		size_t run = 1;
+		while (i + run < size && run < 130 && data[i + run] == data[i]) ++run;
+
+		if (run >= 3) {
+			flush_literals(i);
+			out.push_back(static_cast<uint8_t>(run + 125));
+			out.push_back(data[i]);
+			i += run;
+			literal_start = i;
+		}
+		else {
+			i += run;
+		}
+	}
+	flush_literals(size);
+}
+
+static bool decompress(const uint8_t* in, size_t in_size, std::vector<uint8_t>& out, size_t out_size) {
+	out.resize(out_size);
+	uint8_t* dest = out.data();
+	uint8_t* dest_end = dest + out_size;
+	const uint8_t* in_end = in + in_size;
+
+	while (in < in_end) {
+		uint8_t control = *in++;
+		if (control < 128) {
+			size_t n = control + 1;
+			if ((size_t) (in_end - in) < n || (size_t) (dest_end - dest) < n) return false;
+			memcpy(dest, in, n);
+			in += n;
+			dest += n;
+		}
+		else {
+			size_t n = control - 125;
+			if (in == in_end || (size_t) (dest_end - dest) < n) return false;
+			memset(dest, *in++, n);
+			dest += n;
+		}
+	}
+
+	return dest == dest_end;
+}
+
+// =========================================================================================
+// ==== Files ====
+// =========================================================================================
+
+Result<> write_snapshot_file(const char* filename, SnapshotWriter& writer, bool compressed) {
+	const std::vector<uint8_t>& raw = writer.data();
+
+	SnapshotHeader header;
+	header.version = SNAPSHOT_VERSION;
+	header.flags = 0;
+	header.raw_size = (uint32_t) raw.size();
+	header.checksum = checksum(raw.data(), raw.size());
+
+	std::vector<uint8_t> packed;
+	const std::vector<uint8_t>* payload = &raw;
+	if (compressed) {
+		compress(raw, packed);
+		// Incompressible data is stored as is
+		if (packed.size() < raw.size()) {
+			header.flags |= SNAPSHOT_COMPRESSED;
+			payload = &packed;
+		}
+	}
+	header.stored_size = (uint32_t) payload->size();
+
+	auto file = open(filename, "wb");
+	if (!file) {
+		return file.err;
+	}
+	FILE* stream = file;
+
+	bool ok =
+		fwrite(SNAPSHOT_MAGIC_NUMBER, 1, sizeof(SNAPSHOT_MAGIC_NUMBER) - 1, stream) == sizeof(SNAPSHOT_MAGIC_NUMBER) - 1 &&
+		fwrite(&header, sizeof(header), 1, stream) == 1 &&
+		fwrite(payload->data(), 1, payload->size(), stream) == payload->size();
+
+	fclose(stream);
+
+	if (!ok) {
+		return Error(Errors::CannotOpenFile, "Could not write the full snapshot");
+	}
+
+	LOG_VERBOSE("Wrote snapshot of %u bytes (%u on disk)\n", header.raw_size, header.stored_size);
+	return Result<>::success;
+}
+
+Result<std::vector<uint8_t>> read_snapshot_file(const char* filename) {
+	std::vector<uint8_t> bytes;
+	check_assign(bytes, read_file(filename));
+	BinaryReader reader(bytes);
+
+	if (!check_header(reader, SNAPSHOT_MAGIC_NUMBER)) {
+		return Errors::InvalidSnapshotHeader;
+	}
+
+	SnapshotHeader header;
+	check_void(reader.read(header));
+	if (header.version != SNAPSHOT_VERSION) {
+		return Errors::SnapshotVersionMismatch;
+	}
+	if (bytes.size() - reader.tell() < header.stored_size) {
+		return Errors::SnapshotTruncated;
+	}
+	std::vector<uint8_t> stored(bytes.begin() + reader.tell(), bytes.begin() + reader.tell() + header.stored_size);
+
+	std::vector<uint8_t> raw;
+	if (header.flags & SNAPSHOT_COMPRESSED) {
+		if (!decompress(stored.data(), stored.size(), raw, header.raw_size)) {
+			return Errors::SnapshotTruncated;
+		}
+	}
+	else {
+		raw = std::move(stored);
+	}
+
+	if (raw.size() != header.raw_size || checksum(raw.data(), raw.size()) != header.checksum) {
+		return Errors::SnapshotChecksumMismatch;
+	}
+
+	return raw;
+}
+
+// =========================================================================================
+// ==== Script Reflection ====
+// =========================================================================================
+
+// Fingerprint of a script class' layout, so that restoring into edited scripts fails instead of scrambling memory
+static uint32_t layout_hash(const asITypeInfo* type) {
+	uint32_t hash = 0;
+	size_t n_props = type->GetPropertyCount();
+	for (size_t i = 0; i < n_props; ++i) {
+		hash = hash * 31 + checksum(type->GetPropertyDeclaration(i));
+	}
+	return hash;
+}
+
+// Value types that can be copied as plain bytes
+static inline bool is_plain_value(const asITypeInfo* type) {
+	// LightRandom's whole state is 16 trivially copyable bytes, it just isn't registered as POD
+	return (type->GetFlags() & asOBJ_POD) || strcmp(type->GetName(), "Random") == 0;
+}
+
+SnapshotWriter::SnapshotWriter() {
+	buffer.reserve(1 << 16);
+	write<uint32_t>(0); // type table offset; patched by finish()
+}
+
+uint32_t SnapshotWriter::type_index(const asITypeInfo* type) {
+	auto found = type_indices.find(type);
+	if (found != type_indices.end()) return found->second;
+
+	uint32_t index = (uint32_t) types.size();
+	types.push_back(type);
+	type_indices.emplace(type, index);
+	return index;
+}
+
+void SnapshotWriter::write_script_object(asIScriptObject* obj) {
+	asIScriptEngine* engine = obj->GetEngine();
+	size_t n_props = obj->GetPropertyCount();
+	for (size_t i = 0; i < n_props; ++i) {
+		write_script_value(obj->GetAddressOfProperty(i), obj->GetPropertyTypeId(i), engine);
+	}
+}
+
+// Property types that can't be represented fail the save, rather than coming back as whatever the constructor left.
+void SnapshotWriter::write_script_value(void* addr, int type_id, asIScriptEngine* engine) {
+	if ((type_id & asTYPEID_MASK_OBJECT) == 0) { // primitives and enums
+		write_bytes(addr, engine->GetSizeOfPrimitiveType(type_id));
+		return;
+	}
+
+	asITypeInfo* type = engine->GetTypeInfoById(type_id);
+
+	if (type_id & asTYPEID_OBJHANDLE) {
+		// Only entity handles have a stable identity across a save and load
+		if (strcmp(type->GetName(), "Entity") != 0) {
+			throw Error(Errors::SnapshotUnsupportedType, engine->GetTypeDeclaration(type_id, true));
+		}
+		const Entity* e = *reinterpret_cast<Entity**>(addr);
+		write<uint32_t>(e == nullptr ? 0 : e->id);
+	}
+	else if (type_id & asTYPEID_SCRIPTOBJECT) {
+		asIScriptObject* obj = reinterpret_cast<asIScriptObject*>(addr);
+		write<uint32_t>(type_index(obj->GetObjectType()));
+		write_script_object(obj);
+	}
+	else if (strcmp(type->GetName(), "string") == 0) {
+		const std::string* str = reinterpret_cast<const std::string*>(addr);
+		write_string(str->data(), (uint32_t) str->size());
+	}
+	else if (strcmp(type->GetName(), "array") == 0) {
+		CScriptArray* arr = reinterpret_cast<CScriptArray*>(addr);
+		uint32_t size = arr->GetSize();
+		int elem_type = arr->GetElementTypeId();
+		write<uint32_t>(size);
+		for (uint32_t i = 0; i < size; ++i) {
+			write_script_value(arr->At(i), elem_type, engine);
+		}
+	}
+	else if (is_plain_value(type)) {
+		write_bytes(addr, type->GetSize());
+	}
+	else {
+		throw Error(Errors::SnapshotUnsupportedType, engine->GetTypeDeclaration(type_id, true));
+	}
+}
+
+void SnapshotWriter::finish() {
+	uint32_t offset = (uint32_t) buffer.size();
+	memcpy(buffer.data(), &offset, sizeof(offset));
+
+	write<uint32_t>((uint32_t) types.size());
+	for (const asITypeInfo* type : types) {
+		const asIScriptModule* module = type->GetModule();
+		write_string(module == nullptr ? "" : module->GetName());
+		write_string(type->GetNamespace());
+		write_string(type->GetName());
+		write<uint32_t>(layout_hash(type));
+	}
+}
+
+SnapshotReader::SnapshotReader(const uint8_t* data, size_t len) : begin(data), pos(data), end(data + len) {
+	// The type table offset is always present; it is consumed by read_type_table
+	read<uint32_t>();
+}
+
+void SnapshotReader::read_type_table(asIScriptEngine* engine) {
+	uint32_t offset;
+	memcpy(&offset, begin, sizeof(offset));
+	if (begin + offset > end) throw Error(Errors::SnapshotTruncated);
+
+	// Read the table from the end, then fence it off so sections can't run into it
+	const uint8_t* resume = pos;
+	pos = begin + offset;
+
+	uint32_t n_types = read<uint32_t>();
+	types.clear();
+	types.reserve(n_types);
+	for (uint32_t i = 0; i < n_types; ++i) {
+		// Each length is only known once its string has been read
+		uint32_t len;
+		const char* str = read_string(len);
+		std::string modname(str, len);
+		str = read_string(len);
+		std::string nsname(str, len);
+		str = read_string(len);
+		std::string name(str, len);
+		uint32_t hash = read<uint32_t>();
+
+		asIScriptModule* module = engine->GetModule(modname.c_str(), asGM_ONLY_IF_EXISTS);
+		if (module == nullptr) {
+			throw Error(Errors::SnapshotTypeMismatch, "No script module named " + modname);
+		}
+
+		std::string oldns = module->GetDefaultNamespace();
+		module->SetDefaultNamespace(nsname.c_str());
+		asITypeInfo* type = module->GetTypeInfoByName(name.c_str());
+		module->SetDefaultNamespace(oldns.c_str());
+
+		if (type == nullptr || layout_hash(type) != hash) {
+			throw Error(Errors::SnapshotTypeMismatch, name);
+		}
+		types.push_back(type);
+	}
+
+	end = begin + offset;
+	pos = resume;
+}
+
+asITypeInfo* SnapshotReader::type_at(uint32_t index) const {
+	if (index >= types.size()) throw Error(Errors::SnapshotTypeMismatch, "Type index out of range");
+	return types[index];
+}
+
+void SnapshotReader::read_script_object(asIScriptObject* obj) {
+	asIScriptEngine* engine = obj->GetEngine();
+	size_t n_props = obj->GetPropertyCount();
+	for (size_t i = 0; i < n_props; ++i) {
+		read_script_value(obj->GetAddressOfProperty(i), obj->GetPropertyTypeId(i), engine);
+	}
+}
+
+// Mirror image of SnapshotWriter::write_script_value
+void SnapshotReader::read_script_value(void* addr, int type_id, asIScriptEngine* engine) {
+	if ((type_id & asTYPEID_MASK_OBJECT) == 0) {
+		read_bytes(addr, engine->GetSizeOfPrimitiveType(type_id));
+		return;
+	}
+
+	asITypeInfo* type = engine->GetTypeInfoById(type_id);
+
+	if (type_id & asTYPEID_OBJHANDLE) {
+		if (strcmp(type->GetName(), "Entity") != 0) {
+			throw Error(Errors::SnapshotUnsupportedType, engine->GetTypeDeclaration(type_id, true));
+		}
+		uint32_t id = read<uint32_t>();
+		auto found = entity_lookup.find(id);
+		// Entities are not reference counted, so the handle can be set directly
+		*reinterpret_cast<void**>(addr) = found == entity_lookup.end() ? nullptr : found->second;
+	}
+	else if (type_id & asTYPEID_SCRIPTOBJECT) {
+		asIScriptObject* obj = reinterpret_cast<asIScriptObject*>(addr);
+		if (type_at(read<uint32_t>()) != obj->GetObjectType()) {
+			throw Error(Errors::SnapshotTypeMismatch, obj->GetObjectType()->GetName());
+		}
+		read_script_object(obj);
+	}
+	else if (strcmp(type->GetName(), "string") == 0) {
+		uint32_t len;
+		const char* str = read_string(len);
+		reinterpret_cast<std::string*>(addr)->assign(str, len);
+	}
+	else if (strcmp(type->GetName(), "array") == 0) {
+		CScriptArray* arr = reinterpret_cast<CScriptArray*>(addr);
+		uint32_t size = read<uint32_t>();
+		int elem_type = arr->GetElementTypeId();
+		arr->Resize(size);
+		for (uint32_t i = 0; i < size; ++i) {
+			read_script_value(arr->At(i), elem_type, engine);
+		}
+	}
+	else if (is_plain_value(type)) {
+		read_bytes(addr, type->GetSize());
+	}
+	else {
+		throw Error(Errors::SnapshotUnsupportedType, engine->GetTypeDeclaration(type_id, true));
+	}
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+// Snapshots capture the whole mutable simulation state (entities, level tiles, controllers, RNG)
+// in one contiguous binary blob. Each subsystem writes its own section; this module only deals with
+// the byte stream, the file envelope (version, checksum, compression) and script object reflection.
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <unordered_map>
+#include <type_traits>
+
+#include "result.h"
+#include "error.h"
+
+#include "angelscript.h"
+
+#define SNAPSHOT_MAGIC_NUMBER "PlatEsnapshot"
+#define SNAPSHOT_VERSION 5
+
+// Section tags, so a corrupt or mismatched stream fails loudly instead of being misread
+#define SNAPSHOT_TAG(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+namespace Errors {
+	const error_data
+		InvalidSnapshotHeader  = { 901, "Snapshot does not begin with the string \"" SNAPSHOT_MAGIC_NUMBER "\"" },
+		SnapshotVersionMismatch = { 902, "Snapshot was written by an incompatible version of the engine." },
+		SnapshotChecksumMismatch = { 903, "Snapshot checksum does not match its contents." },
+		SnapshotTruncated       = { 904, "Snapshot ended before all of its data could be read." },
+		SnapshotBadSection      = { 905, "Snapshot section is missing or out of order." },
+		SnapshotTypeMismatch    = { 910, "Script type in snapshot no longer matches the loaded scripts." },
+		SnapshotMissingAsset    = { 911, "Asset referenced by snapshot could not be loaded." },
+		SnapshotUnsupportedType = { 912, "Script property type can't be stored in a snapshot." };
+}
+
+class SnapshotWriter {
+private:
+	std::vector<uint8_t> buffer;
+
+	// Script types are written once in a table and referred to by index afterwards
+	std::unordered_map<const asITypeInfo*, uint32_t> type_indices;
+	std::vector<const asITypeInfo*> types;
+
+public:
+	SnapshotWriter();
+
+	__forceinline void write_bytes(const void* data, size_t len) {
+		size_t at = buffer.size();
+		buffer.resize(at + len);
+		memcpy(buffer.data() + at, data, len);
+	}
+
+	template <class T>
+	__forceinline void write(const T& value) {
+		static_assert(std::is_trivially_copyable<T>::value, "SnapshotWriter::write<T> can only be used for trivially copyable types");
+		write_bytes(&value, sizeof(T));
+	}
+
+	inline void write_string(const char* str, uint32_t len) {
+		write<uint32_t>(len);
+		write_bytes(str, len);
+	}
+	inline void write_string(const char* str) {
+		write_string(str, str == nullptr ? 0 : (uint32_t) strlen(str));
+	}
+
+	inline void begin_section(uint32_t tag) { write<uint32_t>(tag); }
+
+	/// Writes every reflected property of a script object (recursively).
+	// Throws SnapshotUnsupportedType for properties it can't represent.
+	void write_script_object(asIScriptObject* obj);
+	void write_script_value(void* addr, int type_id, asIScriptEngine* engine);
+
+	/// Index of a script type in this snapshot's type table
+	uint32_t type_index(const asITypeInfo* type);
+
+	/// Appends the type table and patches its offset into the start of the payload.
+	/// Must be called once, after every section has been written.
+	void finish();
+
+	inline const std::vector<uint8_t>& data() const { return buffer; }
+	inline size_t size() const { return buffer.size(); }
+};
+
+/// Sequential reader over a snapshot payload.
+// Running off the end throws an Error; the functions reading each section catch it and return a Result.
+class SnapshotReader {
+private:
+	const uint8_t* const begin;
+	const uint8_t* pos;
+	const uint8_t* end;
+
+	std::vector<asITypeInfo*> types;
+
+public:
+	// Entity handles inside script objects are stored as ids; the entity system fills this in before
+	// script objects are read so the ids can be turned back into pointers.
+	std::unordered_map<uint32_t, void*> entity_lookup;
+
+	SnapshotReader(const uint8_t* data, size_t len);
+
+	__forceinline void read_bytes(void* out, size_t len) {
+		if ((size_t) (end - pos) < len) throw Error(Errors::SnapshotTruncated);
+		memcpy(out, pos, len);
+		pos += len;
+	}
+
+	template <class T>
+	__forceinline T read() {
+		static_assert(std::is_trivially_copyable<T>::value, "SnapshotReader::read<T> can only be used for trivially copyable types");
+		T value;
+		read_bytes(&value, sizeof(T));
+		return value;
+	}
+
+	/// Returns a pointer into the snapshot (not null terminated) and its length
+	inline const char* read_string(uint32_t& len) {
+		len = read<uint32_t>();
+		if ((size_t) (end - pos) < len) throw Error(Errors::SnapshotTruncated);
+		const char* str = reinterpret_cast<const char*>(pos);
+		pos += len;
+		return str;
+	}
+
+	inline void expect_section(uint32_t tag) {
+		if (read<uint32_t>() != tag) throw Error(Errors::SnapshotBadSection);
+	}
+
+	/// Reads the type table from the end of the payload and resolves it against the loaded scripts
+	void read_type_table(asIScriptEngine* engine);
+
+	asITypeInfo* type_at(uint32_t index) const;
+
+	/// Restores every reflected property of a script object written by write_script_object
+	void read_script_object(asIScriptObject* obj);
+	void read_script_value(void* addr, int type_id, asIScriptEngine* engine);
+
+	inline bool at_end() const { return pos == end; }
+};
+
+/// Writes a finished snapshot to disk, optionally compressed
+Result<> write_snapshot_file(const char* filename, SnapshotWriter& writer, bool compress);
+
+/// Reads a snapshot from disk, checking its version and checksum, and decompressing it if needed
+Result<std::vector<uint8_t>> read_snapshot_file(const char* filename);
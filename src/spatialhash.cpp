@@ -0,0 +1,67 @@
+#include "spatialhash.h"
+
+SpatialHash::SpatialHash(float cell_size) : cell_size(cell_size), inv_cell_size(1.f / cell_size), bucket_mask(0) {
+	bucket_start.assign(2, 0);
+}
+
+void SpatialHash::clear() {
+	items.clear();
+	oversized.clear();
+}
+
+void SpatialHash::insert(Entity* entity, const AABB& box) {
+	Item item;
+	item.box = box;
+	item.entity = entity;
+	item.cx0 = cell_of(box.left);
+	item.cx1 = cell_of(box.right);
+	item.cy0 = cell_of(box.top);
+	item.cy1 = cell_of(box.bottom);
+	item.oversized = (int64_t) (item.cx1 - item.cx0 + 1) * (item.cy1 - item.cy0 + 1) > SPATIAL_HASH_MAX_ITEM_CELLS;
+
+	if (item.oversized) {
+		oversized.push_back((uint32_t) items.size());
+	}
+	items.push_back(item);
+}
+
+// Counting sort of (cell, item) pairs into buckets
+void SpatialHash::build() {
+	// Keep roughly two buckets per item so collisions stay rare
+	uint32_t n_buckets = 16;
+	while (n_buckets < items.size() * 2) n_buckets <<= 1;
+	bucket_mask = n_buckets - 1;
+
+	bucket_start.assign(n_buckets + 1, 0);
+
+	size_t n_entries = 0;
+	for (const Item& item : items) {
+		if (item.oversized) continue;
+		for (int32_t cy = item.cy0; cy <= item.cy1; ++cy) {
+			for (int32_t cx = item.cx0; cx <= item.cx1; ++cx) {
+				++bucket_start[bucket_of(cx, cy) + 1];
+				++n_entries;
+			}
+		}
+	}
+
+	for (uint32_t i = 1; i <= n_buckets; ++i) {
+		bucket_start[i] += bucket_start[i - 1];
+	}
+
+	bucket_items.resize(n_entries);
+	// Reuse the first n_buckets offsets as write cursors, then shift them back
+	for (uint32_t index = 0; index < items.size(); ++index) {
+		const Item& item = items[index];
+		if (item.oversized) continue;
+		for (int32_t cy = item.cy0; cy <= item.cy1; ++cy) {
+			for (int32_t cx = item.cx0; cx <= item.cx1; ++cx) {
+				bucket_items[bucket_start[bucket_of(cx, cy)]++] = index;
+			}
+		}
+	}
+	for (uint32_t i = n_buckets; i > 0; --i) {
+		bucket_start[i] = bucket_start[i - 1];
+	}
+	bucket_start[0] = 0;
+}
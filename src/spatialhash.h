@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+
+#include "vectors.h"
+
+#define SPATIAL_HASH_DEFAULT_CELL_SIZE 64.f
+
+// Items spanning more cells than this are kept in a separate list that every query scans
+#define SPATIAL_HASH_MAX_ITEM_CELLS 64
+
+struct Entity;
+
+/// Uniform grid of entity bounds, hashed into a fixed number of buckets.
+// Rebuilt from scratch once per frame with a counting sort, so it never needs incremental bookkeeping
+// and does no allocation once it has grown to fit. Queries only read, so any number of threads may run
+// them at once as long as nobody is rebuilding.
+class SpatialHash {
+public:
+	struct Item {
+		AABB box;
+		Entity* entity;
+		int32_t cx0, cy0, cx1, cy1; // cell range, inclusive
+		bool oversized;
+	};
+
+private:
+	float cell_size;
+	float inv_cell_size;
+
+	std::vector<Item> items;
+	std::vector<uint32_t> bucket_start; // n_buckets + 1 offsets into bucket_items
+	std::vector<uint32_t> bucket_items; // item indices grouped by bucket, in item order within a bucket
+	std::vector<uint32_t> oversized;    // items too big to be worth spreading across cells
+	uint32_t bucket_mask;
+
+	__forceinline uint32_t bucket_of(int32_t cx, int32_t cy) const {
+		return ((uint32_t) cx * 73856093u ^ (uint32_t) cy * 19349663u) & bucket_mask;
+	}
+
+	__forceinline int32_t cell_of(float coord) const {
+		// Clamped so that unbounded regions don't overflow the cast
+		float cell = floorf(coord * inv_cell_size);
+		return (int32_t) SDL_max(-1e9f, SDL_min(cell, 1e9f));
+	}
+
+	static __forceinline bool overlaps(const AABB& a, const AABB& b) {
+		return a.left <= b.right && b.left <= a.right && a.top <= b.bottom && b.top <= a.bottom;
+	}
+
+public:
+	SpatialHash(float cell_size = SPATIAL_HASH_DEFAULT_CELL_SIZE);
+
+	/// Starts a new build; follow with insert() for every item and then build()
+	void clear();
+	void insert(Entity* entity, const AABB& box);
+	void build();
+
+	inline size_t size() const { return items.size(); }
+	inline const Item& operator [] (size_t index) const { return items[index]; }
+
+	/// Calls visit(index, item) once for every item whose box overlaps the region
+	template <class F>
+	void query(const AABB& region, F&& visit) const;
+};
+
+template <class F>
+void SpatialHash::query(const AABB& region, F&& visit) const {
+	if (items.empty()) return;
+
+	for (uint32_t index : oversized) {
+		if (overlaps(items[index].box, region)) visit(index, items[index]);
+	}
+
+	int32_t qx0 = cell_of(region.left), qx1 = cell_of(region.right);
+	int32_t qy0 = cell_of(region.top), qy1 = cell_of(region.bottom);
+
+	// Huge regions are cheaper to answer with a straight scan
+	if ((int64_t) (qx1 - qx0 + 1) * (qy1 - qy0 + 1) > (int64_t) items.size()) {
+		for (uint32_t index = 0; index < items.size(); ++index) {
+			const Item& item = items[index];
+			if (item.oversized) continue; // already visited
+			if (overlaps(item.box, region)) visit(index, item);
+		}
+		return;
+	}
+
+	for (int32_t cy = qy0; cy <= qy1; ++cy) {
+		for (int32_t cx = qx0; cx <= qx1; ++cx) {
+			uint32_t bucket = bucket_of(cx, cy);
+			uint32_t last = UINT32_MAX;
+			for (uint32_t i = bucket_start[bucket]; i < bucket_start[bucket + 1]; ++i) {
+				uint32_t index = bucket_items[i];
+				if (index == last) continue; // two cells of the same item collided in this bucket
+				last = index;
+
+				const Item& item = items[index];
+				// Skip hash collisions, and only report each item from the first cell it shares with the region
+				if (cx < item.cx0 || cx > item.cx1 || cy < item.cy0 || cy > item.cy1) continue;
+				if (cx != SDL_max(item.cx0, qx0) || cy != SDL_max(item.cy0, qy0)) continue;
+
+				if (overlaps(item.box, region)) visit(index, item);
+			}
+		}
+	}
+}
@@ -1,15 +1,53 @@
-
 #include "mempool.h"
 #include "sprite.h"
 #include "error.h"
 #include "fileutil.h"
+#include "mappedfile.h"
 #include "assetmanager.h"
 #include <cstdio>
 #include <cerrno>
 #include <cstring>
 
-__forceinline static Result<const Sprite*> read_sprite(FILE* stream, MemoryPool& pool,
-	uint32_t namelen, uint32_t texnamelen, uint32_t n_clips, uint32_t n_frames, uint32_t n_animations,
+// Layout of a sprite file, after the magic number (see tools/buildsprite.py).
+// The flat sections (strings, clips, offsets and polygon vertices) are used where they lie in the mapped file;
+// the rest are records that refer to each other by index, and become pointers when they're built into the pool.
+struct SpriteHeader {
+	uint32_t name;    // in the string table
+	uint32_t texture; // filename, in the string table
+	FileSection strings, clips, frames, offsets, colliders, hitboxes, vertices, animations, timings;
+};
+
+struct FrameRecord {
+	uint32_t clip;
+	FrameOffset display;
+	RecordRange offsets;
+	RecordRange colliders;
+};
+
+struct AnimationRecord {
+	uint32_t name;     // in the string table
+	uint32_t fixed;    // solidity.fixed
+	uint32_t solidity; // hitbox
+	RecordRange timings;
+};
+
+struct FrameTimingRecord {
+	float delay;
+	uint32_t frame;
+};
+
+/// Sections of a mapped sprite file, in place
+struct SpriteImage {
+	SpriteHeader header;
+	MappedShapes shapes;
+	const GPU_Rect* clips;
+	const FrameRecord* frames;
+	const FrameOffset* offsets;
+	const AnimationRecord* animations;
+	const FrameTimingRecord* timings;
+};
+
+__forceinline static Result<const Sprite*> read_sprite(const MappedFile& file, const SpriteImage& image, MemoryPool& pool,
 	const DirContext& context);
 
 Result<const Sprite*> load_sprite(const char* filename, const DirContext& context) {
@@ -21,123 +59,105 @@ Result<const Sprite*> load_sprite(const char* filename, const DirContext& contex
 		if (maybe != nullptr) return maybe;
 	}
 
-	auto file = open(realfile.c_str(), "rb");
-
-	if (!file) {
-		return file.err;
+	auto mapped = MappedFile::map(realfile.c_str());
+	if (!mapped) {
+		return mapped.err;
 	}
-	FILE* stream = file;
+	MappedFile file = mapped;
 
 	// Check the magic number
-	if (!check_header(stream, SPRITE_MAGIC_NUMBER)) {
+	const size_t magic_len = sizeof(SPRITE_MAGIC_NUMBER) - 1;
+	SpriteImage image;
+	if (file.size < magic_len || memcmp(file.data, SPRITE_MAGIC_NUMBER, magic_len) != 0 || !file.copy(magic_len, image.header)) {
+		file.unmap();
 		return Errors::InvalidSpriteHeader;
 	}
+	const SpriteHeader& header = image.header;
 
-	// Read the header to determine how much we need to allocate in the memory pool
-	uint32_t namelen, texnamelen, n_clips, n_frames, n_animations,
-		tn_offsets, tn_colliders, nested_hitboxes,
-		tn_vertices, tn_frametimings, tn_stringbytes;
-
+	// Every section has to lie within the file before the header's counts are trusted to size the pool
 	try {
-		namelen = read<uint32_t>(stream);
-		texnamelen = read<uint32_t>(stream);
-		n_clips = read<uint32_t>(stream);
-		n_frames = read<uint32_t>(stream);
-		n_animations = read<uint32_t>(stream);
-		tn_offsets = read<uint32_t>(stream);
-		tn_colliders = read<uint32_t>(stream);
-		nested_hitboxes = read<uint32_t>(stream);
-		tn_vertices = read<uint32_t>(stream);
-		tn_frametimings = read<uint32_t>(stream);
-		tn_stringbytes = read<uint32_t>(stream);
+		StringTable strings;
+		strings.init(file, header.strings);
+		image.shapes.init(file, strings, header.hitboxes, header.vertices, header.colliders);
+		image.clips = file.view<GPU_Rect>(header.clips);
+		image.frames = file.view<FrameRecord>(header.frames);
+		image.offsets = file.view<FrameOffset>(header.offsets);
+		image.animations = file.view<AnimationRecord>(header.animations);
+		image.timings = file.view<FrameTimingRecord>(header.timings);
 	}
 	catch (Error& err) {
-		fclose(stream);
+		file.unmap();
 		return err;
 	}
 
 	size_t poolsize =
 		sizeof(Sprite) +
-		n_clips * sizeof(SDL_Rect) +
-		n_frames * sizeof(Frame) +
-		n_animations * sizeof(Animation) +
-		(tn_vertices + tn_offsets) * sizeof(Vector2) +
-		tn_colliders * sizeof(Collider) +
-		nested_hitboxes * sizeof(Hitbox) +
-		tn_frametimings * sizeof(FrameTiming) +
-		tn_stringbytes;
+		header.frames.count * sizeof(Frame) +
+		header.animations.count * sizeof(Animation) +
+		header.colliders.count * sizeof(Collider) +
+		header.hitboxes.count * 2 * sizeof(Hitbox) + // composites get up to one extra hitbox per child for their trees
+		header.timings.count * sizeof(FrameTiming) +
+		(header.timings.count + header.animations.count) * sizeof(float) +
+		(header.frames.count + header.animations.count * 2 + header.hitboxes.count + 3) * ALIGNMENT; // every allocation is padded out to ALIGNMENT
 
 	LOG_VERBOSE("Number of bytes needed for sprite data: %zd\n", poolsize);
 	MemoryPool pool(poolsize);
 
 	check_assign_ref(const DirContext& subcontext, context + filename, sctx);
-	// Pulled out into an inline function to ensure we never leak the file
-	auto result = read_sprite(stream, pool,
-		namelen, texnamelen, n_clips, n_frames, n_animations,
-		subcontext);
+	auto result = read_sprite(file, image, pool, subcontext);
 
 	LOG_VERBOSE("Read sprite data with %zd/%zd bytes of slack in memory pool\n", pool.get_slack(), pool.get_size());
 
-	fclose(stream);
-
 	if (result) {
 		AssetManager::store(filename, result.value);
 	}
 	else {
 		// Clean up from the error
 		pool.free();
+		file.unmap();
 	}
 
 	return result;
 }
 
-__forceinline static Result<const Sprite*> read_sprite(FILE* stream, MemoryPool& pool,
-	uint32_t namelen, uint32_t texnamelen, uint32_t n_clips, uint32_t n_frames, uint32_t n_animations,
+__forceinline static Result<const Sprite*> read_sprite(const MappedFile& file, const SpriteImage& image, MemoryPool& pool,
 	const DirContext& context) {
 	try {
-		Sprite* sprite = pool.alloc<Sprite>();
+		const SpriteHeader& header = image.header;
+		const StringTable& strings = image.shapes.strings;
+		const uint32_t n_clips = header.clips.count, n_frames = header.frames.count;
+		const uint32_t n_offsets = header.offsets.count, n_timings_total = header.timings.count;
+		const uint32_t n_animations = header.animations.count;
 
-		sprite->name = read_string(stream, namelen, pool);
-
-		sprite->texture = read_referenced_texture(stream, texnamelen, context);
+		Sprite* sprite = pool.alloc<Sprite>();
+		sprite->file = file;
 
-		GPU_Rect* clips = pool.alloc<GPU_Rect>(n_clips);
-		for (int i = 0; i < n_clips; ++i) {
-			clips[i].x = (float) read<uint32_t>(stream);
-			clips[i].y = (float) read<uint32_t>(stream);
-			clips[i].w = (float) read<uint32_t>(stream);
-			clips[i].h = (float) read<uint32_t>(stream);
-		}
+		sprite->name = strings.at(header.name);
+		sprite->texture = load_referenced_texture(strings.at(header.texture), context);
 
 		Frame* frames = pool.alloc<Frame>(n_frames);
-		for (int i = 0; i < n_frames; ++i) {
+		for (uint32_t i = 0; i < n_frames; ++i) {
+			const FrameRecord& record = image.frames[i];
 			Frame& cur_frame = frames[i];
-			cur_frame.clip = &clips[read<uint32_t>(stream)];
-			cur_frame.display = read<Vector2>(stream);
-
-			size_t n_offsets = read<uint32_t>(stream);
-			size_t n_colliders = read<uint32_t>(stream);
 
-			Vector2* offsets = pool.alloc<Vector2>(n_offsets);
-			for (int j = 0; j < n_offsets; ++j) {
-				offsets[j] = read<Vector2>(stream);
+			if (record.clip >= n_clips || !record.offsets.within(n_offsets)) {
+				throw Error(Errors::InvalidMappedData, "frame");
 			}
-			new(&cur_frame.offsets) Array<const Vector2>(offsets, n_offsets);
-
-			cur_frame.colliders = read_colliders(stream, n_colliders, pool);
+			cur_frame.clip = &image.clips[record.clip];
+			cur_frame.display = record.display;
+			new(&cur_frame.offsets) Array<const FrameOffset>(image.offsets + record.offsets.first, record.offsets.count);
+			cur_frame.colliders = image.shapes.collider_range(record.colliders, pool);
 		}
 
 		Animation* animations = pool.alloc<Animation>(n_animations);
 
-		for (int i = 0; i < n_animations; ++i) {
+		for (uint32_t i = 0; i < n_animations; ++i) {
+			const AnimationRecord& record = image.animations[i];
 			Animation& cur_anim = animations[i];
 
-			size_t namelen = read<uint32_t>(stream);
-			size_t n_timings = read<uint32_t>(stream);
-			cur_anim.solidity.fixed = read<bool>(stream);
-
-			cur_anim.name = read_string(stream, namelen, pool);
-			cur_anim.solidity.hitbox = read_hitbox(stream, pool);
+			cur_anim.name = strings.at(record.name);
+			cur_anim.solidity.fixed = record.fixed != 0;
+			cur_anim.solidity.hitbox = image.shapes.hitbox(record.solidity, pool);
 
 			// precalculate head and foot y coordinates (x is always 0)
 			switch (cur_anim.solidity.hitbox.type) {
@@ -169,18 +189,44 @@ __forceinline static Result<const Sprite*> read_sprite(FILE* stream, MemoryPool&
 				break;
 			}
 
+			if (!record.timings.within(n_timings_total)) {
+				throw Error(Errors::InvalidMappedData, "animation frames");
+			}
+			const uint32_t n_timings = record.timings.count;
 			FrameTiming* timings = pool.alloc<FrameTiming>(n_timings);
-			for (int j = 0; j < n_timings; ++j) {
-				FrameTiming& timing = timings[j];
+			for (uint32_t j = 0; j < n_timings; ++j) {
+				const FrameTimingRecord& timing = image.timings[record.timings.first + j];
+				if (timing.frame >= n_frames) throw Error(Errors::InvalidMappedData, "animation frame");
 
-				timing.delay = read<float>(stream);
-				timing.frame = &frames[read<uint32_t>(stream)];
+				timings[j].delay = timing.delay;
+				timings[j].frame = &frames[timing.frame];
 			}
 
 			new(&cur_anim.frames) Array<const FrameTiming>(timings, n_timings);
+
+			// Build the cumulative timeline so frames can be looked up by time instead of stepped through
+			float* starts = pool.alloc<float>(n_timings + 1);
+			float elapsed = 0.f;
+			cur_anim.loops = n_timings > 0;
+			cur_anim.last = 0;
+			cur_anim.uniform_delay = n_timings > 0 ? timings[0].delay : 0.f;
+			for (int j = 0; j < n_timings; ++j) {
+				starts[j] = elapsed;
+				cur_anim.last = j;
+				if (timings[j].delay <= 0.f) { // this frame holds forever
+					cur_anim.loops = false;
+					break;
+				}
+				if (timings[j].delay != cur_anim.uniform_delay) cur_anim.uniform_delay = 0.f;
+				elapsed += timings[j].delay;
+			}
+			if (cur_anim.loops) starts[n_timings] = elapsed;
+			if (!cur_anim.loops) cur_anim.uniform_delay = 0.f;
+			cur_anim.starts = starts;
+			cur_anim.duration = elapsed;
 		}
 
-		new(&sprite->clips) Array<const GPU_Rect>(clips, n_clips);
+		new(&sprite->clips) Array<const GPU_Rect>(image.clips, n_clips);
 		new(&sprite->framedata) Array<const Frame>(frames, n_frames);
 		new(&sprite->animations) Array<const Animation>(animations, n_animations);
 
@@ -191,10 +237,9 @@ __forceinline static Result<const Sprite*> read_sprite(FILE* stream, MemoryPool&
 	}
 }
 
-Result<const Sprite*> read_referenced_sprite(FILE* stream, uint32_t len, const DirContext& context) {
+Result<const Sprite*> read_referenced_sprite(BinaryReader& reader, uint32_t len, const DirContext& context) {
 	char fn[1024];
-	fread(fn, 1, len, stream);
-	fn[len] = 0;
+	check_void(reader.read_string(len, fn));
 
 	return load_sprite(fn, context);
-}
\ No newline at end of file
+}
@@ -11,6 +11,10 @@
 #include "error.h"
 #include "SDL_gpu.h"
 #include "assetmanager.h"
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <cmath>
 
 #define SPRITE_MAGIC_NUMBER "PlatEsprite"
 
@@ -37,6 +41,27 @@ struct Animation {
 	const char* name;
 	Array<const FrameTiming> frames;
 
+	// Timeline (precalculated at load, not stored)
+	const float* starts; // start time of each frame up to and including last
+	float duration;      // length of one loop, or the time at which a non-looping animation comes to rest
+	float uniform_delay; // delay shared by every frame of a looping animation, or 0 if they differ
+	uint32_t last;       // index of the last frame in the timeline
+	bool loops;          // false if some frame has a delay <= 0 and holds forever
+
+	// Brings an arbitrary time since the start of the animation back into [0, duration]
+	inline float wrap(float time) const {
+		if (time < 0.f) time = 0.f;
+		if (time < duration) return time;
+		return loops ? std::fmod(time, duration) : duration;
+	}
+
+	// Frame index shown at a (wrapped) time. O(1) for uniform timings, O(log n) otherwise.
+	inline uint32_t frame_at(float time) const {
+		if (time >= duration) return loops ? 0 : last;
+		if (uniform_delay > 0.f) return std::min(static_cast<uint32_t>(time / uniform_delay), last);
+		return static_cast<uint32_t>(std::upper_bound(starts, starts + last + 1, time) - starts) - 1;
+	}
+
 
 	struct Solidity {
 		Hitbox hitbox;
@@ -47,6 +72,7 @@ struct Animation {
 };
 
 struct Sprite {
+	MappedFile file; // the name, clips, offsets and polygon vertices are used in place
 	const char* name;
 	GPU_Image* texture;
 	Array<const GPU_Rect> clips;
@@ -57,6 +83,7 @@ struct Sprite {
 Result<const Sprite*> load_sprite(const char* filename, const DirContext& context = DirContext()); // load from "compiled" format
 Result<void> unload_sprite(Sprite* sprite); // deallocates all associated resources
 
-Result<const Sprite*> read_referenced_sprite(FILE* stream, uint32_t len, const DirContext& context);
+class BinaryReader;
+Result<const Sprite*> read_referenced_sprite(BinaryReader& reader, uint32_t len, const DirContext& context);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "tileanim.h"
+#include "tileset.h"
+
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// A frame that doesn't have a positive duration is shown forever
+static inline float frame_duration(const Tile* tile, uint16_t frame) {
+	float duration = tile->animation[frame].duration;
+	return duration > 0.f ? duration : INFINITY;
+}
+
+TileClocks::TileClocks() : count(0), capacity(0), time(nullptr), frame(nullptr), tile(nullptr) {}
+
+TileClocks::~TileClocks() {
+	_mm_free(time);
+	_mm_free(frame);
+	_mm_free(tile);
+}
+
+void TileClocks::grow(size_t min_capacity) {
+	size_t cap = std::max(capacity * 2, (size_t) 16);
+	if (cap < min_capacity) cap = min_capacity;
+	cap = (cap + 3) & ~(size_t) 3;
+
+	float* new_time = static_cast<float*>(_mm_malloc(cap * sizeof(float), 16));
+	uint16_t* new_frame = static_cast<uint16_t*>(_mm_malloc(cap * sizeof(uint16_t), 16));
+	const Tile** new_tile = static_cast<const Tile**>(_mm_malloc(cap * sizeof(const Tile*), 16));
+
+	if (count > 0) {
+		memcpy(new_time, time, count * sizeof(float));
+		memcpy(new_frame, frame, count * sizeof(uint16_t));
+		memcpy(new_tile, tile, count * sizeof(const Tile*));
+	}
+	for (size_t i = count; i < cap; ++i) {
+		new_time[i] = INFINITY;
+		new_frame[i] = 0;
+		new_tile[i] = nullptr;
+	}
+
+	_mm_free(time);
+	_mm_free(frame);
+	_mm_free(tile);
+	time = new_time;
+	frame = new_frame;
+	tile = new_tile;
+	capacity = cap;
+}
+
+uint32_t TileClocks::add(const Tile* t) {
+	if (t->animation.size() <= 1) return TILE_NO_CLOCK;
+	if (count == capacity) grow(count + 1);
+
+	time[count] = frame_duration(t, 0);
+	frame[count] = 0;
+	tile[count] = t;
+	changed_marks.push_back(0);
+	return (uint32_t) count++;
+}
+
+void TileClocks::mark_changed(size_t clock) {
+	if (changed_marks[clock]) return;
+	changed_marks[clock] = 1;
+	changed_list.push_back((uint32_t) clock);
+}
+
+void TileClocks::next_frame(size_t clock) {
+	const Tile* t = tile[clock];
+	const uint16_t n_frames = (uint16_t) t->animation.size();
+	float left = time[clock];
+	uint16_t f = frame[clock];
+
+	// A long step can go past more than one frame
+	while (left <= 0.f) {
+		f = (f + 1) % n_frames;
+		left += frame_duration(t, f);
+	}
+
+	if (f != frame[clock]) mark_changed(clock);
+	time[clock] = left;
+	frame[clock] = f;
+}
+
+void TileClocks::advance(float dt) {
+	for (uint32_t clock : changed_list) changed_marks[clock] = 0;
+	changed_list.clear();
+	if (count == 0) return;
+
+	const __m128 step = _mm_set1_ps(dt);
+	const __m128 zero = _mm_setzero_ps();
+
+	// capacity is a multiple of 4 and the padding lanes are INFINITY, so the last group can run off the end
+	for (size_t i = 0; i < count; i += 4) {
+		__m128 left = _mm_sub_ps(_mm_load_ps(time + i), step);
+		_mm_store_ps(time + i, left);
+
+		int due = _mm_movemask_ps(_mm_cmple_ps(left, zero));
+		while (due != 0) {
+			int lane = 0;
+			while (!(due & (1 << lane))) ++lane;
+			next_frame(i + lane);
+			due &= due - 1;
+		}
+	}
+}
+
+void TileClocks::set(uint32_t clock, float time_left, uint16_t f) {
+	const Tile* t = tile[clock];
+	frame[clock] = f % (uint16_t) t->animation.size();
+	time[clock] = time_left > 0.f ? time_left : frame_duration(t, frame[clock]);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+struct Tile;
+
+// Clock index for tiles that don't animate (one frame or none)
+#define TILE_NO_CLOCK UINT32_MAX
+
+/// Animation clocks for every animated tile type of a level instance, one per tile type no matter how many layers show it.
+// Structure-of-arrays like ParticlePool: time and frame are 16-byte aligned and padded to a multiple of 4,
+// so advancing every clock is one SSE pass that only drops to scalar code for the clocks whose frame is up.
+class TileClocks {
+	size_t count;
+	size_t capacity;
+
+	float* time;       // seconds left in the current frame. Padding lanes hold INFINITY so they never come due
+	uint16_t* frame;   // current frame of each clock
+	const Tile** tile; // tile each clock animates
+
+	/// Clocks whose frame changed in the last advance, in the order they changed
+	std::vector<uint32_t> changed_list;
+	std::vector<uint8_t> changed_marks; // 1 per clock, set while it's in changed_list
+
+	void grow(size_t min_capacity);
+	void next_frame(size_t clock);
+	void mark_changed(size_t clock);
+
+public:
+	TileClocks();
+	TileClocks(const TileClocks&) = delete;
+	~TileClocks();
+
+	/// Adds a clock for the tile, starting on its first frame. Returns TILE_NO_CLOCK if the tile doesn't animate.
+	uint32_t add(const Tile* tile);
+
+	/// Moves every clock on by dt seconds. Afterwards changed() lists the clocks that landed on a different frame.
+	void advance(float dt);
+
+	inline const std::vector<uint32_t>& changed() const { return changed_list; }
+	inline bool is_changed(uint32_t clock) const { return changed_marks[clock] != 0; }
+
+	/// Frame a tile using this clock should show. Tiles without a clock always show their first frame.
+	inline uint16_t frame_of(uint32_t clock) const { return clock == TILE_NO_CLOCK ? 0 : frame[clock]; }
+
+	inline size_t size() const { return count; }
+
+	// For snapshots
+	inline float time_left(uint32_t clock) const { return time[clock]; }
+	/// Sets a clock's state outright. The frame is wrapped to the tile's frame count.
+	void set(uint32_t clock, float time_left, uint16_t frame);
+};
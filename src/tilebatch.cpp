@@ -0,0 +1,168 @@
+#include "tilebatch.h"
+#include "level.h"
+#include "error.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+static_assert(TILE_CHUNK_SIZE * TILE_CHUNK_SIZE <= TILE_BATCH_MAX_QUADS, "A chunk's tiles have to fit in one batch");
+
+// Every batch uses the same quad pattern, so the indices are only built once
+static const uint16_t* quad_indices() {
+	static uint16_t* indices = nullptr;
+	if (indices == nullptr) {
+		indices = new uint16_t[TILE_BATCH_MAX_QUADS * 6];
+		for (uint16_t q = 0; q < TILE_BATCH_MAX_QUADS; ++q) {
+			uint16_t* quad = indices + q * 6;
+			uint16_t base = q * 4;
+			quad[0] = base;
+			quad[1] = base + 1;
+			quad[2] = base + 2;
+			quad[3] = base;
+			quad[4] = base + 2;
+			quad[5] = base + 3;
+		}
+	}
+	return indices;
+}
+
+void TileBatchCache::reset(const Tilemap& map) {
+	batches.clear();
+	batches.resize(map.tiles.n_chunks());
+	for (ChunkBatch& batch : batches) {
+		batch.revision = 0;
+		batch.valid = false;
+		batch.clocks.clear();
+	}
+	chunks_wide = map.tiles.chunks_wide();
+}
+
+void TileBatchCache::invalidate(size_t cx, size_t cy) {
+	batches[cy * chunks_wide + cx].valid = false;
+}
+
+void TileBatchCache::release(size_t cx, size_t cy) {
+	ChunkBatch& batch = batches[cy * chunks_wide + cx];
+	std::vector<float>().swap(batch.vertices);
+	std::vector<uint32_t>().swap(batch.clocks);
+	batch.valid = false;
+}
+
+void TileBatchCache::invalidate_changed(const TileClocks& clocks) {
+	// Most updates don't move any clock on to its next frame
+	if (clocks.changed().empty()) return;
+
+	for (ChunkBatch& batch : batches) {
+		if (!batch.valid) continue;
+		for (uint32_t clock : batch.clocks) {
+			if (clocks.is_changed(clock)) {
+				batch.valid = false;
+				break;
+			}
+		}
+	}
+}
+
+void TileBatchCache::build(ChunkBatch& batch, const Tilemap& map, const Array<uint32_t>& clock_of, const TileClocks& clocks, size_t cx, size_t cy) {
+	const TileChunk& chunk = map.tiles.chunk(cx, cy);
+	const Tileset* tset = map.tileset;
+	const auto& tdata = tset->tile_data;
+	const size_t n_tiles = tdata.size();
+
+	const float width = static_cast<float>(tset->tile_width);
+	const float height = static_cast<float>(tset->tile_height);
+	const float dw = width * fabsf(map.scale.x);
+	const float dh = height * fabsf(map.scale.y);
+	const float tex_w = tset->tilesheet->w;
+	const float tex_h = tset->tilesheet->h;
+
+	const size_t x0 = cx << TILE_CHUNK_SHIFT, y0 = cy << TILE_CHUNK_SHIFT;
+	const size_t nx = SDL_min((size_t) TILE_CHUNK_SIZE, map.tiles.width() - x0);
+	const size_t ny = SDL_min((size_t) TILE_CHUNK_SIZE, map.tiles.height() - y0);
+
+	batch.vertices.clear();
+	batch.clocks.clear();
+
+	for (size_t ly = 0; ly < ny; ++ly) {
+		const float y = (y0 + ly) * height;
+		for (size_t lx = 0; lx < nx; ++lx) {
+			uint16_t t = chunk.tiles[ly * TILE_CHUNK_SIZE + lx];
+			if (t == TILE_BLANK) continue;
+			if (t > n_tiles) {
+				ERR("Tile index out of bounds (%hd > %zd)\n", t, n_tiles);
+				continue;
+			}
+
+			--t; // Because tiles are 1-indexed
+			const Tile& tile = tdata[t];
+			size_t n_frames = tile.animation.size();
+			if (n_frames == 0) continue;
+
+			const uint32_t clock = clock_of[t];
+			if (clock != TILE_NO_CLOCK && (batch.clocks.empty() || batch.clocks.back() != clock)) batch.clocks.push_back(clock);
+
+			const TileFrame& frame = tile.animation[clocks.frame_of(clock) % n_frames];
+			float s0 = frame.x_ind * width / tex_w, s1 = (frame.x_ind + 1) * width / tex_w;
+			float t0 = frame.y_ind * height / tex_h, t1 = (frame.y_ind + 1) * height / tex_h;
+			if (frame.flip & GPU_FLIP_HORIZONTAL) std::swap(s0, s1);
+			if (frame.flip & GPU_FLIP_VERTICAL) std::swap(t0, t1);
+
+			const float x = (x0 + lx) * width;
+			const float v[16] = {
+				x,      y,      s0, t0,
+				x + dw, y,      s1, t0,
+				x + dw, y + dh, s1, t1,
+				x,      y + dh, s0, t1
+			};
+			batch.vertices.insert(batch.vertices.end(), v, v + 16);
+		}
+	}
+
+	std::sort(batch.clocks.begin(), batch.clocks.end());
+	batch.clocks.erase(std::unique(batch.clocks.begin(), batch.clocks.end()), batch.clocks.end());
+
+	batch.revision = chunk.revision;
+	batch.valid = true;
+}
+
+void TileBatchCache::render(GPU_Target* context, const Tilemap& map, const Array<uint32_t>& clock_of, const TileClocks& clocks, const Camera& camera) {
+	const TileGrid& grid = map.tiles;
+	const Tileset* tset = map.tileset;
+	GPU_Image* texture = tset->tilesheet;
+	if (texture == nullptr) return;
+	if (batches.size() != grid.n_chunks() || chunks_wide != grid.chunks_wide()) reset(map);
+
+	// Scaled up tiles hang past their cells to the right and bottom, so look a bit further up and left
+	const float width = static_cast<float>(tset->tile_width);
+	const float height = static_cast<float>(tset->tile_height);
+	AABB view = camera.view(map.parallax);
+	view.left -= width * SDL_max(fabsf(map.scale.x) - 1.f, 0.f);
+	view.top -= height * SDL_max(fabsf(map.scale.y) - 1.f, 0.f);
+	auto range = tiles_in(map, view);
+	if (range.left > range.right || range.top > range.bottom) return;
+
+	const Vector2 origin = map.offset + camera.parallax_shift(map.parallax);
+	GPU_MatrixMode(GPU_MODELVIEW);
+	GPU_PushMatrix();
+	GPU_Translate(origin.x, origin.y, 0.f);
+
+	for (size_t cy = range.top >> TILE_CHUNK_SHIFT; cy <= (size_t) range.bottom >> TILE_CHUNK_SHIFT; ++cy) {
+		for (size_t cx = range.left >> TILE_CHUNK_SHIFT; cx <= (size_t) range.right >> TILE_CHUNK_SHIFT; ++cx) {
+			const TileChunk& chunk = grid.chunk(cx, cy);
+			if (chunk.is_clean() && (chunk.flags & TileChunk::EMPTY)) continue;
+
+			ChunkBatch& batch = batches[cy * chunks_wide + cx];
+			if (!batch.valid || batch.revision != chunk.revision) build(batch, map, clock_of, clocks, cx, cy);
+			if (batch.vertices.empty()) continue;
+
+			size_t n_quads = batch.vertices.size() / 16;
+			GPU_TriangleBatch(texture, context,
+				static_cast<unsigned short>(n_quads * 4), batch.vertices.data(),
+				static_cast<unsigned int>(n_quads * 6), const_cast<uint16_t*>(quad_indices()),
+				GPU_BATCH_XY_ST);
+		}
+	}
+
+	GPU_PopMatrix();
+}
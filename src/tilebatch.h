@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "SDL_gpu.h"
+#include "arrays.h"
+#include "camera.h"
+#include "tileanim.h"
+
+// GPU_TriangleBatch takes 16-bit indices; a whole chunk of quads (TILE_CHUNK_SIZE^2) has to fit in one call
+#define TILE_BATCH_MAX_QUADS 1024
+
+struct Tilemap;
+
+/// Prebuilt GPU_TriangleBatch vertices for every chunk of one tilemap, so drawing a layer takes one call per visible chunk.
+// A chunk's vertices are only rebuilt when its tiles change (see TileChunk::revision) or when it's invalidated,
+// e.g. because the clock of one of its animated tiles moved on to another frame.
+class TileBatchCache {
+	struct ChunkBatch {
+		std::vector<float> vertices; // XY_ST, 4 per non-blank tile, relative to the tilemap's top-left corner
+		uint32_t revision;           // of the chunk these were built from
+		bool valid;
+		std::vector<uint32_t> clocks; // animation clocks of the tiles it shows, sorted and without repeats
+	};
+
+	std::vector<ChunkBatch> batches;
+	size_t chunks_wide;
+
+	void build(ChunkBatch& batch, const Tilemap& map, const Array<uint32_t>& clock_of, const TileClocks& clocks, size_t cx, size_t cy);
+
+public:
+	TileBatchCache() : batches(), chunks_wide(0) {}
+
+	/// Drops every batch and sizes the cache for the map's chunks
+	void reset(const Tilemap& map);
+
+	void invalidate(size_t cx, size_t cy);
+	/// Invalidates a chunk and frees its vertices, for chunks that have been unloaded
+	void release(size_t cx, size_t cy);
+	/// Invalidates the chunks that show a tile whose clock is in clocks.changed()
+	void invalidate_changed(const TileClocks& clocks);
+
+	/// Draws the chunks the camera can see (which must already be applied), rebuilding any that are stale first.
+	// clock_of maps each of the tileset's tiles (0-indexed) to its clock in clocks.
+	void render(GPU_Target* context, const Tilemap& map, const Array<uint32_t>& clock_of, const TileClocks& clocks, const Camera& camera);
+};
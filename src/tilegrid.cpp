@@ -0,0 +1,214 @@
+#include "tilegrid.h"
+#include "tileset.h"
+#include "level.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+static TileChunk blank_chunk() {
+	TileChunk chunk;
+	memset(chunk.tiles, 0, sizeof(chunk.tiles));
+	memset(chunk.solid_rows, 0, sizeof(chunk.solid_rows));
+	memset(chunk.nontrivial_rows, 0, sizeof(chunk.nontrivial_rows));
+	chunk.solid_bounds = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+	chunk.flags = TileChunk::EMPTY | TileChunk::NONSOLID;
+	chunk.revision = 0;
+	return chunk;
+}
+
+TileChunk TileGrid::unloaded = blank_chunk();
+
+TileChunk* TileGrid::new_chunk() {
+	return new TileChunk(blank_chunk());
+}
+
+TileGrid TileGrid::allocate(size_t width, size_t height, bool resident) {
+	size_t n = chunk_count(width, height);
+	TileGrid grid(n > 0 ? new TileChunk*[n] : nullptr, width, height);
+	for (size_t i = 0; i < n; ++i) {
+		grid.table[i] = resident ? new_chunk() : &unloaded;
+	}
+	return grid;
+}
+
+TileGrid TileGrid::clone() const {
+	size_t n = n_chunks();
+	TileGrid grid(n > 0 ? new TileChunk*[n] : nullptr, w, h);
+	for (size_t i = 0; i < n; ++i) {
+		grid.table[i] = table[i] == &unloaded ? &unloaded : new TileChunk(*table[i]);
+	}
+	grid.dirty_x0 = dirty_x0;
+	grid.dirty_y0 = dirty_y0;
+	grid.dirty_x1 = dirty_x1;
+	grid.dirty_y1 = dirty_y1;
+	return grid;
+}
+
+void TileGrid::free() {
+	for (size_t i = 0; i < n_chunks(); ++i) {
+		if (table[i] != &unloaded) delete table[i];
+	}
+	delete[] table;
+	table = nullptr;
+	w = h = cw = ch = 0;
+}
+
+TileChunk* TileGrid::swap_chunk(size_t cx, size_t cy, TileChunk* chunk) {
+	assert(cx < cw && cy < ch && "TileGrid chunk bounds check failed");
+	TileChunk*& slot = table[cy * cw + cx];
+	TileChunk* old = slot == &unloaded ? nullptr : slot;
+	uint32_t revision = slot->revision;
+
+	slot = chunk != nullptr ? chunk : &unloaded;
+	if (chunk != nullptr) {
+		// Anything cached from the old chunk has to see a different revision
+		chunk->revision = revision;
+		mark_dirty(*chunk, (uint32_t) cx, (uint32_t) cy);
+	}
+	return old;
+}
+
+void TileGrid::fill(size_t x, size_t y, size_t width, size_t height, uint16_t tile) {
+	if (x >= w || y >= h) return;
+	const size_t x_end = SDL_min(x + width, (size_t) w);
+	const size_t y_end = SDL_min(y + height, (size_t) h);
+
+	for (size_t ty = y; ty < y_end; ++ty) {
+		for (size_t tx = x; tx < x_end;) {
+			// The part of the row that falls in this chunk
+			size_t n = SDL_min(x_end - tx, TILE_CHUNK_SIZE - (tx & TILE_CHUNK_MASK));
+			if (!is_resident(tx >> TILE_CHUNK_SHIFT, ty >> TILE_CHUNK_SHIFT)) {
+				tx += n;
+				continue;
+			}
+			TileChunk& chunk = chunk_at(tx, ty);
+			std::fill_n(&chunk.tiles[(ty & TILE_CHUNK_MASK) * TILE_CHUNK_SIZE + (tx & TILE_CHUNK_MASK)], n, tile);
+			mark_dirty(chunk, (uint32_t) (tx >> TILE_CHUNK_SHIFT), (uint32_t) (ty >> TILE_CHUNK_SHIFT));
+			tx += n;
+		}
+	}
+}
+
+void TileGrid::blit(size_t x, size_t y, const TileGrid& src, size_t sx, size_t sy, size_t width, size_t height) {
+	if (x >= w || y >= h || sx >= src.w || sy >= src.h) return;
+	width = SDL_min(width, SDL_min(w - x, src.w - sx));
+	height = SDL_min(height, SDL_min(h - y, src.h - sy));
+
+	// Rows go through a buffer, so an overlapping copy within the same row is safe.
+	// Copying down within the same grid goes bottom-up so no source row is overwritten before it's read.
+	thread_local std::vector<uint16_t> row;
+	row.resize(width);
+	const bool bottom_up = &src == this && y > sy;
+
+	for (size_t i = 0; i < height; ++i) {
+		const size_t r = bottom_up ? height - 1 - i : i;
+		const size_t src_y = sy + r, dst_y = y + r;
+
+		for (size_t c = 0; c < width;) {
+			const size_t tx = sx + c;
+			size_t n = SDL_min(width - c, TILE_CHUNK_SIZE - (tx & TILE_CHUNK_MASK));
+			const TileChunk& chunk = src.chunk_at(tx, src_y);
+			memcpy(&row[c], &chunk.tiles[(src_y & TILE_CHUNK_MASK) * TILE_CHUNK_SIZE + (tx & TILE_CHUNK_MASK)], n * sizeof(uint16_t));
+			c += n;
+		}
+
+		for (size_t c = 0; c < width;) {
+			const size_t tx = x + c;
+			size_t n = SDL_min(width - c, TILE_CHUNK_SIZE - (tx & TILE_CHUNK_MASK));
+			if (!is_resident(tx >> TILE_CHUNK_SHIFT, dst_y >> TILE_CHUNK_SHIFT)) {
+				c += n;
+				continue;
+			}
+			TileChunk& chunk = chunk_at(tx, dst_y);
+			memcpy(&chunk.tiles[(dst_y & TILE_CHUNK_MASK) * TILE_CHUNK_SIZE + (tx & TILE_CHUNK_MASK)], &row[c], n * sizeof(uint16_t));
+			mark_dirty(chunk, (uint32_t) (tx >> TILE_CHUNK_SHIFT), (uint32_t) (dst_y >> TILE_CHUNK_SHIFT));
+			c += n;
+		}
+	}
+}
+
+// Bounds of the solid part of a tile, tile-local. False if it has none.
+static bool tile_solid_bounds(const Tile::Solidity& solidity, float w, float h, AABB& out) {
+	switch (solidity.type) {
+	case Tile::Solidity::Full:
+		out = { 0.f, w, 0.f, h };
+		return true;
+	case Tile::Solidity::Partial:
+		out = partial_tile_box(solidity, w, h, { 0.f, 0.f });
+		return true;
+	case Tile::Solidity::Slope:
+	{
+		Point2 verts[5];
+		size_t n = slope_polygon(solidity, w, h, { 0.f, 0.f }, verts);
+		if (n < 3) return false;
+		out = poly_to_aabb(Array<const Point2>(verts, n));
+		return true;
+	}
+	case Tile::Solidity::Complex:
+		if (solidity.complex.type == Hitbox::NONE) return false;
+		out = hitbox_aabb(solidity.complex);
+		return true;
+	default:
+		return false;
+	}
+}
+
+void TileGrid::update(const Tileset& tileset) {
+	const float tw = tileset.tile_width;
+	const float th = tileset.tile_height;
+	const size_t n_tiles = tileset.tile_data.size();
+
+	if (!has_dirty()) return;
+
+	for (uint32_t cy = dirty_y0; cy <= dirty_y1; ++cy) {
+		for (uint32_t cx = dirty_x0; cx <= dirty_x1; ++cx) {
+			TileChunk& chunk = this->chunk(cx, cy);
+			if (chunk.is_clean()) continue;
+
+			const uint32_t x0 = cx << TILE_CHUNK_SHIFT, y0 = cy << TILE_CHUNK_SHIFT;
+			const uint32_t nx = SDL_min((uint32_t) TILE_CHUNK_SIZE, w - x0);
+			const uint32_t ny = SDL_min((uint32_t) TILE_CHUNK_SIZE, h - y0);
+
+			bool empty = true, all_solid = true;
+			AABB bounds = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+			memset(chunk.solid_rows, 0, sizeof(chunk.solid_rows));
+			memset(chunk.nontrivial_rows, 0, sizeof(chunk.nontrivial_rows));
+
+			for (uint32_t ly = 0; ly < ny; ++ly) {
+				uint32_t row = 0, nontrivial = 0;
+				for (uint32_t lx = 0; lx < nx; ++lx) {
+					uint16_t t = chunk.tiles[ly * TILE_CHUNK_SIZE + lx];
+					if (t == TILE_BLANK) {
+						all_solid = false;
+						continue;
+					}
+					empty = false;
+
+					AABB local;
+					if (t > n_tiles || !tile_solid_bounds(tileset.tile_data[t - 1].solidity, tw, th, local)) {
+						all_solid = false;
+						continue;
+					}
+					if (tileset.tile_data[t - 1].solidity.type != Tile::Solidity::Full) {
+						all_solid = false;
+						nontrivial |= 1u << lx;
+					}
+
+					row |= 1u << lx;
+					bounds |= local + Vector2{ (x0 + lx) * tw, (y0 + ly) * th };
+				}
+				chunk.solid_rows[ly] = row;
+				chunk.nontrivial_rows[ly] = nontrivial;
+			}
+
+			chunk.solid_bounds = bounds;
+			chunk.flags = (empty ? TileChunk::EMPTY : 0) |
+				(bounds.left > bounds.right ? TileChunk::NONSOLID : 0) |
+				(all_solid ? TileChunk::ALL_SOLID : 0);
+		}
+	}
+
+	dirty_x0 = dirty_y0 = UINT32_MAX;
+	dirty_x1 = dirty_y1 = 0;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+
+#include "vectors.h"
+
+// Tilemaps are stored in square chunks with this many tiles per side (a power of two)
+#define TILE_CHUNK_SHIFT 5
+#define TILE_CHUNK_SIZE (1 << TILE_CHUNK_SHIFT)
+#define TILE_CHUNK_MASK (TILE_CHUNK_SIZE - 1)
+
+struct Tileset;
+
+/// A square block of tiles, with cached facts about them so whole chunks can be skipped at once.
+// The facts are only trustworthy while the chunk isn't DIRTY; anything that skips chunks must check that first.
+struct TileChunk {
+	enum Flags : uint8_t {
+		EMPTY     = 1 << 0, // every tile is blank
+		NONSOLID  = 1 << 1, // no tile has any solidity
+		ALL_SOLID = 1 << 2, // every tile (within the map) is fully solid
+		DIRTY     = 1 << 3  // tiles have changed since the rest was worked out
+	};
+
+	uint16_t tiles[TILE_CHUNK_SIZE * TILE_CHUNK_SIZE]; // row-major. Tiles past the edge of the map are blank
+
+	/// Bit x of row y is set if that tile has any solidity
+	uint32_t solid_rows[TILE_CHUNK_SIZE];
+	/// Subset of solid_rows for tiles that aren't simply Full (partial, slope and complex), which need the tile's data
+	uint32_t nontrivial_rows[TILE_CHUNK_SIZE];
+
+	/// Bounds of the solid content, relative to the tilemap's top-left corner. Inverted if nothing is solid.
+	AABB solid_bounds;
+
+	uint8_t flags;
+
+	/// Bumped every time the tiles change, so caches built from them can tell when they're stale
+	uint32_t revision;
+
+	__forceinline bool is_clean() const { return !(flags & DIRTY); }
+
+	/// True if the tile at chunk-local x, y might be solid
+	__forceinline bool maybe_solid(uint32_t x, uint32_t y) const {
+		return (flags & DIRTY) || (solid_rows[y] >> x & 1);
+	}
+};
+
+/// Tile indices of a tilemap, stored chunk by chunk.
+// Like Array2D, it's just a view over storage that's owned elsewhere (see allocate and free).
+// Chunks are reached through a table of pointers so they can be paged in and out one at a time (see LevelStreamer);
+// a chunk that isn't resident points at the shared unloaded chunk, which is blank and never written to.
+class TileGrid {
+	TileChunk** table; // row-major, one per chunk
+	uint32_t w, h;
+	uint32_t cw, ch; // size in chunks
+
+	/// Chunks that have been marked dirty since the last update, inclusive. Empty when dirty_x0 > dirty_x1.
+	uint32_t dirty_x0, dirty_y0, dirty_x1, dirty_y1;
+
+	static TileChunk unloaded;
+
+	__forceinline void mark_dirty(TileChunk& chunk, uint32_t cx, uint32_t cy) {
+		assert(&chunk != &unloaded && "The unloaded chunk can't be changed");
+		chunk.flags |= TileChunk::DIRTY;
+		++chunk.revision;
+		if (cx < dirty_x0) dirty_x0 = cx;
+		if (cx > dirty_x1) dirty_x1 = cx;
+		if (cy < dirty_y0) dirty_y0 = cy;
+		if (cy > dirty_y1) dirty_y1 = cy;
+	}
+
+public:
+	__forceinline TileGrid() {}
+	/// table needs room for chunk_count(width, height) pointers. The chunks are left as they are.
+	TileGrid(TileChunk** table, size_t width, size_t height) : table(table),
+		w((uint32_t) width), h((uint32_t) height),
+		cw((uint32_t) chunks_for(width)), ch((uint32_t) chunks_for(height)),
+		dirty_x0(UINT32_MAX), dirty_y0(UINT32_MAX), dirty_x1(0), dirty_y1(0) {}
+
+	static __forceinline size_t chunks_for(size_t tiles) {
+		return (tiles + TILE_CHUNK_MASK) >> TILE_CHUNK_SHIFT;
+	}
+	static __forceinline size_t chunk_count(size_t width, size_t height) {
+		return chunks_for(width) * chunks_for(height);
+	}
+
+	/// Allocates and blanks storage for a grid of the given size. With resident false, no chunk is allocated.
+	static TileGrid allocate(size_t width, size_t height, bool resident = true);
+	/// Allocates a grid with the same size and tiles as this one. Chunks that aren't resident stay that way.
+	TileGrid clone() const;
+	/// For grids from allocate or clone. Deletes every resident chunk.
+	void free();
+
+	/// Allocates a blank chunk, for swap_chunk. Grids delete their resident chunks when they're freed.
+	static TileChunk* new_chunk();
+	/// Puts a chunk into the grid (nullptr to unload it) and returns the one it replaces, which is nullptr if that wasn't resident.
+	// The new chunk is marked dirty and given a revision newer than the old one's.
+	TileChunk* swap_chunk(size_t cx, size_t cy, TileChunk* chunk);
+
+	__forceinline bool is_resident(size_t cx, size_t cy) const {
+		return table[cy * cw + cx] != &unloaded;
+	}
+
+	__forceinline uint16_t operator () (size_t x, size_t y) const {
+		assert(x < w && y < h && "TileGrid bounds check failed");
+		return chunk_at(x, y).tiles[(y & TILE_CHUNK_MASK) * TILE_CHUNK_SIZE + (x & TILE_CHUNK_MASK)];
+	}
+
+	/// Changes one tile and marks its chunk dirty. The chunk has to be resident.
+	__forceinline void set(size_t x, size_t y, uint16_t tile) {
+		assert(x < w && y < h && "TileGrid bounds check failed");
+		TileChunk& chunk = chunk_at(x, y);
+		chunk.tiles[(y & TILE_CHUNK_MASK) * TILE_CHUNK_SIZE + (x & TILE_CHUNK_MASK)] = tile;
+		mark_dirty(chunk, (uint32_t) (x >> TILE_CHUNK_SHIFT), (uint32_t) (y >> TILE_CHUNK_SHIFT));
+	}
+
+	/// Sets every tile in the rectangle (clipped to the grid) to the same index. Chunks that aren't resident are skipped.
+	void fill(size_t x, size_t y, size_t width, size_t height, uint16_t tile);
+	/// Copies a width x height block of src starting at (sx, sy) to (x, y), a row of chunk spans at a time.
+	// The block is clipped to both grids. src may be this grid, even if the two blocks overlap.
+	// Chunks of this grid that aren't resident are skipped; ones of src read as blank.
+	void blit(size_t x, size_t y, const TileGrid& src, size_t sx, size_t sy, size_t width, size_t height);
+
+	/// True if the tile might be solid, going by its chunk's solidity bits
+	__forceinline bool maybe_solid(size_t x, size_t y) const {
+		return chunk_at(x, y).maybe_solid(x & TILE_CHUNK_MASK, y & TILE_CHUNK_MASK);
+	}
+
+	/// Works out the cached facts of every dirty chunk (the tileset gives solidity and tile size).
+	// Only the chunks inside the dirty box are looked at, so it's cheap after small edits.
+	void update(const Tileset& tileset);
+
+	__forceinline bool has_dirty() const { return dirty_x0 <= dirty_x1; }
+
+	__forceinline size_t width() const { return w; }
+	__forceinline size_t height() const { return h; }
+	__forceinline size_t size() const { return (size_t) w * h; }
+
+	__forceinline size_t chunks_wide() const { return cw; }
+	__forceinline size_t chunks_high() const { return ch; }
+	__forceinline size_t n_chunks() const { return (size_t) cw * ch; }
+
+	__forceinline const TileChunk& chunk(size_t cx, size_t cy) const {
+		assert(cx < cw && cy < ch && "TileGrid chunk bounds check failed");
+		return *table[cy * cw + cx];
+	}
+	__forceinline TileChunk& chunk(size_t cx, size_t cy) {
+		assert(cx < cw && cy < ch && "TileGrid chunk bounds check failed");
+		return *table[cy * cw + cx];
+	}
+	__forceinline const TileChunk& chunk_at(size_t x, size_t y) const {
+		return *table[(y >> TILE_CHUNK_SHIFT) * cw + (x >> TILE_CHUNK_SHIFT)];
+	}
+	__forceinline TileChunk& chunk_at(size_t x, size_t y) {
+		return *table[(y >> TILE_CHUNK_SHIFT) * cw + (x >> TILE_CHUNK_SHIFT)];
+	}
+};
@@ -8,7 +8,7 @@
 #include <cerrno>
 #include <cstring>
 
-__forceinline static Result<Tileset*> read_tileset(FILE* stream, MemoryPool& pool,
+__forceinline static Result<Tileset*> read_tileset(BinaryReader& reader, MemoryPool& pool,
 	uint32_t namelen, uint32_t texnamelen, uint32_t n_tiles,
 	const DirContext& context);
 
@@ -21,15 +21,12 @@ Result<const Tileset*> load_tileset(const char* filename, const DirContext& cont
 		if (maybe != nullptr) return maybe;
 	}
 
-	auto file = open(realfile.c_str(), "rb");
-
-	if (!file) {
-		return file.err;
-	}
-	FILE* stream = file;
+	std::vector<uint8_t> bytes;
+	check_assign(bytes, read_file(realfile.c_str()));
+	BinaryReader reader(bytes);
 
 	// Check the magic number
-	if (!check_header(stream, TILESET_MAGIC_NUMBER)) {
+	if (!check_header(reader, TILESET_MAGIC_NUMBER)) {
 		return Errors::InvalidTilesetHeader;
 	}
 
@@ -38,39 +35,32 @@ Result<const Tileset*> load_tileset(const char* filename, const DirContext& cont
 		tn_tileframes, tn_hitboxes, tn_vertices;
 	uint16_t tile_w, tile_h;
 
-	try {
-		namelen = read<uint32_t>(stream);
-		texnamelen = read<uint32_t>(stream);
-		tile_w = read<uint16_t>(stream);
-		tile_h = read<uint16_t>(stream);
-		n_tiles = read<uint32_t>(stream);
-		tn_tileframes = read<uint32_t>(stream);
-		tn_hitboxes = read<uint32_t>(stream);
-		tn_vertices = read<uint32_t>(stream);
-	}
-	catch (Error& err) {
-		fclose(stream);
-		return err;
-	}
+	check_void(reader.read(namelen));
+	check_void(reader.read(texnamelen));
+	check_void(reader.read(tile_w));
+	check_void(reader.read(tile_h));
+	check_void(reader.read(n_tiles));
+	check_void(reader.read(tn_tileframes));
+	check_void(reader.read(tn_hitboxes));
+	check_void(reader.read(tn_vertices));
 
 	size_t poolsize =
 		sizeof(Tileset) +
 		n_tiles * sizeof(Tile) +
 		tn_tileframes * sizeof(TileFrame) +
-		tn_hitboxes * sizeof(Hitbox) +
+		tn_hitboxes * 2 * sizeof(Hitbox) + // composites get up to one extra hitbox per child for their trees
 		tn_vertices * sizeof(Vector2) +
-		namelen + 1;
+		namelen + 1 +
+		(n_tiles + tn_hitboxes + 3) * ALIGNMENT; // every allocation is padded out to ALIGNMENT
 
 	LOG_VERBOSE("Number of bytes needed for tileset data: %zd\n", poolsize);
 	MemoryPool pool(poolsize);
 
 	check_assign_ref(const DirContext& subcontext, context + filename, sctx);
-	auto result = read_tileset(stream, pool, namelen, texnamelen, n_tiles, subcontext);
+	auto result = read_tileset(reader, pool, namelen, texnamelen, n_tiles, subcontext);
 
 	LOG_VERBOSE("Read tileset data with %zd/%zd bytes of slack in memory pool\n", pool.get_slack(), pool.get_size());
 
-	fclose(stream);
-
 	if (!result) {
 		// clean up
 		pool.free();
@@ -88,71 +78,66 @@ Result<const Tileset*> load_tileset(const char* filename, const DirContext& cont
 	}
 }
 
-__forceinline static Result<Tileset*> read_tileset(FILE* stream, MemoryPool& pool,
+__forceinline static Result<Tileset*> read_tileset(BinaryReader& reader, MemoryPool& pool,
 	uint32_t namelen, uint32_t texnamelen, uint32_t n_tiles,
 	const DirContext& context) {
-	try {
-		Tileset* tileset = pool.alloc<Tileset>();
-
-		tileset->name = read_string(stream, namelen, pool);
-		tileset->tilesheet = read_referenced_texture(stream, texnamelen, context);
-
-		Tile* tiles = pool.alloc<Tile>(n_tiles);
-		for (int i = 0; i < n_tiles; ++i) {
-			auto& tile = tiles[i];
-
-			uint32_t n_frames = read<uint32_t>(stream);
-			uint32_t n_properties = read<uint32_t>(stream);
-
-			auto sType = read<Tile::Solidity::Type>(stream);
-			tile.solidity.type = sType;
-			switch (sType) {
-			case Tile::Solidity::None:
-				break;
-			case Tile::Solidity::Partial:
-				tile.solidity.partial.position = read<float>(stream);
-				tile.solidity.partial.vertical = read<bool>(stream);
-				tile.solidity.partial.topleft = read<bool>(stream);
-				break;
-			case Tile::Solidity::Slope:
-				tile.solidity.slope.position = read<float>(stream);
-				tile.solidity.slope.slope = read<float>(stream);
-				tile.solidity.slope.above = read<bool>(stream);
-				break;
-			case Tile::Solidity::Complex:
-				tile.solidity.complex = read_hitbox(stream, pool);
-				break;
-			default:
-				break;
-			}
-
-			TileFrame* frames = pool.alloc<TileFrame>(n_frames);
-			for (int j = 0; j < n_frames; ++j) {
-				frames[j] = {
-					read<uint16_t>(stream),
-					read<uint16_t>(stream),
-					read<float>(stream),
-					read<uint8_t>(stream)
-				};
-				frames[j].flip &= 0x03;
-			}
-
-			new(&tile.animation) Array<const TileFrame>(frames, n_frames);
+	// The pool was sized from the header, so counts in the tiles that don't agree with it run out of room
+	Tileset* tileset = pool.alloc<Tileset>();
+	Tile* tiles = pool.alloc<Tile>(n_tiles);
+	if (tileset == nullptr || (tiles == nullptr && n_tiles > 0)) return Errors::BadAlloc;
+
+	check_void(reader.read_string(namelen, pool, tileset->name));
+	check_assign(tileset->tilesheet, read_referenced_texture(reader, texnamelen, context));
+
+	for (uint32_t i = 0; i < n_tiles; ++i) {
+		auto& tile = tiles[i];
+
+		uint32_t n_frames, n_properties;
+		check_void(reader.read(n_frames));
+		check_void(reader.read(n_properties));
+
+		check_void(reader.read(tile.solidity.type));
+		switch (tile.solidity.type) {
+		case Tile::Solidity::None:
+			break;
+		case Tile::Solidity::Partial:
+			check_void(reader.read(tile.solidity.partial.position));
+			check_void(reader.read(tile.solidity.partial.vertical));
+			check_void(reader.read(tile.solidity.partial.topleft));
+			break;
+		case Tile::Solidity::Slope:
+			check_void(reader.read(tile.solidity.slope.position));
+			check_void(reader.read(tile.solidity.slope.slope));
+			check_void(reader.read(tile.solidity.slope.above));
+			break;
+		case Tile::Solidity::Complex:
+			check_assign(tile.solidity.complex, read_hitbox(reader, pool));
+			break;
+		default:
+			break;
 		}
 
-		new(&tileset->tile_data) Array<const Tile>(tiles, n_tiles);
+		TileFrame* frames = n_frames <= INT_MAX ? pool.alloc<TileFrame>((int) n_frames) : nullptr;
+		if (frames == nullptr && n_frames > 0) return Errors::BadAlloc;
+		for (uint32_t j = 0; j < n_frames; ++j) {
+			check_void(reader.read(frames[j].x_ind));
+			check_void(reader.read(frames[j].y_ind));
+			check_void(reader.read(frames[j].duration));
+			check_void(reader.read(frames[j].flip));
+			frames[j].flip &= 0x03;
+		}
 
-		return tileset;
-	}
-	catch (Error& err) {
-		return err;
+		new(&tile.animation) Array<const TileFrame>(frames, n_frames);
 	}
+
+	new(&tileset->tile_data) Array<const Tile>(tiles, n_tiles);
+
+	return tileset;
 }
 
-Result<const Tileset*> read_referenced_tileset(FILE* stream, uint32_t len, const DirContext& context) {
+Result<const Tileset*> read_referenced_tileset(BinaryReader& reader, uint32_t len, const DirContext& context) {
 	char fn[1024];
-	fread(fn, 1, len, stream);
-	fn[len] = 0;
+	check_void(reader.read_string(len, fn));
 
 	return load_tileset(fn, context);
 }
\ No newline at end of file
@@ -3,7 +3,7 @@
 #include "arrays.h"
 #include "hitbox.h"
 #include "assetmanager.h"
-#include "SDL2\SDL_render.h"
+#include "SDL2/SDL_render.h"
 
 #define TILESET_MAGIC_NUMBER "PlatEtileset"
 #define TILESET_MAGIC_NUMBER_LENGTH (sizeof(TILESET_MAGIC_NUMBER) - 1)
@@ -69,14 +69,9 @@ struct Tileset {
 	// ShaderType shader;
 };
 
-struct TileAnimationState {
-	const Tile* data;
-	float frame_time;
-	uint16_t anim_frame;
-};
-
 Result<const Tileset*> load_tileset(const char* filename, const DirContext& context = DirContext());
 
 Result<> unload_tileset(const Tileset*);
 
-Result<const Tileset*> read_referenced_tileset(FILE* stream, uint32_t len, const DirContext& context);
\ No newline at end of file
+class BinaryReader;
+Result<const Tileset*> read_referenced_tileset(BinaryReader& reader, uint32_t len, const DirContext& context);
\ No newline at end of file
@@ -41,8 +41,8 @@ Line operator * (const Transform& tx, const Line& l) {
 
 Circle operator * (const Transform& tx, const Circle& circ) {
 	return{
-		{circ.center.x + tx._13, circ.center.y + tx._23},
-		fmaxf(tx.get_scaleX(), tx.get_scaleY()) * circ.radius
+		tx * circ.center,
+		fmaxf(fabsf(tx.get_scaleX()), fabsf(tx.get_scaleY())) * circ.radius
 	};
 }
 
@@ -149,7 +149,7 @@ struct Transform {
 	}
 
 	// modify this matrix by doing the given transform after the current one. Chainable.
-	__forceinline Transform& apply(Transform& next) {
+	__forceinline Transform& apply(const Transform& next) {
 		return *this = next * *this;
 	}
 
@@ -176,7 +176,7 @@ struct Transform {
 	}
 
 	// give a transform that does this transform and then the given one
-	__forceinline Transform compose(Transform& next) const {
+	__forceinline Transform compose(const Transform& next) const {
 		return next * *this;
 	}
 
@@ -198,6 +198,14 @@ void aabb_to_poly(const AABB& aabb, Point2* arr) {
 	arr[3] = { aabb.left, aabb.bottom };
 }
 
+AABB poly_to_aabb(Array<const Point2> polygon) {
+	AABB box = { INFINITY, -INFINITY, INFINITY, -INFINITY };
+	for (const Point2& p : polygon) {
+		box |= AABB{ p.x, p.x, p.y, p.y };
+	}
+	return box;
+}
+
 Vector2 lerp(const Vector2& p1, const Vector2& p2, float t) {
 	return p1 + (p2 - p1) * t;
 }
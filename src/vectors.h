@@ -70,7 +70,7 @@ struct AABB {
 };
 
 void aabb_to_poly(const AABB& aabb, Point2* arr);
-AABB poly_to_aabb(Array<Point2> polygon);
+AABB poly_to_aabb(Array<const Point2> polygon);
 
 struct Circle {
 	Point2 center;
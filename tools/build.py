@@ -1,6 +1,6 @@
 #!/usr/bin/python3
 
-import buildsprite, buildlevel, buildtileset, buildengine
+import buildsprite, buildlevel, buildtileset, buildengine, buildemitter
 import re
 import traceback
 
@@ -60,6 +60,8 @@ def main(indir = "data", outdir = "assets", *args,
                     buildlevel.build(infn, outfn)
                 elif t == 'tileset':
                     buildtileset.build(infn, outfn)
+                elif t == 'emitter':
+                    buildemitter.build(infn, outfn)
                 else:
                     raise Exception("Unsupported bake type")
 
@@ -0,0 +1,81 @@
+import struct
+import json
+import math
+from util import *
+
+MAGIC_NUMBER = b"PlatEemitter"
+
+# Particle emitter definition
+#  length of the name
+#  length of the filename of the texture
+#  clip rect (x, y, w, h)
+#  number of particles in a default burst
+#  maximum number of live particles
+#  lifetime range (seconds)
+#  speed range (pixels per second)
+#  angle range (radians, clockwise from the right)
+#  gravity
+#  drag (fraction of velocity lost per second)
+#  collision mode
+#  restitution (fraction of speed kept after a bounce)
+Emitter = struct.Struct("<2I4I2I2f2f2f2ffcf")
+
+CollisionModes = {
+    "none": b'\0',
+    "kill": b'k',
+    "bounce": b'b'
+}
+
+'Accepts either a single number or a {"min", "max"} pair'
+def get_range(value):
+    if isinstance(value, int) or isinstance(value, float):
+        return value, value
+    return value["min"], value["max"]
+
+def build(infile, outfile):
+    emitter = None
+    with open(infile, 'r') as f:
+        try:
+            emitter = json.load(f)
+        except Exception as e:
+            raise Exception("Error in parsing '{}': {}".format(infile, str(e)))
+
+    name = emitter["name"].encode()
+    texture = emitter["texture"].encode()
+
+    life_min, life_max = get_range(emitter.get("lifetime", 1))
+    speed_min, speed_max = get_range(emitter.get("speed", 0))
+    angle_min, angle_max = get_range(emitter.get("angle", {"min": 0, "max": 360}))
+    gravity = emitter.get("gravity", {"x": 0, "y": 0})
+
+    collision = emitter.get("collision", "none").lower()
+    if collision not in CollisionModes:
+        raise Exception("Invalid particle collision mode: " + collision)
+
+    with open(outfile, "wb") as f:
+        f.write(MAGIC_NUMBER)
+
+        f.write(Emitter.pack(
+            len(name),
+            len(texture),
+            emitter["clip"]["x"],
+            emitter["clip"]["y"],
+            emitter["clip"]["w"],
+            emitter["clip"]["h"],
+            emitter.get("burst", 1),
+            emitter.get("capacity", 4096),
+            life_min,
+            life_max,
+            speed_min,
+            speed_max,
+            math.radians(angle_min),
+            math.radians(angle_max),
+            gravity["x"],
+            gravity["y"],
+            emitter.get("drag", 0),
+            CollisionModes[collision],
+            emitter.get("restitution", 0.5)
+        ))
+
+        f.write(name)
+        f.write(texture)
@@ -1,5 +1,3 @@
-
-
 import struct
 import json
 import array
@@ -10,56 +8,63 @@ assert array.array('H').itemsize == 2
 
 MAGIC_NUMBER = b"PlatElevel"
 
-# Header data
-#  length of name
+# Levels are memory mapped, so everything after the header is in aligned, fixed-size records,
+# found through the header's sections. These have to match the records in src/level.cpp.
+
+# Header
+#  name (offset in the string table)
 #  4 floats for boundaries
-#  number of tilemaps
-#  number of static objects
-#  number of entity spawn points
-#  number of areas
-#  number of edge triggers
-#  total number of tiles in all tilemaps
-#  total number of colliders
-#  total number of hitboxes
-Header = struct.Struct("<I4f5I3I")
-
-# Tilemap struct
-#  Length of filename of tileset
+#  sections, each an offset from the start of the file and a number of records:
+#   strings (bytes), tilemaps, chunk index, static objects, colliders, hitboxes, polygon vertices,
+#   entity spawn points, areas, edge triggers
+#  number of stored (non-blank) tile chunks
+Header = struct.Struct("<I4f20II")
+
+# Tilemap
+#  filename of tileset (offset in the string table)
 #  width x height of tilemap
 #  z_order
 #  top-left offset
 #  scale
 #  parallax
 #  solidness of tile data
-Tilemap = struct.Struct("<I2Ii2f2f2f?")
-
-# SceneObject struct
-#  length of filename of texture
-#  SDL_Rect clip;
+#  first entry of the layer in the chunk index, which holds the file offset of each chunk,
+#   row-major, or 0 for chunks that are entirely blank
+Tilemap = struct.Struct("<I2Ii2f2f2f2I")
+
+# Tiles are stored in square chunks of CHUNK_SIZE^2 tiles (row-major, blank past the edge of the map),
+# all together at the end of the file so the engine can copy any one of them out of the mapping. Must match TILE_CHUNK_SHIFT.
+CHUNK_SIZE = 32
+ChunkOffset = struct.Struct("<I")
+
+# SceneObject
+#  filename of sprite (offset in the string table)
+#  clip (x, y, w, h as floats, like GPU_Rect)
+#  Vector2 display;
 #  Vector2 position;
 #  int z_order;
 #  float rotation;
 #  Vector2 scale;
-#  CollisionData collision;
-SceneObject = struct.Struct("<I4I2f2fif2fI")
+#  range (first, count) of its colliders
+SceneObject = struct.Struct("<I4f2f2fif2f2I")
 
-# EntitySpawnPoint struct
+# EntitySpawnPoint
 #  location of spawn
-#  length of name of entity class
+#  name of entity class (offset in the string table)
 EntitySpawnPoint = struct.Struct("<2fI")
 
 # LevelArea
 #  AABB of boundaries
 #  priority
 #  r, g, b color values
-LevelArea = struct.Struct("<4fi3B")
+LevelArea = struct.Struct("<4fi3Bx")
 
 # EdgeTrigger
 #  side enum
 #  position
 #  size
 #  strictness
-EdgeTrigger = struct.Struct("<cfff")
+EdgeTrigger = struct.Struct("<c3x3f")
 EdgeTriggerSides = {
     "top": b't',
     "bottom": b'b',
@@ -79,6 +84,24 @@ def regular(l2d):
 
     return True
 
+'splits a 2d list of tiles into chunks: returns (chunks wide, chunks high, list of chunks or None for blank ones)'
+def chunk_tiles(tiles):
+    width = len(tiles[0])
+    height = len(tiles)
+    cw = (width + CHUNK_SIZE - 1) // CHUNK_SIZE
+    ch = (height + CHUNK_SIZE - 1) // CHUNK_SIZE
+
+    chunks = []
+    for cy in range(ch):
+        for cx in range(cw):
+            chunk = array.array("H", [0] * (CHUNK_SIZE * CHUNK_SIZE))
+            for ly in range(min(CHUNK_SIZE, height - cy * CHUNK_SIZE)):
+                row = tiles[cy * CHUNK_SIZE + ly][cx * CHUNK_SIZE : (cx + 1) * CHUNK_SIZE]
+                chunk[ly * CHUNK_SIZE : ly * CHUNK_SIZE + len(row)] = array.array("H", row)
+            chunks.append(chunk if any(chunk) else None)
+
+    return cw, ch, chunks
+
 def build(infile, outfile):
     level = None
     with open(infile, 'r') as f:
@@ -87,128 +110,131 @@ def build(infile, outfile):
         except Exception as e:
             raise Exception("Error in parsing '{}': {}".format(infile, str(e)))
 
-    # Sanity check / header prep
-    name = level["name"].encode()
+    strings = StringTable()
+    shapes = ShapeTables(strings)
 
-    n_vertices = 0
-    nested_hitboxes = 0
-    n_tiles = 0
+    name = strings.add(level["name"])
+
+    # Sanity check
+    tilemaps = []
+    layer_chunks = []
     for index, tilemap in enumerate(level["tilemaps"]):
         if len(tilemap['tiles']) == 0:
             raise Exception("Tilemap #{} is empty".format(index))
         if not regular(tilemap['tiles']):
             raise Exception("Tilemap #{} has inconsistent widths and is therefore invalid".format(index))
 
-        n_tiles += len(tilemap["tiles"][0]) * len(tilemap["tiles"])
+        scale = tilemap.get("scale", 1)
+        parallax = tilemap.get("parallax", 1)
+
+        if isinstance(scale, int) or isinstance(scale, float):
+            scale = {'x': scale, 'y': scale}
+
+        if isinstance(parallax, int) or isinstance(parallax, float):
+            parallax = {'x': parallax, "y": parallax}
+
+        tilemaps.append((
+            strings.add(tilemap["tileset"]),
+            len(tilemap["tiles"][0]),
+            len(tilemap["tiles"]),
+            tilemap["z_order"],
+            tilemap["offset"]["x"],
+            tilemap["offset"]["y"],
+            scale["x"],
+            scale["y"],
+            parallax["x"],
+            parallax["y"],
+            bool(tilemap.get("solid")),
+            sum(len(chunks) for chunks in layer_chunks)
+        ))
+        layer_chunks.append(chunk_tiles(tilemap["tiles"])[2])
 
+    objects = []
     for obj in level["objects"]:
-        for collider in obj["collision"]:
-            h, v = count_nested_hitboxes_and_vertices(collider["hitbox"])
-            n_vertices += v
-            nested_hitboxes += h
+        first_collider, n_colliders = shapes.add_colliders(obj["collision"])
+
+        objects.append((
+            strings.add(obj["texture"]),
+            obj["clip"]["x"],
+            obj["clip"]["y"],
+            obj["clip"]["w"],
+            obj["clip"]["h"],
+            obj["display"]["x"],
+            obj["display"]["y"],
+            obj["position"]["x"],
+            obj["position"]["y"],
+            obj["z_order"],
+            obj.get("rotation", 0),
+            obj.get("scale", {}).get("x", 1),
+            obj.get("scale", {}).get("y", 1),
+            first_collider,
+            n_colliders
+        ))
+
+    entities = [(
+        ent["location"]["x"],
+        ent["location"]["y"],
+        strings.add(ent["class"])
+    ) for ent in level["entities"]]
+
+    areas = [(
+        area["boundary"]["left"],
+        area["boundary"]["right"],
+        area["boundary"]["top"],
+        area["boundary"]["bottom"],
+        area["priority"],
+        *str2rgb(area["ui_color"])
+    ) for area in level["areas"]]
+
+    edge_triggers = [(
+        EdgeTriggerSides[edgetrig["side"].lower()],
+        edgetrig["position"],
+        edgetrig["size"],
+        edgetrig.get("strictness", 0)
+    ) for edgetrig in level["edge_triggers"]]
+
+    all_chunks = [chunk for chunks in layer_chunks for chunk in chunks]
 
     with open(outfile, "wb") as f:
         f.write(MAGIC_NUMBER)
-
+        header_position = f.tell()
+        f.write(b'\0' * Header.size)
+
+        sections = []
+        sections.append(write_section(f, bytes(strings.data), len(strings.data)))
+        sections.append(write_records(f, Tilemap, tilemaps))
+
+        # Chunk offsets aren't known until everything before the chunks is written, so the index is patched in afterwards
+        index_section = write_section(f, ChunkOffset.pack(0) * len(all_chunks), len(all_chunks))
+        sections.append(index_section)
+
+        sections.append(write_records(f, SceneObject, objects))
+        hitboxes, vertices, colliders = shapes.write(f)
+        sections += [colliders, hitboxes, vertices]
+        sections.append(write_records(f, EntitySpawnPoint, entities))
+        sections.append(write_records(f, LevelArea, areas))
+        sections.append(write_records(f, EdgeTrigger, edge_triggers))
+
+        offsets = []
+        for chunk in all_chunks:
+            if chunk is None:
+                offsets.append(0)
+            else:
+                pad_to(f, 64)
+                offsets.append(f.tell())
+                chunk.tofile(f)
+
+        f.seek(index_section[0])
+        for offset in offsets:
+            f.write(ChunkOffset.pack(offset))
+
+        f.seek(header_position)
         f.write(Header.pack(
-            len(name),
+            name,
             level["boundary"]["left"],
             level["boundary"]["right"],
             level["boundary"]["top"],
             level["boundary"]["bottom"],
-            len(level["tilemaps"]),
-            len(level["objects"]),
-            len(level["entities"]),
-            len(level["areas"]),
-            len(level["edge_triggers"]),
-            n_tiles,
-            n_vertices,
-            nested_hitboxes
+            *[n for section in sections for n in section],
+            sum(1 for chunk in all_chunks if chunk is not None)
         ))
-
-        f.write(name)
-
-        for tilemap in level["tilemaps"]:
-            tileset = tilemap["tileset"].encode()
-
-            scale = tilemap.get("scale", 1)
-            parallax = tilemap.get("parallax", 1)
-
-            if isinstance(scale, int) or isinstance(scale, float):
-                scale = {'x': scale, 'y': scale}
-
-            if isinstance(parallax, int) or isinstance(parallax, float):
-                parallax = {'x': parallax, "y": parallax}
-
-            f.write(Tilemap.pack(
-                len(tileset),
-                len(tilemap["tiles"][0]),
-                len(tilemap["tiles"]),
-                tilemap["z_order"],
-                tilemap["offset"]["x"],
-                tilemap["offset"]["y"],
-                scale["x"],
-                scale["y"],
-                parallax["x"],
-                parallax["y"],
-                tilemap.get("solid")
-            ))
-
-            f.write(tileset)
-
-            for row in tilemap["tiles"]:
-                array.array("H", row).tofile(f)
-
-        for obj in level["objects"]:
-            texture = obj["texture"].encode()
-
-            f.write(SceneObject.pack(
-                len(texture),
-                obj["clip"]["x"],
-                obj["clip"]["y"],
-                obj["clip"]["w"],
-                obj["clip"]["h"],
-                obj["display"]["x"],
-                obj["display"]["y"],
-                obj["position"]["x"],
-                obj["position"]["y"],
-                obj["z_order"],
-                obj.get("rotation", 0),
-                obj.get("scale", {}).get("x", 1),
-                obj.get("scale", {}).get("y", 1),
-                len(obj["collision"])
-            ))
-
-            f.write(texture)
-
-            for collider in obj["collision"]:
-                write_collider(f, collider)
-
-        for ent in level["entities"]:
-            entityclass = ent["class"].encode()
-
-            f.write(EntitySpawnPoint.pack(
-                ent["location"]["x"],
-                ent["location"]["y"],
-                len(entityclass)
-            ))
-
-            f.write(entityclass)
-
-        for area in level["areas"]:
-            f.write(LevelArea.pack(
-                area["boundary"]["left"],
-                area["boundary"]["right"],
-                area["boundary"]["top"],
-                area["boundary"]["bottom"],
-                area["priority"],
-                str2rgb(area["ui_color"])
-            ))
-
-        for edgetrig in level["edge_triggers"]:
-            f.write(EdgeTrigger.pack(
-                EdgeTriggerSides[edgetrig["side"].lower()],
-                edgetrig["position"],
-                edgetrig["size"],
-                edgetrig.get("strictness", 0)
-            ))
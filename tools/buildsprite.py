@@ -1,4 +1,3 @@
-
 import struct
 import json
 from hitbox import *
@@ -6,36 +5,33 @@ from util import *
 
 MAGIC_NUMBER = b"PlatEsprite"
 
-# Basic data to the sprite
-#  length of the name
-#  length of the filename of the texture
-#  number of cliprects
-#  number of frame data entries
-#  number of animations
-#  total number of offsets
-#  total number of colliders
-#  number of nested hitboxes
-#  total number of polygon vertices
-#  total number of frame timings
-#  total number of bytes needed for strings
-Header = struct.Struct("<11I")
-
-# x, y, w, h
-ClipRect = struct.Struct("<4I")
+# Sprites are memory mapped and used in place, so everything after the header is in aligned, fixed-size records,
+# found through the header's sections. These have to match the records in src/sprite.cpp.
+
+# Header
+#  name (offset in the string table)
+#  filename of the texture (offset in the string table)
+#  sections, each an offset from the start of the file and a number of records:
+#   strings (bytes), cliprects, frame data, offsets, colliders, hitboxes, polygon vertices, animations, frame timings
+Header = struct.Struct("<2I18I")
+
+# x, y, w, h (as floats, like GPU_Rect)
+ClipRect = struct.Struct("<4f")
 
 # Frame Data
 #  index of the clip
 #  display offset
-#  number of additional offsets
-#  number of colliders
-Frame = struct.Struct("<I2fII")
+#  range (first, count) of additional offsets
+#  range (first, count) of colliders
+Frame = struct.Struct("<I2f2I2I")
 Offset = struct.Struct("<2f")
 
 # Animation
-#  length of the name of the animation
-#  number of frames in the animation
+#  name (offset in the string table)
 #  solidity.fixed
-AnimationNoHitbox = struct.Struct("<II?")
+#  index of the solidity hitbox
+#  range (first, count) of its frame timings
+Animation = struct.Struct("<3I2I")
 
 # Animation Frame
 #  duration to display
@@ -51,90 +47,59 @@ def build(infile, outfile):
         except Exception as e:
             raise Exception("Error in parsing '{}': {}".format(infile, str(e)))
 
-    with open(outfile, "wb") as f:
-        f.write(MAGIC_NUMBER)
+    strings = StringTable()
+    shapes = ShapeTables(strings)
+
+    name = strings.add(sprite["name"])
+    texture = strings.add(sprite["spritesheet"])
+
+    clips = [(clip["x"], clip["y"], clip["w"], clip["h"]) for clip in sprite["clips"]]
+
+    frames = []
+    offsets = []
+    for frame in sprite["frames"]:
+        first_offset = len(offsets)
+        offsets.extend((offset["x"], offset["y"]) for offset in frame["offsets"])
+        first_collider, n_colliders = shapes.add_colliders(frame["collision"])
+
+        frames.append((
+            frame["clip"],
+            frame["display"]["x"],
+            frame["display"]["y"],
+            first_offset,
+            len(frame["offsets"]),
+            first_collider,
+            n_colliders
+        ))
 
-        name = sprite["name"].encode()
-        texture = sprite["spritesheet"].encode()
-
-        n_stringbytes = alignstrlen(name)
-        n_offsets = 0
-        n_colliders = 0
-        n_vertices = 0
-        nested_hitboxes = 0
-        for frame in sprite["frames"]:
-            n_offsets += len(frame["offsets"])
-            n_colliders += len(frame["collision"])
-            for collider in frame["collision"]:
-                h, v = count_nested_hitboxes_and_vertices(collider["hitbox"])
-                nested_hitboxes += h
-                n_vertices += v
-
-        n_frametimings = 0
-        for anim in sprite["animations"]:
-            n_stringbytes += alignstrlen(anim["name"])
-            n_frametimings += len(anim["frames"])
-            h, v = count_nested_hitboxes_and_vertices(anim["solidity"]['hitbox'])
-            nested_hitboxes += h
-            n_vertices += v
-
-        f.write(Header.pack(
-            len(name),
-            len(texture),
-            len(sprite["clips"]),
-            len(sprite["frames"]),
-            len(sprite["animations"]),
-            n_offsets,
-            n_colliders,
-            nested_hitboxes,
-            n_vertices,
-            n_frametimings,
-            n_stringbytes
+    animations = []
+    timings = []
+    for anim in sprite["animations"]:
+        first_timing = len(timings)
+        timings.extend((frame["duration"], frame["frame"]) for frame in anim["frames"])
+
+        animations.append((
+            strings.add(anim["name"]),
+            anim['solidity'].get("fixed", False),
+            shapes.add_hitbox(anim['solidity']['hitbox']),
+            first_timing,
+            len(anim["frames"])
         ))
 
-        f.write(name)
-        f.write(texture)
-
-        for clip in sprite["clips"]:
-            f.write(ClipRect.pack(
-                clip["x"],
-                clip["y"],
-                clip["w"],
-                clip["h"]
-            ))
-
-        for frame in sprite["frames"]:
-            f.write(Frame.pack(
-                frame["clip"],
-                frame["display"]["x"],
-                frame["display"]["y"],
-                len(frame["offsets"]),
-                len(frame["collision"])
-            ))
-
-            for offset in frame["offsets"]:
-                f.write(Offset.pack(
-                    offset["x"],
-                    offset["y"]
-                ))
-
-            for collider in frame["collision"]:
-                write_collider(f, collider)
-
-
-        for anim in sprite["animations"]:
-            name = anim["name"].encode()
-
-            f.write(AnimationNoHitbox.pack(
-                len(name),
-                len(anim["frames"]),
-                anim['solidity'].get("fixed", False)
-            ))
-            f.write(name)
-            write_hitbox(f, anim['solidity']['hitbox'])
-
-            for frame in anim["frames"]:
-                f.write(AnimFrame.pack(
-                    frame["duration"],
-                    frame["frame"]
-                ))
+    with open(outfile, "wb") as f:
+        f.write(MAGIC_NUMBER)
+        header_position = f.tell()
+        f.write(Header.pack(*([0] * 20)))
+
+        sections = []
+        sections.append(write_section(f, bytes(strings.data), len(strings.data)))
+        sections.append(write_records(f, ClipRect, clips))
+        sections.append(write_records(f, Frame, frames))
+        sections.append(write_records(f, Offset, offsets))
+        hitboxes, vertices, colliders = shapes.write(f)
+        sections += [colliders, hitboxes, vertices]
+        sections.append(write_records(f, Animation, animations))
+        sections.append(write_records(f, AnimFrame, timings))
+
+        f.seek(header_position)
+        f.write(Header.pack(name, texture, *[n for section in sections for n in section]))
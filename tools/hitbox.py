@@ -1,9 +1,6 @@
 
 import struct
-
-# Collider data without the Hitbox (due to hitboxes being variable length)
-#  length of the name of the collider type
-ColliderNoHitbox = struct.Struct("<I")
+from util import write_section, write_records
 
 # Stuff for hitboxes
 HitboxNone      = b'\0'
@@ -90,12 +87,79 @@ def write_hitbox(f, hitbox):
     else:
         raise Exception("Invalid hitbox type: " + type)
 
-def write_collider(f, collider):
-    ctype = collider["type"].encode()
+# Mapped assets (sprites and levels) keep their hitboxes in flat tables instead, so they can be used in place:
+# HitboxRecord is the type, then 16 bytes that depend on it. Polygons give the range (first, count) of their vertices
+# in the vertex table; composites give the range of their children in the hitbox table, which always comes after them.
+# Colliders are the offset of their type's name in the string table and the index of their hitbox.
+HitboxRecord = struct.Struct("<c3x16s")
+HitboxRange = struct.Struct("<2I")
+ColliderRecord = struct.Struct("<2I")
+
+class ShapeTables:
+    'The hitbox, vertex and collider tables of a mapped asset'
+    def __init__(self, strings):
+        self.strings = strings
+        self.hitboxes = []
+        self.vertices = []
+        self.colliders = []
+
+    def add_hitbox(self, hitbox):
+        'Adds a hitbox (and everything in it), returning its index in the hitbox table'
+        index = len(self.hitboxes)
+        self.hitboxes.append(None)
+        self.hitboxes[index] = self.encode(hitbox)
+        return index
+
+    def add_colliders(self, colliders):
+        'Adds colliders next to each other, returning their range in the collider table'
+        first = len(self.colliders)
+        for collider in colliders:
+            self.colliders.append((self.strings.add(collider["type"]), self.add_hitbox(collider["hitbox"])))
+        return first, len(colliders)
 
-    f.write(ColliderNoHitbox.pack(
-        len(ctype)
-    ))
+    def encode(self, hitbox):
+        type = hitbox.get("type", "none").lower()
+
+        if type == "none":
+            return HitboxRecord.pack(HitboxNone, b'')
+        elif type == "box":
+            return HitboxRecord.pack(HitboxBox, Box.pack(
+                hitbox["left"],
+                hitbox["right"],
+                hitbox["top"],
+                hitbox["bottom"]
+            ))
+        elif type == "line" or type == "oneway":
+            return HitboxRecord.pack(HitboxLine if type == "line" else HitboxOneway, Line.pack(
+                hitbox["p1"]["x"],
+                hitbox["p1"]["y"],
+                hitbox["p2"]["x"],
+                hitbox["p2"]["y"]
+            ))
+        elif type == "circle":
+            return HitboxRecord.pack(HitboxCircle, Circle.pack(
+                hitbox["center"]["x"],
+                hitbox["center"]["y"],
+                hitbox["radius"]
+            ))
+        elif type == "polygon":
+            first = len(self.vertices)
+            self.vertices.extend((vertex["x"], vertex["y"]) for vertex in hitbox["vertices"])
+            return HitboxRecord.pack(HitboxPolygon, HitboxRange.pack(first, len(hitbox["vertices"])))
+        elif type == "composite":
+            # Children go in a block of their own, so their own children come after all of them
+            subs = hitbox["hitboxes"]
+            first = len(self.hitboxes)
+            self.hitboxes.extend([None] * len(subs))
+            for i, sub in enumerate(subs):
+                self.hitboxes[first + i] = self.encode(sub)
+            return HitboxRecord.pack(HitboxComposite, HitboxRange.pack(first, len(subs)))
+        else:
+            raise Exception("Invalid hitbox type: " + type)
 
-    f.write(ctype)
-    write_hitbox(f, collider["hitbox"])
+    def write(self, f):
+        'Writes the hitbox, vertex and collider sections, returning their (offset, count)s in that order'
+        hitboxes = write_section(f, b''.join(self.hitboxes), len(self.hitboxes))
+        vertices = write_records(f, Vertex, self.vertices)
+        colliders = write_records(f, ColliderRecord, self.colliders)
+        return hitboxes, vertices, colliders
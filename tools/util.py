@@ -9,4 +9,33 @@ def alignstrlen(s, align = 8):
 def str2rgb(s):
     if s[0] == '#':
         s = s[1:]
-    return int(s[0:2], 16), int(s[2:4], 16), int(s[4:6], 16)
\ No newline at end of file
+    return int(s[0:2], 16), int(s[2:4], 16), int(s[4:6], 16)
+
+class StringTable:
+    'NUL-terminated strings that the records of a mapped asset refer to by byte offset. Equal strings are stored once.'
+    def __init__(self):
+        self.data = bytearray()
+        self.offsets = {}
+
+    def add(self, s):
+        if isinstance(s, str):
+            s = s.encode()
+        if s not in self.offsets:
+            self.offsets[s] = len(self.data)
+            self.data += s + b'\0'
+        return self.offsets[s]
+
+'Writes zeros until the position in the file is a multiple of align'
+def pad_to(f, align):
+    f.write(b'\0' * (-f.tell() % align))
+
+'Writes one section of a mapped asset, aligned, and returns its (offset, count) for the header'
+def write_section(f, data, count, align = 8):
+    pad_to(f, align)
+    offset = f.tell()
+    f.write(data)
+    return offset, count
+
+'Packs every row with the struct into one section'
+def write_records(f, record, rows, align = 8):
+    return write_section(f, b''.join(record.pack(*row) for row in rows), len(rows), align)